@@ -113,6 +113,12 @@ if (MSVC)
     set_property(TARGET ${CORE_LIBRARY_NAME} APPEND PROPERTY LINK_FLAGS /DEBUG)
 endif ()
 
+# Batched SVD kernels for wider ISAs, selected at runtime (see math/svd.cpp)
+if (NOT MSVC)
+    set_source_files_properties(include/taichi/math/svd_avx2.cpp PROPERTIES COMPILE_FLAGS "-mavx2 -mfma")
+    set_source_files_properties(include/taichi/math/svd_avx512.cpp PROPERTIES COMPILE_FLAGS "-mavx512f")
+endif ()
+
 if (WIN32)
     set_target_properties(${CORE_LIBRARY_NAME} PROPERTIES RUNTIME_OUTPUT_DIRECTORY
             "${CMAKE_CURRENT_SOURCE_DIR}/runtimes")
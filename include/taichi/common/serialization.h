@@ -15,6 +15,12 @@
 #include <cassert>
 #include <iostream>
 #include <type_traits>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #ifdef TC_INCLUDED
 TC_NAMESPACE_BEGIN
@@ -226,6 +232,11 @@ inline void write_data_to_file(const std::string &fn, uint8_t *data, std::size_t
   }
 }
 
+// Binary format: a std::size_t holding the total size in bytes, followed by
+// the serialized values. If the highest bit of the size is set, the elements
+// of large POD std::vectors start at a page boundary, so that they can be used
+// in place from a memory mapping of the file. Only output streamed to a file
+// is page-aligned.
 template <bool writing>
 class BinarySerializer : public Serializer {
  public:
@@ -235,18 +246,57 @@ class BinarySerializer : public Serializer {
   std::size_t head;
   std::size_t preserved;
 
+  static constexpr std::size_t page_size = 4096;
+  static constexpr std::size_t page_aligned_flag = std::size_t(1) << 63;
+  static constexpr std::size_t stream_chunk_size = 1 << 20;
+
   using Base = Serializer;
   using Base::assets;
 
+ private:
+  // Streaming output: data buffers the bytes after the first flushed ones
+  std::FILE *stream_file;
+  std::size_t flushed;
+  // Input mapped from a file
+  void *mapped;
+  std::size_t mapped_size;
+  bool page_aligned;
+
+ public:
+  BinarySerializer()
+      : c_data(nullptr),
+        head(0),
+        preserved(0),
+        stream_file(nullptr),
+        flushed(0),
+        mapped(nullptr),
+        mapped_size(0),
+        page_aligned(false) {
+  }
+
+  BinarySerializer(const BinarySerializer &) = delete;
+
+  BinarySerializer &operator=(const BinarySerializer &) = delete;
+
+  ~BinarySerializer() {
+    release();
+  }
+
   template <bool writing_ = writing>
   typename std::enable_if<!writing_, void>::type initialize(
       const std::string &fn) {
-    data = read_data_from_file(fn);
-    c_data = reinterpret_cast<uint8_t *>(&data[0]);
+    release();
+    if (!ends_with(fn, ".zip") && map_file(fn)) {
+      c_data = reinterpret_cast<uint8_t *>(mapped);
+    } else {
+      data = read_data_from_file(fn);
+      c_data = reinterpret_cast<uint8_t *>(&data[0]);
+    }
     head = sizeof(std::size_t);
   }
 
   void write_to_file(const std::string &fn) {
+    TC_ASSERT(stream_file == nullptr);
     void *ptr = c_data;
     if (!ptr) {
       assert(!data.empty());
@@ -259,6 +309,7 @@ class BinarySerializer : public Serializer {
   typename std::enable_if<writing_, void>::type initialize(
       std::size_t preserved_ = std::size_t(0),
       void *c_data = nullptr) {
+    release();
     std::size_t n = 0;
     head = 0;
     if (preserved_ != 0) {
@@ -267,18 +318,43 @@ class BinarySerializer : public Serializer {
       this->preserved = preserved_;
       assert(c_data != nullptr);
       this->c_data = (uint8_t *)c_data;
+      page_aligned = false;
     } else {
       // otherwise use a std::vector<uint8_t>
       this->preserved = 0;
       this->c_data = nullptr;
+      page_aligned = false;
     }
     this->operator()("", n);
   }
 
+  // Streams the output to file fn in chunks of stream_chunk_size bytes,
+  // instead of keeping it in memory. The file is complete after finalize().
+  template <bool writing_ = writing>
+  typename std::enable_if<writing_, void>::type initialize(
+      const std::string &fn) {
+    release();
+    stream_file = std::fopen(fn.c_str(), "wb");
+    TC_ERROR_IF(stream_file == nullptr,
+                "Cannot open file [{}] for writing. (Does the directory "
+                "exist?)",
+                fn);
+    std::setvbuf(stream_file, nullptr, _IONBF, 0);
+    data.resize(stream_chunk_size);
+    c_data = nullptr;
+    preserved = 0;
+    flushed = 0;
+    head = 0;
+    page_aligned = true;
+    std::size_t n = 0;
+    this->operator()("", n);
+  }
+
   template <bool writing_ = writing>
   typename std::enable_if<!writing_, void>::type initialize(
       void *raw_data,
       std::size_t preserved_ = std::size_t(0)) {
+    release();
     if (preserved_ != 0) {
       assert(raw_data == nullptr);
       data.resize(preserved_);
@@ -293,16 +369,138 @@ class BinarySerializer : public Serializer {
 
   void finalize() {
     if (writing) {
-      if (c_data) {
-        *reinterpret_cast<std::size_t *>(&c_data[0]) = head;
+      std::size_t size = head | (page_aligned ? page_aligned_flag : 0);
+      if (stream_file) {
+        flush_stream();
+        std::fseek(stream_file, 0, SEEK_SET);
+        std::fwrite(&size, sizeof(size), 1, stream_file);
+        TC_ERROR_IF(std::fclose(stream_file) != 0, "Failed to write to file");
+        stream_file = nullptr;
+        data.clear();
+      } else if (c_data) {
+        *reinterpret_cast<std::size_t *>(&c_data[0]) = size;
       } else {
-        *reinterpret_cast<std::size_t *>(&data[0]) = head;
+        *reinterpret_cast<std::size_t *>(&data[0]) = size;
       }
     } else {
-      assert(head == *reinterpret_cast<std::size_t *>(c_data));
+      assert(head == (*reinterpret_cast<std::size_t *>(c_data) &
+                      ~page_aligned_flag));
+    }
+  }
+
+  // Reads a std::vector<T> of a POD type without copying its elements.
+  // Returns a pointer into the input, i.e. into the file mapping when reading
+  // from a file, which stays valid during the lifetime of the serializer.
+  template <typename T, bool writing_ = writing>
+  typename std::enable_if<!writing_, const T *>::type view_array(
+      std::size_t &n) {
+    static_assert(is_pod_element<T>::value, "T must be a POD type");
+    this->operator()("", n);
+    align_array(n * sizeof(T));
+    auto ptr = reinterpret_cast<const T *>(&c_data[head]);
+    head += n * sizeof(T);
+    return ptr;
+  }
+
+ private:
+  void release() {
+    if (stream_file) {
+      std::fclose(stream_file);
+      stream_file = nullptr;
     }
+#if !defined(_WIN32)
+    if (mapped) {
+      munmap(mapped, mapped_size);
+    }
+#endif
+    mapped = nullptr;
+    mapped_size = 0;
+  }
+
+  bool map_file(const std::string &fn) {
+#if !defined(_WIN32)
+    int fd = open(fn.c_str(), O_RDONLY);
+    if (fd == -1) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      close(fd);
+      return false;
+    }
+    auto ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+      return false;
+    }
+    madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+    mapped = ptr;
+    mapped_size = st.st_size;
+    return true;
+#else
+    return false;
+#endif
   }
 
+  void flush_stream() {
+    auto size = head - flushed;
+    TC_ERROR_IF(std::fwrite(&data[0], 1, size, stream_file) != size,
+                "Failed to write to file");
+    flushed = head;
+  }
+
+  void write_bytes(const void *ptr, std::size_t size) {
+    if (stream_file) {
+      if (head - flushed + size > stream_chunk_size) {
+        flush_stream();
+      }
+      if (size >= stream_chunk_size) {
+        TC_ERROR_IF(std::fwrite(ptr, 1, size, stream_file) != size,
+                    "Failed to write to file");
+        flushed += size;
+      } else {
+        std::memcpy(&data[head - flushed], ptr, size);
+      }
+    } else if (c_data) {
+      if (head + size > preserved) {
+        TC_CRITICAL("Preserved Buffer (size {}) Overflow.", preserved);
+      }
+      std::memcpy(&c_data[head], ptr, size);
+    } else {
+      data.resize(head + size);
+      std::memcpy(&data[head], ptr, size);
+    }
+    head += size;
+  }
+
+  void read_bytes(void *ptr, std::size_t size) {
+    std::memcpy(ptr, &c_data[head], size);
+    head += size;
+  }
+
+  // Moves head to the next page boundary before the elements of a large POD
+  // array, if the format is page-aligned
+  void align_array(std::size_t bytes) {
+    if (bytes < page_size) {
+      return;
+    }
+    if (writing) {
+      if (page_aligned) {
+        static const uint8_t zeros[page_size] = {0};
+        write_bytes(zeros, (page_size - head % page_size) % page_size);
+      }
+    } else if (*reinterpret_cast<std::size_t *>(c_data) & page_aligned_flag) {
+      head = (head + page_size - 1) / page_size * page_size;
+    }
+  }
+
+  template <typename T>
+  using is_pod_element = std::integral_constant<
+      bool,
+      std::is_trivially_copyable<T>::value && !has_io<T>::value &&
+          !std::is_pointer<T>::value && !std::is_same<T, bool>::value>;
+
+ public:
   // std::string
   void operator()(const char *, const std::string &val_) {
     auto &val = get_writable(val_);
@@ -348,27 +546,10 @@ class BinarySerializer : public Serializer {
     static_assert(!std::is_volatile<T>::value, "T cannot be volatile");
     static_assert(!std::is_pointer<T>::value, "T cannot be pointer");
     if (writing) {
-      std::size_t new_size = head + sizeof(T);
-      if (c_data) {
-        if (new_size > preserved) {
-          TC_CRITICAL("Preserved Buffer (size {}) Overflow.", preserved);
-        }
-        //*reinterpret_cast<typename type::remove_cvref_t<T> *>(&c_data[head]) =
-        //    val;
-        std::memcpy(&c_data[head], &val, sizeof(T));
-      } else {
-        data.resize(new_size);
-        //*reinterpret_cast<typename type::remove_cvref_t<T> *>(&data[head]) =
-        //    val;
-        std::memcpy(&data[head], &val, sizeof(T));
-      }
+      write_bytes(&val, sizeof(T));
     } else {
-      // get_writable(val) =
-      //    *reinterpret_cast<typename std::remove_reference<T>::type *>(
-      //        &c_data[head]);
-      std::memcpy(&get_writable(val), &c_data[head], sizeof(T));
+      read_bytes(&get_writable(val), sizeof(T));
     }
-    head += sizeof(T);
   }
 
   template <typename T>
@@ -461,7 +642,9 @@ class BinarySerializer : public Serializer {
 
   // std::vector
   template <typename T>
-  void operator()(const char *, const std::vector<T> &val_) {
+  typename std::enable_if<!is_pod_element<T>::value, void>::type operator()(
+      const char *,
+      const std::vector<T> &val_) {
     auto &val = get_writable(val_);
     if (writing) {
       this->operator()("", val.size());
@@ -482,6 +665,25 @@ class BinarySerializer : public Serializer {
     }
   }
 
+  // std::vector of POD types, copied in bulk
+  template <typename T>
+  typename std::enable_if<is_pod_element<T>::value, void>::type operator()(
+      const char *,
+      const std::vector<T> &val_) {
+    auto &val = get_writable(val_);
+    std::size_t n = val.size();
+    this->operator()("", n);
+    if (!writing) {
+      val.resize(n);
+    }
+    align_array(n * sizeof(T));
+    if (writing) {
+      write_bytes(val.data(), n * sizeof(T));
+    } else {
+      read_bytes(val.data(), n * sizeof(T));
+    }
+  }
+
   // std::pair
   template <typename T, typename G>
   void operator()(const char *, const std::pair<T, G> &val) {
@@ -739,10 +941,16 @@ void read_from_binary_file(T &t, const std::string &file_name) {
 template <typename T>
 void write_to_binary_file(const T &t, const std::string &file_name) {
   BinaryOutputSerializer writer;
-  writer.initialize();
-  writer(t);
-  writer.finalize();
-  writer.write_to_file(file_name);
+  if (ends_with(file_name, ".tcb")) {
+    writer.initialize(file_name);
+    writer(t);
+    writer.finalize();
+  } else {
+    writer.initialize();
+    writer(t);
+    writer.finalize();
+    writer.write_to_file(file_name);
+  }
 }
 
 // Compile-Time Tests
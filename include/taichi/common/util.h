@@ -372,6 +372,34 @@ void write(std::string fn, const uint8 *data, std::size_t len);
 void write(const std::string &fn, const std::string &data);
 std::vector<uint8> read(const std::string fn, bool verbose = false);
 
+// Streaming gzip compression into a file
+class GzipWriter {
+ public:
+  explicit GzipWriter(const std::string &fn, int level = 1);
+
+  void write(const void *data, std::size_t len);
+
+  // Writes the end of the stream and closes the file. Errors are only
+  // reported when this is called explicitly; the destructor ignores them.
+  void close();
+
+  ~GzipWriter();
+
+ private:
+  // Both return false on failure instead of raising an error
+  bool write_compressed(int flush);
+  bool finish();
+
+  std::FILE *file;
+  void *stream;
+  uint32 crc;
+  uint64 size;
+  std::vector<uint8> buffer;
+};
+
+// Decompresses a whole gzip file
+std::vector<uint8> read_gzip(const std::string &fn);
+
 }  // namespace zip
 
 //******************************************************************************
@@ -5,6 +5,7 @@
 TLANG_NAMESPACE_BEGIN
 
 class CPUProfiler;
+class UnifiedAllocator;
 
 struct Context {
   using Buffer = void *;
@@ -15,10 +16,18 @@ struct Context {
   int num_leaves;
   CPUProfiler *cpu_profiler;
   void *runtime;
+  // key the random number streams of RandStmt
+  uint32 rand_seed;
+  uint32 launch_id;
+  // of the program; kernels of the source backend allocate from it
+  UnifiedAllocator *allocator;
 
   Context() {
     leaves = 0;
     num_leaves = 0;
+    rand_seed = 0;
+    launch_id = 0;
+    allocator = nullptr;
     for (int i = 0; i < 1; i++)
       buffers[i] = nullptr;
   }
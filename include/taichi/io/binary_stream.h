@@ -7,9 +7,11 @@
 
 #include <taichi/common/interface.h>
 #include <cstdio>
+#include <type_traits>
 
 TC_NAMESPACE_BEGIN
 
+// Raw binary file streams for POD data and large memory blobs.
 class BinaryFileStreamInput final {
  private:
   FILE *f;
@@ -17,13 +19,39 @@ class BinaryFileStreamInput final {
  public:
   BinaryFileStreamInput(const std::string &fn) {
     f = std::fopen(fn.c_str(), "rb");
+    TC_ERROR_IF(f == nullptr, "Cannot open file [{}] for reading", fn);
+  }
+
+  void read(void *data, std::size_t size) {
+    auto ret = std::fread(data, 1, size, f);
+    TC_ERROR_IF(ret != size, "Unexpected end of file");
   }
 
   template <typename T>
-  BinaryFileStreamInput operator>>(const T &t) {
+  BinaryFileStreamInput &operator>>(T &t) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Only POD types can be read");
+    read(&t, sizeof(T));
+    return *this;
   }
 
-  BinaryFileStreamInput() {
+  void seek(std::size_t pos) {
+    std::fseek(f, (long)pos, SEEK_SET);
+  }
+
+  // Size of the file in bytes. Moves the position to the beginning.
+  std::size_t size() {
+    std::fseek(f, 0, SEEK_END);
+    auto ret = tell();
+    seek(0);
+    return ret;
+  }
+
+  std::size_t tell() const {
+    return (std::size_t)std::ftell(f);
+  }
+
+  ~BinaryFileStreamInput() {
     std::fclose(f);
   }
 };
@@ -31,15 +59,43 @@ class BinaryFileStreamInput final {
 class BinaryFileStreamOutput final {
  private:
   FILE *f;
+  std::size_t pos;
 
  public:
-  BinaryFileStreamOutput(const std::string &fn) {
+  BinaryFileStreamOutput(const std::string &fn) : pos(0) {
     f = std::fopen(fn.c_str(), "wb");
+    TC_ERROR_IF(f == nullptr, "Cannot open file [{}] for writing", fn);
+  }
+
+  void write(const void *data, std::size_t size) {
+    auto ret = std::fwrite(data, 1, size, f);
+    TC_ERROR_IF(ret != size, "Failed to write to file");
+    pos += size;
+  }
+
+  template <typename T>
+  BinaryFileStreamOutput &operator<<(const T &t) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Only POD types can be written");
+    write(&t, sizeof(T));
+    return *this;
+  }
+
+  // Pads with zeros until the position is a multiple of alignment
+  void align(std::size_t alignment) {
+    char zeros[256] = {0};
+    while (pos % alignment != 0) {
+      write(zeros, std::min(sizeof(zeros), alignment - pos % alignment));
+    }
+  }
+
+  std::size_t tell() const {
+    return pos;
   }
 
-  BinaryFileStreamOutput() {
+  ~BinaryFileStreamOutput() {
     std::fclose(f);
   }
 };
 
-TC_NAMESPACE_END
\ No newline at end of file
+TC_NAMESPACE_END
@@ -2,7 +2,15 @@
     Copyright (c) The Taichi Authors (2016- ). All Rights Reserved.
     The use of this software is governed by the LICENSE file.
 *******************************************************************************/
+
+#pragma once
+
 #include <taichi/util.h>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
 
 TC_NAMESPACE_BEGIN
 
@@ -76,4 +84,66 @@ class PLYWriter {
   }
 };
 
+// Particles with float32 properties, stored as one array per property
+struct ParticleFrame {
+  std::size_t num_particles;
+  std::vector<std::string> names;
+  std::vector<std::vector<float32>> properties;
+
+  ParticleFrame(std::size_t num_particles = 0) : num_particles(num_particles) {
+  }
+
+  void add_property(const std::string &name, std::vector<float32> &&data) {
+    TC_ASSERT(data.size() == num_particles);
+    names.push_back(name);
+    properties.push_back(std::move(data));
+  }
+
+  void add_property(const std::string &name, const float32 *data) {
+    add_property(name, std::vector<float32>(data, data + num_particles));
+  }
+};
+
+// Writes n particles as the vertices of a binary little-endian PLY file, with
+// one float property per array of n elements. The arrays are interleaved
+// into large buffers, which are written without further buffering. Files
+// whose names end with .gz are gzip-compressed.
+void write_particles_ply(const std::string &fn,
+                         std::size_t n,
+                         const std::vector<std::string> &names,
+                         const std::vector<const float32 *> &properties);
+
+void write_particles_ply(const std::string &fn, const ParticleFrame &frame);
+
+// Writes particle frames on a background I/O thread, so that the next steps
+// can be computed in the meantime
+class AsyncParticleWriter {
+ public:
+  explicit AsyncParticleWriter(int max_pending_frames = 2);
+
+  // Queues the frame to be written to fn. Blocks while max_pending_frames
+  // frames are waiting to be written. Exceptions thrown while writing a
+  // previous frame are rethrown here or from wait(), and the frames queued
+  // after it are dropped.
+  void write(const std::string &fn, ParticleFrame &&frame);
+
+  // Blocks until all queued frames are written
+  void wait();
+
+  ~AsyncParticleWriter();
+
+ private:
+  void run();
+  void rethrow_error();
+
+  int max_pending_frames;
+  bool stopped;
+  bool writing;
+  std::deque<std::pair<std::string, ParticleFrame>> queue;
+  std::exception_ptr error;
+  std::mutex mut;
+  std::condition_variable queued, written;
+  std::thread thread;
+};
+
 TC_NAMESPACE_END
\ No newline at end of file
@@ -5,4 +5,5 @@
 #include "context.h"
 #include "struct.h"
 #include "arithmetics.h"
+#include "philox.h"
 #include "profiler.h"
\ No newline at end of file
@@ -17,7 +17,7 @@ class IndexND;
 template <int dim>
 class RegionND;
 
-template <int dim, typename T>
+template <int dim, typename T, typename Layout>
 class ArrayND;
 
 TC_NAMESPACE_END
@@ -13,6 +13,7 @@
 
 #include "array_fwd.h"
 #include "linalg.h"
+#include "array_parallel.h"
 
 TC_NAMESPACE_BEGIN
 
@@ -20,6 +21,8 @@ template <>
 class IndexND<2> {
  private:
   int x[2], y[2];
+  // Iterate brick by brick (see BrickLayout) if nonzero
+  int log_brick_size = 0;
 
  public:
   using Index = IndexND<2>;
@@ -36,7 +39,8 @@ class IndexND<2> {
           int x1,
           int y0,
           int y1,
-          Vector2 storage_offset = Vector2(0.5f, 0.5f)) {
+          Vector2 storage_offset = Vector2(0.5f, 0.5f),
+          int log_brick_size = 0) {
     x[0] = x0;
     x[1] = x1;
     y[0] = y0;
@@ -46,11 +50,13 @@ class IndexND<2> {
     // offset = 0;
     stride = y[1] - y[0];
     this->storage_offset = storage_offset;
+    this->log_brick_size = log_brick_size;
   }
 
   IndexND(Vector2i start,
           Vector2i end,
-          Vector2 storage_offset = Vector2(0.5f, 0.5f)) {
+          Vector2 storage_offset = Vector2(0.5f, 0.5f),
+          int log_brick_size = 0) {
     x[0] = start[0];
     x[1] = end[0];
     y[0] = start[1];
@@ -60,6 +66,7 @@ class IndexND<2> {
     // offset = 0;
     stride = y[1] - y[0];
     this->storage_offset = storage_offset;
+    this->log_brick_size = log_brick_size;
   }
 
   IndexND(int i, int j) {
@@ -68,6 +75,10 @@ class IndexND<2> {
   }
 
   void next() {
+    if (log_brick_size) {
+      next_in_brick();
+      return;
+    }
     j++;
     // offset++;
     if (j == y[1]) {
@@ -78,6 +89,25 @@ class IndexND<2> {
     }
   }
 
+  // Row-major within the part of the current brick inside the range, then
+  // on to the next brick
+  void next_in_brick() {
+    int b = 1 << log_brick_size;
+    int i0 = i & -b, j0 = j & -b;
+    if (++j < std::min(y[1], j0 + b))
+      return;
+    j = std::max(y[0], j0);
+    if (++i < std::min(x[1], i0 + b))
+      return;
+    i = std::max(x[0], i0);
+    if (j0 + b < y[1]) {
+      j = j0 + b;
+      return;
+    }
+    j = y[0];
+    i = i0 + b < x[1] ? i0 + b : x[1];
+  }
+
   Index operator++() {
     this->next();
     return *this;
@@ -150,6 +180,7 @@ class RegionND<2> {
   Index2D index_begin;
   Index2D index_end;
   Vector2 storage_offset;
+  int log_brick_size = 0;
 
  public:
   using Region = RegionND<2>;
@@ -161,26 +192,48 @@ class RegionND<2> {
            int x1,
            int y0,
            int y1,
-           Vector2 storage_offset = Vector2(0.5f, 0.5f)) {
+           Vector2 storage_offset = Vector2(0.5f, 0.5f),
+           int log_brick_size = 0) {
     x[0] = x0;
     x[1] = x1;
     y[0] = y0;
     y[1] = y1;
-    index_begin = Index2D(x0, x1, y0, y1, storage_offset);
+    index_begin = Index2D(x0, x1, y0, y1, storage_offset, log_brick_size);
     index_end = Index2D(x0, x1, y0, y1, storage_offset).to_end();
     this->storage_offset = storage_offset;
+    this->log_brick_size = log_brick_size;
   }
 
+  // Iterates brick by brick if log_brick_size is nonzero, which follows the
+  // storage order of arrays with BrickLayout<log_brick_size>
   RegionND(Vector2i start,
            Vector2i end,
-           Vector2 storage_offset = Vector2(0.5f, 0.5f)) {
+           Vector2 storage_offset = Vector2(0.5f, 0.5f),
+           int log_brick_size = 0) {
     x[0] = start[0];
     x[1] = end[0];
     y[0] = start[1];
     y[1] = end[1];
-    index_begin = Index2D(start, end, storage_offset);
+    index_begin = Index2D(start, end, storage_offset, log_brick_size);
     index_end = Index2D(start, end, storage_offset).to_end();
     this->storage_offset = storage_offset;
+    this->log_brick_size = log_brick_size;
+  }
+
+  Vector2i get_lower() const {
+    return Vector2i(x[0], y[0]);
+  }
+
+  Vector2i get_upper() const {
+    return Vector2i(x[1], y[1]);
+  }
+
+  Vector2 get_storage_offset() const {
+    return storage_offset;
+  }
+
+  int get_log_brick_size() const {
+    return log_brick_size;
   }
 
   const Index2D begin() const {
@@ -202,21 +255,36 @@ class RegionND<2> {
 
 typedef RegionND<2> Region2D;
 
-template <typename T>
-class ArrayND<2, T> {
+// Elements are stored in the order given by Layout. With brick layouts the
+// resolution must be a multiple of the brick size, and data is indexed
+// through offset() rather than row-major.
+template <typename T, typename Layout>
+class ArrayND<2, T, Layout> {
  protected:
+  static constexpr int log_brick_size = Layout::log_brick_size;
   Region2D region;
   typedef typename std::vector<T>::iterator iterator;
   int size;
   Vector2i res;
+  // number of bricks along each axis
+  Vector2i num_bricks;
   Vector2 storage_offset = Vector2(0.5f, 0.5f);  // defualt : center storage
+
+  // a[i][j] for brick layouts
+  template <typename A, typename E>
+  struct BrickAccessor1D {
+    A *arr;
+    int i;
+
+    TC_FORCE_INLINE E &operator[](int j) const {
+      return arr->data[arr->offset(i, j)];
+    }
+  };
+
  public:
   std::vector<T> data;
   template <typename S>
-  using Array2D = ArrayND<2, S>;
-
-  template <typename P>
-  friend Array2D<T> operator*(const P &b, const Array2D<T> &a);
+  using Array2D = ArrayND<2, S, Layout>;
 
   int get_size() const {
     return size;
@@ -236,18 +304,35 @@ class ArrayND<2, T> {
                   T init = T(0),
                   Vector2 storage_offset = Vector2(0.5f)) {
     this->res = res;
-    region = Region2D(0, res[0], 0, res[1], storage_offset);
-    size = res[0] * res[1];
-    data = std::vector<T>(size, init);
     this->storage_offset = storage_offset;
+    update_layout();
+    data = std::vector<T>(size, init);
+  }
+
+  void update_layout() {
+    for (int i = 0; i < 2; i++) {
+      TC_ERROR_UNLESS(res[i] % Layout::brick_size == 0,
+                      "Resolution {} is not a multiple of the brick size {}",
+                      res[i], Layout::brick_size);
+      num_bricks[i] = res[i] >> log_brick_size;
+    }
+    region = Region2D(0, res[0], 0, res[1], storage_offset, log_brick_size);
+    size = res[0] * res[1];
+  }
+
+  // Offset of element (i, j) in data
+  TC_FORCE_INLINE int offset(int i, int j) const {
+    constexpr int b = log_brick_size, m = Layout::brick_mask;
+    int brick = (i >> b) * num_bricks[1] + (j >> b);
+    return (brick << (2 * b)) + (((i & m) << b) | (j & m));
   }
 
   Array2D<T> same_shape(T init) const {
-    return ArrayND<2, T>(res, init, storage_offset);
+    return Array2D<T>(res, init, storage_offset);
   }
 
   Array2D<T> same_shape() const {
-    return ArrayND<2, T>(res);
+    return Array2D<T>(res);
   }
 
   ArrayND(const Array2D<T> &arr) : ArrayND(arr.res) {
@@ -255,12 +340,13 @@ class ArrayND<2, T> {
     this->storage_offset = arr.storage_offset;
   }
 
+  ArrayND(Array2D<T> &&arr) = default;
+
   template <typename P>
   Array2D<T> operator*(const P &b) const {
     Array2D<T> o(res);
-    for (int i = 0; i < size; i++) {
-      o.data[i] = b * data[i];
-    }
+    array_kernels::map(o.data.data(), data.data(), size,
+                       [&](const auto &x) { return b * x; });
     return o;
   }
 
@@ -273,53 +359,51 @@ class ArrayND<2, T> {
   Array2D<T> operator+(const Array2D<T> &b) const {
     Array2D<T> o(res);
     assert(same_dim(b));
-    for (int i = 0; i < size; i++) {
-      o.data[i] = data[i] + b.data[i];
-    }
+    array_kernels::map(o.data.data(), data.data(), b.data.data(), size,
+                       [](const auto &x, const auto &y) { return x + y; });
     return o;
   }
 
   Array2D<T> operator-(const Array2D<T> &b) const {
     Array2D<T> o(res);
     assert(same_dim(b));
-    for (int i = 0; i < size; i++) {
-      o.data[i] = data[i] - b.data[i];
-    }
+    array_kernels::map(o.data.data(), data.data(), b.data.data(), size,
+                       [](const auto &x, const auto &y) { return x - y; });
     return o;
   }
 
   void operator+=(const Array2D<T> &b) {
     assert(same_dim(b));
-    for (int i = 0; i < size; i++) {
-      data[i] = data[i] + b.data[i];
-    }
+    array_kernels::map(data.data(), data.data(), b.data.data(), size,
+                       [](const auto &x, const auto &y) { return x + y; });
   }
 
   void operator-=(const Array2D<T> &b) {
     assert(same_dim(b));
-    for (int i = 0; i < size; i++) {
-      data[i] = data[i] - b.data[i];
-    }
+    array_kernels::map(data.data(), data.data(), b.data.data(), size,
+                       [](const auto &x, const auto &y) { return x - y; });
   }
 
   Array2D<T> &operator=(const Array2D<T> &arr) {
     this->res = arr.res;
     this->size = arr.size;
+    this->num_bricks = arr.num_bricks;
     this->data = arr.data;
     this->region = arr.region;
     this->storage_offset = arr.storage_offset;
     return *this;
   }
 
+  Array2D<T> &operator=(Array2D<T> &&arr) = default;
+
   Array2D<T> &operator=(const T &a) {
-    for (int i = 0; i < size; i++) {
-      data[i] = a;
-    }
+    reset(a);
     return *this;
   }
 
   ArrayND() {
     res = Vector2i(0);
+    num_bricks = Vector2i(0);
     size = 0;
     data.resize(0);
   }
@@ -327,12 +411,27 @@ class ArrayND<2, T> {
   ~ArrayND() {
   }
 
-  void reset(T a) {
-    for (int i = 0; i < size; i++) {
-      data[i] = a;
+  TC_IO_DECL {
+    // Reading data stored in another layout would silently permute it
+    int32 layout_log_brick_size = log_brick_size;
+    TC_IO(res, storage_offset, layout_log_brick_size);
+    TC_ERROR_UNLESS(layout_log_brick_size == log_brick_size,
+                    "Array stored with log_brick_size {} is read with "
+                    "log_brick_size {}",
+                    layout_log_brick_size, log_brick_size);
+    TC_IO(data);
+    if (TC_SERIALIZER_IS(BinaryInputSerializer)) {
+      auto &self = const_cast<ArrayND &>(*this);
+      self.update_layout();
     }
   }
 
+  void reset(T a) {
+    parallel_for_chunks(size, [&](int begin, int end) {
+      std::fill(data.begin() + begin, data.begin() + end, a);
+    });
+  }
+
   void reset_zero() {
     memset(&data[0], 0, sizeof(T) * data.size());
   }
@@ -342,48 +441,53 @@ class ArrayND<2, T> {
   }
 
   T dot(const Array2D<T> &b) const {
-    T sum = 0;
     assert(same_dim(b));
-    for (int i = 0; i < size; i++) {
-      sum += this->data[i] * b.data[i];
-    }
-    return sum;
+    return array_kernels::sum<T>(
+        data.data(), b.data.data(), size,
+        [](const auto &x, const auto &y) { return x * y; });
   }
 
   double dot_double(const Array2D<T> &b) const {
-    double sum = 0;
     assert(same_dim(b));
-    for (int i = 0; i < size; i++) {
-      sum += this->data[i] * b.data[i];
-    }
-    return sum;
+    return array_kernels::sum<double>(
+        data.data(), b.data.data(), size,
+        [](const T &x, const T &y) { return (double)x * (double)y; });
   }
 
   Array2D<T> add(T alpha, const Array2D<T> &b) const {
     Array2D<T> o(res);
     assert(same_dim(b));
-    for (int i = 0; i < size; i++) {
-      o.data[i] = data[i] + alpha * b.data[i];
-    }
+    array_kernels::map(
+        o.data.data(), data.data(), b.data.data(), size,
+        [&](const auto &x, const auto &y) { return x + alpha * y; });
     return o;
   }
 
   void add_in_place(T alpha, const Array2D<T> &b) {
-    for (int i = 0; i < size; i++) {
-      data[i] += alpha * b.data[i];
-    }
+    array_kernels::map(
+        data.data(), data.data(), b.data.data(), size,
+        [&](const auto &x, const auto &y) { return x + alpha * y; });
   }
 
-  T *operator[](int i) {
-    return &data[0] + i * res[1];
+  // a[i] is a pointer to a row of elements in row-major storage
+  auto operator[](int i) {
+    if constexpr (log_brick_size == 0) {
+      return &data[0] + i * res[1];
+    } else {
+      return BrickAccessor1D<ArrayND, T>{this, i};
+    }
   }
 
-  const T *operator[](int i) const {
-    return &data[0] + i * res[1];
+  auto operator[](int i) const {
+    if constexpr (log_brick_size == 0) {
+      return &data[0] + i * res[1];
+    } else {
+      return BrickAccessor1D<const ArrayND, const T>{this, i};
+    }
   }
 
   const T &get(int i, int j) const {
-    return (*this)[i][j];
+    return data[offset(i, j)];
   }
 
   const T &get(const Index2D &ind) const {
@@ -403,54 +507,30 @@ class ArrayND<2, T> {
   }
 
   T abs_sum() const {
-    T ret = 0;
-    for (int i = 0; i < size; i++) {
-      ret += std::abs(data[i]);
-    }
-    return ret;
+    return array_kernels::sum<T>(
+        data.data(), data.data(), size,
+        [](const auto &x, const auto &) {
+          using std::abs;
+          return abs(x);
+        });
   }
 
   T sum() const {
-    T ret = 0;
-    for (int i = 0; i < size; i++) {
-      ret += data[i];
-    }
-    return ret;
+    return array_kernels::sum<T>(data.data(), data.data(), size,
+                                 [](const auto &x, const auto &) { return x; });
   }
 
-  template <typename TT = T,
-            typename std::enable_if_t<!std::is_class<TT>::value, int> = 0>
-  T abs_max() const {
-    T ret(0);
-    for (int i = 0; i < size; i++) {
-      ret = std::max(ret, abs(data[i]));
-    }
-    return ret;
-  }
-
-  template <typename TT = T, typename TS = typename TT::ScalarType>
-  TS abs_max() const {
-    TS ret(0);
-    for (int i = 0; i < size; i++) {
-      ret = std::max(ret, data[i].abs().max());
-    }
-    return ret;
+  // Largest absolute value of the elements, or of their components
+  auto abs_max() const {
+    return array_kernels::abs_max(data.data(), size);
   }
 
   T min() const {
-    T ret = std::numeric_limits<T>::max();
-    for (int i = 0; i < size; i++) {
-      ret = std::min(ret, data[i]);
-    }
-    return ret;
+    return array_kernels::min(data.data(), size);
   }
 
   T max() const {
-    T ret = std::numeric_limits<T>::min();
-    for (int i = 0; i < size; i++) {
-      ret = std::max(ret, data[i]);
-    }
-    return ret;
+    return array_kernels::max(data.data(), size);
   }
 
   void print_abs_max_pos() const {
@@ -573,19 +653,19 @@ class ArrayND<2, T> {
   }
 
   T &operator[](const Vector2i &pos) {
-    return (*this)[pos.x][pos.y];
+    return data[offset(pos.x, pos.y)];
   }
 
   const T &operator[](const Vector2i &pos) const {
-    return (*this)[pos.x][pos.y];
+    return data[offset(pos.x, pos.y)];
   }
 
   T &operator[](const Index2D &index) {
-    return (*this)[index.i][index.j];
+    return data[offset(index.i, index.j)];
   }
 
   const T &operator[](const Index2D &index) const {
-    return (*this)[index.i][index.j];
+    return data[offset(index.i, index.j)];
   }
 
   Vector2i get_res() const {
@@ -625,7 +705,8 @@ class ArrayND<2, T> {
     return Region2D(std::max(0, x - half_extent + 1),
                     std::min(res[0], x + half_extent + 1),
                     std::max(0, y - half_extent + 1),
-                    std::min(res[1], y + half_extent + 1), storage_offset);
+                    std::min(res[1], y + half_extent + 1), storage_offset,
+                    log_brick_size);
   }
 
   bool is_normal() const {
@@ -780,15 +861,19 @@ class ArrayND<2, T> {
 template <typename T>
 using Array2D = ArrayND<2, T>;
 
-template <typename T, typename P>
-inline Array2D<T> operator*(const P &b, const Array2D<T> &a) {
-  Array2D<T> o(a.res);
-  for (int i = 0; i < a.size; i++) {
+template <typename T, typename Layout, typename P>
+inline ArrayND<2, T, Layout> operator*(const P &b,
+                                       const ArrayND<2, T, Layout> &a) {
+  ArrayND<2, T, Layout> o(a.get_res());
+  for (int i = 0; i < a.get_size(); i++) {
     o.data[i] = b * a.data[i];
   }
   return o;
 }
 
+template <typename T, int log_brick_size = 3>
+using BrickArray2D = ArrayND<2, T, BrickLayout<log_brick_size>>;
+
 template <typename T>
 inline void print(const Array2D<T> &arr) {
   arr.print("");
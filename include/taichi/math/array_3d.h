@@ -13,6 +13,7 @@
 
 #include "array_fwd.h"
 #include "linalg.h"
+#include "array_parallel.h"
 
 TC_NAMESPACE_BEGIN
 
@@ -20,6 +21,8 @@ template <>
 class IndexND<3> {
  private:
   int x[2], y[2], z[2];
+  // Iterate brick by brick (see BrickLayout) if nonzero
+  int log_brick_size = 0;
 
  public:
   int i, j, k;
@@ -37,7 +40,8 @@ class IndexND<3> {
           int y1,
           int z0,
           int z1,
-          Vector3 storage_offset = Vector3(0.5f, 0.5f, 0.5f)) {
+          Vector3 storage_offset = Vector3(0.5f, 0.5f, 0.5f),
+          int log_brick_size = 0) {
     x[0] = x0;
     x[1] = x1;
     y[0] = y0;
@@ -48,11 +52,13 @@ class IndexND<3> {
     j = y[0];
     k = z[0];
     this->storage_offset = storage_offset;
+    this->log_brick_size = log_brick_size;
   }
 
   IndexND(Vector3i start,
           Vector3i end,
-          Vector3 storage_offset = Vector3(0.5f, 0.5f, 0.5f)) {
+          Vector3 storage_offset = Vector3(0.5f, 0.5f, 0.5f),
+          int log_brick_size = 0) {
     x[0] = start[0];
     x[1] = end[0];
     y[0] = start[1];
@@ -63,6 +69,7 @@ class IndexND<3> {
     j = y[0];
     k = z[0];
     this->storage_offset = storage_offset;
+    this->log_brick_size = log_brick_size;
   }
 
   IndexND(int i, int j, int k) {
@@ -78,6 +85,10 @@ class IndexND<3> {
   }
 
   void next() {
+    if (log_brick_size) {
+      next_in_brick();
+      return;
+    }
     k++;
     if (k == z[1]) {
       k = z[0];
@@ -91,6 +102,33 @@ class IndexND<3> {
     }
   }
 
+  // Row-major within the part of the current brick inside the range, then
+  // on to the next brick
+  void next_in_brick() {
+    int b = 1 << log_brick_size;
+    int i0 = i & -b, j0 = j & -b, k0 = k & -b;
+    if (++k < std::min(z[1], k0 + b))
+      return;
+    k = std::max(z[0], k0);
+    if (++j < std::min(y[1], j0 + b))
+      return;
+    j = std::max(y[0], j0);
+    if (++i < std::min(x[1], i0 + b))
+      return;
+    i = std::max(x[0], i0);
+    if (k0 + b < z[1]) {
+      k = k0 + b;
+      return;
+    }
+    k = z[0];
+    if (j0 + b < y[1]) {
+      j = j0 + b;
+      return;
+    }
+    j = y[0];
+    i = i0 + b < x[1] ? i0 + b : x[1];
+  }
+
   Index3D operator++() {
     this->next();
     return *this;
@@ -174,6 +212,7 @@ class RegionND<3> {
   Index3D index_begin;
   Index3D index_end;
   Vector3 storage_offset;
+  int log_brick_size = 0;
 
  public:
   using Region3D = RegionND<3>;
@@ -187,30 +226,53 @@ class RegionND<3> {
            int y1,
            int z0,
            int z1,
-           Vector3 storage_offset = Vector3(0.5f, 0.5f, 0.5f)) {
+           Vector3 storage_offset = Vector3(0.5f, 0.5f, 0.5f),
+           int log_brick_size = 0) {
     x[0] = x0;
     x[1] = x1;
     y[0] = y0;
     y[1] = y1;
     z[0] = z0;
     z[1] = z1;
-    index_begin = Index3D(x0, x1, y0, y1, z0, z1, storage_offset);
+    index_begin =
+        Index3D(x0, x1, y0, y1, z0, z1, storage_offset, log_brick_size);
     index_end = Index3D(x0, x1, y0, y1, z0, z1, storage_offset).to_end();
     this->storage_offset = storage_offset;
+    this->log_brick_size = log_brick_size;
   }
 
+  // Iterates brick by brick if log_brick_size is nonzero, which follows the
+  // storage order of arrays with BrickLayout<log_brick_size>
   RegionND(Vector3i start,
            Vector3i end,
-           Vector3 storage_offset = Vector3(0.5f, 0.5f, 0.5f)) {
+           Vector3 storage_offset = Vector3(0.5f, 0.5f, 0.5f),
+           int log_brick_size = 0) {
     x[0] = start[0];
     x[1] = end[0];
     y[0] = start[1];
     y[1] = end[1];
     z[0] = start[2];
     z[1] = end[2];
-    index_begin = Index3D(start, end, storage_offset);
+    index_begin = Index3D(start, end, storage_offset, log_brick_size);
     index_end = Index3D(start, end, storage_offset).to_end();
     this->storage_offset = storage_offset;
+    this->log_brick_size = log_brick_size;
+  }
+
+  Vector3i get_lower() const {
+    return Vector3i(x[0], y[0], z[0]);
+  }
+
+  Vector3i get_upper() const {
+    return Vector3i(x[1], y[1], z[1]);
+  }
+
+  Vector3 get_storage_offset() const {
+    return storage_offset;
+  }
+
+  int get_log_brick_size() const {
+    return log_brick_size;
   }
 
   const Index3D begin() const {
@@ -241,14 +303,20 @@ class RegionND<3> {
 
 using Region3D = RegionND<3>;
 
-template <typename T>
-class ArrayND<3, T> {
+// Elements are stored in the order given by Layout. With brick layouts the
+// resolution must be a multiple of the brick size, and data is indexed
+// through offset() rather than row-major.
+template <typename T, typename Layout>
+class ArrayND<3, T, Layout> {
  protected:
+  static constexpr int log_brick_size = Layout::log_brick_size;
   Region3D region;
   typedef typename std::vector<T>::iterator iterator;
   int size;
   Vector3i res;
   int stride;
+  // number of bricks along each axis
+  Vector3i num_bricks;
   Vector3 storage_offset =
       Vector3(0.5f, 0.5f, 0.5f);  // defualt : center storage
   struct Accessor2D {
@@ -277,10 +345,31 @@ class ArrayND<3, T> {
     }
   };
 
+  // a[i][j][k] for brick layouts
+  template <typename A, typename E>
+  struct BrickAccessor1D {
+    A *arr;
+    int i, j;
+
+    TC_FORCE_INLINE E &operator[](int k) const {
+      return arr->data[arr->offset(i, j, k)];
+    }
+  };
+
+  template <typename A, typename E>
+  struct BrickAccessor2D {
+    A *arr;
+    int i;
+
+    TC_FORCE_INLINE BrickAccessor1D<A, E> operator[](int j) const {
+      return BrickAccessor1D<A, E>{arr, i, j};
+    }
+  };
+
  public:
   std::vector<T> data;
   template <typename S>
-  using Array3D = ArrayND<3, S>;
+  using Array3D = ArrayND<3, S, Layout>;
 
   TC_FORCE_INLINE int get_size() const {
     return size;
@@ -300,11 +389,31 @@ class ArrayND<3, T> {
                   T init = T(0),
                   Vector3 storage_offset = Vector3(0.5f)) {
     this->res = res;
-    region = Region3D(0, res[0], 0, res[1], 0, res[2], storage_offset);
+    this->storage_offset = storage_offset;
+    update_layout();
+    data = std::vector<T>(size, init);
+  }
+
+  void update_layout() {
+    for (int i = 0; i < 3; i++) {
+      TC_ERROR_UNLESS(res[i] % Layout::brick_size == 0,
+                      "Resolution {} is not a multiple of the brick size {}",
+                      res[i], Layout::brick_size);
+      num_bricks[i] = res[i] >> log_brick_size;
+    }
+    region = Region3D(0, res[0], 0, res[1], 0, res[2], storage_offset,
+                      log_brick_size);
     size = res[0] * res[1] * res[2];
     stride = res[1] * res[2];
-    data = std::vector<T>(size, init);
-    this->storage_offset = storage_offset;
+  }
+
+  // Offset of element (i, j, k) in data
+  TC_FORCE_INLINE int offset(int i, int j, int k) const {
+    constexpr int b = log_brick_size, m = Layout::brick_mask;
+    int brick =
+        ((i >> b) * num_bricks[1] + (j >> b)) * num_bricks[2] + (k >> b);
+    return (brick << (3 * b)) +
+           (((i & m) << (2 * b)) | ((j & m) << b) | (k & m));
   }
 
   Array3D<T> same_shape(T init = T(0)) const {
@@ -319,39 +428,36 @@ class ArrayND<3, T> {
   Array3D<T> operator+(const Array3D<T> &b) const {
     Array3D<T> o(res);
     assert(same_dim(b));
-    for (int i = 0; i < size; i++) {
-      o.data[i] = data[i] + b.data[i];
-    }
+    array_kernels::map(o.data.data(), data.data(), b.data.data(), size,
+                       [](const auto &x, const auto &y) { return x + y; });
     return o;
   }
 
   Array3D<T> operator-(const Array3D<T> &b) const {
     Array3D<T> o(res);
     assert(same_dim(b));
-    for (int i = 0; i < size; i++) {
-      o.data[i] = data[i] - b.data[i];
-    }
+    array_kernels::map(o.data.data(), data.data(), b.data.data(), size,
+                       [](const auto &x, const auto &y) { return x - y; });
     return o;
   }
 
   void operator+=(const Array3D<T> &b) {
     assert(same_dim(b));
-    for (int i = 0; i < size; i++) {
-      data[i] = data[i] + b.data[i];
-    }
+    array_kernels::map(data.data(), data.data(), b.data.data(), size,
+                       [](const auto &x, const auto &y) { return x + y; });
   }
 
   void operator-=(const Array3D<T> &b) {
     assert(same_dim(b));
-    for (int i = 0; i < size; i++) {
-      data[i] = data[i] - b.data[i];
-    }
+    array_kernels::map(data.data(), data.data(), b.data.data(), size,
+                       [](const auto &x, const auto &y) { return x - y; });
   }
 
   Array3D<T> &operator=(const Array3D<T> &arr) {
     this->res = arr.res;
     this->size = arr.size;
     this->stride = arr.stride;
+    this->num_bricks = arr.num_bricks;
     this->data = arr.data;
     this->region = arr.region;
     this->storage_offset = arr.storage_offset;
@@ -359,14 +465,13 @@ class ArrayND<3, T> {
   }
 
   Array3D<T> &operator=(const T &a) {
-    for (int i = 0; i < size; i++) {
-      data[i] = a;
-    }
+    reset(a);
     return *this;
   }
 
   ArrayND() {
     res = Vector3i(0);
+    num_bricks = Vector3i(0);
     size = 0;
     stride = 0;
     data.resize(0);
@@ -375,12 +480,27 @@ class ArrayND<3, T> {
   ~ArrayND() {
   }
 
-  void reset(T a) {
-    for (int i = 0; i < size; i++) {
-      data[i] = a;
+  TC_IO_DECL {
+    // Reading data stored in another layout would silently permute it
+    int32 layout_log_brick_size = log_brick_size;
+    TC_IO(res, storage_offset, layout_log_brick_size);
+    TC_ERROR_UNLESS(layout_log_brick_size == log_brick_size,
+                    "Array stored with log_brick_size {} is read with "
+                    "log_brick_size {}",
+                    layout_log_brick_size, log_brick_size);
+    TC_IO(data);
+    if (TC_SERIALIZER_IS(BinaryInputSerializer)) {
+      auto &self = const_cast<ArrayND &>(*this);
+      self.update_layout();
     }
   }
 
+  void reset(T a) {
+    parallel_for_chunks(size, [&](int begin, int end) {
+      std::fill(data.begin() + begin, data.begin() + end, a);
+    });
+  }
+
   void reset_zero() {
     memset(&data[0], 0, sizeof(T) * data.size());
   }
@@ -390,48 +510,53 @@ class ArrayND<3, T> {
   }
 
   T dot(const Array3D<T> &b) const {
-    T sum = 0;
     assert(same_dim(b));
-    for (int i = 0; i < size; i++) {
-      sum += this->data[i] * b.data[i];
-    }
-    return sum;
+    return array_kernels::sum<T>(
+        data.data(), b.data.data(), size,
+        [](const auto &x, const auto &y) { return x * y; });
   }
 
   double dot_double(const Array3D<T> &b) const {
-    double sum = 0;
     assert(same_dim(b));
-    for (int i = 0; i < size; i++) {
-      sum += this->data[i] * b.data[i];
-    }
-    return sum;
+    return array_kernels::sum<double>(
+        data.data(), b.data.data(), size,
+        [](const T &x, const T &y) { return (double)x * (double)y; });
   }
 
   Array3D<T> add(T alpha, const Array3D<T> &b) const {
     Array3D<T> o(res);
     assert(same_dim(b));
-    for (int i = 0; i < size; i++) {
-      o.data[i] = data[i] + alpha * b.data[i];
-    }
+    array_kernels::map(
+        o.data.data(), data.data(), b.data.data(), size,
+        [&](const auto &x, const auto &y) { return x + alpha * y; });
     return o;
   }
 
   void add_in_place(T alpha, const Array3D<T> &b) {
-    for (int i = 0; i < size; i++) {
-      data[i] += alpha * b.data[i];
-    }
+    array_kernels::map(
+        data.data(), data.data(), b.data.data(), size,
+        [&](const auto &x, const auto &y) { return x + alpha * y; });
   }
 
-  TC_FORCE_INLINE const Accessor2D operator[](int i) {
-    return Accessor2D(&data[0] + i * stride, res[2]);
+  // a[i][j] is a pointer to a row of elements in row-major storage
+  TC_FORCE_INLINE const auto operator[](int i) {
+    if constexpr (log_brick_size == 0) {
+      return Accessor2D(&data[0] + i * stride, res[2]);
+    } else {
+      return BrickAccessor2D<ArrayND, T>{this, i};
+    }
   }
 
-  TC_FORCE_INLINE const ConstAccessor2D operator[](int i) const {
-    return ConstAccessor2D(&data[0] + i * stride, res[2]);
+  TC_FORCE_INLINE const auto operator[](int i) const {
+    if constexpr (log_brick_size == 0) {
+      return ConstAccessor2D(&data[0] + i * stride, res[2]);
+    } else {
+      return BrickAccessor2D<const ArrayND, const T>{this, i};
+    }
   }
 
   const T &get(int i, int j, int k) const {
-    return (*this)[i][j][k];
+    return data[offset(i, j, k)];
   }
 
   const T &get(const Index3D &ind) const {
@@ -461,35 +586,25 @@ class ArrayND<3, T> {
   }
 
   T abs_sum() const {
-    T ret = 0;
-    for (int i = 0; i < size; i++) {
-      ret += abs(data[i]);
-    }
-    return ret;
+    return array_kernels::sum<T>(
+        data.data(), data.data(), size,
+        [](const auto &x, const auto &) {
+          using std::abs;
+          return abs(x);
+        });
   }
 
   T sum() const {
-    T ret = 0;
-    for (int i = 0; i < size; i++) {
-      ret += data[i];
-    }
-    return ret;
+    return array_kernels::sum<T>(data.data(), data.data(), size,
+                                 [](const auto &x, const auto &) { return x; });
   }
 
   T min() const {
-    T ret = std::numeric_limits<T>::max();
-    for (int i = 0; i < size; i++) {
-      ret = std::min(ret, data[i]);
-    }
-    return ret;
+    return array_kernels::min(data.data(), size);
   }
 
   T max() const {
-    T ret = std::numeric_limits<T>::min();
-    for (int i = 0; i < size; i++) {
-      ret = std::max(ret, data[i]);
-    }
-    return ret;
+    return array_kernels::max(data.data(), size);
   }
 
   void print_abs_max_pos() const {
@@ -585,23 +700,9 @@ class ArrayND<3, T> {
     return sample(x, y, z);
   }
 
-  template <typename TT = T,
-            typename std::enable_if_t<!std::is_class<TT>::value, int> = 0>
-  T abs_max() const {
-    T ret(0);
-    for (int i = 0; i < size; i++) {
-      ret = std::max(ret, abs(data[i]));
-    }
-    return ret;
-  }
-
-  template <typename TT = T, typename TS = typename TT::ScalarType>
-  TS abs_max() const {
-    TS ret(0);
-    for (int i = 0; i < size; i++) {
-      ret = std::max(ret, data[i].abs().max());
-    }
-    return ret;
+  // Largest absolute value of the elements, or of their components
+  auto abs_max() const {
+    return array_kernels::abs_max(data.data(), size);
   }
 
   auto begin() const {
@@ -613,19 +714,19 @@ class ArrayND<3, T> {
   }
 
   TC_FORCE_INLINE T &operator[](const Vector3i &pos) {
-    return data[(pos.x * res[1] + pos.y) * res[2] + pos.z];
+    return data[offset(pos.x, pos.y, pos.z)];
   }
 
   TC_FORCE_INLINE const T &operator[](const Vector3i &pos) const {
-    return (*this)[pos.x][pos.y][pos.z];
+    return data[offset(pos.x, pos.y, pos.z)];
   }
 
   TC_FORCE_INLINE T &operator[](const Index3D &index) {
-    return (*this)[index.i][index.j][index.k];
+    return data[offset(index.i, index.j, index.k)];
   }
 
   TC_FORCE_INLINE const T &operator[](const Index3D &index) const {
-    return (*this)[index.i][index.j][index.k];
+    return data[offset(index.i, index.j, index.k)];
   }
 
   Vector3i get_res() const {
@@ -674,7 +775,7 @@ class ArrayND<3, T> {
         std::max(0, x - half_extent + 1), std::min(res[0], x + half_extent + 1),
         std::max(0, y - half_extent + 1), std::min(res[1], y + half_extent + 1),
         std::max(0, z - half_extent + 1), std::min(res[2], z + half_extent + 1),
-        storage_offset);
+        storage_offset, log_brick_size);
   }
 
   bool is_normal() const {
@@ -702,6 +803,9 @@ class ArrayND<3, T> {
 template <typename T>
 using Array3D = ArrayND<3, T>;
 
+template <typename T, int log_brick_size = 2>
+using BrickArray3D = ArrayND<3, T, BrickLayout<log_brick_size>>;
+
 template <typename T>
 void print(const Array3D<T> &arr) {
   arr.print("");
@@ -21,7 +21,20 @@ class RegionND;
 template <int dim>
 using TRegion = RegionND<dim>;
 
-template <int dim, typename T>
+// Storage order of the elements of ArrayND. The array is split into bricks of
+// 2^log_brick_size elements along each axis, which are stored one after
+// another in row-major order; the elements of a brick are row-major as well.
+// BrickLayout<0> is plain row-major storage.
+template <int log_brick_size_>
+struct BrickLayout {
+  static constexpr int log_brick_size = log_brick_size_;
+  static constexpr int brick_size = 1 << log_brick_size;
+  static constexpr int brick_mask = brick_size - 1;
+};
+
+using RowMajorLayout = BrickLayout<0>;
+
+template <int dim, typename T, typename Layout = RowMajorLayout>
 class ArrayND;
 
 template <typename T, int dim>
@@ -0,0 +1,338 @@
+/*******************************************************************************
+    Copyright (c) The Taichi Authors (2016- ). All Rights Reserved.
+    The use of this software is governed by the LICENSE file.
+*******************************************************************************/
+
+#pragma once
+
+#include <limits>
+#include <taichi/system/threading.h>
+#include "array_fwd.h"
+#include "linalg.h"
+
+TC_NAMESPACE_BEGIN
+
+// Parallel execution of the element-wise operations of ArrayND.
+//
+// Elements are split into chunks of array_chunk_size consecutive elements,
+// which are processed in parallel. Reductions combine the results of the
+// chunks in chunk order, so that they do not depend on the number of threads.
+// Arrays with a single chunk are processed on the calling thread.
+constexpr int array_chunk_size = 1 << 15;
+
+// Calls f(begin, end) for each chunk of [0, size)
+template <typename F>
+void parallel_for_chunks(int size, const F &f) {
+  int num_chunks = (size + array_chunk_size - 1) / array_chunk_size;
+  ThreadedTaskManager::run(num_chunks, -1, [&](int c) {
+    f(c * array_chunk_size, std::min(size, (c + 1) * array_chunk_size));
+  });
+}
+
+// Combines init and f(begin, end) of each chunk of [0, size), in order
+template <typename R, typename F, typename C>
+R parallel_reduce_chunks(int size,
+                         const R &init,
+                         const F &f,
+                         const C &combine) {
+  int num_chunks = (size + array_chunk_size - 1) / array_chunk_size;
+  std::vector<R> partial(num_chunks, init);
+  ThreadedTaskManager::run(num_chunks, -1, [&](int c) {
+    partial[c] =
+        f(c * array_chunk_size, std::min(size, (c + 1) * array_chunk_size));
+  });
+  R ret = init;
+  for (auto &p : partial) {
+    ret = combine(ret, p);
+  }
+  return ret;
+}
+
+// Calls f(ind) for each index of the region, in parallel over slabs along the
+// first axis. Slabs are aligned to the bricks the region iterates over, so
+// that each slab walks its part of a brick array in storage order.
+template <int dim, typename F>
+void parallel_for(const RegionND<dim> &region, const F &f) {
+  auto lower = region.get_lower(), upper = region.get_upper();
+  int b = 1 << region.get_log_brick_size();
+  int base = lower[0] & -b;
+  int num_slabs = (upper[0] - base + b - 1) / b;
+  ThreadedTaskManager::run(num_slabs, -1, [&](int s) {
+    auto slab_lower = lower, slab_upper = upper;
+    slab_lower[0] = std::max(lower[0], base + s * b);
+    slab_upper[0] = std::min(upper[0], base + (s + 1) * b);
+    for (auto &ind : RegionND<dim>(slab_lower, slab_upper,
+                                   region.get_storage_offset(),
+                                   region.get_log_brick_size())) {
+      f(ind);
+    }
+  });
+}
+
+// Four float32 lanes, held in an SSE register if the instruction set allows.
+// Only the operations used by the array kernels below are provided.
+template <InstSetExt ISE, class Enable = void>
+struct Float32x4 {
+  float32 d[4];
+
+  Float32x4() = default;
+
+  TC_FORCE_INLINE Float32x4(float32 x) {
+    for (int i = 0; i < 4; i++)
+      d[i] = x;
+  }
+
+  static TC_FORCE_INLINE Float32x4 load(const float32 *p) {
+    Float32x4 ret;
+    for (int i = 0; i < 4; i++)
+      ret.d[i] = p[i];
+    return ret;
+  }
+
+  TC_FORCE_INLINE void store(float32 *p) const {
+    for (int i = 0; i < 4; i++)
+      p[i] = d[i];
+  }
+
+  template <typename F>
+  static TC_FORCE_INLINE Float32x4 map(const Float32x4 &a,
+                                       const Float32x4 &b,
+                                       const F &f) {
+    Float32x4 ret;
+    for (int i = 0; i < 4; i++)
+      ret.d[i] = f(a.d[i], b.d[i]);
+    return ret;
+  }
+
+  friend TC_FORCE_INLINE Float32x4 operator+(const Float32x4 &a,
+                                             const Float32x4 &b) {
+    return map(a, b, [](float32 x, float32 y) { return x + y; });
+  }
+
+  friend TC_FORCE_INLINE Float32x4 operator-(const Float32x4 &a,
+                                             const Float32x4 &b) {
+    return map(a, b, [](float32 x, float32 y) { return x - y; });
+  }
+
+  friend TC_FORCE_INLINE Float32x4 operator*(const Float32x4 &a,
+                                             const Float32x4 &b) {
+    return map(a, b, [](float32 x, float32 y) { return x * y; });
+  }
+
+  friend TC_FORCE_INLINE Float32x4 min(const Float32x4 &a,
+                                       const Float32x4 &b) {
+    return map(a, b, [](float32 x, float32 y) { return std::min(x, y); });
+  }
+
+  friend TC_FORCE_INLINE Float32x4 max(const Float32x4 &a,
+                                       const Float32x4 &b) {
+    return map(a, b, [](float32 x, float32 y) { return std::max(x, y); });
+  }
+
+  friend TC_FORCE_INLINE Float32x4 abs(const Float32x4 &a) {
+    return map(a, a, [](float32 x, float32) { return std::abs(x); });
+  }
+};
+
+template <InstSetExt ISE>
+struct Float32x4<ISE, std::enable_if_t<(ISE >= InstSetExt::SSE)>> {
+  __m128 v;
+
+  Float32x4() = default;
+
+  TC_FORCE_INLINE Float32x4(__m128 v) : v(v) {
+  }
+
+  TC_FORCE_INLINE Float32x4(float32 x) : v(_mm_set1_ps(x)) {
+  }
+
+  static TC_FORCE_INLINE Float32x4 load(const float32 *p) {
+    return _mm_loadu_ps(p);
+  }
+
+  TC_FORCE_INLINE void store(float32 *p) const {
+    _mm_storeu_ps(p, v);
+  }
+
+  friend TC_FORCE_INLINE Float32x4 operator+(const Float32x4 &a,
+                                             const Float32x4 &b) {
+    return _mm_add_ps(a.v, b.v);
+  }
+
+  friend TC_FORCE_INLINE Float32x4 operator-(const Float32x4 &a,
+                                             const Float32x4 &b) {
+    return _mm_sub_ps(a.v, b.v);
+  }
+
+  friend TC_FORCE_INLINE Float32x4 operator*(const Float32x4 &a,
+                                             const Float32x4 &b) {
+    return _mm_mul_ps(a.v, b.v);
+  }
+
+  friend TC_FORCE_INLINE Float32x4 min(const Float32x4 &a,
+                                       const Float32x4 &b) {
+    return _mm_min_ps(a.v, b.v);
+  }
+
+  friend TC_FORCE_INLINE Float32x4 max(const Float32x4 &a,
+                                       const Float32x4 &b) {
+    return _mm_max_ps(a.v, b.v);
+  }
+
+  friend TC_FORCE_INLINE Float32x4 abs(const Float32x4 &a) {
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v);
+  }
+};
+
+namespace array_kernels {
+
+template <typename T>
+constexpr bool use_float32x4 = std::is_same<T, float32>::value;
+
+using Pack = Float32x4<default_instruction_set>;
+
+// o[i] = f(a[i]). For float32 elements f is also applied to Float32x4 packs,
+// so it has to be a generic lambda built from +, -, * and scalars.
+template <typename T, typename F>
+void map(T *o, const T *a, int size, const F &f) {
+  parallel_for_chunks(size, [&](int begin, int end) {
+    int i = begin;
+    if constexpr (use_float32x4<T>) {
+      for (; i + 4 <= end; i += 4) {
+        f(Pack::load(a + i)).store(o + i);
+      }
+    }
+    for (; i < end; i++) {
+      o[i] = f(a[i]);
+    }
+  });
+}
+
+// o[i] = f(a[i], b[i])
+template <typename T, typename F>
+void map(T *o, const T *a, const T *b, int size, const F &f) {
+  parallel_for_chunks(size, [&](int begin, int end) {
+    int i = begin;
+    if constexpr (use_float32x4<T>) {
+      for (; i + 4 <= end; i += 4) {
+        f(Pack::load(a + i), Pack::load(b + i)).store(o + i);
+      }
+    }
+    for (; i < end; i++) {
+      o[i] = f(a[i], b[i]);
+    }
+  });
+}
+
+// Sum of f(a[i], b[i]) in R, accumulated lane by lane for float32
+template <typename R, typename T, typename F>
+R sum(const T *a, const T *b, int size, const F &f) {
+  return parallel_reduce_chunks(
+      size, R(0),
+      [&](int begin, int end) {
+        R ret(0);
+        int i = begin;
+        if constexpr (use_float32x4<T> && std::is_same<R, float32>::value) {
+          Pack acc(0.0f);
+          for (; i + 4 <= end; i += 4) {
+            acc = acc + f(Pack::load(a + i), Pack::load(b + i));
+          }
+          float32 lanes[4];
+          acc.store(lanes);
+          ret = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        }
+        for (; i < end; i++) {
+          ret += f(a[i], b[i]);
+        }
+        return ret;
+      },
+      [](const R &x, const R &y) { return x + y; });
+}
+
+// Combination of a[i] with f, starting from init. f has to be associative and
+// commutative, e.g. min or max.
+template <typename T, typename F>
+T fold(const T *a, int size, const T &init, const F &f) {
+  return parallel_reduce_chunks(
+      size, init,
+      [&](int begin, int end) {
+        T ret = init;
+        int i = begin;
+        if constexpr (use_float32x4<T>) {
+          Pack acc(init);
+          for (; i + 4 <= end; i += 4) {
+            acc = f(acc, Pack::load(a + i));
+          }
+          float32 lanes[4];
+          acc.store(lanes);
+          ret = f(f(lanes[0], lanes[1]), f(lanes[2], lanes[3]));
+        }
+        for (; i < end; i++) {
+          ret = f(ret, a[i]);
+        }
+        return ret;
+      },
+      f);
+}
+
+template <typename T>
+T min(const T *a, int size) {
+  return fold(a, size, std::numeric_limits<T>::max(),
+              [](const auto &x, const auto &y) {
+                using std::min;
+                return min(x, y);
+              });
+}
+
+template <typename T>
+T max(const T *a, int size) {
+  return fold(a, size, std::numeric_limits<T>::lowest(),
+              [](const auto &x, const auto &y) {
+                using std::max;
+                return max(x, y);
+              });
+}
+
+// Largest absolute value of the elements, or of their components for vectors
+template <typename T>
+auto abs_max(const T *a, int size) {
+  if constexpr (std::is_class<T>::value) {
+    using S = typename T::ScalarType;
+    return parallel_reduce_chunks(
+        size, S(0),
+        [&](int begin, int end) {
+          S ret(0);
+          for (int i = begin; i < end; i++) {
+            ret = std::max(ret, a[i].abs().max());
+          }
+          return ret;
+        },
+        [](S x, S y) { return std::max(x, y); });
+  } else {
+    return parallel_reduce_chunks(
+        size, T(0),
+        [&](int begin, int end) {
+          T ret(0);
+          int i = begin;
+          if constexpr (use_float32x4<T>) {
+            Pack acc(0.0f);
+            for (; i + 4 <= end; i += 4) {
+              acc = max(acc, abs(Pack::load(a + i)));
+            }
+            float32 lanes[4];
+            acc.store(lanes);
+            ret = std::max(std::max(lanes[0], lanes[1]),
+                           std::max(lanes[2], lanes[3]));
+          }
+          for (; i < end; i++) {
+            ret = std::max(ret, T(std::abs(a[i])));
+          }
+          return ret;
+        },
+        [](T x, T y) { return std::max(x, y); });
+  }
+}
+
+}  // namespace array_kernels
+
+TC_NAMESPACE_END
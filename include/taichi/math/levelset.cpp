@@ -3,6 +3,8 @@
     The use of this software is governed by the LICENSE file.
 *******************************************************************************/
 
+#include <atomic>
+#include <taichi/system/threading.h>
 #include "levelset.h"
 
 TC_NAMESPACE_BEGIN
@@ -290,6 +292,246 @@ Vector3 LevelSet<3>::get_gradient(const Vector3 &pos) const {
   return Vector3(gx, gy, gz);
 }
 
+namespace {
+
+// Godunov upwind solution of |grad u| = 1 (unit spacing), given the smaller
+// neighbor of the cell along each axis
+TC_FORCE_INLINE real solve_eikonal(real a, real b, real c) {
+  if (a > b)
+    std::swap(a, b);
+  if (b > c)
+    std::swap(b, c);
+  if (a > b)
+    std::swap(a, b);
+  real u = a + 1;
+  if (u > b) {
+    u = 0.5_f * (a + b + std::sqrt(2 - (a - b) * (a - b)));
+    if (u > c) {
+      real s = a + b + c;
+      real d = s * s - 3 * (a * a + b * b + c * c - 1);
+      u = (s + std::sqrt(std::max(d, 0.0_f))) / 3;
+    }
+  }
+  return u;
+}
+
+// Fast sweeping on a 2D or 3D grid stored as res[0] x res[1] x res[2]
+// (res[2] = 1 in 2D). Each sweep visits the grid in one of the 2^dim
+// diagonal orders. The grid is split into tiles that are swept while in
+// cache; tiles on the same diagonal hyperplane never share a face, so each
+// hyperplane is processed in parallel while the sweep order is respected.
+// Tiles are skipped unless they or a neighbor changed since they were last
+// visited, which limits the work to the band around the interface and ends
+// the sweeps once a sweep changes nothing.
+class FastSweeping {
+ public:
+  // Changes smaller than this (relative to the distance) do not trigger
+  // further sweeps
+  static constexpr real tolerance = 1e-4_f;
+
+  FastSweeping(real *phi, const Vector3i &res, int dim, real band)
+      : phi(phi), res(res), dim(dim), band(band) {
+    stride = Vector3i(res[1] * res[2], res[2], 1);
+    tile = dim == 3 ? Vector3i(8) : Vector3i(32, 32, 1);
+    for (int i = 0; i < 3; i++) {
+      num_tiles[i] = (res[i] + tile[i] - 1) / tile[i];
+    }
+  }
+
+  void run() {
+    int64 n = (int64)res[0] * res[1] * res[2];
+    int total_tiles = num_tiles[0] * num_tiles[1] * num_tiles[2];
+    dist.resize(n);
+    fixed.resize(n);
+    // Visits are stamped with (sweep, hyperplane) in increasing order
+    last_changed.assign(total_tiles, -2);
+    last_visited.assign(total_tiles, -1);
+    // Cells next to the interface are fixed at the distance estimated from
+    // linear interpolation of phi; tiles holding them start the sweeps.
+    ThreadedTaskManager::run(total_tiles, -1, [&](int t) {
+      for_each_cell(t, 0, [&](int i, int j, int k) {
+        auto c = index(i, j, k);
+        real d = interface_distance(i, j, k);
+        fixed[c] = d < band;
+        dist[c] = std::min(d, band);
+        if (fixed[c])
+          last_changed[t] = 0;
+      });
+    });
+
+    int num_levels = num_tiles[0] + num_tiles[1] + num_tiles[2] - 2;
+    std::vector<std::vector<int>> levels(num_levels);
+    int64 stamp = 0;
+    for (int sweep = 0;; sweep++) {
+      int order = sweep % (1 << dim);
+      for (auto &level : levels) {
+        level.clear();
+      }
+      for (int t = 0; t < total_tiles; t++) {
+        auto c = tile_coord(t);
+        int l = 0;
+        for (int a = 0; a < 3; a++) {
+          l += (order >> a & 1) ? num_tiles[a] - 1 - c[a] : c[a];
+        }
+        levels[l].push_back(t);
+      }
+      std::atomic<bool> changed(false);
+      for (auto &level : levels) {
+        stamp++;
+        ThreadedTaskManager::run((int)level.size(), -1, [&](int p) {
+          int t = level[p];
+          if (!needs_visit(t))
+            return;
+          last_visited[t] = stamp;
+          if (sweep_tile(t, order)) {
+            last_changed[t] = stamp;
+            changed = true;
+          }
+        });
+      }
+      if (!changed)
+        break;
+    }
+
+    ThreadedTaskManager::run(res[0], -1, [&](int i) {
+      for (int64 c = index(i, 0, 0); c < index(i + 1, 0, 0); c++) {
+        phi[c] = phi[c] < 0 ? -dist[c] : dist[c];
+      }
+    });
+  }
+
+ private:
+  real *phi;
+  Vector3i res, stride, tile, num_tiles;
+  int dim;
+  real band;
+  std::vector<real> dist;
+  std::vector<uint8> fixed;
+  std::vector<int64> last_changed, last_visited;
+
+  TC_FORCE_INLINE int64 index(int i, int j, int k) const {
+    return (int64)i * stride[0] + j * stride[1] + k;
+  }
+
+  Vector3i tile_coord(int t) const {
+    return Vector3i(t / (num_tiles[1] * num_tiles[2]),
+                    t / num_tiles[2] % num_tiles[1], t % num_tiles[2]);
+  }
+
+  // Whether the tile changed during its last visit, or a neighbor changed
+  // after it
+  bool needs_visit(int t) const {
+    if (last_changed[t] >= last_visited[t])
+      return true;
+    auto coord = tile_coord(t);
+    for (int a = 0; a < 3; a++) {
+      int step = a == 0 ? num_tiles[1] * num_tiles[2]
+                        : (a == 1 ? num_tiles[2] : 1);
+      if (coord[a] > 0 && last_changed[t - step] > last_visited[t])
+        return true;
+      if (coord[a] < num_tiles[a] - 1 &&
+          last_changed[t + step] > last_visited[t])
+        return true;
+    }
+    return false;
+  }
+
+  // Visits the cells of tile t in the sweep order given by the bits of order
+  template <typename F>
+  void for_each_cell(int t, int order, const F &f) const {
+    auto begin = tile_coord(t) * tile;
+    Vector3i size;
+    for (int a = 0; a < 3; a++) {
+      size[a] = std::min(tile[a], res[a] - begin[a]);
+    }
+    for (int ii = 0; ii < size[0]; ii++) {
+      int i = begin[0] + (order & 1 ? size[0] - 1 - ii : ii);
+      for (int jj = 0; jj < size[1]; jj++) {
+        int j = begin[1] + (order & 2 ? size[1] - 1 - jj : jj);
+        for (int kk = 0; kk < size[2]; kk++) {
+          int k = begin[2] + (order & 4 ? size[2] - 1 - kk : kk);
+          f(i, j, k);
+        }
+      }
+    }
+  }
+
+  // Distance to the interface for cells whose neighbors have the opposite
+  // sign, infinity otherwise
+  real interface_distance(int i, int j, int k) const {
+    Vector3i coord(i, j, k);
+    auto c = index(i, j, k);
+    real p = phi[c];
+    real inv2 = 0;
+    bool interface = false;
+    for (int a = 0; a < dim; a++) {
+      real theta = std::numeric_limits<real>::infinity();
+      for (int s = -1; s <= 1; s += 2) {
+        int x = coord[a] + s;
+        if (x < 0 || x >= res[a])
+          continue;
+        real q = phi[c + s * stride[a]];
+        if ((q < 0) != (p < 0)) {
+          theta = std::min(theta, p / (p - q));
+        }
+      }
+      if (theta == 0) {
+        return 0;
+      }
+      if (theta <= 1) {
+        inv2 += 1 / (theta * theta);
+        interface = true;
+      }
+    }
+    return interface ? 1 / std::sqrt(inv2)
+                     : std::numeric_limits<real>::infinity();
+  }
+
+  // Returns if any cell changed by more than the tolerance
+  bool sweep_tile(int t, int order) {
+    bool changed = false;
+    for_each_cell(t, order, [&](int i, int j, int k) {
+      auto c = index(i, j, k);
+      if (fixed[c])
+        return;
+      int coord[3] = {i, j, k};
+      real a[3];
+      for (int d = 0; d < 3; d++) {
+        a[d] = std::numeric_limits<real>::infinity();
+        if (d >= dim)
+          continue;
+        if (coord[d] > 0)
+          a[d] = dist[c - stride[d]];
+        if (coord[d] < res[d] - 1)
+          a[d] = std::min(a[d], dist[c + stride[d]]);
+      }
+      real u = solve_eikonal(a[0], a[1], a[2]);
+      if (u < dist[c]) {
+        changed |= dist[c] - u > tolerance * (1 + u);
+        dist[c] = u;
+      }
+    });
+    return changed;
+  }
+};
+
+}  // namespace
+
+template <int DIM>
+void redistance(ArrayND<DIM, real> &phi, real band) {
+  if (phi.get_size() == 0)
+    return;
+  Vector3i res(1);
+  for (int i = 0; i < DIM; i++) {
+    res[i] = phi.get_res()[i];
+  }
+  FastSweeping(&phi.data[0], res, DIM, band).run();
+}
+
+template void redistance<2>(ArrayND<2, real> &phi, real band);
+
+template void redistance<3>(ArrayND<3, real> &phi, real band);
+
 template class LevelSet<2>;
 
 template class LevelSet<3>;
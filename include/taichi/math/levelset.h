@@ -12,6 +12,12 @@
 
 TC_NAMESPACE_BEGIN
 
+// Rebuilds phi as the signed distance (in cells) to its zero isocontour, by
+// parallel fast sweeping. Distances are clamped to band, and only tiles
+// within band of the interface are swept.
+template <int DIM>
+void redistance(ArrayND<DIM, real> &phi, real band);
+
 // Rasterized level set
 template <int DIM>
 class LevelSet : public ArrayND<DIM, real> {
@@ -61,6 +67,10 @@ class LevelSet : public ArrayND<DIM, real> {
 
   void global_increase(real delta);
 
+  void redistance(real band = INF) {
+    taichi::redistance<DIM>(*this, band);
+  }
+
   Vector get_gradient(const Vector &pos) const;  // Note this is not normalized!
 
   Vector get_normalized_gradient(const Vector &pos) const;
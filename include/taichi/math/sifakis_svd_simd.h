@@ -0,0 +1,419 @@
+/*******************************************************************************
+    Copyright (c) The Taichi Authors (2016- ). All Rights Reserved.
+    The use of this software is governed by the LICENSE file.
+*******************************************************************************/
+
+// Lane-parallel version of the branch-free 3x3 SVD in sifakis_svd.h, written
+// once against a small "lanes" interface (float lanes, masks, select, rsqrt)
+// and instantiated for scalar, AVX2 (8 lanes) and AVX-512 (16 lanes) code.
+//
+// Each ISA instantiation lives in its own translation unit compiled with the
+// corresponding ISA flags (see svd_avx2.cpp, svd_avx512.cpp); svd.cpp
+// dispatches at runtime.
+//
+// This header must not include other headers with inline functions: those
+// would be emitted with AVX2/AVX-512 code by the ISA translation units, and
+// the linker may keep these copies for the whole program.
+
+#pragma once
+
+#include <immintrin.h>
+
+#ifdef _WIN64
+#define SVD_FORCE_INLINE __forceinline
+#else
+#define SVD_FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
+namespace SifakisSVD {
+
+constexpr float Tiny_Number = 1.e-20f;
+
+struct ScalarLanes {
+  using F = float;
+  using Mask = bool;
+  static constexpr int width = 1;
+
+  static SVD_FORCE_INLINE F load(const float *p) {
+    return *p;
+  }
+
+  static SVD_FORCE_INLINE void store(float *p, F v) {
+    *p = v;
+  }
+
+  static SVD_FORCE_INLINE F select(Mask m, F a, F b) {
+    return m ? a : b;
+  }
+
+  static SVD_FORCE_INLINE F rsqrt(F x) {
+    return 1.0f / _mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(x)));
+  }
+};
+
+#if defined(__AVX2__)
+struct AVX2Float {
+  __m256 v;
+
+  AVX2Float() = default;
+
+  SVD_FORCE_INLINE AVX2Float(__m256 v) : v(v) {
+  }
+
+  SVD_FORCE_INLINE AVX2Float(float x) : v(_mm256_set1_ps(x)) {
+  }
+
+  SVD_FORCE_INLINE AVX2Float operator+(AVX2Float o) const {
+    return _mm256_add_ps(v, o.v);
+  }
+
+  SVD_FORCE_INLINE AVX2Float operator-(AVX2Float o) const {
+    return _mm256_sub_ps(v, o.v);
+  }
+
+  SVD_FORCE_INLINE AVX2Float operator*(AVX2Float o) const {
+    return _mm256_mul_ps(v, o.v);
+  }
+
+  SVD_FORCE_INLINE AVX2Float operator-() const {
+    return _mm256_xor_ps(v, _mm256_set1_ps(-0.0f));
+  }
+
+  SVD_FORCE_INLINE __m256 operator<(AVX2Float o) const {
+    return _mm256_cmp_ps(v, o.v, _CMP_LT_OQ);
+  }
+
+  SVD_FORCE_INLINE __m256 operator<=(AVX2Float o) const {
+    return _mm256_cmp_ps(v, o.v, _CMP_LE_OQ);
+  }
+};
+
+struct AVX2Lanes {
+  using F = AVX2Float;
+  using Mask = __m256;
+  static constexpr int width = 8;
+
+  static SVD_FORCE_INLINE F load(const float *p) {
+    return _mm256_loadu_ps(p);
+  }
+
+  static SVD_FORCE_INLINE void store(float *p, F v) {
+    _mm256_storeu_ps(p, v.v);
+  }
+
+  static SVD_FORCE_INLINE F select(Mask m, F a, F b) {
+    return _mm256_blendv_ps(b.v, a.v, m);
+  }
+
+  // 12-bit estimate refined with one Newton iteration
+  static SVD_FORCE_INLINE F rsqrt(F x) {
+    F y = _mm256_rsqrt_ps(x.v);
+    return y * (F(1.5f) - F(0.5f) * x * y * y);
+  }
+};
+#endif
+
+#if defined(__AVX512F__)
+struct AVX512Float {
+  __m512 v;
+
+  AVX512Float() = default;
+
+  SVD_FORCE_INLINE AVX512Float(__m512 v) : v(v) {
+  }
+
+  SVD_FORCE_INLINE AVX512Float(float x) : v(_mm512_set1_ps(x)) {
+  }
+
+  SVD_FORCE_INLINE AVX512Float operator+(AVX512Float o) const {
+    return _mm512_add_ps(v, o.v);
+  }
+
+  SVD_FORCE_INLINE AVX512Float operator-(AVX512Float o) const {
+    return _mm512_sub_ps(v, o.v);
+  }
+
+  SVD_FORCE_INLINE AVX512Float operator*(AVX512Float o) const {
+    return _mm512_mul_ps(v, o.v);
+  }
+
+  SVD_FORCE_INLINE AVX512Float operator-() const {
+    return _mm512_sub_ps(_mm512_setzero_ps(), v);
+  }
+
+  SVD_FORCE_INLINE __mmask16 operator<(AVX512Float o) const {
+    return _mm512_cmp_ps_mask(v, o.v, _CMP_LT_OQ);
+  }
+
+  SVD_FORCE_INLINE __mmask16 operator<=(AVX512Float o) const {
+    return _mm512_cmp_ps_mask(v, o.v, _CMP_LE_OQ);
+  }
+};
+
+struct AVX512Lanes {
+  using F = AVX512Float;
+  using Mask = __mmask16;
+  static constexpr int width = 16;
+
+  static SVD_FORCE_INLINE F load(const float *p) {
+    return _mm512_loadu_ps(p);
+  }
+
+  static SVD_FORCE_INLINE void store(float *p, F v) {
+    _mm512_storeu_ps(p, v.v);
+  }
+
+  static SVD_FORCE_INLINE F select(Mask m, F a, F b) {
+    return _mm512_mask_blend_ps(m, b.v, a.v);
+  }
+
+  // 14-bit estimate refined with one Newton iteration
+  static SVD_FORCE_INLINE F rsqrt(F x) {
+    F y = _mm512_rsqrt14_ps(x.v);
+    return y * (F(1.5f) - F(0.5f) * x * y * y);
+  }
+};
+#endif
+
+// One Jacobi conjugation of the symmetric matrix s in the (p, q) plane with
+// an approximate Givens rotation, accumulated into v
+template <typename L, int p, int q>
+SVD_FORCE_INLINE void jacobi_conjugation(typename L::F s[3][3],
+                                        typename L::F v[3][3]) {
+  using F = typename L::F;
+  constexpr float Four_Gamma_Squared = 5.82842712474619f;
+  constexpr float Sine_Pi_Over_Eight = 0.3826834323650897f;
+  constexpr float Cosine_Pi_Over_Eight = 0.9238795325112867f;
+
+  // half-angle sine and cosine, unnormalized
+  F ch = s[p][p] - s[q][q];
+  F sh = F(0.5f) * s[p][q];
+  auto significant = F(Tiny_Number) <= sh * sh;
+  sh = L::select(significant, sh, F(0.0f));
+  ch = L::select(significant, ch, F(1.0f));
+  F w = L::rsqrt(ch * ch + sh * sh);
+  sh = sh * w;
+  ch = ch * w;
+  // limit the rotation to pi / 4 to guarantee convergence
+  auto large_angle = ch * ch <= F(Four_Gamma_Squared) * sh * sh;
+  sh = L::select(large_angle, F(Sine_Pi_Over_Eight), sh);
+  ch = L::select(large_angle, F(Cosine_Pi_Over_Eight), ch);
+  F c = ch * ch - sh * sh;
+  F sn = F(2.0f) * ch * sh;
+
+  // s = Q^T s Q, v = v Q with Q = [[c, -sn], [sn, c]] in the (p, q) plane
+  for (int i = 0; i < 3; i++) {
+    F sp = s[i][p], sq = s[i][q];
+    s[i][p] = c * sp + sn * sq;
+    s[i][q] = c * sq - sn * sp;
+    F vp = v[i][p], vq = v[i][q];
+    v[i][p] = c * vp + sn * vq;
+    v[i][q] = c * vq - sn * vp;
+  }
+  for (int j = 0; j < 3; j++) {
+    F sp = s[p][j], sq = s[q][j];
+    s[p][j] = c * sp + sn * sq;
+    s[q][j] = c * sq - sn * sp;
+  }
+}
+
+// Swap columns i and j of b and v (negating one to preserve the orientation
+// of v) where the norm of column i is smaller
+template <typename L, int i, int j>
+SVD_FORCE_INLINE void sort_columns(typename L::F b[3][3],
+                                  typename L::F v[3][3],
+                                  typename L::F rho[3]) {
+  using F = typename L::F;
+  auto swap = rho[i] < rho[j];
+  for (int r = 0; r < 3; r++) {
+    F bi = b[r][i], bj = b[r][j];
+    b[r][i] = L::select(swap, bj, bi);
+    b[r][j] = L::select(swap, -bi, bj);
+    F vi = v[r][i], vj = v[r][j];
+    v[r][i] = L::select(swap, vj, vi);
+    v[r][j] = L::select(swap, -vi, vj);
+  }
+  F ri = rho[i], rj = rho[j];
+  rho[i] = L::select(swap, rj, ri);
+  rho[j] = L::select(swap, ri, rj);
+}
+
+// Givens rotation on rows (p, q) of b zeroing b[q][k], accumulated into u
+template <typename L, int p, int q, int k>
+SVD_FORCE_INLINE void givens_qr(typename L::F b[3][3], typename L::F u[3][3]) {
+  using F = typename L::F;
+  F a1 = b[p][k], a2 = b[q][k];
+  F r2 = a1 * a1 + a2 * a2;
+  auto significant = F(Tiny_Number) <= r2;
+  F w = L::rsqrt(L::select(significant, r2, F(1.0f)));
+  F c = L::select(significant, a1 * w, F(1.0f));
+  F sn = L::select(significant, a2 * w, F(0.0f));
+  for (int j = 0; j < 3; j++) {
+    F bp = b[p][j], bq = b[q][j];
+    b[p][j] = c * bp + sn * bq;
+    b[q][j] = c * bq - sn * bp;
+    F up = u[j][p], uq = u[j][q];
+    u[j][p] = c * up + sn * uq;
+    u[j][q] = c * uq - sn * up;
+  }
+}
+
+// a = u diag(sigma) v^T with rotations u, v (det = +1) and
+// sigma1 >= sigma2 >= |sigma3|. Like taichi::svd_rot, sigma3 is negative when
+// det(a) < 0.
+template <typename L, int sweeps = 5>
+SVD_FORCE_INLINE void svd_lanes(const typename L::F a[3][3],
+                               typename L::F u[3][3],
+                               typename L::F sigma[3],
+                               typename L::F v[3][3]) {
+  using F = typename L::F;
+  // s = a^T a
+  F s[3][3];
+  for (int i = 0; i < 3; i++) {
+    for (int j = i; j < 3; j++) {
+      s[i][j] = a[0][i] * a[0][j] + a[1][i] * a[1][j] + a[2][i] * a[2][j];
+      s[j][i] = s[i][j];
+    }
+  }
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      v[i][j] = F(i == j ? 1.0f : 0.0f);
+      u[i][j] = F(i == j ? 1.0f : 0.0f);
+    }
+  }
+  for (int sweep = 0; sweep < sweeps; sweep++) {
+    jacobi_conjugation<L, 0, 1>(s, v);
+    jacobi_conjugation<L, 1, 2>(s, v);
+    jacobi_conjugation<L, 0, 2>(s, v);
+  }
+
+  // b = a v
+  F b[3][3], rho[3];
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      b[i][j] = a[i][0] * v[0][j] + a[i][1] * v[1][j] + a[i][2] * v[2][j];
+    }
+  }
+  for (int j = 0; j < 3; j++) {
+    rho[j] = b[0][j] * b[0][j] + b[1][j] * b[1][j] + b[2][j] * b[2][j];
+  }
+  sort_columns<L, 0, 1>(b, v, rho);
+  sort_columns<L, 0, 2>(b, v, rho);
+  sort_columns<L, 1, 2>(b, v, rho);
+
+  // b = u r
+  givens_qr<L, 0, 1, 0>(b, u);
+  givens_qr<L, 0, 2, 0>(b, u);
+  givens_qr<L, 1, 2, 1>(b, u);
+
+  // The QR rotations leave b[0][0], b[1][1] >= 0 unless a column is
+  // (numerically) zero. Any sign flip of the first two columns of u is paired
+  // with one of the third, so that u stays a rotation.
+  F parity(1.0f);
+  for (int i = 0; i < 2; i++) {
+    F sign = L::select(b[i][i] < F(0.0f), F(-1.0f), F(1.0f));
+    sigma[i] = sign * b[i][i];
+    parity = parity * sign;
+    for (int j = 0; j < 3; j++) {
+      u[j][i] = sign * u[j][i];
+    }
+  }
+  sigma[2] = parity * b[2][2];
+  for (int j = 0; j < 3; j++) {
+    u[j][2] = parity * u[j][2];
+  }
+}
+
+// a = r s with r = u v^T and s = v diag(sigma) v^T
+template <typename L>
+SVD_FORCE_INLINE void polar_decomp_lanes(const typename L::F a[3][3],
+                                        typename L::F r[3][3],
+                                        typename L::F s[3][3]) {
+  using F = typename L::F;
+  F u[3][3], sigma[3], v[3][3];
+  svd_lanes<L>(a, u, sigma, v);
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      r[i][j] = u[i][0] * v[j][0] + u[i][1] * v[j][1] + u[i][2] * v[j][2];
+      s[i][j] = v[i][0] * sigma[0] * v[j][0] + v[i][1] * sigma[1] * v[j][1] +
+                v[i][2] * sigma[2] * v[j][2];
+    }
+  }
+}
+
+// Structure-of-arrays batches: entry (i, j) of matrix k is m[i * 3 + j][k].
+// Both process matrices [begin, end) in groups of L::width and return the
+// index of the first matrix not processed (at most L::width - 1 remain).
+template <typename L>
+int svd_batch(int begin,
+              int end,
+              const float *const a[9],
+              float *const u[9],
+              float *const sigma[3],
+              float *const v[9]) {
+  using F = typename L::F;
+  int k = begin;
+  for (; k + L::width <= end; k += L::width) {
+    F a_[3][3], u_[3][3], sigma_[3], v_[3][3];
+    for (int i = 0; i < 9; i++)
+      a_[i / 3][i % 3] = L::load(a[i] + k);
+    svd_lanes<L>(a_, u_, sigma_, v_);
+    for (int i = 0; i < 9; i++) {
+      L::store(u[i] + k, u_[i / 3][i % 3]);
+      L::store(v[i] + k, v_[i / 3][i % 3]);
+    }
+    for (int i = 0; i < 3; i++)
+      L::store(sigma[i] + k, sigma_[i]);
+  }
+  return k;
+}
+
+template <typename L>
+int polar_decomp_batch(int begin,
+                       int end,
+                       const float *const a[9],
+                       float *const r[9],
+                       float *const s[9]) {
+  using F = typename L::F;
+  int k = begin;
+  for (; k + L::width <= end; k += L::width) {
+    F a_[3][3], r_[3][3], s_[3][3];
+    for (int i = 0; i < 9; i++)
+      a_[i / 3][i % 3] = L::load(a[i] + k);
+    polar_decomp_lanes<L>(a_, r_, s_);
+    for (int i = 0; i < 9; i++) {
+      L::store(r[i] + k, r_[i / 3][i % 3]);
+      L::store(s[i] + k, s_[i / 3][i % 3]);
+    }
+  }
+  return k;
+}
+
+// Defined in svd_avx2.cpp and svd_avx512.cpp
+int svd_batch_avx2(int begin,
+                   int end,
+                   const float *const a[9],
+                   float *const u[9],
+                   float *const sigma[3],
+                   float *const v[9]);
+
+int svd_batch_avx512(int begin,
+                     int end,
+                     const float *const a[9],
+                     float *const u[9],
+                     float *const sigma[3],
+                     float *const v[9]);
+
+int polar_decomp_batch_avx2(int begin,
+                            int end,
+                            const float *const a[9],
+                            float *const r[9],
+                            float *const s[9]);
+
+int polar_decomp_batch_avx512(int begin,
+                              int end,
+                              const float *const a[9],
+                              float *const r[9],
+                              float *const s[9]);
+
+}  // namespace SifakisSVD
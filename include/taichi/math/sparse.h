@@ -5,63 +5,422 @@
 
 #pragma once
 
+#include <algorithm>
+#include <numeric>
+#include <taichi/system/threading.h>
 #include "math.h"
 #include "array_1d.h"
 
 TC_NAMESPACE_BEGIN
 
-class SparseMatrix {
- private:
-  struct Entry {
-    int j;
-    real val;
+template <typename T>
+struct SparseTriplet {
+  int i, j;
+  T val;
+
+  SparseTriplet() {
+  }
+
+  SparseTriplet(int i, int j, const T &val) : i(i), j(j), val(val) {
+  }
+
+  TC_IO_DECL {
+    TC_IO(i, j, val);
+  }
+};
+
+// Assembles (i, j, val) triplets into compressed sparse rows, summing entries
+// with the same (i, j). Triplets are bucketed by row with a counting sort,
+// then each row is sorted by column and reduced in parallel.
+template <typename T>
+void compress_triplets(int rows,
+                       const std::vector<SparseTriplet<T>> &triplets,
+                       std::vector<int> &row_offsets,
+                       std::vector<int> &col_indices,
+                       std::vector<T> &values,
+                       int num_threads = -1) {
+  std::vector<int> bucket_offsets(rows + 1, 0);
+  for (auto &t : triplets) {
+    TC_ASSERT(0 <= t.i && t.i < rows);
+    bucket_offsets[t.i + 1]++;
+  }
+  std::partial_sum(bucket_offsets.begin(), bucket_offsets.end(),
+                   bucket_offsets.begin());
 
-    Entry() {
+  // (column, triplet index) pairs. Sorting them also keeps the summation order
+  // of duplicated entries deterministic.
+  std::vector<std::pair<int, int>> buckets(triplets.size());
+  std::vector<int> head(bucket_offsets.begin(), bucket_offsets.end() - 1);
+  for (int k = 0; k < (int)triplets.size(); k++) {
+    buckets[head[triplets[k].i]++] = std::make_pair(triplets[k].j, k);
+  }
+
+  std::vector<int> row_nnz(rows);
+  ThreadedTaskManager::run(rows, num_threads, [&](int i) {
+    auto begin = buckets.begin() + bucket_offsets[i];
+    auto end = buckets.begin() + bucket_offsets[i + 1];
+    std::sort(begin, end);
+    int unique = 0;
+    for (auto it = begin; it != end; ++it) {
+      if (it == begin || (it - 1)->first != it->first)
+        unique++;
     }
+    row_nnz[i] = unique;
+  });
+
+  row_offsets.resize(rows + 1);
+  row_offsets[0] = 0;
+  std::partial_sum(row_nnz.begin(), row_nnz.end(), row_offsets.begin() + 1);
+  col_indices.resize(row_offsets[rows]);
+  values.resize(row_offsets[rows]);
 
-    Entry(int j, real val) : j(j), val(val) {
+  ThreadedTaskManager::run(rows, num_threads, [&](int i) {
+    int out = row_offsets[i] - 1;
+    for (int k = bucket_offsets[i]; k < bucket_offsets[i + 1]; k++) {
+      auto &entry = buckets[k];
+      if (k == bucket_offsets[i] || buckets[k - 1].first != entry.first) {
+        out++;
+        col_indices[out] = entry.first;
+        values[out] = triplets[entry.second].val;
+      } else {
+        values[out] += triplets[entry.second].val;
+      }
     }
-  };
+  });
+}
 
-  // TODO: This is slow... make some low-level optimizations here...
-  std::vector<std::vector<Entry>> entries;
+// Compressed sparse row (CSR) matrix.
+// Entries are inserted as triplets (duplicates are summed) and compressed
+// into CSR on compress() or on the first operation that needs it.
+class SparseMatrix {
+ public:
+  using Vector = Array1D<real>;
+
+ private:
+  int rows, cols;
+  std::vector<SparseTriplet<real>> triplets;
+  std::vector<int> row_offsets;
+  std::vector<int> col_indices;
+  std::vector<real> values;
 
-  int n;
+  // Rows are processed in batches to amortize the scheduling overhead
+  static constexpr int rows_per_task = 256;
 
  public:
-  SparseMatrix(int n) : n(n) {
-    entries.resize(n);
+  int num_threads;
+
+  SparseMatrix(int n) : SparseMatrix(n, n) {
   }
 
-  SparseMatrix() {
+  SparseMatrix(int rows, int cols) : rows(rows), cols(cols) {
+    row_offsets.resize(rows + 1, 0);
+    num_threads = -1;
+  }
+
+  SparseMatrix() : SparseMatrix(0) {
+  }
+
+  int get_rows() const {
+    return rows;
+  }
+
+  int get_cols() const {
+    return cols;
   }
 
   void insert(int i, int j, real value) {
-    for (int k = 0; k < (int)entries[i].size(); k++) {
-      if (entries[i][k].j == j) {
-        entries[i][k].val += value;
-        return;
+    TC_ASSERT(0 <= j && j < cols);
+    triplets.push_back(SparseTriplet<real>(i, j, value));
+  }
+
+  void clear() {
+    triplets.clear();
+    std::fill(row_offsets.begin(), row_offsets.end(), 0);
+    col_indices.clear();
+    values.clear();
+  }
+
+  // Merge pending triplets into the compressed rows
+  void compress() {
+    if (triplets.empty())
+      return;
+    for (int i = 0; i < rows; i++) {
+      for (int k = row_offsets[i]; k < row_offsets[i + 1]; k++) {
+        triplets.push_back(SparseTriplet<real>(i, col_indices[k], values[k]));
+      }
+    }
+    compress_triplets(rows, triplets, row_offsets, col_indices, values,
+                      num_threads);
+    triplets.clear();
+  }
+
+  int num_nonzeros() {
+    compress();
+    return (int)values.size();
+  }
+
+  real get(int i, int j) {
+    compress();
+    auto begin = col_indices.begin() + row_offsets[i];
+    auto end = col_indices.begin() + row_offsets[i + 1];
+    auto it = std::lower_bound(begin, end, j);
+    if (it != end && *it == j)
+      return values[it - col_indices.begin()];
+    return 0;
+  }
+
+  // y = A x
+  void multiply(const Vector &x, Vector &y) {
+    compress();
+    TC_ASSERT(x.size == cols);
+    TC_ASSERT(y.size == rows);
+    const int *offsets = row_offsets.data();
+    const int *indices = col_indices.data();
+    const real *vals = values.data();
+    const real *x_data = x.data.data();
+    real *y_data = y.data.data();
+    int num_tasks = (rows + rows_per_task - 1) / rows_per_task;
+    ThreadedTaskManager::run(num_tasks, num_threads, [&](int t) {
+      int row_end = std::min(rows, (t + 1) * rows_per_task);
+      for (int i = t * rows_per_task; i < row_end; i++) {
+        int k = offsets[i], end = offsets[i + 1];
+        // independent accumulators hide the latency of the gathers
+        real sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+        for (; k + 4 <= end; k += 4) {
+          sum0 += vals[k] * x_data[indices[k]];
+          sum1 += vals[k + 1] * x_data[indices[k + 1]];
+          sum2 += vals[k + 2] * x_data[indices[k + 2]];
+          sum3 += vals[k + 3] * x_data[indices[k + 3]];
+        }
+        for (; k < end; k++) {
+          sum0 += vals[k] * x_data[indices[k]];
+        }
+        y_data[i] = (sum0 + sum1) + (sum2 + sum3);
       }
+    });
+  }
+
+  Vector multiply(const Vector &x) {
+    Vector y(rows);
+    multiply(x, y);
+    return y;
+  }
+
+  Vector diagonal() {
+    compress();
+    Vector diag(std::min(rows, cols));
+    for (int i = 0; i < diag.size; i++) {
+      diag[i] = get(i, i);
     }
-    entries[i].push_back(Entry(j, value));
+    return diag;
+  }
+
+  TC_IO_DECL {
+    TC_IO(rows, cols, triplets, row_offsets, col_indices, values);
+  }
+};
+
+// Block compressed sparse row (BSR) matrix with dense dim x dim blocks, e.g.
+// for the 3x3 blocks of elasticity stiffness matrices. Vectors are flat, with
+// dim consecutive entries per block row.
+template <int dim>
+class BlockSparseMatrix {
+ public:
+  using Block = MatrixND<dim, real>;
+  using Vector = Array1D<real>;
+
+ private:
+  int block_rows, block_cols;
+  std::vector<SparseTriplet<Block>> triplets;
+  std::vector<int> row_offsets;
+  std::vector<int> col_indices;
+  std::vector<Block> blocks;
+
+  static constexpr int rows_per_task = 64;
+
+ public:
+  int num_threads;
+
+  BlockSparseMatrix(int n) : BlockSparseMatrix(n, n) {
+  }
+
+  BlockSparseMatrix(int block_rows, int block_cols)
+      : block_rows(block_rows), block_cols(block_cols) {
+    row_offsets.resize(block_rows + 1, 0);
+    num_threads = -1;
+  }
+
+  BlockSparseMatrix() : BlockSparseMatrix(0) {
+  }
+
+  int get_rows() const {
+    return block_rows * dim;
+  }
+
+  int get_cols() const {
+    return block_cols * dim;
+  }
+
+  void insert(int bi, int bj, const Block &block) {
+    TC_ASSERT(0 <= bj && bj < block_cols);
+    triplets.push_back(SparseTriplet<Block>(bi, bj, block));
   }
 
   void clear() {
-    for (int i = 0; i < n; i++) {
-      entries[i].clear();
+    triplets.clear();
+    std::fill(row_offsets.begin(), row_offsets.end(), 0);
+    col_indices.clear();
+    blocks.clear();
+  }
+
+  void compress() {
+    if (triplets.empty())
+      return;
+    for (int i = 0; i < block_rows; i++) {
+      for (int k = row_offsets[i]; k < row_offsets[i + 1]; k++) {
+        triplets.push_back(SparseTriplet<Block>(i, col_indices[k], blocks[k]));
+      }
     }
+    compress_triplets(block_rows, triplets, row_offsets, col_indices, blocks,
+                      num_threads);
+    triplets.clear();
   }
 
-  Array1D<real> multiply(const Array1D<real> &x) {
-    Array1D<real> y(x.get_dim());
+  int num_blocks() {
+    compress();
+    return (int)blocks.size();
+  }
 
+  void multiply(const Vector &x, Vector &y) {
+    compress();
+    TC_ASSERT(x.size == get_cols());
+    TC_ASSERT(y.size == get_rows());
+    const real *x_data = x.data.data();
+    real *y_data = y.data.data();
+    int num_tasks = (block_rows + rows_per_task - 1) / rows_per_task;
+    ThreadedTaskManager::run(num_tasks, num_threads, [&](int t) {
+      int row_end = std::min(block_rows, (t + 1) * rows_per_task);
+      for (int i = t * rows_per_task; i < row_end; i++) {
+        real sum[dim] = {0};
+        for (int k = row_offsets[i]; k < row_offsets[i + 1]; k++) {
+          const Block &b = blocks[k];
+          const real *xb = x_data + col_indices[k] * dim;
+          // blocks are column major
+          for (int c = 0; c < dim; c++) {
+            for (int r = 0; r < dim; r++) {
+              sum[r] += b(r, c) * xb[c];
+            }
+          }
+        }
+        for (int r = 0; r < dim; r++) {
+          y_data[i * dim + r] = sum[r];
+        }
+      }
+    });
+  }
+
+  Vector multiply(const Vector &x) {
+    Vector y(get_rows());
+    multiply(x, y);
     return y;
   }
 
+  Vector diagonal() {
+    compress();
+    Vector diag(std::min(get_rows(), get_cols()));
+    for (int i = 0; i < std::min(block_rows, block_cols); i++) {
+      auto begin = col_indices.begin() + row_offsets[i];
+      auto end = col_indices.begin() + row_offsets[i + 1];
+      auto it = std::lower_bound(begin, end, i);
+      if (it != end && *it == i) {
+        auto &b = blocks[it - col_indices.begin()];
+        for (int r = 0; r < dim; r++) {
+          diag[i * dim + r] = b(r, r);
+        }
+      }
+    }
+    return diag;
+  }
+
   TC_IO_DECL {
-    TC_IO(n);
-    TC_IO(entries);
+    TC_IO(block_rows, block_cols, triplets, row_offsets, col_indices, blocks);
   }
 };
 
+// Solves A x = b for a symmetric positive definite A with Jacobi-
+// preconditioned conjugate gradients. x is the initial guess. Returns the
+// number of iterations, or -1 if the relative residual did not drop below
+// tolerance within max_iterations.
+// Dot products and vector updates run on A.num_threads threads, over fixed
+// chunks, so that the result does not depend on the number of threads.
+template <typename Matrix>
+int conjugate_gradient(Matrix &A,
+                       const Array1D<real> &b,
+                       Array1D<real> &x,
+                       real tolerance = 1e-6_f,
+                       int max_iterations = 1000) {
+  using Vector = Array1D<real>;
+  int n = A.get_rows();
+  TC_ASSERT(A.get_cols() == n && b.size == n && x.size == n);
+
+  constexpr int chunk_size = 4096;
+  int num_chunks = (n + chunk_size - 1) / chunk_size;
+  // Runs body(begin, end) over all chunks of [0, n)
+  auto for_each_chunk = [&](const std::function<void(int, int)> &body) {
+    ThreadedTaskManager::run(num_chunks, A.num_threads, [&](int c) {
+      body(c * chunk_size, std::min(n, (c + 1) * chunk_size));
+    });
+  };
+
+  std::vector<float64> partial_sums(num_chunks);
+  auto dot = [&](const Vector &u, const Vector &v) {
+    for_each_chunk([&](int begin, int end) {
+      float64 sum = 0;
+      for (int i = begin; i < end; i++)
+        sum += u[i] * v[i];
+      partial_sums[begin / chunk_size] = sum;
+    });
+    float64 sum = 0;
+    for (auto partial : partial_sums)
+      sum += partial;
+    return (real)sum;
+  };
+
+  Vector inv_diag = A.diagonal();
+  Vector r(n), z(n), p(n), Ap(n);
+  A.multiply(x, Ap);
+  for_each_chunk([&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      inv_diag[i] = inv_diag[i] != 0 ? 1.0_f / inv_diag[i] : 1.0_f;
+      r[i] = b[i] - Ap[i];
+      z[i] = inv_diag[i] * r[i];
+      p[i] = z[i];
+    }
+  });
+  real threshold = tolerance * tolerance * dot(b, b);
+  real zTr = dot(z, r);
+  for (int iter = 0; iter < max_iterations; iter++) {
+    if (dot(r, r) <= threshold)
+      return iter;
+    A.multiply(p, Ap);
+    real alpha = zTr / dot(p, Ap);
+    for_each_chunk([&](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        x[i] += alpha * p[i];
+        r[i] -= alpha * Ap[i];
+        z[i] = inv_diag[i] * r[i];
+      }
+    });
+    real new_zTr = dot(z, r);
+    real beta = new_zTr / zTr;
+    zTr = new_zTr;
+    for_each_chunk([&](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        p[i] = z[i] + beta * p[i];
+      }
+    });
+  }
+  return dot(r, r) <= threshold ? max_iterations : -1;
+}
+
 TC_NAMESPACE_END
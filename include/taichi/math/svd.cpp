@@ -11,6 +11,7 @@
 #pragma GCC diagnostic pop
 #include <taichi/testing.h>
 #include "sifakis_svd.h"
+#include "sifakis_svd_simd.h"
 #include "svd.h"
 
 //#define TC_USE_EIGEN_SVD
@@ -228,6 +229,67 @@ void svd_eigen2(void const *A_, void *u_, void *sig_, void *v_) {
   *reinterpret_cast<Eigen::Matrix2d *>(v_) = v;
 }
 
+namespace {
+
+enum class SVDBatchISA { scalar, avx2, avx512 };
+
+SVDBatchISA detect_svd_batch_isa() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return SVDBatchISA::avx512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return SVDBatchISA::avx2;
+#endif
+  return SVDBatchISA::scalar;
+}
+
+SVDBatchISA svd_batch_isa_enum() {
+  static SVDBatchISA isa = detect_svd_batch_isa();
+  return isa;
+}
+
+}  // namespace
+
+std::string svd_batch_isa() {
+  auto isa = svd_batch_isa_enum();
+  if (isa == SVDBatchISA::avx512)
+    return "avx512";
+  else if (isa == SVDBatchISA::avx2)
+    return "avx2";
+  else
+    return "scalar";
+}
+
+// The wide kernels process whole groups of lanes and return the first index
+// left over; narrower kernels (and finally the scalar one) take the rest.
+void svd_batch(int n,
+               const float32 *const a[9],
+               float32 *const u[9],
+               float32 *const sigma[3],
+               float32 *const v[9]) {
+  int begin = 0;
+  auto isa = svd_batch_isa_enum();
+  if (isa == SVDBatchISA::avx512)
+    begin = SifakisSVD::svd_batch_avx512(begin, n, a, u, sigma, v);
+  if (isa >= SVDBatchISA::avx2)
+    begin = SifakisSVD::svd_batch_avx2(begin, n, a, u, sigma, v);
+  SifakisSVD::svd_batch<SifakisSVD::ScalarLanes>(begin, n, a, u, sigma, v);
+}
+
+void polar_decomp_batch(int n,
+                        const float32 *const a[9],
+                        float32 *const r[9],
+                        float32 *const s[9]) {
+  int begin = 0;
+  auto isa = svd_batch_isa_enum();
+  if (isa == SVDBatchISA::avx512)
+    begin = SifakisSVD::polar_decomp_batch_avx512(begin, n, a, r, s);
+  if (isa >= SVDBatchISA::avx2)
+    begin = SifakisSVD::polar_decomp_batch_avx2(begin, n, a, r, s);
+  SifakisSVD::polar_decomp_batch<SifakisSVD::ScalarLanes>(begin, n, a, r, s);
+}
+
 #define SPECIALIZE(T, dim)                                                    \
   template void eigen_svd<dim, T>(const MatrixND<dim, T> &,                   \
                                   MatrixND<dim, T> &, MatrixND<dim, T> &,     \
@@ -73,4 +73,24 @@ void svd_eigen2(void const *A_, void *u_, void *sig_, void *v_);
 
 void svd_eigen3(void const *A_, void *u_, void *sig_, void *v_);
 
+// Batched 3x3 SVD (a = u * diag(sigma) * v^T with rotations u and v,
+// sigma[0] >= sigma[1] >= |sigma[2]|, sigma[2] < 0 iff det(a) < 0) and polar
+// decomposition (a = r * s with a rotation r) of n matrices stored as
+// structure of arrays: entry (i, j) of matrix k is a[i * 3 + j][k].
+// 16 (AVX-512) or 8 (AVX2) matrices are decomposed at a time, depending on the
+// instruction sets supported by the CPU at runtime.
+void svd_batch(int n,
+               const float32 *const a[9],
+               float32 *const u[9],
+               float32 *const sigma[3],
+               float32 *const v[9]);
+
+void polar_decomp_batch(int n,
+                        const float32 *const a[9],
+                        float32 *const r[9],
+                        float32 *const s[9]);
+
+// "avx512", "avx2" or "scalar"
+std::string svd_batch_isa();
+
 TC_NAMESPACE_END
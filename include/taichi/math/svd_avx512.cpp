@@ -0,0 +1,39 @@
+/*******************************************************************************
+    Copyright (c) The Taichi Authors (2016- ). All Rights Reserved.
+    The use of this software is governed by the LICENSE file.
+*******************************************************************************/
+
+// Compiled with -mavx512f (see cmake/TaichiCore.cmake). Otherwise nothing is
+// processed here and svd.cpp falls back to narrower lanes.
+
+#include <immintrin.h>
+#include "sifakis_svd_simd.h"
+
+namespace SifakisSVD {
+
+int svd_batch_avx512(int begin,
+                     int end,
+                     const float *const a[9],
+                     float *const u[9],
+                     float *const sigma[3],
+                     float *const v[9]) {
+#if defined(__AVX512F__)
+  return svd_batch<AVX512Lanes>(begin, end, a, u, sigma, v);
+#else
+  return begin;
+#endif
+}
+
+int polar_decomp_batch_avx512(int begin,
+                              int end,
+                              const float *const a[9],
+                              float *const r[9],
+                              float *const s[9]) {
+#if defined(__AVX512F__)
+  return polar_decomp_batch<AVX512Lanes>(begin, end, a, r, s);
+#else
+  return begin;
+#endif
+}
+
+}  // namespace SifakisSVD
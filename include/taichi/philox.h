@@ -0,0 +1,94 @@
+// Counter-based random numbers of RandStmt
+
+#pragma once
+
+// Shared by the LLVM runtime (src/runtime/runtime.cpp) and the kernels of the
+// source backend. The runtime is compiled on its own, so this header must not
+// include other taichi headers.
+#include <cstdint>
+
+namespace taichi {
+namespace Tlang {
+namespace philox {
+
+// Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2,
+// 3", SC'11): a keyed bijection on 128-bit counters. Random streams need no
+// shared state and can be generated in any order.
+inline void philox4x32_10(const uint32_t *counter,
+                          const uint32_t *key,
+                          uint32_t *output) {
+  uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+  uint32_t k0 = key[0], k1 = key[1];
+  for (int i = 0; i < 10; i++) {
+    uint64_t p0 = (uint64_t)0xD2511F53u * c0;
+    uint64_t p1 = (uint64_t)0xCD9E8D57u * c2;
+    c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+    c1 = (uint32_t)p1;
+    c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+    c3 = (uint32_t)p0;
+    k0 += 0x9E3779B9u;
+    k1 += 0xBB67AE85u;
+  }
+  output[0] = c0;
+  output[1] = c1;
+  output[2] = c2;
+  output[3] = c3;
+}
+
+// Each loop iteration of a task draws from its own stream. The key is
+// derived from (seed, task, launch), and the counter is (loop index, block),
+// where block counts the Philox blocks already drawn in the iteration.
+// Results are therefore independent of scheduling and thread count.
+struct State {
+  uint32_t key[2];
+  uint32_t counter[4];
+  uint32_t buffer[4];  // every Philox block yields four numbers
+  int32_t num_buffered;
+};
+
+inline void initialize(State *state,
+                       uint32_t seed,
+                       uint32_t launch_id,
+                       int32_t task_id,
+                       int32_t i0,
+                       int32_t i1,
+                       int32_t i2,
+                       int32_t i3) {
+  // multiplying by an odd constant keeps the keys of tasks distinct
+  state->key[0] = seed ^ ((uint32_t)task_id * 0x9E3779B9u);
+  state->key[1] = launch_id;
+  state->counter[0] = (uint32_t)i0;
+  state->counter[1] = (uint32_t)i1;
+  state->counter[2] = (uint32_t)i2 ^ ((uint32_t)i3 << 16);
+  state->counter[3] = 0;
+  state->num_buffered = 0;
+}
+
+inline uint32_t next(State *state) {
+  if (state->num_buffered == 0) {
+    philox4x32_10(state->counter, state->key, state->buffer);
+    state->counter[3]++;
+    state->num_buffered = 4;
+  }
+  state->num_buffered--;
+  return state->buffer[state->num_buffered];
+}
+
+inline int32_t rand_i32(State *state) {
+  return (int32_t)next(state);
+}
+
+// uniform in [0, 1)
+inline float rand_f32(State *state) {
+  return (next(state) >> 8) * (1.0f / 16777216.0f);
+}
+
+inline double rand_f64(State *state) {
+  uint64_t hi = next(state);
+  uint64_t lo = next(state);
+  return (((hi << 32) | lo) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+}  // namespace philox
+}  // namespace Tlang
+}  // namespace taichi
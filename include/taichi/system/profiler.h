@@ -193,8 +193,9 @@ class ProfilerRecords {
     current_depth -= 1;
   }
 
+  // Scopes nest per thread, so each thread records its own tree
   static ProfilerRecords &get_instance() {
-    static ProfilerRecords profiler_records;
+    static thread_local ProfilerRecords profiler_records;
     return profiler_records;
   }
 };
@@ -8,7 +8,10 @@
 #include <taichi/common/util.h>
 
 #include <atomic>
+#include <condition_variable>
+#include <exception>
 #include <functional>
+#include <mutex>
 #include <thread>
 #include <vector>
 #if defined(TC_PLATFORM_WINDOWS)
@@ -17,9 +20,6 @@
 // Mac and Linux
 #include <unistd.h>
 #endif
-#if !defined(TC_AMALGAMATED)
-#define TBB_PREVIEW_GLOBAL_CONTROL 1
-#endif
 
 TC_NAMESPACE_BEGIN
 
@@ -62,36 +62,85 @@ class Spinlock {
   }
 };
 
-#if (0)
+// Worker threads that live for the whole process, so that parallel loops do
+// not pay for thread creation on every call
+class ThreadPool {
+ public:
+  explicit ThreadPool(int num_threads);
+
+  ~ThreadPool();
+
+  // Runs job on the calling thread and on up to num_helpers pool threads, and
+  // returns once all of them are done. The first exception thrown by any of
+  // them is rethrown here. Calls from within a job run the job serially.
+  void run(const std::function<void()> &job, int num_helpers);
+
+  int size() const {
+    return (int)threads.size();
+  }
+
+  // Shared pool with one thread per hardware thread, minus the caller
+  static ThreadPool &get_instance();
+
+ private:
+  void target();
+
+  std::vector<std::thread> threads;
+  // held for the duration of a run, so that jobs from different threads
+  // take turns
+  std::mutex run_mut;
+  std::mutex mut;
+  std::condition_variable work_available, work_done;
+  const std::function<void()> *job;
+  int pending;  // helper slots not taken yet
+  int running;  // helper slots not finished yet
+  bool exiting;
+  std::exception_ptr error;
+};
+
 class ThreadedTaskManager {
  public:
-#if !defined(TC_AMALGAMATED)
-  class TbbParallelismControl {
-    std::unique_ptr<tbb::global_control> c;
-   public:
-    TbbParallelismControl(int threads) {
-      c = std::make_unique<tbb::global_control>(
-          tbb::global_control::max_allowed_parallelism, threads);
-    }
-  };
-#endif
+  // Runs target(i) for i in [begin, end) on num_threads threads (-1 for all
+  // hardware threads) of the shared ThreadPool. Threads grab chunks of
+  // iterations from a shared counter, so that uneven iterations are balanced
+  // dynamically. If target throws, the remaining chunks are skipped and the
+  // exception is rethrown.
   template <typename T>
   void static run(const T &target, int begin, int end, int num_threads) {
-#if !defined(TC_AMALGAMATED)
-    if (num_threads > 0) {
-      tbb::task_arena limited_arena(num_threads);
-      limited_arena.execute([&]() { tbb::parallel_for(begin, end, target); });
-    } else {
-      TC_ASSERT_INFO(
-          num_threads == -1,
-          fmt::format(
-              "num_threads must be a positive number or -1, instead of [{}]",
-              num_threads));
-      tbb::parallel_for(begin, end, target);
+    if (num_threads == -1) {
+      num_threads = std::max(1, (int)std::thread::hardware_concurrency());
     }
-#else
-    TC_NOT_IMPLEMENTED
-#endif
+    TC_ASSERT_INFO(
+        num_threads > 0,
+        fmt::format(
+            "num_threads must be a positive number or -1, instead of [{}]",
+            num_threads));
+    num_threads = std::min(num_threads, end - begin);
+    if (num_threads <= 1) {
+      for (int i = begin; i < end; i++) {
+        target(i);
+      }
+      return;
+    }
+    int grain = std::max(1, (end - begin) / (num_threads * 8));
+    std::atomic<int> next(begin);
+    std::function<void()> worker = [&]() {
+      while (true) {
+        int chunk_begin = next.fetch_add(grain);
+        if (chunk_begin >= end)
+          break;
+        int chunk_end = std::min(end, chunk_begin + grain);
+        try {
+          for (int i = chunk_begin; i < chunk_end; i++) {
+            target(i);
+          }
+        } catch (...) {
+          next = end;
+          throw;
+        }
+      }
+    };
+    ThreadPool::get_instance().run(worker, num_threads - 1);
   }
 
   template <typename T>
@@ -109,7 +158,6 @@ class ThreadedTaskManager {
     return run(target, 0, end, num_threads);
   }
 };
-#endif
 
 class PID {
  public:
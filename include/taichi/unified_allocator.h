@@ -12,10 +12,19 @@ TLANG_NAMESPACE_BEGIN
 
 class UnifiedAllocator;
 
-extern UnifiedAllocator *&allocator();
-extern UnifiedAllocator* allocator_instance;
+namespace {
+// Generated code is compiled into one library per kernel or layout. Each
+// library allocates from the allocator of the program it belongs to, which
+// the program sets before running it (see Context::allocator).
+UnifiedAllocator *library_allocator = nullptr;
+
+TC_FORCE_INLINE UnifiedAllocator *&allocator() {
+  return library_allocator;
+}
+}  // namespace
 
-// This class can only have one instance
+// Each program has its own instance, and releases its memory at once when it
+// is destroyed
 class UnifiedAllocator {
   std::unique_ptr<VirtualMemoryAllocator> cpu_vm;
   void *_cuda_data{};
@@ -65,9 +74,9 @@ class UnifiedAllocator {
 
   UnifiedAllocator operator=(const UnifiedAllocator &) = delete;
 
-  static void create();
+  static UnifiedAllocator *create();
 
-  static void free();
+  static void free(UnifiedAllocator *allocator);
 };
 
 TC_FORCE_INLINE __host__ __device__ void *allocate(std::size_t size,
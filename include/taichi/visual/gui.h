@@ -415,10 +415,42 @@ class Canvas {
   }
 };
 
+// Maps [0, 1] to [0, 255], truncating. Values out of range are clamped, and
+// NaN becomes 0.
+TC_FORCE_INLINE uint8 color_to_uint8(float32 x) {
+  return x > 0 ? uint8(std::min(x, 1.0f) * 255.0f) : 0;
+}
+
+// A float32 image in memory, e.g. the data of a dense field. Channel c of
+// pixel (i, j) is data[i * stride_i + j * stride_j + c * stride_c]. Images
+// with one channel are gray, and alpha is 1 unless there are four channels.
+struct ImageView {
+  const float32 *data = nullptr;
+  int width = 0, height = 0;
+  int64 stride_i = 0, stride_j = 0, stride_c = 1;
+  int num_channels = 1;
+
+  Vector4 pixel(int i, int j) const {
+    auto p = data + i * stride_i + j * stride_j;
+    if (num_channels < 3) {
+      return Vector4(p[0], p[0], p[0], 1);
+    }
+    return Vector4(p[0], p[stride_c], p[2 * stride_c],
+                   num_channels == 4 ? p[3 * stride_c] : 1);
+  }
+
+  // Converts the lower left width x height pixels to BGRA, with the top row
+  // first
+  void to_bgra8(int width, int height, uint32 *out) const;
+};
+
 #if defined(TC_GUI_X11)
 
 class CXImage;
 
+// Converts view into the window image (defined in x11.cpp)
+void set_image_data(CXImage *img, const ImageView &view);
+
 class GUIBaseX11 {
  public:
   void *display;
@@ -463,6 +495,8 @@ class GUI : public GUIBase {
   const int fps = 60;
   float64 start_time;
   Array2D<Vector4> buffer;
+  // set_image was called since the last update
+  bool image_set = false;
   std::vector<real> last_frame_interval;
   std::unique_ptr<Canvas> canvas;
   float64 last_frame_time;
@@ -742,6 +776,11 @@ class GUI : public GUIBase {
 
   void redraw();
 
+  // Shows view instead of the canvas at the next update. On X11 it is
+  // converted straight into the window image, without going through the
+  // canvas. view must cover the window, and is not used after this call.
+  void set_image(const ImageView &view);
+
   void set_title(std::string title);
 
   void redraw_widgets() {
@@ -4,5 +4,270 @@
 *******************************************************************************/
 
 #include "voxelizer.h"
+
 TC_NAMESPACE_BEGIN
+
+namespace {
+
+// Edge function of (x, y) with respect to the directed edge a -> b. It is
+// evaluated with the vertices in a canonical order, so that it is exactly
+// antisymmetric and triangles sharing the edge agree on which side a point
+// lies.
+float64 edge_function(float64 ax,
+                      float64 ay,
+                      float64 bx,
+                      float64 by,
+                      float64 x,
+                      float64 y) {
+  if (ax > bx || (ax == bx && ay > by)) {
+    return -edge_function(bx, by, ax, ay, x, y);
+  }
+  return (bx - ax) * (y - ay) - (by - ay) * (x - ax);
+}
+
+// Top-left rule: points on an edge belong to exactly one of the two
+// (counter-clockwise) triangles sharing it
+bool owns(float64 e, float64 dx, float64 dy) {
+  return e > 0 || (e == 0 && (dy < 0 || (dy == 0 && dx > 0)));
+}
+
+// Height at which the vertical line through (x, y) crosses the triangle
+bool crossing(const Voxelizer::Triangle &t, real x, real y, real &z) {
+  float64 ax = t.v[0].x, ay = t.v[0].y, bx = t.v[1].x, by = t.v[1].y,
+          cx = t.v[2].x, cy = t.v[2].y;
+  float64 area = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+  if (area == 0) {
+    return false;
+  }
+  float64 e0 = edge_function(ax, ay, bx, by, x, y);
+  float64 e1 = edge_function(bx, by, cx, cy, x, y);
+  float64 e2 = edge_function(cx, cy, ax, ay, x, y);
+  float64 s = area > 0 ? 1 : -1;
+  if (!owns(s * e0, s * (bx - ax), s * (by - ay)) ||
+      !owns(s * e1, s * (cx - bx), s * (cy - by)) ||
+      !owns(s * e2, s * (ax - cx), s * (ay - cy))) {
+    return false;
+  }
+  z = (real)((e1 * t.v[0].z + e2 * t.v[1].z + e0 * t.v[2].z) /
+             (e0 + e1 + e2));
+  return true;
+}
+
+Vector3 closest_point(const Vector3 &p, const Voxelizer::Triangle &t) {
+  const Vector3 &a = t.v[0], &b = t.v[1], &c = t.v[2];
+  Vector3 ab = b - a, ac = c - a, ap = p - a;
+  real d1 = dot(ab, ap), d2 = dot(ac, ap);
+  if (d1 <= 0 && d2 <= 0)
+    return a;
+  Vector3 bp = p - b;
+  real d3 = dot(ab, bp), d4 = dot(ac, bp);
+  if (d3 >= 0 && d4 <= d3)
+    return b;
+  real vc = d1 * d4 - d3 * d2;
+  if (vc <= 0 && d1 >= 0 && d3 <= 0)
+    return a + d1 / (d1 - d3) * ab;
+  Vector3 cp = p - c;
+  real d5 = dot(ab, cp), d6 = dot(ac, cp);
+  if (d6 >= 0 && d5 <= d6)
+    return c;
+  real vb = d5 * d2 - d1 * d6;
+  if (vb <= 0 && d2 >= 0 && d6 <= 0)
+    return a + d2 / (d2 - d6) * ac;
+  real va = d3 * d6 - d5 * d4;
+  if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0)
+    return b + (d4 - d3) / ((d4 - d3) + (d5 - d6)) * (c - b);
+  real denom = 1 / (va + vb + vc);
+  return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+real box_distance2(const Vector3 &p, const Voxelizer::Node &node) {
+  real d2 = 0;
+  for (int i = 0; i < 3; i++) {
+    real d = std::max({node.lower[i] - p[i], 0.0_f, p[i] - node.upper[i]});
+    d2 += d * d;
+  }
+  return d2;
+}
+
+constexpr int max_bvh_depth = 64;
+
+}  // namespace
+
+Voxelizer::Voxelizer(const std::vector<Vector3> &vertices,
+                     const std::vector<Vector3i> &faces,
+                     const Matrix4 &transform) {
+  for (auto &face : faces) {
+    Triangle t;
+    for (int i = 0; i < 3; i++) {
+      TC_ERROR_UNLESS(0 <= face[i] && face[i] < (int)vertices.size(),
+                      "Vertex index {} out of range [0, {})", face[i],
+                      vertices.size());
+      t.v[i] = multiply_matrix4(transform, vertices[face[i]], 1.0_f);
+    }
+    triangles.push_back(t);
+  }
+  if (!triangles.empty()) {
+    build(0, (int)triangles.size());
+  }
+}
+
+int Voxelizer::build(int begin, int end) {
+  Node node;
+  node.lower = Vector3(1e30_f);
+  node.upper = Vector3(-1e30_f);
+  Vector3 center_lower(1e30_f), center_upper(-1e30_f);
+  for (int t = begin; t < end; t++) {
+    for (int i = 0; i < 3; i++) {
+      auto center = triangles[t].get_center();
+      center_lower[i] = std::min(center_lower[i], center[i]);
+      center_upper[i] = std::max(center_upper[i], center[i]);
+      for (int v = 0; v < 3; v++) {
+        node.lower[i] = std::min(node.lower[i], triangles[t].v[v][i]);
+        node.upper[i] = std::max(node.upper[i], triangles[t].v[v][i]);
+      }
+    }
+  }
+  node.left = node.right = -1;
+  node.begin = begin;
+  node.end = end;
+  int id = (int)nodes.size();
+  nodes.push_back(node);
+  if (end - begin <= 4) {
+    return id;
+  }
+  // split at the median along the longest axis of the triangle centers
+  int axis = 0;
+  for (int i = 1; i < 3; i++) {
+    if (center_upper[i] - center_lower[i] >
+        center_upper[axis] - center_lower[axis])
+      axis = i;
+  }
+  int mid = (begin + end) / 2;
+  std::nth_element(triangles.begin() + begin, triangles.begin() + mid,
+                   triangles.begin() + end,
+                   [axis](const Triangle &a, const Triangle &b) {
+                     return a.get_center()[axis] < b.get_center()[axis];
+                   });
+  int left = build(begin, mid);
+  int right = build(mid, end);
+  nodes[id].left = left;
+  nodes[id].right = right;
+  return id;
+}
+
+void Voxelizer::crossings(real x, real y, std::vector<real> &z) const {
+  z.clear();
+  if (nodes.empty()) {
+    return;
+  }
+  int stack[max_bvh_depth];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    auto &node = nodes[stack[--top]];
+    if (x < node.lower.x || x > node.upper.x || y < node.lower.y ||
+        y > node.upper.y) {
+      continue;
+    }
+    if (node.left == -1) {
+      for (int t = node.begin; t < node.end; t++) {
+        real h;
+        if (crossing(triangles[t], x, y, h)) {
+          z.push_back(h);
+        }
+      }
+    } else {
+      TC_ASSERT(top + 2 <= max_bvh_depth);
+      stack[top++] = node.left;
+      stack[top++] = node.right;
+    }
+  }
+  std::sort(z.begin(), z.end());
+}
+
+bool Voxelizer::inside(const Vector3 &pos) const {
+  std::vector<real> z;
+  crossings(pos.x, pos.y, z);
+  int count = 0;
+  for (auto h : z) {
+    count += h > pos.z;
+  }
+  return count % 2 == 1;
+}
+
+real Voxelizer::distance(const Vector3 &pos, real max_distance) const {
+  real best2 = max_distance * max_distance;
+  if (nodes.empty()) {
+    return max_distance;
+  }
+  int stack[max_bvh_depth];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    auto &node = nodes[stack[--top]];
+    if (box_distance2(pos, node) >= best2) {
+      continue;
+    }
+    if (node.left == -1) {
+      for (int t = node.begin; t < node.end; t++) {
+        auto d = pos - closest_point(pos, triangles[t]);
+        best2 = std::min(best2, d.length2());
+      }
+    } else {
+      // visit the closer child first
+      int a = node.left, b = node.right;
+      if (box_distance2(pos, nodes[a]) < box_distance2(pos, nodes[b])) {
+        std::swap(a, b);
+      }
+      TC_ASSERT(top + 2 <= max_bvh_depth);
+      stack[top++] = a;
+      stack[top++] = b;
+    }
+  }
+  return std::min(std::sqrt(best2), max_distance);
+}
+
+void Voxelizer::for_each_inside(
+    const Vector3i &res,
+    const Vector3 &storage_offset,
+    const std::function<void(int, int, int)> &f) const {
+  ThreadedTaskManager::run(res[0], -1, [&](int i) {
+    std::vector<real> z;
+    for (int j = 0; j < res[1]; j++) {
+      crossings(i + storage_offset.x, j + storage_offset.y, z);
+      // samples strictly between pairs of crossings are inside
+      for (int p = 0; p + 1 < (int)z.size(); p += 2) {
+        int begin =
+            std::max(0, (int)std::floor(z[p] - storage_offset.z) + 1);
+        int end =
+            std::min(res[2], (int)std::ceil(z[p + 1] - storage_offset.z));
+        for (int k = begin; k < end; k++) {
+          f(i, j, k);
+        }
+      }
+    }
+  });
+}
+
+void Voxelizer::add_to_levelset(LevelSet<3> &levelset, real band) const {
+  auto res = levelset.get_res();
+  auto offset = levelset.get_storage_offset();
+  std::vector<uint8> is_inside(res[0] * res[1] * res[2], 0);
+  for_each_inside(res, offset, [&](int i, int j, int k) {
+    is_inside[(i * res[1] + j) * res[2] + k] = 1;
+  });
+  ThreadedTaskManager::run(res[0], -1, [&](int i) {
+    for (int j = 0; j < res[1]; j++) {
+      for (int k = 0; k < res[2]; k++) {
+        auto pos = Vector3(i, j, k) + offset;
+        real phi = distance(pos, band);
+        if (is_inside[(i * res[1] + j) * res[2] + k]) {
+          phi = -phi;
+        }
+        levelset[i][j][k] = std::min(levelset[i][j][k], phi);
+      }
+    }
+  });
+}
+
 TC_NAMESPACE_END
@@ -8,12 +8,73 @@
 #include <functional>
 #include <taichi/common/interface.h>
 #include <taichi/math/math.h>
+#include <taichi/math/levelset.h>
+#include <taichi/system/threading.h>
 
 TC_NAMESPACE_BEGIN
 
+// Voxelizes closed triangle meshes. The triangles are binned in a BVH, which
+// accelerates inside/outside tests by the parity of ray crossings and
+// distance queries.
+//
+// Positions are in grid coordinates, where the sample of cell (i, j, k) of an
+// ArrayND is at (i, j, k) + storage_offset, as in LevelSet.
 class Voxelizer {
- protected:
  public:
+  struct Triangle {
+    Vector3 v[3];
+
+    Vector3 get_center() const {
+      return (v[0] + v[1] + v[2]) * (1.0_f / 3);
+    }
+  };
+
+  struct Node {
+    Vector3 lower, upper;
+    // children, or -1 for leaves, which hold triangles [begin, end)
+    int left, right;
+    int begin, end;
+  };
+
+  std::vector<Triangle> triangles;
+  std::vector<Node> nodes;
+
+  // A mesh with triangles faces[t] indexing into vertices; transform maps it
+  // into grid coordinates
+  Voxelizer(const std::vector<Vector3> &vertices,
+            const std::vector<Vector3i> &faces,
+            const Matrix4 &transform = Matrix4(1.0_f));
+
+  // Heights at which the line {(x, y, z)} crosses the mesh, sorted. Crossings
+  // of edges and vertices are counted once.
+  void crossings(real x, real y, std::vector<real> &z) const;
+
+  bool inside(const Vector3 &pos) const;
+
+  // Distance to the closest triangle, or max_distance if it is further
+  real distance(const Vector3 &pos, real max_distance = 1e20_f) const;
+
+  // Calls f(i, j, k) for each cell of a grid with resolution res whose sample
+  // is inside the mesh. Columns along z are filled by scanline parity in
+  // parallel; f is called from several threads, one column at a time.
+  void for_each_inside(const Vector3i &res,
+                       const Vector3 &storage_offset,
+                       const std::function<void(int, int, int)> &f) const;
+
+  // Sets the cells inside the mesh to value
+  template <typename T>
+  void fill(ArrayND<3, T> &grid, const T &value) const {
+    for_each_inside(grid.get_res(), grid.get_storage_offset(),
+                    [&](int i, int j, int k) { grid[i][j][k] = value; });
+  }
+
+  // Adds the signed distance (negative inside) to the mesh to the level set,
+  // taking the minimum as the other add_* methods of LevelSet. Distances are
+  // clamped to band.
+  void add_to_levelset(LevelSet<3> &levelset, real band = 1e20_f) const;
+
+ private:
+  int build(int begin, int end);
 };
 
 TC_NAMESPACE_END
@@ -12,6 +12,10 @@
 #define TC_IMAGE_IO
 #endif
 
+#if !defined(TC_PLATFORM_WINDOWS)
+#include <sys/wait.h>
+#endif
+
 #if defined(TC_IMAGE_IO)
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_FAILURE_USERMSG
@@ -24,8 +28,9 @@
 
 TC_NAMESPACE_BEGIN
 
-template <typename T>
-void Array2D<T>::load_image(const std::string &filename, bool linearize) {
+template <typename T, typename Layout>
+void ArrayND<2, T, Layout>::load_image(const std::string &filename,
+                                       bool linearize) {
 #if !defined(TC_AMALGAMATED)
   int channels;
   FILE *f = fopen(filename.c_str(), "rb");
@@ -67,42 +72,69 @@ void Array2D<T>::load_image(const std::string &filename, bool linearize) {
 #endif
 }
 
-template <typename T>
-void Array2D<T>::write_as_image(const std::string &filename) {
 #if defined(TC_IMAGE_IO)
+namespace {
+
+// 8-bit RGB pixels, top row first
+template <typename T>
+std::vector<unsigned char> to_rgb8(const Array2D<T> &img) {
   int comp = 3;
-  std::vector<unsigned char> data(this->res[0] * this->res[1] * comp);
-  for (int i = 0; i < this->res[0]; i++) {
-    for (int j = 0; j < this->res[1]; j++) {
+  auto res = img.get_res();
+  std::vector<unsigned char> data(res[0] * res[1] * comp);
+  for (int i = 0; i < res[0]; i++) {
+    for (int j = 0; j < res[1]; j++) {
+      auto pixel = VectorND<3, real>(img.data[i * res[1] + (res[1] - j - 1)]);
       for (int k = 0; k < comp; k++) {
-        data[j * this->res[0] * comp + i * comp + k] =
-            (unsigned char)(255.0f *
-                            clamp(VectorND<3, real>(
-                                      this->data[i * this->res[1] +
-                                                 (this->res[1] - j - 1)])[k],
-                                  0.0_f, 1.0_f));
+        data[j * res[0] * comp + i * comp + k] =
+            (unsigned char)(255.0f * clamp(pixel[k], 0.0_f, 1.0_f));
       }
     }
   }
-  TC_ASSERT(filename.size() >= 5);
+  return data;
+}
+
+// Returns an error message, or an empty string on success
+std::string try_write_rgb8_image(const std::string &filename,
+                                 Vector2i res,
+                                 const std::vector<unsigned char> &data) {
+  int comp = 3;
+  if (filename.size() < 5)
+    return fmt::format("Invalid image file name [{}]", filename);
   int write_result = 0;
   std::string suffix = filename.substr(filename.size() - 4);
   if (suffix == ".png") {
-    write_result = stbi_write_png(filename.c_str(), this->res[0], this->res[1],
-                                  comp, &data[0], comp * this->res[0]);
+    write_result = stbi_write_png(filename.c_str(), res[0], res[1], comp,
+                                  &data[0], comp * res[0]);
   } else if (suffix == ".bmp") {
     // TODO: test
-    write_result = stbi_write_bmp(filename.c_str(), this->res[0], this->res[1],
-                                  comp, &data[0]);
+    write_result =
+        stbi_write_bmp(filename.c_str(), res[0], res[1], comp, &data[0]);
   } else if (suffix == ".jpg") {
     // TODO: test
-    write_result = stbi_write_jpg(filename.c_str(), this->res[0], this->res[1],
-                                  comp, &data[0], 95);
+    write_result =
+        stbi_write_jpg(filename.c_str(), res[0], res[1], comp, &data[0], 95);
   } else {
-    TC_ERROR("Unknown suffix {}", suffix);
+    return fmt::format("Unknown suffix {}", suffix);
   }
+  if (!write_result)
+    return fmt::format("Cannot write image file [{}]", filename);
+  return "";
+}
+
+void write_rgb8_image(const std::string &filename,
+                      Vector2i res,
+                      const std::vector<unsigned char> &data) {
+  auto error = try_write_rgb8_image(filename, res, data);
+  TC_ERROR_IF(!error.empty(), "{}", error);
+}
 
-  TC_ASSERT_INFO((bool)write_result, "Cannot write image file");
+}  // namespace
+#endif
+
+template <typename T, typename Layout>
+void ArrayND<2, T, Layout>::write_as_image(const std::string &filename) {
+#if defined(TC_IMAGE_IO)
+  write_rgb8_image(filename, this->res, to_rgb8(*this));
 #else
   TC_ERROR(
       "'write_as_image' is not implemented. Append -DTC_IMAGE_IO to "
@@ -110,18 +142,163 @@ void Array2D<T>::write_as_image(const std::string &filename) {
 #endif
 }
 
+AsyncFrameWriter::AsyncFrameWriter(int num_threads,
+                                   int max_pending_frames,
+                                   bool drop_when_full)
+    : pipe(nullptr),
+      max_pending_frames(max_pending_frames),
+      drop_when_full(drop_when_full) {
+  if (num_threads == -1) {
+    num_threads = std::max(1, (int)std::thread::hardware_concurrency());
+  }
+  start(num_threads);
+}
+
+AsyncFrameWriter::AsyncFrameWriter(const std::string &pipe_command,
+                                   int max_pending_frames,
+                                   bool drop_when_full)
+    : pipe_command(pipe_command),
+      max_pending_frames(max_pending_frames),
+      drop_when_full(drop_when_full) {
+#if defined(TC_PLATFORM_WINDOWS)
+  pipe = _popen(pipe_command.c_str(), "wb");
+#else
+  pipe = popen(pipe_command.c_str(), "w");
+#endif
+  TC_ERROR_IF(pipe == nullptr, "Cannot start [{}]", pipe_command);
+  // A single thread keeps the frames in order
+  start(1);
+}
+
+void AsyncFrameWriter::start(int num_threads) {
+  TC_ASSERT(max_pending_frames > 0);
+  stopped = false;
+  num_writing = 0;
+  num_dropped = 0;
+  for (int i = 0; i < num_threads; i++) {
+    threads.emplace_back([this] { run(); });
+  }
+}
+
+bool AsyncFrameWriter::write(const std::string &fn, Array2D<Vector3> &&frame) {
+  std::unique_lock<std::mutex> lock(mut);
+  TC_ASSERT(!stopped);
+  rethrow_error();
+  if (drop_when_full && (int)queue.size() >= max_pending_frames) {
+    num_dropped++;
+    return false;
+  }
+  written.wait(lock,
+               [&] { return (int)queue.size() < max_pending_frames; });
+  queue.emplace_back(fn, std::move(frame));
+  queued.notify_one();
+  return true;
+}
+
+void AsyncFrameWriter::wait() {
+  std::unique_lock<std::mutex> lock(mut);
+  written.wait(lock, [&] { return queue.empty() && num_writing == 0; });
+  rethrow_error();
+}
+
+void AsyncFrameWriter::rethrow_error() {
+  if (error) {
+    auto e = error;
+    error = nullptr;
+    std::rethrow_exception(e);
+  }
+}
+
+void AsyncFrameWriter::run() {
+  while (true) {
+    std::pair<std::string, Array2D<Vector3>> task;
+    {
+      std::unique_lock<std::mutex> lock(mut);
+      queued.wait(lock, [&] { return stopped || !queue.empty(); });
+      if (queue.empty())
+        return;
+      task = std::move(queue.front());
+      queue.pop_front();
+      num_writing++;
+    }
+    written.notify_all();
+    // TC_ERROR would abort the process from this thread, so failures are
+    // turned into exceptions for the caller
+    std::exception_ptr e;
+    try {
+#if defined(TC_IMAGE_IO)
+      auto data = to_rgb8(task.second);
+      std::string message;
+      if (pipe) {
+        auto size = std::fwrite(data.data(), 1, data.size(), pipe);
+        if (size != data.size())
+          message = "Failed to write to pipe";
+      } else {
+        message =
+            try_write_rgb8_image(task.first, task.second.get_res(), data);
+      }
+#else
+      std::string message = "Image output requires TC_IMAGE_IO";
+#endif
+      if (!message.empty())
+        throw std::runtime_error(message);
+    } catch (...) {
+      e = std::current_exception();
+    }
+    {
+      std::lock_guard<std::mutex> lock(mut);
+      num_writing--;
+      // only the first failure is reported
+      if (e && !error)
+        error = e;
+    }
+    written.notify_all();
+  }
+}
+
+void AsyncFrameWriter::close() {
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    stopped = true;
+  }
+  queued.notify_all();
+  for (auto &th : threads) {
+    th.join();
+  }
+  threads.clear();
+  std::lock_guard<std::mutex> lock(mut);
+  if (pipe) {
+#if defined(TC_PLATFORM_WINDOWS)
+    int status = _pclose(pipe);
+    bool failed = status != 0;
+#else
+    int status = pclose(pipe);
+    bool failed =
+        status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    if (status != -1 && WIFEXITED(status))
+      status = WEXITSTATUS(status);
+#endif
+    pipe = nullptr;
+    if (failed && !error) {
+      error = std::make_exception_ptr(std::runtime_error(
+          fmt::format("[{}] failed with status {}", pipe_command, status)));
+    }
+  }
+  rethrow_error();
+}
+
 #if defined(TC_IMAGE_IO)
 std::map<std::string, stbtt_fontinfo> fonts;
 std::map<std::string, std::vector<uint8>> font_buffers;
 #endif
 
-template <typename T>
-void Array2D<T>::write_text(const std::string &font_fn,
-                            const std::string &content_,
-                            real size,
-                            int dx,
-                            int dy,
-                            T color) {
+template <typename T, typename Layout>
+void ArrayND<2, T, Layout>::write_text(const std::string &font_fn,
+                                       const std::string &content_,
+                                       real size,
+                                       int dx,
+                                       int dy,
+                                       T color) {
 #if defined(TC_IMAGE_IO)
 
   std::vector<unsigned char> screen_buffer(
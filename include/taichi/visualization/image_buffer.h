@@ -6,6 +6,11 @@
 #pragma once
 
 #include <memory>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
 #include <taichi/math/math.h>
 #include <taichi/math/array_2d.h>
 #include <taichi/system/threading.h>
@@ -72,4 +77,70 @@ class ImageAccumulator {
   Vector2i res;
 };
 
+// Writes frames in the background. Frames are moved into a bounded queue, and
+// encoded by a pool of threads to image files (png, bmp or jpg), or written
+// in order as raw rgb24 to the standard input of an encoder process such as
+// ffmpeg. When max_pending_frames frames are queued, write() blocks, or drops
+// the frame if drop_when_full is set.
+class AsyncFrameWriter {
+ public:
+  AsyncFrameWriter(int num_threads = -1,
+                   int max_pending_frames = 16,
+                   bool drop_when_full = false);
+
+  AsyncFrameWriter(const std::string &pipe_command,
+                   int max_pending_frames = 16,
+                   bool drop_when_full = false);
+
+  // Returns false if the frame was dropped. fn is ignored when writing to a
+  // pipe. A failure to write a previous frame is thrown as
+  // std::runtime_error from the next call to write, wait or close.
+  bool write(const std::string &fn, Array2D<Vector3> &&frame);
+
+  // Blocks until all queued frames are written
+  void wait();
+
+  // Writes the queued frames, stops the threads and closes the pipe. Throws
+  // std::runtime_error if the encoder process failed.
+  void close();
+
+  int get_num_dropped() const {
+    return num_dropped;
+  }
+
+  // Frames queued and not yet taken by a writer thread
+  int get_num_pending() {
+    std::lock_guard<std::mutex> lock(mut);
+    return (int)queue.size();
+  }
+
+  ~AsyncFrameWriter() {
+    try {
+      close();
+    } catch (...) {
+      // call close() to handle the errors
+    }
+  }
+
+ private:
+  void start(int num_threads);
+
+  void run();
+
+  void rethrow_error();
+
+  std::FILE *pipe;
+  std::string pipe_command;
+  int max_pending_frames;
+  bool drop_when_full;
+  bool stopped;
+  int num_writing;
+  int num_dropped;
+  std::deque<std::pair<std::string, Array2D<Vector3>>> queue;
+  std::exception_ptr error;
+  std::mutex mut;
+  std::condition_variable queued, written;
+  std::vector<std::thread> threads;
+};
+
 TC_NAMESPACE_END
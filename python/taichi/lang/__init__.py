@@ -52,6 +52,16 @@ def Tape(loss, clear_gradients=True):
 def clear_all_gradients():
   core.get_current_program().clear_all_gradients()
 
+def save_snapshot(fn):
+  if not get_runtime().materialized:
+    get_runtime().materialize()
+  core.get_current_program().save_snapshot(fn)
+
+def load_snapshot(fn):
+  if not get_runtime().materialized:
+    get_runtime().materialize()
+  core.get_current_program().load_snapshot(fn)
+
 schedules = [parallelize, vectorize, block_dim, cache]
 lang_core = core
 
@@ -220,8 +220,15 @@ class Expr:
   def atomic_add(self, other):
     taichi_lang_core.expr_atomic_add(self.ptr, other.ptr)
 
+  def atomic_max(self, other):
+    taichi_lang_core.expr_atomic_max(self.ptr, other.ptr)
+
+  def atomic_min(self, other):
+    taichi_lang_core.expr_atomic_min(self.ptr, other.ptr)
+
   def __pow__(self, power, modulo=None):
-    assert isinstance(power, int) and power >= 0
+    if not isinstance(power, int) or power < 0:
+      return Expr(taichi_lang_core.expr_pow(self.ptr, Expr(power).ptr))
     if power == 0:
       return Expr(1)
     ret = self
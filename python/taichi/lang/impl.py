@@ -84,6 +84,14 @@ def atomic_add(a, b):
   a.atomic_add(Expr(b))
 
 
+def atomic_max(a, b):
+  a.atomic_max(Expr(b))
+
+
+def atomic_min(a, b):
+  a.atomic_min(Expr(b))
+
+
 def subscript(value, *indices):
   try:
     import numpy as np
@@ -519,7 +527,8 @@ def binary(foo):
 
 
 def pow(x, n):
-  assert isinstance(n, int) and n >= 0
+  if not isinstance(n, int) or n < 0:
+    return Expr(taichi_lang_core.expr_pow(Expr(x).ptr, Expr(n).ptr))
   if n == 0:
     return 1
   ret = x
@@ -622,6 +631,11 @@ def min(a, b):
   return Expr(taichi_lang_core.expr_min(a.ptr, b.ptr))
 
 
+@binary
+def atan2(a, b):
+  return Expr(taichi_lang_core.expr_atan2(a.ptr, b.ptr))
+
+
 def append(l, indices, val):
   taichi_lang_core.insert_append(l.ptr, make_expr_group(indices), Expr(val).ptr)
 
@@ -1,12 +1,17 @@
 from taichi.misc.util import ndarray_to_array2d, array2d_to_ndarray
 from taichi.misc.settings import get_os_name, get_directory
 import taichi.core as core
+import numpy as np
 import os
 
 FRAME_FN_TEMPLATE = '%05d.png'
 FRAME_DIR = 'frames'
 
-# Write the frames to the disk and then make videos (mp4 or gif) if necessary
+# Write the frames to the disk and then make videos (mp4 or gif) if necessary.
+# Frames are encoded in the background by a pool of threads. When more than
+# max_pending_frames frames are waiting, write_frame blocks, or drops the frame
+# if drop_when_full is set. With pipe=True, raw frames are streamed to an
+# ffmpeg process instead of being written as PNG files.
 
 def get_ffmpeg_path():
   # return get_directory('external/lib/ffmpeg')
@@ -20,7 +25,11 @@ class VideoManager:
                height=None,
                post_processor=None,
                framerate=24,
-               automatic_build=True):
+               automatic_build=True,
+               num_threads=-1,
+               max_pending_frames=16,
+               drop_when_full=False,
+               pipe=False):
     assert (width is None) == (height is None)
     self.width = width
     self.height = height
@@ -36,12 +45,21 @@ class VideoManager:
     self.frame_counter = 0
     self.frame_fns = []
     self.automatic_build = automatic_build
+    self.max_pending_frames = max_pending_frames
+    self.drop_when_full = drop_when_full
+    self.pipe = pipe
+    if pipe:
+      # started with the resolution of the first frame
+      self.writer = None
+    else:
+      self.writer = core.AsyncFrameWriter(num_threads, max_pending_frames,
+                                          drop_when_full)
 
   def get_output_filename(self, suffix):
     return os.path.join(self.directory, 'video' + suffix)
 
   def write_frame(self, img):
-    if isinstance(img, core.Array2DVector3):
+    if not isinstance(img, np.ndarray):
       img = array2d_to_ndarray(img)
     if img.shape[0] % 2 != 0:
       print('Warning: height is not divisible by 2! Dropping last row')
@@ -51,19 +69,57 @@ class VideoManager:
       img = img[:, :-1]
     if self.post_processor:
       img = self.post_processor.process(img)
+    if len(img.shape) == 2:
+      img = img[:, :, None]
+    if img.shape[2] == 1:
+      # the writer takes RGB frames
+      img = np.repeat(img, 3, axis=2)
+    elif img.shape[2] == 4:
+      img = img[:, :, :3]
     if self.width is None:
       self.width = img.shape[0]
       self.height = img.shape[1]
     assert os.path.exists(self.directory)
-    fn = FRAME_FN_TEMPLATE % self.frame_counter
-    self.frame_fns.append(fn)
-    ndarray_to_array2d(img).write(os.path.join(self.frame_directory, fn))
+    if self.pipe:
+      if self.writer is None:
+        self.writer = core.AsyncFrameWriter(self.get_pipe_command(),
+                                            self.max_pending_frames,
+                                            self.drop_when_full)
+      self.writer.write('', ndarray_to_array2d(img))
+      self.frame_counter += 1
+      return
+    # Dropped frames leave no gap in the sequence read by ffmpeg
+    fn = FRAME_FN_TEMPLATE % len(self.frame_fns)
+    if self.writer.write(
+        os.path.join(self.frame_directory, fn), ndarray_to_array2d(img)):
+      self.frame_fns.append(fn)
     self.frame_counter += 1
     if self.frame_counter % self.next_video_checkpoint == 0:
       if self.automatic_build:
         self.make_video()
         self.next_video_checkpoint *= 2
 
+  def get_pipe_command(self):
+    return (get_ffmpeg_path() + " -loglevel panic -f rawvideo -pix_fmt rgb24"
+            " -s:v %dx%d -framerate %d -i - -c:v libx264 -profile:v high"
+            " -crf 1 -pix_fmt yuv420p -y %s") % (
+                self.width, self.height, self.framerate,
+                self.get_output_filename('.mp4'))
+
+  # Blocks until all frames are written
+  def wait(self):
+    if self.writer is not None:
+      self.writer.wait()
+
+  # Finishes writing the frames and the video
+  def close(self):
+    if self.writer is None:
+      return
+    self.writer.close()
+    if self.pipe:
+      self.writer = None
+      self.make_gif()
+
   def get_frame_directory(self):
     return self.frame_directory
 
@@ -77,6 +133,10 @@ class VideoManager:
         os.remove(fn)
 
   def make_video(self, mp4=True, gif=True):
+    if self.pipe:
+      # the video is written by the ffmpeg process, see close()
+      return
+    self.writer.wait()
 
     command = (get_ffmpeg_path() + " -loglevel panic -framerate %d -i " % self.framerate) + os.path.join(self.frame_directory, FRAME_FN_TEMPLATE) + \
               " -s:v " + str(self.width) + 'x' + str(self.height) + \
@@ -85,28 +145,31 @@ class VideoManager:
     os.system(command)
 
     if gif:
-      # Generate the palette
-      palette_name = self.get_output_filename('_palette.png')
-      if get_os_name() == 'win':
-        command = get_ffmpeg_path() + " -loglevel panic -i %s -vf 'palettegen' -y %s" % (
-            self.get_output_filename('.mp4'), palette_name)
-      else:
-        command = get_ffmpeg_path() + " -loglevel panic -i %s -vf 'fps=%d,scale=320:640:flags=lanczos,palettegen' -y %s" % (
-            self.get_output_filename('.mp4'), self.framerate, palette_name)
-      # print command
-      os.system(command)
-
-      # Generate the GIF
-      command = get_ffmpeg_path() + " -loglevel panic -i %s -i %s -lavfi paletteuse -y %s" % (
-          self.get_output_filename('.mp4'), palette_name,
-          self.get_output_filename('.gif'))
-      # print command
-      os.system(command)
-      os.remove(palette_name)
+      self.make_gif()
 
     if not mp4:
       os.remove(self.get_output_filename('mp4'))
 
+  def make_gif(self):
+    # Generate the palette
+    palette_name = self.get_output_filename('_palette.png')
+    if get_os_name() == 'win':
+      command = get_ffmpeg_path() + " -loglevel panic -i %s -vf 'palettegen' -y %s" % (
+          self.get_output_filename('.mp4'), palette_name)
+    else:
+      command = get_ffmpeg_path() + " -loglevel panic -i %s -vf 'fps=%d,scale=320:640:flags=lanczos,palettegen' -y %s" % (
+          self.get_output_filename('.mp4'), self.framerate, palette_name)
+    # print command
+    os.system(command)
+
+    # Generate the GIF
+    command = get_ffmpeg_path() + " -loglevel panic -i %s -i %s -lavfi paletteuse -y %s" % (
+        self.get_output_filename('.mp4'), palette_name,
+        self.get_output_filename('.gif'))
+    # print command
+    os.system(command)
+    os.remove(palette_name)
+
 def interpolate_frames(frame_dir, mul=4):
   # TODO: remove dependency on cv2 here
   import cv2
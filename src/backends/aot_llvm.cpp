@@ -0,0 +1,380 @@
+// Ahead-of-time export of kernels to a standalone shared library
+
+#include <cctype>
+#include <fstream>
+#include <set>
+#include <taichi/common/util.h>
+#include "../program.h"
+
+#if defined(TLANG_WITH_LLVM)
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetRegistry.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include "codegen_llvm.h"
+#include "llvm_jit.h"
+#endif
+
+TLANG_NAMESPACE_BEGIN
+
+#if defined(TLANG_WITH_LLVM)
+
+namespace {
+
+std::string c_type_name(DataType dt) {
+  switch (dt) {
+    case DataType::f32:
+      return "float";
+    case DataType::f64:
+      return "double";
+    case DataType::i8:
+      return "int8_t";
+    case DataType::i16:
+      return "int16_t";
+    case DataType::i32:
+      return "int32_t";
+    case DataType::i64:
+      return "int64_t";
+    case DataType::u8:
+      return "uint8_t";
+    case DataType::u16:
+      return "uint16_t";
+    case DataType::u32:
+      return "uint32_t";
+    case DataType::u64:
+      return "uint64_t";
+    default:
+      TC_ERROR("Data type {} cannot be exported", data_type_name(dt));
+  }
+  return "";
+}
+
+bool is_c_identifier(const std::string &s) {
+  if (s.empty() || std::isdigit(s[0]))
+    return false;
+  for (auto c : s) {
+    if (!std::isalnum(c) && c != '_')
+      return false;
+  }
+  return true;
+}
+
+std::string sanitize(std::string s) {
+  for (auto &c : s) {
+    if (!std::isalnum(c))
+      c = '_';
+  }
+  return s;
+}
+
+void collect_places(SNode *snode, std::vector<SNode *> &places) {
+  if (snode->type == SNodeType::place)
+    places.push_back(snode);
+  for (auto &ch : snode->ch)
+    collect_places(ch.get(), places);
+}
+
+// Exported kernel: the C symbol and the LLVM entry function behind it
+struct ExportedKernel {
+  Kernel *kernel;
+  std::string symbol;
+  std::string entry;
+};
+
+// Exported place node and the name of its C accessor
+struct ExportedField {
+  SNode *snode;
+  std::string symbol;
+};
+
+// The CPU the library is compiled for (see CompileConfig::export_target_cpu)
+std::string export_cpu(const CompileConfig &config) {
+  if (config.export_target_cpu == "native")
+    return llvm::sys::getHostCPUName().str();
+  return config.export_target_cpu;
+}
+
+void emit_object(llvm::Module &module,
+                 const std::string &fn,
+                 const CompileConfig &config) {
+  auto triple = llvm::sys::getProcessTriple();
+  std::string err;
+  auto target = llvm::TargetRegistry::lookupTarget(triple, err);
+  TC_ERROR_UNLESS(target, err);
+
+  bool fast_math = config.fast_math;
+  llvm::TargetOptions options;
+  options.AllowFPOpFusion =
+      fast_math ? llvm::FPOpFusion::Fast : llvm::FPOpFusion::Strict;
+  options.UnsafeFPMath = fast_math;
+  options.NoInfsFPMath = fast_math;
+  options.NoNaNsFPMath = fast_math;
+  std::unique_ptr<llvm::TargetMachine> target_machine(
+      target->createTargetMachine(triple, export_cpu(config), "", options,
+                                  llvm::Reloc::PIC_,
+                                  llvm::CodeModel::Small,
+                                  llvm::CodeGenOpt::Aggressive));
+  TC_ERROR_UNLESS(target_machine, "Could not allocate target machine!");
+  module.setTargetTriple(triple);
+  module.setDataLayout(target_machine->createDataLayout());
+
+  std::error_code ec;
+  llvm::raw_fd_ostream dest(fn, ec, llvm::sys::fs::F_None);
+  TC_ERROR_IF(ec, "Cannot open {}: {}", fn, ec.message());
+  llvm::legacy::PassManager pass;
+  TC_ERROR_IF(target_machine->addPassesToEmitFile(
+                  pass, dest, nullptr, llvm::TargetMachine::CGFT_ObjectFile),
+              "The target machine cannot emit object files");
+  pass.run(module);
+  dest.flush();
+}
+
+std::string kernel_signature(const ExportedKernel &k) {
+  std::string ret = fmt::format("void {}(TaichiDataStructure *ds", k.symbol);
+  auto &args = k.kernel->args;
+  for (int i = 0; i < (int)args.size(); i++) {
+    auto type = c_type_name(args[i].dt);
+    if (args[i].is_nparray)
+      type += " *";
+    else
+      type += " ";
+    ret += fmt::format(", {}arg{}", type, i);
+  }
+  return ret + ")";
+}
+
+std::string accessor_signature(const ExportedField &f) {
+  std::string ret = fmt::format("{} *{}(TaichiDataStructure *ds",
+                                c_type_name(f.snode->dt), f.symbol);
+  for (int i = 0; i < f.snode->num_active_indices; i++) {
+    ret += fmt::format(", int i{}", i);
+  }
+  return ret + ")";
+}
+
+std::string generate_header(const std::vector<ExportedKernel> &kernels,
+                            const std::vector<ExportedField> &fields) {
+  std::string ret;
+  auto emit = [&](const std::string &line) { ret += line + "\n"; };
+  emit("// Generated by taichi. Do not edit.");
+  emit("#pragma once");
+  emit("");
+  emit("#include <stdint.h>");
+  emit("");
+  emit("#ifdef __cplusplus");
+  emit("extern \"C\" {");
+  emit("#endif");
+  emit("");
+  emit("typedef struct TaichiDataStructure TaichiDataStructure;");
+  emit("");
+  emit("TaichiDataStructure *create_data_structure(void);");
+  emit("void destroy_data_structure(TaichiDataStructure *ds);");
+  emit("");
+  emit("// Kernels");
+  for (auto &k : kernels)
+    emit(kernel_signature(k) + ";");
+  emit("");
+  emit("// Field accessors, indexed like Expr::val");
+  for (auto &f : fields)
+    emit(accessor_signature(f) + ";");
+  emit("");
+  emit("#ifdef __cplusplus");
+  emit("}");
+  emit("#endif");
+  return ret;
+}
+
+std::string generate_source(const std::string &header,
+                            const std::vector<ExportedKernel> &kernels,
+                            const std::vector<ExportedField> &fields) {
+  std::string ret;
+  auto emit = [&](const std::string &line) { ret += line + "\n"; };
+  emit("// Generated by taichi. Do not edit.");
+  emit(fmt::format("#include \"{}\"", header));
+  emit("#include <sys/mman.h>");
+  emit("#include <cstring>");
+  emit("#include <utility>");
+  emit("#include <vector>");
+  emit("");
+  emit("struct TaichiDataStructure {");
+  emit("  void *root;");
+  emit("  void *runtime;");
+  emit("  uint32_t num_launches;");
+  emit("  std::vector<std::pair<void *, std::size_t>> allocations;");
+  emit("};");
+  emit("");
+  emit("namespace {");
+  emit("");
+  emit("// Must match Context in the runtime");
+  emit("struct Context {");
+  emit("  void *buffer;");
+  emit(fmt::format("  uint64_t args[{}];", max_num_args));
+  emit("  void *leaves;");
+  emit("  int num_leaves;");
+  emit("  void *cpu_profiler;");
+  emit("  void *runtime;");
+  emit("  uint32_t rand_seed;");
+  emit("  uint32_t launch_id;");
+  emit("  void *allocator;");
+  emit("};");
+  emit("");
+  emit("}  // namespace");
+  emit("");
+  emit("extern \"C\" {");
+  emit("");
+  emit("void *initialize_data_structure(void *runtime, void *allocator);");
+  for (auto &k : kernels)
+    emit(fmt::format("void {}(Context *context);", k.entry));
+  for (auto &f : fields) {
+    emit(fmt::format("void *leaf_accessor_{}(void *root, int, int, int, int);",
+                     f.snode->node_type_name));
+  }
+  emit("");
+  emit("// The runtime only allocates while the data structure is created, and");
+  emit("// passes the data structure back as the allocator");
+  emit("__attribute__((visibility(\"hidden\")))");
+  emit("void *taichi_allocate_aligned(void *allocator, std::size_t size,");
+  emit("                              int alignment) {");
+  emit("  void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,");
+  emit("                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,");
+  emit("                   -1, 0);");
+  emit("  if (ptr == MAP_FAILED)");
+  emit("    return nullptr;");
+  emit("  ((TaichiDataStructure *)allocator)->allocations.emplace_back(ptr, size);");
+  emit("  return ptr;");
+  emit("}");
+  emit("");
+  emit("TaichiDataStructure *create_data_structure(void) {");
+  emit("  auto ds = new TaichiDataStructure();");
+  emit("  ds->root = initialize_data_structure(&ds->runtime, ds);");
+  emit("  return ds;");
+  emit("}");
+  emit("");
+  emit("void destroy_data_structure(TaichiDataStructure *ds) {");
+  emit("  for (auto &a : ds->allocations)");
+  emit("    munmap(a.first, a.second);");
+  emit("  delete ds;");
+  emit("}");
+  for (auto &k : kernels) {
+    emit("");
+    emit(kernel_signature(k) + " {");
+    emit("  Context context;");
+    emit("  std::memset(&context, 0, sizeof(context));");
+    emit("  context.buffer = ds->root;");
+    emit("  context.runtime = ds->runtime;");
+    emit("  context.launch_id = ds->num_launches++;");
+    for (int i = 0; i < (int)k.kernel->args.size(); i++) {
+      emit(fmt::format(
+          "  std::memcpy(&context.args[{}], &arg{}, sizeof(arg{}));", i, i, i));
+    }
+    emit(fmt::format("  {}(&context);", k.entry));
+    emit("}");
+  }
+  for (auto &f : fields) {
+    // physical_index_position[i] is the physical slot of the i-th index
+    std::string ind[max_num_indices];
+    for (int i = 0; i < max_num_indices; i++)
+      ind[i] = "0";
+    for (int i = 0; i < f.snode->num_active_indices; i++)
+      ind[f.snode->physical_index_position[i]] = fmt::format("i{}", i);
+    emit("");
+    emit(accessor_signature(f) + " {");
+    emit(fmt::format(
+        "  return ({} *)leaf_accessor_{}(ds->root, {}, {}, {}, {});",
+        c_type_name(f.snode->dt), f.snode->node_type_name, ind[0], ind[1],
+        ind[2], ind[3]));
+    emit("}");
+  }
+  emit("");
+  emit("}");
+  return ret;
+}
+
+}  // namespace
+
+void Program::export_library(const std::string &prefix,
+                             const std::vector<Kernel *> &kernels) {
+  TC_ERROR_UNLESS(config.arch == Arch::x86_64 && config.use_llvm,
+                  "Only the x86_64 LLVM backend supports library export");
+  TC_ERROR_UNLESS(snode_root, "Materialize the layout before exporting");
+  CurrentProgramGuard _(*this);
+
+  auto tlctx = get_llvm_context(Arch::x86_64);
+  auto module = tlctx->clone_struct_module();
+  std::set<std::string> exported{"initialize_data_structure"};
+
+  std::vector<ExportedKernel> exported_kernels;
+  for (auto kernel : kernels) {
+    ExportedKernel k;
+    k.kernel = kernel;
+    k.symbol = kernel->name + (kernel->grad ? "_grad" : "");
+    TC_ERROR_UNLESS(is_c_identifier(kernel->name),
+                    "Kernel name [{}] is not a valid C identifier",
+                    kernel->name);
+    for (auto &other : exported_kernels) {
+      TC_ERROR_IF(other.symbol == k.symbol, "Kernel [{}] exported twice",
+                  k.symbol);
+    }
+    // lowers and offloads the IR
+    if (!kernel->compiled)
+      kernel->compile();
+    current_kernel = kernel;
+    CodeGenLLVM gen(nullptr, kernel);
+    gen.emit_to_module();
+    gen.emit_entry_function();
+    current_kernel = nullptr;
+    k.entry = gen.kernel_name;
+    exported.insert(k.entry);
+    // Defined functions of the kernel module are private, so the duplicated
+    // runtime functions are renamed instead of clashing
+    TC_ERROR_IF(llvm::Linker::linkModules(*module, std::move(gen.module)),
+                "Failed to link kernel [{}]", k.symbol);
+    exported_kernels.push_back(k);
+  }
+
+  std::vector<SNode *> places;
+  collect_places(snode_root, places);
+  std::vector<ExportedField> fields;
+  std::set<std::string> field_symbols;
+  for (auto snode : places) {
+    auto symbol = "access_" + sanitize(snode->name);
+    if (snode->name.empty() || field_symbols.count(symbol))
+      symbol += "_" + snode->node_type_name;
+    field_symbols.insert(symbol);
+    fields.push_back(ExportedField{snode, symbol});
+    exported.insert("leaf_accessor_" + snode->node_type_name);
+  }
+
+  // Everything else is internal to the library and may be inlined or dropped
+  for (auto &f : *module) {
+    if (!f.isDeclaration() && !exported.count(f.getName().str()))
+      f.setLinkage(llvm::Function::InternalLinkage);
+  }
+  global_optimize_module_x86_64(module, config.fast_math, export_cpu(config));
+
+  auto header = prefix + ".h";
+  auto header_name = header.substr(header.find_last_of('/') + 1);
+  emit_object(*module, prefix + ".o", config);
+  std::ofstream(header) << generate_header(exported_kernels, fields);
+  std::ofstream(prefix + ".cpp")
+      << generate_source(header_name, exported_kernels, fields);
+
+  auto cmd = fmt::format("{} -shared -fPIC -O2 -std=c++14 {}.cpp {}.o -o {}.so",
+                         config.compiler_name(), prefix, prefix, prefix);
+  TC_ERROR_IF(std::system(cmd.c_str()), "Linking failed: {}", cmd);
+  TC_INFO("Exported {} kernel(s) to {}.so", kernels.size(), prefix);
+}
+
+#else
+
+void Program::export_library(const std::string &prefix,
+                             const std::vector<Kernel *> &kernels) {
+  TC_ERROR("LLVM not found");
+}
+
+#endif
+
+TLANG_NAMESPACE_END
@@ -62,27 +62,29 @@ void CodeGenBase::disassemble() {
 }
 
 FunctionType CodeGenBase::load_function() {
-  return load_function<FunctionType>(func_name);
+  // generated kernels take the context by value
+  auto func = load_function<std::function<void(Context)>>(func_name);
+  return [func](Context &context) { func(context); };
 }
 
 std::string CodeGenBase::get_source_name() {
   return fmt::format("tmp{:04d}.{}", id, suffix);
 }
 
-void CodeGenBase::generate_binary(std::string extra_flags) {
+void CodeGenBase::generate_binary(CompileConfig &config,
+                                  std::string extra_flags) {
   auto t = Time::get_time();
   write_source();
   auto format_ret =
       std::system(fmt::format("clang-format -i {}", get_source_path()).c_str());
   trash(format_ret);
   auto pp_fn = get_source_path() + ".i";
-  auto preprocess_cmd = get_current_program().config.preprocess_cmd(
+  auto preprocess_cmd = config.preprocess_cmd(
       get_source_path(), pp_fn, extra_flags);
   auto ret = std::system(preprocess_cmd.c_str());
   if (ret) {
     trash(std::system(
-        get_current_program()
-            .config.preprocess_cmd(get_source_path(), pp_fn, extra_flags, true)
+        config.preprocess_cmd(get_source_path(), pp_fn, extra_flags, true)
             .c_str()));
     TC_ERROR("Preprocessing failed.");
   }
@@ -106,12 +108,12 @@ void CodeGenBase::generate_binary(std::string extra_flags) {
         fmt::format("cp {} {}", get_source_path(), get_source_path())
             .c_str()));
             */
-    auto cmd = get_current_program().config.compile_cmd(
+    auto cmd = config.compile_cmd(
         get_source_path(), get_library_path(), extra_flags);
     auto compile_ret = std::system(cmd.c_str());
     if (compile_ret != 0) {
       TC_WARN("Compilation cmd: {}", cmd);
-      auto cmd = get_current_program().config.compile_cmd(
+      auto cmd = config.compile_cmd(
           get_source_path(), get_library_path(), extra_flags, true);
       trash(std::system(cmd.c_str()));
       TC_ERROR("Source {} compilation failed.", get_source_path());
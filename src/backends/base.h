@@ -5,6 +5,7 @@
 #include "../snode.h"
 #include "../ir.h"
 #include "../program.h"
+#include <atomic>
 #include <dlfcn.h>
 
 TLANG_NAMESPACE_BEGIN
@@ -65,8 +66,10 @@ class CodeGenBase {
 #define CODE_REGION_VAR(region) auto _____ = codegen->get_region_guard(region);
 
   static int get_kernel_id() {
-    static int id = 0;
-    TC_ASSERT(id < 10000);
+    // programs on different threads generate code concurrently. The ids are
+    // unique within the process, as the programs share the cache folder, and
+    // are not bounded since programs may be created throughout its lifetime.
+    static std::atomic<int> id(0);
     return id++;
   }
 
@@ -121,7 +124,7 @@ class CodeGenBase {
 
   FunctionType load_function();
 
-  void generate_binary(std::string extra_flags);
+  void generate_binary(CompileConfig &config, std::string extra_flags);
 
   void disassemble();
 
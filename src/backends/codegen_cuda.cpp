@@ -3,6 +3,7 @@
 #include "codegen_cuda.h"
 #include "loopgen.h"
 #include "../scratch_pad.h"
+#include "../pass_manager.h"
 
 TLANG_NAMESPACE_BEGIN
 
@@ -225,6 +226,7 @@ class GPUIRCodeGen : public IRVisitor {
           vars += ",";
         }
       }
+      emit("allocator() = context.allocator;");
       emit("gpu_runtime_init();");
       emit("int blockDim = ({}::get_max_n()+ {} - 1) / {};",
            leaf->node_type_name, block_division, block_division);
@@ -254,7 +256,7 @@ class GPUIRCodeGen : public IRVisitor {
 
         emit("cudaEvent_t start, stop;");
 
-        if (current_program->get_current_kernel().benchmarking) {
+        if (codegen->kernel->benchmarking) {
           emit("while(1) {{");
         }
 
@@ -281,7 +283,7 @@ class GPUIRCodeGen : public IRVisitor {
         emit(
             R"(std::cout << "     device only : " << milliseconds << " ms\n";)");
 
-        if (current_program->current_kernel->benchmarking) {
+        if (codegen->kernel->benchmarking) {
           emit("cudaDeviceSynchronize();\n");
           emit("auto err = cudaGetLastError();");
           emit("if (err) {{");
@@ -350,6 +352,7 @@ class GPUIRCodeGen : public IRVisitor {
         TC_WARN("Using default block size = 256");
         block_size = 256;
       }
+      emit("allocator() = context.allocator;");
       emit("gpu_runtime_init();");
       int num_blocks = (end - begin + block_size - 1) / block_size;
       if (cfg.enable_profiler)
@@ -406,7 +409,8 @@ class GPUIRCodeGen : public IRVisitor {
       } else if (pure_loop) {
         emit("extern \"C\" void {} (Context context) {{\n", codegen->func_name);
         emit("auto root = ({} *)context.buffers[0];",
-             current_program->snode_root->node_type_name);
+             codegen->prog->snode_root->node_type_name);
+        emit("allocator() = context.allocator;");
         for (int i = 0; i < (int)stmt_list->statements.size(); i++) {
           auto s = stmt_list->statements[i].get();
           if (s->is<StructForStmt>() || s->is<RangeForStmt>()) {
@@ -427,6 +431,7 @@ class GPUIRCodeGen : public IRVisitor {
 
         // CPU Kernel code
         emit("extern \"C\" void {} (Context context) {{\n", codegen->func_name);
+        emit("allocator() = context.allocator;");
         emit("gpu_runtime_init();");
 
         if (cfg.enable_profiler)
@@ -938,9 +943,10 @@ class GPUIRCodeGen : public IRVisitor {
 
     emit("extern \"C\" void {} (Context context) {{\n", codegen->func_name);
     emit("auto root = ({} *)context.buffers[0];",
-         current_program->snode_root->node_type_name);
+         codegen->prog->snode_root->node_type_name);
     emit("{{");
 
+    emit("allocator() = context.allocator;");
     emit("gpu_runtime_init();");
     emit("int blockDim = {};", max_gpu_block_size);
     emit("");
@@ -975,155 +981,85 @@ class GPUIRCodeGen : public IRVisitor {
 
 void GPUCodeGen::lower_cuda() {
   auto ir = kernel->ir;
-  if (prog->config.print_ir) {
-    irpass::print(ir);
-  }
-  irpass::lower(ir);
-  irpass::re_id(ir);
-  if (prog->config.print_ir) {
-    irpass::print(ir);
-  }
-  irpass::typecheck(ir);
-  irpass::re_id(ir);
-  if (prog->config.print_ir) {
-    irpass::print(ir);
-  }
-  irpass::constant_fold(ir);
-  if (prog->config.simplify_before_lower_access) {
-    irpass::simplify(ir);
-    irpass::re_id(ir);
-    if (prog->config.print_ir) {
-      TC_TRACE("Simplified I:");
-      irpass::print(ir);
-    }
+  auto &config = prog->config;
+  PassManager passes(ir, config);
+  if (config.print_ir)
+    passes.print("Initial IR");
+  passes.run("Lowered", [&] { irpass::lower(ir); });
+  passes.run("Typechecked", [&] { irpass::typecheck(ir); });
+  passes.run("Constant folded", [&] { irpass::constant_fold(ir); });
+  if (config.simplify_before_lower_access) {
+    passes.run("Simplified I", [&] { irpass::simplify(ir); });
   }
   if (kernel->grad) {
-    // irpass::re_id(ir);
-    // TC_TRACE("Primal:");
-    // irpass::print(ir);
-    irpass::make_adjoint(ir);
-    irpass::typecheck(ir);
-    // irpass::re_id(ir);
-    // TC_TRACE("Adjoint:");
-    // irpass::print(ir);
+    passes.run("Adjoint", [&] {
+      irpass::make_adjoint(ir);
+      irpass::typecheck(ir);
+    });
   }
-  if (prog->config.lower_access || prog->config.use_llvm) {
+  if (config.lower_access || config.use_llvm) {
     TC_INFO("Always lower access when using llvm");
-    irpass::lower_access(ir, prog->config.use_llvm);
-    if (prog->config.print_ir) {
-      TC_TRACE("Access Lowered:");
-      irpass::re_id(ir);
-      irpass::print(ir);
-    }
-    if (prog->config.simplify_after_lower_access) {
-      irpass::die(ir);
-      if (prog->config.print_ir) {
-        TC_TRACE("DIEd:");
-        irpass::re_id(ir);
-        irpass::print(ir);
-      }
-      irpass::simplify(ir);
-      if (prog->config.print_ir) {
-        TC_TRACE("Simplified II:");
-        irpass::re_id(ir);
-        irpass::print(ir);
-      }
+    passes.run("Access Lowered",
+               [&] { irpass::lower_access(ir, config.use_llvm); });
+    if (config.simplify_after_lower_access) {
+      passes.run("DIEd", [&] { irpass::die(ir); });
+      passes.run("Simplified II", [&] { irpass::simplify(ir); });
     }
   }
-  irpass::die(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("DIEd:");
-    irpass::re_id(ir);
-    irpass::print(ir);
+  passes.run("DIEd", [&] { irpass::die(ir); });
+  passes.run("Access Flagged", [&] { irpass::flag_access(ir); });
+  if (config.hoist_loop_invariants) {
+    passes.run("Loop Invariants Hoisted",
+               [&] { irpass::loop_invariant_code_motion(ir); });
   }
-  irpass::flag_access(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("Access Flagged:");
-    irpass::re_id(ir);
-    irpass::print(ir);
+  if (config.value_numbering) {
+    passes.run("Value Numbered", [&] { irpass::global_value_numbering(ir); });
   }
+  // statement ids are used as variable names in the generated source
+  irpass::re_id(ir);
 }
 
 void GPUCodeGen::lower_llvm() {
   auto ir = kernel->ir;
-  if (prog->config.print_ir) {
-    irpass::print(ir);
-  }
-  irpass::lower(ir);
-  irpass::re_id(ir);
-  if (prog->config.print_ir) {
-    irpass::print(ir);
-  }
-  irpass::typecheck(ir);
-  irpass::re_id(ir);
-  if (prog->config.print_ir) {
-    irpass::print(ir);
-  }
-  irpass::constant_fold(ir);
-  if (prog->config.simplify_before_lower_access) {
-    irpass::simplify(ir);
-    irpass::re_id(ir);
-    if (prog->config.print_ir) {
-      TC_TRACE("Simplified I:");
-      irpass::print(ir);
-    }
+  auto &config = prog->config;
+  PassManager passes(ir, config);
+  if (config.print_ir)
+    passes.print("Initial IR");
+  passes.run("Lowered", [&] { irpass::lower(ir); });
+  passes.run("Typechecked", [&] { irpass::typecheck(ir); });
+  passes.run("Constant folded", [&] { irpass::constant_fold(ir); });
+  if (config.simplify_before_lower_access) {
+    passes.run("Simplified I", [&] { irpass::simplify(ir); });
   }
   if (kernel->grad) {
-    // irpass::re_id(ir);
-    // TC_TRACE("Primal:");
-    // irpass::print(ir);
-    irpass::make_adjoint(ir);
-    irpass::typecheck(ir);
-    // irpass::re_id(ir);
-    // TC_TRACE("Adjoint:");
-    // irpass::print(ir);
+    passes.run("Adjoint", [&] {
+      irpass::make_adjoint(ir);
+      irpass::typecheck(ir);
+    });
   }
-  if (prog->config.lower_access || prog->config.use_llvm) {
-    // TC_DEBUG("Always lower access when using llvm");
-    irpass::lower_access(ir, prog->config.use_llvm);
-    if (prog->config.print_ir) {
-      TC_TRACE("Access Lowered:");
-      irpass::re_id(ir);
-      irpass::print(ir);
+  if (config.lower_access || config.use_llvm) {
+    passes.run("Access Lowered",
+               [&] { irpass::lower_access(ir, config.use_llvm); });
+    if (config.simplify_after_lower_access) {
+      passes.run("DIEd", [&] { irpass::die(ir); });
+      passes.run("Simplified II", [&] { irpass::simplify(ir); });
     }
-    if (prog->config.simplify_after_lower_access) {
-      irpass::die(ir);
-      if (prog->config.print_ir) {
-        TC_TRACE("DIEd:");
-        irpass::re_id(ir);
-        irpass::print(ir);
-      }
-      irpass::simplify(ir);
-      if (prog->config.print_ir) {
-        TC_TRACE("Simplified II:");
-        irpass::re_id(ir);
-        irpass::print(ir);
-      }
-    }
-  }
-  irpass::die(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("DIEd:");
-    irpass::re_id(ir);
-    irpass::print(ir);
   }
-  irpass::flag_access(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("Access Flagged:");
-    irpass::re_id(ir);
-    irpass::print(ir);
+  passes.run("DIEd", [&] { irpass::die(ir); });
+  passes.run("Access Flagged", [&] { irpass::flag_access(ir); });
+  if (config.hoist_loop_invariants) {
+    passes.run("Loop Invariants Hoisted",
+               [&] { irpass::loop_invariant_code_motion(ir); });
   }
-  irpass::offload(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("Offloaded:");
-    irpass::re_id(ir);
-    irpass::print(ir);
+  if (config.value_numbering) {
+    passes.run("Value Numbered", [&] { irpass::global_value_numbering(ir); });
   }
-  irpass::full_simplify(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("Simplified III:");
-    irpass::re_id(ir);
-    irpass::print(ir);
+  passes.run("Offloaded", [&] { irpass::offload(ir); });
+  passes.run("Simplified III", [&] { irpass::full_simplify(ir); });
+  if (config.demote_atomics) {
+    // GPU struct-fors run the prologue and epilogue once per thread and leaf
+    // block; range-fors once per iteration, where this gains nothing
+    passes.run("Atomics Demoted", [&] { irpass::demote_atomics(ir); });
   }
 }
 
@@ -8,6 +8,8 @@
 #include "../util.h"
 #include "../program.h"
 #include "../ir.h"
+#include "../pass_manager.h"
+#include "../scratch_pad.h"
 
 #if defined(TLANG_WITH_LLVM)
 #include "llvm_codegen_utils.h"
@@ -25,6 +27,7 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
 
   CodeGenBase *codegen;
   Kernel *kernel;
+  Program *prog;
   std::string kernel_name;
   std::vector<Value *> kernel_args;
   llvm::Type *context_ty;
@@ -35,12 +38,16 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
   llvm::FunctionType *task_function_type;
   OffloadedStmt *current_offloaded_stmt;
   int task_counter;
+  // RandState of the current loop iteration, if the task uses RandStmt
+  llvm::Value *rand_state;
+  // Block-local buffers of the current struct_for task
+  std::unordered_map<SNode *, llvm::Value *> block_local_buffers;
 
   void initialize_context() {
-    if (get_current_program().config.arch == Arch::gpu) {
-      tlctx = get_current_program().llvm_context_device.get();
+    if (prog->config.arch == Arch::gpu) {
+      tlctx = prog->llvm_context_device.get();
     } else {
-      tlctx = get_current_program().llvm_context_host.get();
+      tlctx = prog->llvm_context_host.get();
     }
     llvm_context = tlctx->ctx.get();
     jit = tlctx->jit.get();
@@ -53,15 +60,11 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
    public:
     std::string name;
     CodeGenLLVM *codegen;
-    using task_fp_type = int32 (*)(void *);
-    task_fp_type func;
 
     int block_dim;
     int grid_dim;
-    void *cuda_func;
 
     OffloadedTask(CodeGenLLVM *codegen) : codegen(codegen) {
-      func = nullptr;
     }
 
     void begin(std::string name) {
@@ -71,19 +74,6 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
     void end() {
       codegen->offloaded_tasks.push_back(*this);
     }
-
-    void compile() {
-      TC_ASSERT(!func);
-      auto kernel_symbol = codegen->jit->lookup(name);
-      TC_ASSERT_INFO(kernel_symbol, "Function not found");
-
-      func = (task_fp_type)(void *)(llvm::cantFail(kernel_symbol.getAddress()));
-    }
-
-    void operator()(Context *context) {
-      TC_ASSERT(func);
-      func(context);
-    }
   };
 
   std::unique_ptr<OffloadedTask> current_task;
@@ -91,11 +81,13 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
 
   CodeGenLLVM(CodeGenBase *codegen, Kernel *kernel)
       // TODO: simplify ModuleBuilder ctor input
-      : ModuleBuilder(get_current_program()
-                          .get_llvm_context(get_current_program().config.arch)
-                          ->clone_struct_module()),
+      : ModuleBuilder(
+            kernel->program.get_llvm_context(kernel->program.config.arch)
+                ->clone_struct_module()),
         kernel(kernel),
-        task_counter(0) {
+        prog(&kernel->program),
+        task_counter(0),
+        rand_state(nullptr) {
     initialize_context();
 
     context_ty = get_runtime_type("Context");
@@ -211,18 +203,36 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
     kernel->ir->accept(this);
   }
 
-  virtual FunctionType compile_module_to_executable() {
-    jit->addModule(std::move(module));
-
+  // Emits the kernel entry function, named kernel_name, which calls the
+  // offloaded tasks in order. A launch is then a single indirect call.
+  void emit_entry_function() {
+    auto entry_type =
+        llvm::FunctionType::get(llvm::Type::getVoidTy(*llvm_context),
+                                {PointerType::get(context_ty, 0)}, false);
+    auto entry = Function::Create(entry_type, Function::ExternalLinkage,
+                                  kernel_name, module.get());
+    auto bb = BasicBlock::Create(*llvm_context, "entry", entry);
+    llvm::IRBuilder<> entry_builder(bb);
+    llvm::Value *context = &*entry->arg_begin();
     for (auto &task : offloaded_tasks) {
-      task.compile();
+      auto task_func = module->getFunction(task.name);
+      TC_ASSERT(task_func);
+      entry_builder.CreateCall(task_func, {context});
     }
-    auto offloaded_tasks_local = offloaded_tasks;
-    return [=](Context context) {
-      for (auto task : offloaded_tasks_local) {
-        task(&context);
-      }
-    };
+    entry_builder.CreateRetVoid();
+    TC_ASSERT(!llvm::verifyFunction(*entry, &errs()));
+  }
+
+  virtual FunctionType compile_module_to_executable() {
+    emit_entry_function();
+    jit->addModule(std::move(module), prog->config.fast_math);
+
+    auto entry_symbol = jit->lookup(kernel_name);
+    TC_ASSERT_INFO(entry_symbol, "Function not found");
+    using entry_fp_type = void (*)(Context *);
+    auto entry =
+        (entry_fp_type)(void *)(llvm::cantFail(entry_symbol.getAddress()));
+    return [entry](Context &context) { entry(&context); };
   }
 
   virtual FunctionType gen() {
@@ -251,9 +261,39 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
   }
 
   void visit(RandStmt *stmt) {
-    TC_ASSERT(stmt->ret_type.data_type == DataType::f32);
-    emit("const auto {} = {}::rand();", stmt->raw_name(),
-         stmt->ret_data_type_name());
+    TC_ASSERT(stmt->width() == 1);
+    TC_ASSERT(rand_state);
+    stmt->value = create_call(
+        fmt::format("rand_{}", data_type_short_name(stmt->ret_type.data_type)),
+        {rand_state});
+  }
+
+  // Seeds the random number stream of a loop iteration (see RandState in the
+  // runtime). Must be called at the beginning of each iteration.
+  void init_rand_state(OffloadedStmt *stmt, std::vector<llvm::Value *> indices) {
+    rand_state = nullptr;
+    bool uses_rand = false;
+    for (auto s : gather_statements(stmt->body.get()))
+      uses_rand |= s->is<RandStmt>();
+    if (!uses_rand)
+      return;
+    rand_state = create_entry_block_alloca(get_runtime_type("RandState"));
+    while ((int)indices.size() < max_num_indices)
+      indices.push_back(tlctx->get_constant(0));
+    // init_task_function has counted the current task
+    int task_id = task_counter - 1;
+    create_call("RandState_initialize",
+                {rand_state, get_context(), tlctx->get_constant(task_id),
+                 indices[0], indices[1], indices[2], indices[3]});
+  }
+
+  // Name of the runtime function computing the real function `name`. With
+  // fast_math, the vectorizable approximations are used instead of libm.
+  virtual std::string real_function_name(const std::string &name,
+                                         DataType dt) {
+    TC_ASSERT(dt == DataType::f32 || dt == DataType::f64);
+    return fmt::format("{}{}_{}", prog->config.fast_math ? "fast_" : "", name,
+                       data_type_short_name(dt));
   }
 
   virtual void emit_extra_unary(UnaryOpStmt *stmt) {
@@ -277,19 +317,25 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
       TC_NOT_IMPLEMENTED                                               \
     }                                                                  \
   }
+#define UNARY_REAL(x)                                                   \
+  else if (op == UnaryOpType::x && is_real(input_taichi_type)) {        \
+    stmt->value =                                                       \
+        create_call(real_function_name(#x, input_taichi_type), {input}); \
+  }
     if (false) {
     }
     UNARY_STD(abs)
-    UNARY_STD(exp)
-    UNARY_STD(log)
-    UNARY_STD(tan)
-    UNARY_STD(tanh)
+    UNARY_REAL(exp)
+    UNARY_REAL(log)
+    UNARY_REAL(tan)
+    UNARY_REAL(tanh)
     UNARY_STD(sgn)
     UNARY_STD(logic_not)
     else {
       TC_P(unary_op_type_name(op));
       TC_NOT_IMPLEMENTED
     }
+#undef UNARY_REAL
 #undef UNARY_STD
   }
 
@@ -312,6 +358,12 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
         stmt->value = builder->CreateCall(sqrt_fn, input, "sqrt");
       } else if (op == UnaryOpType::neg) {
         stmt->value = builder->CreateFNeg(input, "neg");
+      } else if ((op == UnaryOpType::sin || op == UnaryOpType::cos) &&
+                 prog->config.fast_math && is_real(input_taichi_type)) {
+        // the intrinsics become libm calls on CPUs
+        stmt->value = create_call(
+            real_function_name(unary_op_type_name(op), input_taichi_type),
+            {input});
       }
       UNARY_INTRINSIC(sin)
       UNARY_INTRINSIC(cos)
@@ -440,6 +492,12 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
         TC_P(data_type_name(ret_type));
         TC_NOT_IMPLEMENTED
       }
+    } else if (op == BinaryOpType::atan2 || op == BinaryOpType::pow) {
+      TC_ERROR_UNLESS(is_real(ret_type), "{} is only defined for reals.",
+                      binary_op_type_name(op));
+      stmt->value =
+          create_call(real_function_name(binary_op_type_name(op), ret_type),
+                      {stmt->lhs->value, stmt->rhs->value});
     } else if (is_comparison(op)) {
       llvm::Value *cmp = nullptr;
       auto input_type = stmt->lhs->ret_type.data_type;
@@ -751,22 +809,44 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
     }
   }
 
+  static llvm::AtomicRMWInst::BinOp atomic_rmw_op(AtomicOpType op,
+                                                 DataType dt) {
+    if (op == AtomicOpType::add) {
+      return llvm::AtomicRMWInst::BinOp::Add;
+    } else if (op == AtomicOpType::max) {
+      return is_unsigned(dt) ? llvm::AtomicRMWInst::BinOp::UMax
+                             : llvm::AtomicRMWInst::BinOp::Max;
+    } else {
+      TC_ASSERT(op == AtomicOpType::min);
+      return is_unsigned(dt) ? llvm::AtomicRMWInst::BinOp::UMin
+                             : llvm::AtomicRMWInst::BinOp::Min;
+    }
+  }
+
+  // Floating-point atomic min/max are compare-and-swap loops in the runtime
+  static std::string atomic_cas_function_name(AtomicOpType op, DataType dt) {
+    return fmt::format("atomic_{}_{}", atomic_op_type_name(op),
+                       data_type_short_name(dt));
+  }
+
   virtual void visit(AtomicOpStmt *stmt) {
     auto mask = stmt->parent->mask();
     for (int l = 0; l < stmt->width(); l++) {
       if (mask) {
         emit("if ({}[{}]) ", mask->raw_name(), l);
       } else {
-        TC_ASSERT(stmt->op_type == AtomicOpType::add);
-        if (stmt->val->ret_type.data_type == DataType::i32)
+        auto dt = stmt->val->ret_type.data_type;
+        if (dt == DataType::i32)
           builder->CreateAtomicRMW(
-              llvm::AtomicRMWInst::BinOp::Add, stmt->dest->value,
+              atomic_rmw_op(stmt->op_type, dt), stmt->dest->value,
               stmt->val->value, llvm::AtomicOrdering::SequentiallyConsistent);
-        else if (stmt->val->ret_type.data_type == DataType::f32) {
-          builder->CreateCall(get_runtime_function("atomic_add_cpu_f32"),
-                              {stmt->dest->value, stmt->val->value});
-        } else if (stmt->val->ret_type.data_type == DataType::f64) {
-          builder->CreateCall(get_runtime_function("atomic_add_cpu_f64"),
+        else if (dt == DataType::f32 || dt == DataType::f64) {
+          builder->CreateCall(get_runtime_function(
+                                  stmt->op_type == AtomicOpType::add
+                                      ? "atomic_add_cpu_" +
+                                            data_type_short_name(dt)
+                                      : atomic_cas_function_name(
+                                            stmt->op_type, dt)),
                               {stmt->dest->value, stmt->val->value});
         } else {
           TC_NOT_IMPLEMENTED
@@ -781,7 +861,7 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
 
   void visit(GlobalStoreStmt *stmt) {
     /*
-    if (!current_program->config.force_vectorized_global_store) {
+    if (!prog->config.force_vectorized_global_store) {
       for (int i = 0; i < stmt->data->ret_type.width; i++) {
         if (stmt->parent->mask()) {
           TC_ASSERT(stmt->width() == 1);
@@ -808,7 +888,7 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
 
   void visit(GlobalLoadStmt *stmt) {
     int width = stmt->width();
-    if (get_current_program().config.attempt_vectorized_load_cpu &&
+    if (prog->config.attempt_vectorized_load_cpu &&
         width >= 4 && stmt->ptr->is<ElementShuffleStmt>()) {
       /*
       TC_ASSERT(stmt->ret_type.data_type == DataType::i32 ||
@@ -942,7 +1022,7 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
     } else {
       parent = builder->CreateBitCast(
           get_root(),
-          PointerType::get(get_current_program().snode_root->llvm_type, 0));
+          PointerType::get(prog->snode_root->llvm_type, 0));
     }
     TC_ASSERT(parent);
     // This part may need a redesign - why do we need both global indices and
@@ -1026,6 +1106,8 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
   void init_task_function(OffloadedStmt *stmt) {
     while_after_loop = nullptr;
     current_offloaded_stmt = stmt;
+    // the same IR may be emitted again, e.g. for library export
+    stmt->loop_vars_llvm.clear();
 
     task_function_type =
         llvm::FunctionType::get(llvm::Type::getVoidTy(*llvm_context),
@@ -1059,7 +1141,7 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
     builder->SetInsertPoint(entry_block);
     builder->CreateBr(func_body_bb);
 
-    if (get_current_program().config.print_kernel_llvm_ir) {
+    if (prog->config.print_kernel_llvm_ir) {
       TC_INFO("Kernel Module IR");
       module->print(errs(), nullptr);
       TC_INFO("Kernel Module IR printed.");
@@ -1080,11 +1162,14 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
                                               tlctx->get_constant(1)),
                            loop_var);
     }
+    if (stmt->prologue)
+      stmt->prologue->accept(this);
     builder->CreateBr(body);
 
     // body cfg
     builder->SetInsertPoint(body);
 
+    init_rand_state(stmt, {builder->CreateLoad(loop_var)});
     stmt->body->accept(this);
 
     llvm::Value *cond = nullptr;
@@ -1104,6 +1189,8 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
 
     // next cfg
     builder->SetInsertPoint(after_loop);
+    if (stmt->epilogue)
+      stmt->epilogue->accept(this);
   }
 
   void create_offload_struct_for(OffloadedStmt *stmt, bool spmd = false) {
@@ -1158,19 +1245,45 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
       } else {
         builder->CreateStore(lower_bound, loop_index);
       }
+      auto refine =
+          get_runtime_function(leaf_block->refine_coordinates_func_name());
+      RuntimeObject element("Element", this, builder, get_arg(1));
+
+      // The transfers between the block-local buffers and the global data
+      // in the prologue and epilogue are relative to the block origin
+      llvm::Value *block_origin = nullptr;
+      block_local_buffers.clear();
+      if (stmt->scratch_pads) {
+        for (auto &it : stmt->scratch_pads->pads) {
+          block_local_buffers[it.first] =
+              create_entry_block_alloca(llvm::ArrayType::get(
+                  tlctx->get_data_type(it.first->dt), it.second.linear_size()));
+        }
+        block_origin = create_entry_block_alloca(physical_coordinate_ty);
+        create_call(refine, {element.get_ptr("pcoord"), block_origin,
+                             tlctx->get_constant(0)});
+        current_coordinates = block_origin;
+      }
+
+      if (stmt->prologue)
+        stmt->prologue->accept(this);
       builder->CreateBr(body_bb);
 
       builder->SetInsertPoint(body_bb);
       // initialize the coordinates
 
-      auto refine =
-          get_runtime_function(leaf_block->refine_coordinates_func_name());
       auto new_coordinates = create_entry_block_alloca(physical_coordinate_ty);
-      RuntimeObject element("Element", this, builder, get_arg(1));
       create_call(refine, {element.get_ptr("pcoord"), new_coordinates,
                            builder->CreateLoad(loop_index)});
 
       current_coordinates = new_coordinates;
+      std::vector<llvm::Value *> indices;
+      for (int i = 0; i < max_num_indices; i++) {
+        indices.push_back(builder->CreateLoad(builder->CreateGEP(
+            new_coordinates, {tlctx->get_constant(0), tlctx->get_constant(0),
+                              tlctx->get_constant(i)})));
+      }
+      init_rand_state(stmt, indices);
       stmt->body->accept(this);
 
       BasicBlock *after_loop = BasicBlock::Create(*llvm_context, "block", func);
@@ -1191,6 +1304,10 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
 
       // next cfg
       builder->SetInsertPoint(after_loop);
+      if (block_origin)
+        current_coordinates = block_origin;
+      if (stmt->epilogue)
+        stmt->epilogue->accept(this);
 
       builder->CreateRetVoid();
       func = old_func;
@@ -1205,6 +1322,9 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
     }
 
     int num_splits = leaf_block->max_num_elements() / stmt->block_size;
+    // the prologue and epilogue must see whole leaf blocks
+    if (stmt->scratch_pads)
+      num_splits = 1;
     // traverse leaf node
     create_call("for_each_block",
                 {get_context(), tlctx->get_constant(leaf_block->parent->id),
@@ -1212,6 +1332,14 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
                  tlctx->get_constant(num_splits), body});
   }
 
+  void visit(BlockLocalPtrStmt *stmt) override {
+    TC_ASSERT(block_local_buffers.find(stmt->snode) !=
+              block_local_buffers.end());
+    stmt->value = builder->CreateGEP(block_local_buffers[stmt->snode],
+                                     {tlctx->get_constant(0),
+                                      stmt->offset->value});
+  }
+
   void visit(LoopIndexStmt *stmt) override {
     if (stmt->is_struct_for) {
       stmt->value = builder->CreateLoad(builder->CreateGEP(
@@ -1227,6 +1355,7 @@ class CodeGenLLVM : public IRVisitor, public ModuleBuilder {
     using Type = OffloadedStmt::TaskType;
     init_task_function(stmt);
     if (stmt->task_type == Type::serial) {
+      init_rand_state(stmt, {});
       stmt->body->accept(this);
     } else if (stmt->task_type == Type::range_for) {
       create_offload_range_for(stmt);
@@ -9,6 +9,7 @@
 #include "loopgen.h"
 #include "../program.h"
 #include "../ir.h"
+#include "../pass_manager.h"
 
 TLANG_NAMESPACE_BEGIN
 
@@ -18,10 +19,17 @@ class CPUIRCodeGen : public IRVisitor {
   CodeGenBase *codegen;
   LoopGenerator loopgen;
   Kernel *kernel;
+  IRNode *root;
   std::unique_ptr<Stmt> atomic_add;
+  // The random number streams of the lanes (see taichi/philox.h)
+  std::string rand_state;
+  int rand_width;
+  int task_counter;  // top-level loops, which draw from streams of their own
 
   CPUIRCodeGen(CodeGenBase *codegen) : codegen(codegen), loopgen(codegen) {
     current_struct_for = nullptr;
+    rand_width = 0;
+    task_counter = 0;
   }
 
   template <typename... Args>
@@ -32,9 +40,56 @@ class CPUIRCodeGen : public IRVisitor {
   static void run(CodeGenBase *codegen, IRNode *node, Kernel *kernel) {
     auto p = CPUIRCodeGen(codegen);
     p.kernel = kernel;
+    p.root = node;
+    // for random numbers drawn outside of the top-level loops
+    if (uses_rand(node))
+      p.init_rand_state("rand_state", 1, -1, [](int, int) { return "0"; });
     node->accept(&p);
   }
 
+  static bool uses_rand(IRNode *node) {
+    auto stmts = gather_statements(node);
+    return std::any_of(stmts.begin(), stmts.end(),
+                       [](Stmt *s) { return s->is<RandStmt>(); });
+  }
+
+  // Seeds one stream per lane, in the same way as the LLVM runtime does.
+  // index(j, l) is physical index j of lane l.
+  void init_rand_state(const std::string &name,
+                       int width,
+                       int task_id,
+                       const std::function<std::string(int, int)> &index) {
+    emit("philox::State {}[{}];", name, width);
+    for (int l = 0; l < width; l++) {
+      std::vector<std::string> indices;
+      for (int j = 0; j < max_num_indices; j++)
+        indices.push_back(index(j, l));
+      emit("philox::initialize(&{}[{}], context.rand_seed, "
+           "context.launch_id, {}, {});",
+           name, l, task_id, make_list(indices));
+    }
+    rand_state = name;
+    rand_width = width;
+  }
+
+  // Top-level loops draw from new streams in every iteration
+  void begin_iteration(Stmt *loop,
+                       int width,
+                       const std::function<std::string(int, int)> &index) {
+    if (loop->parent != root)
+      return;
+    int task_id = task_counter++;
+    if (uses_rand(loop))
+      init_rand_state("rand_state_task", width, task_id, index);
+  }
+
+  void end_iteration(Stmt *loop) {
+    if (loop->parent == root) {
+      rand_state = "rand_state";
+      rand_width = 1;
+    }
+  }
+
   void visit(Block *stmt_list) {
     for (auto &stmt : stmt_list->statements) {
       stmt->accept(this);
@@ -47,8 +102,12 @@ class CPUIRCodeGen : public IRVisitor {
 
   void visit(RandStmt *stmt) {
     TC_ASSERT(stmt->ret_type.data_type == DataType::f32);
-    emit("const auto {} = {}::rand();", stmt->raw_name(),
-         stmt->ret_data_type_name());
+    TC_ASSERT(stmt->width() <= rand_width);
+    emit("{} {};", stmt->ret_data_type_name(), stmt->raw_name());
+    for (int l = 0; l < stmt->width(); l++) {
+      emit("{}[{}] = philox::rand_f32(&{}[{}]);", stmt->raw_name(), l,
+           rand_state, l);
+    }
   }
 
   void visit(UnaryOpStmt *stmt) {
@@ -144,6 +203,8 @@ class CPUIRCodeGen : public IRVisitor {
     }
     emit("for (int leaf_loop = 0; leaf_loop < num_leaves; leaf_loop++) {{");
 
+    // The LLVM backends use irpass::demote_atomics instead. This loop has no
+    // per-thread prologue or epilogue to run it in.
     if (kernel->is_reduction) {
       atomic_add = std::move(for_stmt->body->statements.back());
       for_stmt->body->statements.resize((int)for_stmt->body->statements.size() -
@@ -156,7 +217,18 @@ class CPUIRCodeGen : public IRVisitor {
     loopgen.emit_load_from_context(leaf);
     loopgen.generate_single_loop_header(leaf, true, for_stmt->vectorize);
     loopgen.emit_setup_loop_variables(for_stmt, leaf);
+    begin_iteration(for_stmt, for_stmt->loop_vars[0]->width(),
+                    [&](int j, int l) -> std::string {
+                      for (int i = 0; i < (int)for_stmt->loop_vars.size();
+                           i++) {
+                        if (for_stmt->snode->physical_index_position[i] == j)
+                          return fmt::format(
+                              "{}[{}]", for_stmt->loop_vars[i]->raw_name(), l);
+                      }
+                      return "0";
+                    });
     for_stmt->body->accept(this);
+    end_iteration(for_stmt);
     if (kernel->is_reduction) {
       auto atomic = atomic_add->as<AtomicOpStmt>();
       emit("reduction = add(reduction, {});", atomic->val->raw_name());
@@ -224,7 +296,14 @@ class CPUIRCodeGen : public IRVisitor {
            loop_var->raw_name(), loop_var->ret_data_type_name(),
            for_stmt->vectorize);
     }
+    begin_iteration(for_stmt, loop_var->width(),
+                    [&](int j, int l) -> std::string {
+                      if (j == 0)
+                        return fmt::format("{}[{}]", loop_var->raw_name(), l);
+                      return "0";
+                    });
     for_stmt->body->accept(this);
+    end_iteration(for_stmt);
     emit("}}");
   }
 
@@ -421,7 +500,7 @@ class CPUIRCodeGen : public IRVisitor {
   }
 
   void visit(GlobalStoreStmt *stmt) {
-    if (!current_program->config.force_vectorized_global_store) {
+    if (!kernel->program.config.force_vectorized_global_store) {
       for (int i = 0; i < stmt->data->ret_type.width; i++) {
         if (stmt->parent->mask()) {
           TC_ASSERT(stmt->width() == 1);
@@ -438,7 +517,7 @@ class CPUIRCodeGen : public IRVisitor {
 
   void visit(GlobalLoadStmt *stmt) {
     int width = stmt->width();
-    if (get_current_program().config.attempt_vectorized_load_cpu &&
+    if (kernel->program.config.attempt_vectorized_load_cpu &&
         width >= 4 && stmt->ptr->is<ElementShuffleStmt>()) {
       TC_ASSERT(stmt->ret_type.data_type == DataType::i32 ||
                 stmt->ret_type.data_type == DataType::f32);
@@ -606,212 +685,94 @@ class CPUIRCodeGen : public IRVisitor {
 
 void CPUCodeGen::lower_cpp() {
   auto ir = kernel->ir;
-  if (prog->config.print_ir) {
-    TC_TRACE("Initial IR:");
-    irpass::re_id(ir);
-    irpass::print(ir);
-  }
-  irpass::lower(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("Lowered:");
-    irpass::re_id(ir);
-    irpass::print(ir);
-  }
-  irpass::typecheck(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("Typechecked:");
-    irpass::re_id(ir);
-    irpass::print(ir);
-  }
-  irpass::slp_vectorize(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("SLPed:");
-    irpass::re_id(ir);
-    irpass::print(ir);
-  }
-  irpass::loop_vectorize(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("LoopVeced:");
-    irpass::re_id(ir);
-    irpass::print(ir);
-  }
-  irpass::vector_split(ir, prog->config.max_vector_width,
-                       prog->config.serial_schedule);
-  if (prog->config.print_ir) {
-    TC_TRACE("LoopSplitted:");
-    irpass::re_id(ir);
-    irpass::print(ir);
-  }
-  if (prog->config.simplify_before_lower_access) {
-    irpass::simplify(ir);
-    if (prog->config.print_ir) {
-      TC_TRACE("Simplified I:");
-      irpass::re_id(ir);
-      irpass::print(ir);
-    }
+  auto &config = prog->config;
+  PassManager passes(ir, config);
+  if (config.print_ir)
+    passes.print("Initial IR");
+  passes.run("Lowered", [&] { irpass::lower(ir); });
+  passes.run("Typechecked", [&] { irpass::typecheck(ir); });
+  passes.run("Constant folded", [&] { irpass::constant_fold(ir); });
+  passes.run("SLPed", [&] { irpass::slp_vectorize(ir); });
+  passes.run("LoopVeced", [&] { irpass::loop_vectorize(ir); });
+  passes.run("LoopSplitted", [&] {
+    irpass::vector_split(ir, config.max_vector_width, config.serial_schedule);
+  });
+  if (config.simplify_before_lower_access) {
+    passes.run("Simplified I", [&] { irpass::simplify(ir); });
   }
   if (kernel->grad) {
-    // irpass::re_id(ir);
-    // TC_TRACE("Primal:");
-    // irpass::print(ir);
-    irpass::make_adjoint(ir);
-    irpass::typecheck(ir);
-    if (prog->config.print_ir) {
-      TC_TRACE("Adjoint:");
-      irpass::re_id(ir);
-      irpass::print(ir);
-    }
-  }
-  if (prog->config.lower_access) {
-    irpass::lower_access(ir, true);
-    if (prog->config.print_ir) {
-      TC_TRACE("Access Lowered:");
-      irpass::re_id(ir);
-      irpass::print(ir);
-    }
-    if (prog->config.simplify_after_lower_access) {
-      irpass::die(ir);
-      if (prog->config.print_ir) {
-        TC_TRACE("DIEd:");
-        irpass::re_id(ir);
-        irpass::print(ir);
-      }
-      irpass::simplify(ir);
-      if (prog->config.print_ir) {
-        TC_TRACE("Simplified II:");
-        irpass::re_id(ir);
-        irpass::print(ir);
-      }
+    passes.run("Adjoint", [&] {
+      irpass::make_adjoint(ir);
+      irpass::typecheck(ir);
+    });
+  }
+  if (config.lower_access) {
+    passes.run("Access Lowered", [&] { irpass::lower_access(ir, true); });
+    if (config.simplify_after_lower_access) {
+      passes.run("DIEd", [&] { irpass::die(ir); });
+      passes.run("Simplified II", [&] { irpass::simplify(ir); });
     }
   }
-  irpass::die(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("DIEd:");
-    irpass::re_id(ir);
-    irpass::print(ir);
+  passes.run("DIEd", [&] { irpass::die(ir); });
+  passes.run("Access Flagged", [&] { irpass::flag_access(ir); });
+  if (config.hoist_loop_invariants) {
+    passes.run("Loop Invariants Hoisted",
+               [&] { irpass::loop_invariant_code_motion(ir); });
   }
-
-  irpass::flag_access(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("Access Flagged:");
-    irpass::re_id(ir);
-    irpass::print(ir);
+  if (config.value_numbering) {
+    passes.run("Value Numbered", [&] { irpass::global_value_numbering(ir); });
   }
 }
 
 void CPUCodeGen::lower_llvm() {
   auto ir = kernel->ir;
-  if (prog->config.print_ir) {
-    TC_TRACE("Initial IR:");
-    irpass::re_id(ir);
-    irpass::print(ir);
-  }
-  irpass::lower(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("Lowered:");
-    irpass::re_id(ir);
-    irpass::print(ir);
-  }
-  irpass::typecheck(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("Typechecked:");
-    irpass::re_id(ir);
-    irpass::print(ir);
-  }
-  irpass::slp_vectorize(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("SLPed:");
-    irpass::re_id(ir);
-    irpass::print(ir);
-  }
-  irpass::loop_vectorize(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("LoopVeced:");
-    irpass::re_id(ir);
-    irpass::print(ir);
-  }
-  irpass::vector_split(ir, prog->config.max_vector_width,
-                       prog->config.serial_schedule);
-  if (prog->config.print_ir) {
-    TC_TRACE("LoopSplitted:");
-    irpass::re_id(ir);
-    irpass::print(ir);
-  }
-  if (prog->config.simplify_before_lower_access) {
-    irpass::simplify(ir);
-    if (prog->config.print_ir) {
-      TC_TRACE("Simplified I:");
-      irpass::re_id(ir);
-      irpass::print(ir);
-    }
+  auto &config = prog->config;
+  PassManager passes(ir, config);
+  if (config.print_ir)
+    passes.print("Initial IR");
+  passes.run("Lowered", [&] { irpass::lower(ir); });
+  passes.run("Typechecked", [&] { irpass::typecheck(ir); });
+  passes.run("SLPed", [&] { irpass::slp_vectorize(ir); });
+  passes.run("LoopVeced", [&] { irpass::loop_vectorize(ir); });
+  passes.run("LoopSplitted", [&] {
+    irpass::vector_split(ir, config.max_vector_width, config.serial_schedule);
+  });
+  if (config.simplify_before_lower_access) {
+    passes.run("Simplified I", [&] { irpass::simplify(ir); });
   }
   if (kernel->grad) {
-    // irpass::re_id(ir);
-    // TC_TRACE("Primal:");
-    // irpass::print(ir);
-    irpass::make_adjoint(ir);
-    irpass::typecheck(ir);
-    if (prog->config.print_ir) {
-      TC_TRACE("Adjoint:");
-      irpass::re_id(ir);
-      irpass::print(ir);
-    }
-  }
-  if (prog->config.lower_access) {
-    irpass::lower_access(ir, true);
-    if (prog->config.print_ir) {
-      TC_TRACE("Access Lowered:");
-      irpass::re_id(ir);
-      irpass::print(ir);
-    }
-    if (prog->config.simplify_after_lower_access) {
-      irpass::die(ir);
-      if (prog->config.print_ir) {
-        TC_TRACE("DIEd:");
-        irpass::re_id(ir);
-        irpass::print(ir);
-      }
-      irpass::simplify(ir);
-      if (prog->config.print_ir) {
-        TC_TRACE("Simplified II:");
-        irpass::re_id(ir);
-        irpass::print(ir);
-      }
-    }
-  }
-  irpass::die(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("DIEd:");
-    irpass::re_id(ir);
-    irpass::print(ir);
+    passes.run("Adjoint", [&] {
+      irpass::make_adjoint(ir);
+      irpass::typecheck(ir);
+    });
   }
-
-  irpass::flag_access(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("Access Flagged:");
-    irpass::re_id(ir);
-    irpass::print(ir);
-  }
-
-  irpass::constant_fold(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("Constant folded:");
-    irpass::re_id(ir);
-    irpass::print(ir);
-  }
-
-  irpass::offload(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("Offloaded:");
-    irpass::re_id(ir);
-    irpass::print(ir);
-  }
-
-  irpass::full_simplify(ir);
-  if (prog->config.print_ir) {
-    TC_TRACE("Simplified III:");
-    irpass::re_id(ir);
-    irpass::print(ir);
+  passes.run("Block Local", [&] {
+    irpass::make_block_local(ir);
+    irpass::typecheck(ir);
+  });
+  if (config.lower_access) {
+    passes.run("Access Lowered", [&] { irpass::lower_access(ir, true); });
+    if (config.simplify_after_lower_access) {
+      passes.run("DIEd", [&] { irpass::die(ir); });
+      passes.run("Simplified II", [&] { irpass::simplify(ir); });
+    }
+  }
+  passes.run("DIEd", [&] { irpass::die(ir); });
+  passes.run("Access Flagged", [&] { irpass::flag_access(ir); });
+  if (config.hoist_loop_invariants) {
+    passes.run("Loop Invariants Hoisted",
+               [&] { irpass::loop_invariant_code_motion(ir); });
+  }
+  if (config.value_numbering) {
+    passes.run("Value Numbered", [&] { irpass::global_value_numbering(ir); });
+  }
+  passes.run("Constant folded", [&] { irpass::constant_fold(ir); });
+  passes.run("Offloaded", [&] { irpass::offload(ir); });
+  passes.run("Block Local Transfers",
+             [&] { irpass::emit_block_local_transfers(ir); });
+  passes.run("Simplified III", [&] { irpass::full_simplify(ir); });
+  if (config.demote_atomics) {
+    passes.run("Atomics Demoted", [&] { irpass::demote_atomics(ir); });
   }
 }
 
@@ -830,6 +791,8 @@ void CPUCodeGen::codegen() {
   emit("extern \"C\" void " + func_name + "(Context context) {{\n");
   emit("auto root = ({} *)context.buffers[0];",
        prog->snode_root->node_type_name);
+  // the library allocates from the program that launches it
+  emit("allocator() = context.allocator;");
 
   emit(R"(context.cpu_profiler->start("{}");)", func_name);
   CPUIRCodeGen::run(this, kernel->ir, kernel);
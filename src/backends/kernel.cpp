@@ -15,7 +15,7 @@ FunctionType KernelCodeGen::compile(taichi::Tlang::Program &prog,
     return codegen_llvm();
   } else {
     codegen();
-    generate_binary("");
+    generate_binary(prog.config, "");
     // TC_P(Time::get_time() - t);
     return load_function();
   }
@@ -2,7 +2,9 @@
 #include <llvm/Support/TargetRegistry.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 #if defined(TLANG_WITH_CUDA)
 #include <cuda.h>
 #endif
@@ -49,7 +51,29 @@ std::string mattrs() {
   */
 }
 
-void global_optimize_module_x86_64(std::unique_ptr<llvm::Module> &module) {
+// The fast_* math functions in the runtime, and their 128-bit vector versions
+std::vector<VecDesc> vectorizable_math_functions() {
+  static const std::vector<std::string> names = [] {
+    std::vector<std::string> names;
+    for (auto f : {"exp", "log", "sin", "cos", "tan", "tanh", "pow", "atan2"}) {
+      names.push_back(fmt::format("fast_{}_f32", f));
+      names.push_back(fmt::format("fast_{}_f32_x4", f));
+      names.push_back(fmt::format("fast_{}_f64", f));
+      names.push_back(fmt::format("fast_{}_f64_x2", f));
+    }
+    return names;
+  }();
+  std::vector<VecDesc> descs;
+  for (int i = 0; i < (int)names.size(); i += 4) {
+    descs.push_back({names[i], names[i + 1], 4});
+    descs.push_back({names[i + 2], names[i + 3], 2});
+  }
+  return descs;
+}
+
+void global_optimize_module_x86_64(std::unique_ptr<llvm::Module> &module,
+                                   bool fast_math,
+                                   const std::string &cpu) {
   auto JTMB = JITTargetMachineBuilder::detectHost();
   if (!JTMB) {
     TC_ERROR("Target machine creation failed.");
@@ -64,10 +88,10 @@ void global_optimize_module_x86_64(std::unique_ptr<llvm::Module> &module) {
 
   TargetOptions options;
   options.PrintMachineCode = false;
-  options.AllowFPOpFusion = FPOpFusion::Fast;
-  options.UnsafeFPMath = true;
-  options.NoInfsFPMath = true;
-  options.NoNaNsFPMath = true;
+  options.AllowFPOpFusion = fast_math ? FPOpFusion::Fast : FPOpFusion::Strict;
+  options.UnsafeFPMath = fast_math;
+  options.NoInfsFPMath = fast_math;
+  options.NoNaNsFPMath = fast_math;
   options.HonorSignDependentRoundingFPMathOption = false;
   options.NoZerosInBSS = false;
   options.GuaranteedTailCallOpt = false;
@@ -76,9 +100,9 @@ void global_optimize_module_x86_64(std::unique_ptr<llvm::Module> &module) {
   legacy::FunctionPassManager function_pass_manager(module.get());
   legacy::PassManager module_pass_manager;
 
-  llvm::StringRef mcpu = llvm::sys::getHostCPUName();
+  std::string mcpu = cpu.empty() ? llvm::sys::getHostCPUName().str() : cpu;
   std::unique_ptr<TargetMachine> target_machine(target->createTargetMachine(
-      triple.str(), mcpu.str(), "", options, llvm::Reloc::PIC_,
+      triple.str(), mcpu, "", options, llvm::Reloc::PIC_,
       llvm::CodeModel::Small, CodeGenOpt::Aggressive));
 
   TC_ERROR_UNLESS(target_machine.get(), "Could not allocate target machine!");
@@ -95,6 +119,31 @@ void global_optimize_module_x86_64(std::unique_ptr<llvm::Module> &module) {
   b.Inliner = createFunctionInliningPass(b.OptLevel, 0, false);
   b.LoopVectorize = true;
   b.SLPVectorize = true;
+  // owned by the builder
+  b.LibraryInfo = new TargetLibraryInfoImpl(triple);
+  if (fast_math) {
+    // Calls that are not inlined can still be vectorized. The runtime is
+    // compiled without optimization, so the functions must be allowed to
+    // be optimized for their attributes (readnone) to be inferred.
+    auto math_functions = vectorizable_math_functions();
+    b.LibraryInfo->addVectorizableFunctions(math_functions);
+    std::vector<llvm::GlobalValue *> used;
+    for (auto &desc : math_functions) {
+      for (auto name : {desc.ScalarFnName, desc.VectorFnName}) {
+        if (auto f = module->getFunction(name)) {
+          f->removeAttribute(AttributeList::FunctionIndex,
+                             llvm::Attribute::OptimizeNone);
+          f->removeAttribute(AttributeList::FunctionIndex,
+                             llvm::Attribute::NoInline);
+          used.push_back(f);
+        }
+      }
+    }
+    // Runtime functions are private, and the vector variants have no callers
+    // until the loop vectorizer creates them. Keep them from being deleted
+    // as dead before that.
+    llvm::appendToCompilerUsed(*module, used);
+  }
 
   target_machine->adjustPassManager(b);
 
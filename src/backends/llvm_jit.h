@@ -42,7 +42,10 @@ std::string compile_module_to_ptx(std::unique_ptr<llvm::Module> &module);
 int compile_ptx_and_launch(const std::string &ptx,
                            const std::string &kernel_name,
                            void *);
-void global_optimize_module_x86_64(std::unique_ptr<llvm::Module> &module);
+// Optimizes for the host CPU, or for cpu if it is not empty
+void global_optimize_module_x86_64(std::unique_ptr<llvm::Module> &module,
+                                   bool fast_math,
+                                   const std::string &cpu = "");
 
 class TaichiLLVMJIT {
  private:
@@ -118,8 +121,8 @@ class TaichiLLVMJIT {
     return llvm::make_unique<TaichiLLVMJIT>(std::move(*jtmb), std::move(*DL));
   }
 
-  VModuleKey addModule(std::unique_ptr<Module> M) {
-    global_optimize_module_x86_64(M);
+  VModuleKey addModule(std::unique_ptr<Module> M, bool fast_math) {
+    global_optimize_module_x86_64(M, fast_math);
     // Create a new VModuleKey.
     VModuleKey K = ES.allocateVModule();
 
@@ -77,16 +77,23 @@ class CodeGenLLVMGPU : public CodeGenLLVM {
     auto ptx = compile_module_to_ptx(module);
     auto cuda_module = cuda_context.compile(ptx);
 
+    // a flat array of what a launch needs, instead of the tasks themselves
+    struct TaskLaunch {
+      CUfunction func;
+      int grid_dim;
+      int block_dim;
+    };
+    std::vector<TaskLaunch> launches;
     for (auto &task : offloaded_local) {
-      task.cuda_func =
-          (void *)cuda_context.get_function(cuda_module, task.name);
+      launches.push_back({cuda_context.get_function(cuda_module, task.name),
+                          task.grid_dim, task.block_dim});
     }
-    return [offloaded_local](Context context) {
-      for (auto task : offloaded_local) {
-        // TC_INFO("Launching kernel {}<<<{}, {}>>>", task.name, task.grid_dim,
-        //    task.block_dim);
-        cuda_context.launch((CUfunction)task.cuda_func, &context, task.grid_dim,
-                            task.block_dim);
+    return [launches](Context &context) {
+      for (auto &launch : launches) {
+        // TC_INFO("Launching kernel <<<{}, {}>>>", launch.grid_dim,
+        //    launch.block_dim);
+        cuda_context.launch(launch.func, &context, launch.grid_dim,
+                            launch.block_dim);
       }
     };
 #else
@@ -132,6 +139,12 @@ class CodeGenLLVMGPU : public CodeGenLLVM {
                                llvm::Type::getInt8PtrTy(*llvm_context)));
   }
 
+  std::string real_function_name(const std::string &name,
+                                 DataType dt) override {
+    // functions from libdevice
+    return fmt::format("__nv_{}{}", name, dt == DataType::f32 ? "f" : "");
+  }
+
   void emit_extra_unary(UnaryOpStmt *stmt) override {
     // functions from libdevice
     auto input = stmt->operand->value;
@@ -192,12 +205,16 @@ class CodeGenLLVMGPU : public CodeGenLLVM {
       if (mask) {
         emit("if ({}[{}]) ", mask->raw_name(), l);
       } else {
-        TC_ASSERT(stmt->op_type == AtomicOpType::add);
-        if (is_integral(stmt->val->ret_type.data_type))
+        auto dt = stmt->val->ret_type.data_type;
+        if (is_integral(dt))
           builder->CreateAtomicRMW(
-              llvm::AtomicRMWInst::BinOp::Add, stmt->dest->value,
+              atomic_rmw_op(stmt->op_type, dt), stmt->dest->value,
               stmt->val->value, llvm::AtomicOrdering::SequentiallyConsistent);
-        else if (stmt->val->ret_type.data_type == DataType::f32) {
+        else if (stmt->op_type != AtomicOpType::add) {
+          builder->CreateCall(
+              get_runtime_function(atomic_cas_function_name(stmt->op_type, dt)),
+              {stmt->dest->value, stmt->val->value});
+        } else if (stmt->val->ret_type.data_type == DataType::f32) {
           auto dt = tlctx->get_data_type(DataType::f32);
           builder->CreateIntrinsic(Intrinsic::nvvm_atomic_load_add_f32,
                                    {llvm::PointerType::get(dt, 0)},
@@ -245,6 +262,8 @@ class CodeGenLLVMGPU : public CodeGenLLVM {
         builder->CreateAdd(threadIdx, builder->CreateMul(blockIdx, blockDim)));
 
     builder->CreateStore(loop_id, loop_var);
+    if (stmt->prologue)
+      stmt->prologue->accept(this);
 
     auto cond = builder->CreateICmp(llvm::CmpInst::Predicate::ICMP_SLT,
                                     builder->CreateLoad(loop_var),
@@ -254,11 +273,14 @@ class CodeGenLLVMGPU : public CodeGenLLVM {
     {
       // body cfg
       builder->SetInsertPoint(body);
+      init_rand_state(stmt, {builder->CreateLoad(loop_var)});
       stmt->body->accept(this);
       builder->CreateBr(after_loop);
     }
 
     builder->SetInsertPoint(after_loop);
+    if (stmt->epilogue)
+      stmt->epilogue->accept(this);
   }
 
   void visit(OffloadedStmt *stmt) override {
@@ -268,6 +290,7 @@ class CodeGenLLVMGPU : public CodeGenLLVM {
     kernel_block_dim = 1;
     init_task_function(stmt);
     if (stmt->task_type == Type::serial) {
+      init_rand_state(stmt, {});
       stmt->body->accept(this);
     } else if (stmt->task_type == Type::range_for) {
       create_offload_range_for(stmt);
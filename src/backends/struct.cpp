@@ -6,7 +6,8 @@
 
 TLANG_NAMESPACE_BEGIN
 
-StructCompiler::StructCompiler() : CodeGenBase(), loopgen(this) {
+StructCompiler::StructCompiler(Program *prog)
+    : CodeGenBase(), prog(prog), loopgen(this) {
   creator = [] {
     TC_ERROR("Not Specified");
     return nullptr;
@@ -18,11 +19,11 @@ StructCompiler::StructCompiler() : CodeGenBase(), loopgen(this) {
     TC_WARN("Profiler not yet implemented in this backend.");
   };
 
-  if (get_current_program().config.arch == Arch::x86_64)
+  if (prog->config.arch == Arch::x86_64)
     suffix = "cpp";
   else
     suffix = "cu";
-  if (get_current_program().config.debug) {
+  if (prog->config.debug) {
     emit("#define TL_DEBUG");
   }
   emit("#define TL_HOST");
@@ -172,7 +173,7 @@ void StructCompiler::generate_types(SNode &snode) {
   }
 
   if (snode.has_null()) {
-    if (get_current_program().config.arch == Arch::gpu) {
+    if (prog->config.arch == Arch::gpu) {
       emit("__device__ __constant__ {}::child_type *{}_ambient_ptr;",
            snode.node_type_name, snode.node_type_name);
     }
@@ -314,6 +315,9 @@ void StructCompiler::load_accessors(SNode &snode) {
     snode.access_func = load_function<SNode::AccessorFunction>(
         fmt::format("access_{}", snode.node_type_name));
   } else {
+    // activates the node's ancestors and returns the node
+    snode.access_func = load_function<SNode::AccessorFunction>(
+        fmt::format("access_{}", snode.node_type_name));
     snode.stat_func = load_function<SNode::StatFunction>(
         fmt::format("stat_{}", snode.node_type_name));
   }
@@ -373,11 +377,28 @@ void StructCompiler::run(SNode &root, bool host) {
     }
   }
 
+  // memory layout of each node, see SNode::offset_in_parent
+  emit("TC_EXPORT void snode_layout(std::size_t *layout) {{");
+  for (int i = 0; i < (int)snodes.size(); i++) {
+    auto snode = snodes[i];
+    emit("layout[{}] = sizeof({}_ch);", i * 3, snode->node_type_name);
+    emit("layout[{}] = sizeof({});", i * 3 + 1, snode->node_type_name);
+    if (snode->parent) {
+      emit("layout[{}] = offsetof({}_ch, member{});", i * 3 + 2,
+           snode->parent->node_type_name, snode->parent->child_id(snode));
+    } else {
+      emit("layout[{}] = 0;", i * 3 + 2);
+    }
+  }
+  emit("}}");
+
   root_type = root.node_type_name;
   generate_leaf_accessors(root);
   emit("#if defined(TC_STRUCT)");
-  emit("TC_EXPORT void *create_data_structure() {{");
+  emit("TC_EXPORT void *create_data_structure(void *allocator) {{");
 
+  // Managers live at the start of the allocator of the program
+  emit("taichi::Tlang::allocator() = (UnifiedAllocator *)allocator;");
   emit("Managers::initialize();");
 
   TC_ASSERT((int)snodes.size() <= max_num_snodes);
@@ -392,7 +413,7 @@ void StructCompiler::run(SNode &root, bool host) {
     }
   }
 
-  if (get_current_program().config.arch == Arch::gpu) {
+  if (prog->config.arch == Arch::gpu) {
     for (int i = 0; i < (int)ambient_snodes.size(); i++) {
       emit("{{");
       auto ntn = ambient_snodes[i]->node_type_name;
@@ -441,15 +462,28 @@ void StructCompiler::run(SNode &root, bool host) {
   emit("}} }}");
   write_source();
 
-  generate_binary("-DTC_STRUCT");
+  generate_binary(prog->config, "-DTC_STRUCT");
   load_dll();
-  creator = load_function<void *(*)()>("create_data_structure");
+  auto create_data_structure =
+      load_function<void *(*)(void *)>("create_data_structure");
+  creator = [create_data_structure, prog = prog]() {
+    return create_data_structure(prog->unified_allocator);
+  };
   profiler_print = load_function<void (*)()>("profiler_print");
   profiler_clear = load_function<void (*)()>("profiler_clear");
 
   for (auto n : snodes) {
     load_accessors(*n);
   }
+
+  auto snode_layout = load_function<void (*)(std::size_t *)>("snode_layout");
+  std::vector<std::size_t> layout(snodes.size() * 3);
+  snode_layout(layout.data());
+  for (int i = 0; i < (int)snodes.size(); i++) {
+    snodes[i]->element_size = layout[i * 3];
+    snodes[i]->node_size = layout[i * 3 + 1];
+    snodes[i]->offset_in_parent = layout[i * 3 + 2];
+  }
 }
 
 TLANG_NAMESPACE_END
@@ -9,6 +9,7 @@ TLANG_NAMESPACE_BEGIN
 
 class StructCompiler : public CodeGenBase {
  public:
+  Program *prog;
   std::vector<SNode *> stack;
   std::vector<SNode *> snodes;
   std::vector<SNode *> ambient_snodes;
@@ -18,7 +19,7 @@ class StructCompiler : public CodeGenBase {
   std::function<void()> profiler_clear;
   LoopGenerator loopgen;
 
-  StructCompiler();
+  StructCompiler(Program *prog);
 
   virtual ~StructCompiler() {}
 
@@ -36,7 +37,9 @@ class StructCompiler : public CodeGenBase {
 
   virtual void run(SNode &node, bool host);
 
-  static std::unique_ptr<StructCompiler> make(bool use_llvm, Arch arch);
+  static std::unique_ptr<StructCompiler> make(Program *prog,
+                                              bool use_llvm,
+                                              Arch arch);
 };
 
 TLANG_NAMESPACE_END
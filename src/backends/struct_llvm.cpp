@@ -12,15 +12,14 @@
 TLANG_NAMESPACE_BEGIN
 
 #if defined(TLANG_WITH_LLVM)
-StructCompilerLLVM::StructCompilerLLVM(Arch arch)
-    : StructCompiler(),
-      ModuleBuilder(
-          get_current_program().get_llvm_context(arch)->get_init_module()),
+StructCompilerLLVM::StructCompilerLLVM(Program *prog, Arch arch)
+    : StructCompiler(prog),
+      ModuleBuilder(prog->get_llvm_context(arch)->get_init_module()),
       arch(arch) {
   creator = [] {
     TC_WARN("Data structure creation not implemented"); return nullptr;
   };
-  tlctx = get_current_program().get_llvm_context(arch);
+  tlctx = prog->get_llvm_context(arch);
   llvm_ctx = tlctx->ctx.get();
 }
 
@@ -63,7 +62,7 @@ void StructCompilerLLVM::generate_types(SNode &snode) {
     TC_NOT_IMPLEMENTED;
   }
   if (snode.has_null()) {
-    if (get_current_program().config.arch == Arch::gpu) {
+    if (prog->config.arch == Arch::gpu) {
       emit("__device__ __constant__ {}::child_type *{}_ambient_ptr;",
            snode.node_type_name, snode.node_type_name);
     }
@@ -399,7 +398,7 @@ void StructCompilerLLVM::run(SNode &root, bool host) {
   root_type = root.node_type_name;
   generate_leaf_accessors(root);
 
-  if (get_current_program().config.print_struct_llvm_ir) {
+  if (prog->config.print_struct_llvm_ir) {
     TC_INFO("Struct Module IR");
     module->print(errs(), nullptr);
   }
@@ -416,7 +415,7 @@ void StructCompilerLLVM::run(SNode &root, bool host) {
     }
   }
 
-  if (get_current_program().config.arch == Arch::gpu) {
+  if (prog->config.arch == Arch::gpu) {
     for (int i = 0; i < (int)ambient_snodes.size(); i++) {
       emit("{{");
       auto ntn = ambient_snodes[i]->node_type_name;
@@ -426,13 +425,28 @@ void StructCompilerLLVM::run(SNode &root, bool host) {
     }
   }
 
-  auto root_size = tlctx->jit->getDataLayout().getTypeAllocSize(root.llvm_type);
+  auto &data_layout = tlctx->jit->getDataLayout();
+  for (auto n : snodes) {
+    n->node_size = data_layout.getTypeAllocSize(n->llvm_type);
+    n->element_size = data_layout.getTypeAllocSize(n->llvm_element_type);
+    if (n->parent) {
+      n->offset_in_parent =
+          data_layout
+              .getStructLayout(
+                  llvm::cast<llvm::StructType>(n->parent->llvm_element_type))
+              ->getElementOffset(n->parent->child_id(n));
+    }
+  }
+
+  auto root_size = data_layout.getTypeAllocSize(root.llvm_type);
   // initializer
 
   {
-    auto ft =
-        llvm::FunctionType::get(llvm::Type::getInt8PtrTy(*llvm_ctx),
-                                {llvm::Type::getInt8PtrTy(*llvm_ctx)}, false);
+    // (runtime_ptr, allocator)
+    auto ft = llvm::FunctionType::get(llvm::Type::getInt8PtrTy(*llvm_ctx),
+                                      {llvm::Type::getInt8PtrTy(*llvm_ctx),
+                                       llvm::Type::getInt8PtrTy(*llvm_ctx)},
+                                      false);
     auto init = llvm::Function::Create(ft, llvm::Function::ExternalLinkage,
                                        "initialize_data_structure", *module);
     std::vector<llvm::Value *> args;
@@ -447,7 +461,7 @@ void StructCompilerLLVM::run(SNode &root, bool host) {
         {builder.CreateBitCast(
              args[0],
              llvm::PointerType::get(llvm::PointerType::get(runtime_ty, 0), 0)),
-         tlctx->get_constant((int)snodes.size()),
+         args[1], tlctx->get_constant((int)snodes.size()),
          tlctx->get_constant(root_size), tlctx->get_constant(root.id)});
     builder.CreateRet(ret);
   }
@@ -457,7 +471,7 @@ void StructCompilerLLVM::run(SNode &root, bool host) {
   tlctx->set_struct_module(module);
 
   if (arch == Arch::x86_64) // Do not compile the GPU struct module alone since it's useless unless used with kernels
-    tlctx->jit->addModule(std::move(module));
+    tlctx->jit->addModule(std::move(module), prog->config.fast_math);
 
   if (host) {
     for (auto n : snodes) {
@@ -465,28 +479,30 @@ void StructCompilerLLVM::run(SNode &root, bool host) {
     }
 
     auto initialize_data_structure =
-        tlctx->lookup_function<std::function<void *(void *)>>(
+        tlctx->lookup_function<std::function<void *(void *, void *)>>(
             "initialize_data_structure");
 
-    creator = [initialize_data_structure, root_size]() {
+    creator = [initialize_data_structure, root_size, prog = prog]() {
       TC_INFO("Allocating data structure of size {}", root_size);
-      auto root_ptr =
-          initialize_data_structure(&get_current_program().llvm_runtime);
+      auto root_ptr = initialize_data_structure(&prog->llvm_runtime,
+                                                prog->unified_allocator);
       return (void *)root_ptr;
     };
   }
 }
 #endif
 
-std::unique_ptr<StructCompiler> StructCompiler::make(bool use_llvm, Arch arch) {
+std::unique_ptr<StructCompiler> StructCompiler::make(Program *prog,
+                                                     bool use_llvm,
+                                                     Arch arch) {
   if (use_llvm) {
 #if defined(TLANG_WITH_LLVM)
-    return std::make_unique<StructCompilerLLVM>(arch);
+    return std::make_unique<StructCompilerLLVM>(prog, arch);
 #else
     TC_NOT_IMPLEMENTED
 #endif
   } else {
-    return std::make_unique<StructCompiler>();
+    return std::make_unique<StructCompiler>(prog);
   }
 }
 
@@ -81,6 +81,7 @@ DEFINE_EXPRESSION_OP_BINARY(!=, cmp_ne)
 DEFINE_EXPRESSION_FUNC(min);
 DEFINE_EXPRESSION_FUNC(max);
 DEFINE_EXPRESSION_FUNC(atan2);
+DEFINE_EXPRESSION_FUNC(pow);
 
 #undef DEFINE_EXPRESSION_OP_UNARY
 #undef DEFINE_EXPRESSION_OP_BINARY
@@ -1,7 +1,91 @@
 #include <taichi/visual/gui.h>
+#include <taichi/system/threading.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 TC_NAMESPACE_BEGIN
 
 Vector2 Canvas::Line::vertices[128];
 
+namespace {
+
+// Converts pixels (i, j), (i, j - 1), ... of view to BGRA
+void convert(const ImageView &view, int i, int j, int n, uint32 *pixels) {
+#if defined(__SSE2__)
+  __m128i v[4];
+  for (int r = n; r < 4; r++) {
+    v[r] = _mm_setzero_si128();
+  }
+  for (int r = 0; r < n; r++) {
+    __m128 c;
+    if (view.num_channels == 4 && view.stride_c == 1) {
+      c = _mm_loadu_ps(view.data + i * view.stride_i + (j - r) * view.stride_j);
+    } else {
+      auto p = view.pixel(i, j - r);
+      c = _mm_setr_ps(p[0], p[1], p[2], p[3]);
+    }
+    c = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 1, 2));
+    // Clamp before converting, which gives INT_MIN for NaN and large values.
+    // max returns its second operand if either is NaN.
+    c = _mm_min_ps(_mm_max_ps(c, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+    v[r] = _mm_cvttps_epi32(_mm_mul_ps(c, _mm_set1_ps(255.0f)));
+  }
+  auto bytes = _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]),
+                                _mm_packs_epi32(v[2], v[3]));
+  uint32 tmp[4];
+  _mm_storeu_si128((__m128i *)tmp, bytes);
+  std::memcpy(pixels, tmp, n * sizeof(uint32));
+#else
+  for (int r = 0; r < n; r++) {
+    auto c = view.pixel(i, j - r);
+    auto p = reinterpret_cast<uint8 *>(&pixels[r]);
+    p[0] = color_to_uint8(c[2]);
+    p[1] = color_to_uint8(c[1]);
+    p[2] = color_to_uint8(c[0]);
+    p[3] = color_to_uint8(c[3]);
+  }
+#endif
+}
+
+}  // namespace
+
+// Threads convert bands of four rows, so that a cache line of a column-major
+// image is read only once
+void ImageView::to_bgra8(int width, int height, uint32 *out) const {
+  TC_ASSERT(width <= this->width && height <= this->height);
+  ThreadedTaskManager::run((height + 3) / 4, -1, [&](int band) {
+    int j0 = band * 4;
+    int rows = std::min(4, height - j0);
+    for (int i = 0; i < width; i++) {
+      uint32 pixels[4];
+      convert(*this, i, height - 1 - j0, rows, pixels);
+      for (int r = 0; r < rows; r++) {
+        out[(j0 + r) * width + i] = pixels[r];
+      }
+    }
+  });
+}
+
+void GUI::set_image(const ImageView &view) {
+  TC_ERROR_IF(view.data == nullptr, "The image has no data");
+  TC_ERROR_IF(view.num_channels != 1 && view.num_channels != 3 &&
+                  view.num_channels != 4,
+              "The image has {} channels instead of 1, 3 or 4",
+              view.num_channels);
+  TC_ERROR_IF(view.width < width || view.height < height,
+              "The image ({}x{}) is smaller than the window ({}x{})",
+              view.width, view.height, width, height);
+#if defined(TC_GUI_X11)
+  set_image_data(img, view);
+  image_set = true;
+#else
+  for (int i = 0; i < width; i++) {
+    for (int j = 0; j < height; j++) {
+      buffer[i][j] = view.pixel(i, j);
+    }
+  }
+#endif
+}
+
 TC_NAMESPACE_END
@@ -28,23 +28,43 @@ class CXImage {
   }
 
   void set_data(const Array2D<Vector4> &color) {
-    auto p = image_data.data();
-    for (int j = 0; j < height; j++) {
-      for (int i = 0; i < width; i++) {
-        auto c = color[i][height - j - 1];
-        *p++ = uint8(clamp(int(c[2] * 255.0_f), 0, 255));
-        *p++ = uint8(clamp(int(c[1] * 255.0_f), 0, 255));
-        *p++ = uint8(clamp(int(c[0] * 255.0_f), 0, 255));
-        *p++ = uint8(clamp(int(c[3] * 255.0_f), 0, 255));
+    if constexpr (std::is_same<real, float32>::value &&
+                  sizeof(Vector4) == 4 * sizeof(float32)) {
+      ImageView view;
+      view.data = &color.data[0][0];
+      view.width = width;
+      view.height = height;
+      view.stride_i = 4 * height;
+      view.stride_j = 4;
+      view.num_channels = 4;
+      set_data(view);
+    } else {
+      auto p = image_data.data();
+      for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+          auto c = color[i][height - j - 1];
+          *p++ = color_to_uint8(c[2]);
+          *p++ = color_to_uint8(c[1]);
+          *p++ = color_to_uint8(c[0]);
+          *p++ = color_to_uint8(c[3]);
+        }
       }
     }
   }
 
+  void set_data(const ImageView &view) {
+    view.to_bgra8(width, height, reinterpret_cast<uint32 *>(image_data.data()));
+  }
+
   ~CXImage() {
     delete image;  // image->data is automatically released in image_data
   }
 };
 
+void set_image_data(CXImage *img, const ImageView &view) {
+  img->set_data(view);
+}
+
 void GUI::process_event() {
   while (XPending((Display *)display)) {
     XEvent ev;
@@ -84,7 +104,11 @@ void GUI::create_window() {
 }
 
 void GUI::redraw() {
-  img->set_data(buffer);
+  if (image_set) {
+    image_set = false;
+  } else {
+    img->set_data(buffer);
+  }
   XPutImage((Display *)display, window, DefaultGC(display, 0), img->image, 0, 0,
             0, 0, width, height);
 }
@@ -0,0 +1,81 @@
+// A vector of trivially copyable elements with inline storage for the first N
+
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include "util.h"
+
+TLANG_NAMESPACE_BEGIN
+
+// Most statements have at most a few operands; keeping them inline saves a
+// heap allocation per statement.
+template <typename T, int N>
+class InlinedVector {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "InlinedVector only holds trivially copyable elements");
+
+  T inline_data[N];
+  std::unique_ptr<T[]> heap_data;
+  T *data_;
+  int size_;
+  int capacity;
+
+ public:
+  InlinedVector() : data_(inline_data), size_(0), capacity(N) {
+  }
+
+  InlinedVector(const InlinedVector &o) = delete;
+
+  InlinedVector &operator=(const InlinedVector &o) = delete;
+
+  void push_back(const T &t) {
+    if (size_ == capacity) {
+      capacity *= 2;
+      auto new_data = std::make_unique<T[]>(capacity);
+      std::memcpy(new_data.get(), data_, sizeof(T) * size_);
+      heap_data = std::move(new_data);
+      data_ = heap_data.get();
+    }
+    data_[size_++] = t;
+  }
+
+  void clear() {
+    size_ = 0;
+  }
+
+  std::size_t size() const {
+    return (std::size_t)size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  T &operator[](int i) {
+    return data_[i];
+  }
+
+  const T &operator[](int i) const {
+    return data_[i];
+  }
+
+  T *begin() {
+    return data_;
+  }
+
+  T *end() {
+    return data_ + size_;
+  }
+
+  const T *begin() const {
+    return data_;
+  }
+
+  const T *end() const {
+    return data_ + size_;
+  }
+};
+
+TLANG_NAMESPACE_END
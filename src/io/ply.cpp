@@ -45,4 +45,138 @@ auto write_tcb_c_2 = [](const std::vector<std::string> &parameters) {
 
 TC_REGISTER_TASK(write_tcb_c_2);
 
+void write_particles_ply(const std::string &fn,
+                         std::size_t n,
+                         const std::vector<std::string> &names,
+                         const std::vector<const float32 *> &properties) {
+  TC_ASSERT(names.size() == properties.size());
+  std::size_t m = properties.size();
+  std::string header = fmt::format(
+      "ply\n"
+      "format binary_little_endian 1.0\n"
+      "element vertex {}\n",
+      n);
+  for (auto &name : names) {
+    header += fmt::format("property float {}\n", name);
+  }
+  header += "end_header\n";
+
+  std::unique_ptr<zip::GzipWriter> gzip;
+  std::FILE *file = nullptr;
+  if (ends_with(fn, ".gz")) {
+    gzip = std::make_unique<zip::GzipWriter>(fn);
+  } else {
+    file = std::fopen(fn.c_str(), "wb");
+    TC_ERROR_IF(file == nullptr, "Cannot open file [{}] for writing", fn);
+    std::setvbuf(file, nullptr, _IONBF, 0);
+  }
+  auto write = [&](const void *data, std::size_t size) {
+    if (gzip) {
+      gzip->write(data, size);
+    } else {
+      TC_ERROR_IF(std::fwrite(data, 1, size, file) != size,
+                  "Failed to write to file [{}]", fn);
+    }
+  };
+
+  write(header.data(), header.size());
+  // Interleave the properties into chunks of about 4 MB
+  std::size_t chunk = (1 << 20) / (m + 1) + 1;
+  std::vector<float32> buffer(std::min(chunk, n) * m);
+  for (std::size_t begin = 0; begin < n; begin += chunk) {
+    auto end = std::min(n, begin + chunk);
+    for (std::size_t p = 0; p < m; p++) {
+      auto src = properties[p];
+      for (std::size_t i = begin; i < end; i++) {
+        buffer[(i - begin) * m + p] = src[i];
+      }
+    }
+    write(buffer.data(), (end - begin) * m * sizeof(float32));
+  }
+  if (gzip) {
+    gzip->close();
+  } else {
+    TC_ERROR_IF(std::fclose(file) != 0, "Failed to write to file [{}]", fn);
+  }
+}
+
+void write_particles_ply(const std::string &fn, const ParticleFrame &frame) {
+  std::vector<const float32 *> properties;
+  for (auto &p : frame.properties) {
+    properties.push_back(p.data());
+  }
+  write_particles_ply(fn, frame.num_particles, frame.names, properties);
+}
+
+AsyncParticleWriter::AsyncParticleWriter(int max_pending_frames)
+    : max_pending_frames(max_pending_frames), stopped(false), writing(false) {
+  TC_ASSERT(max_pending_frames > 0);
+  thread = std::thread([this] { run(); });
+}
+
+void AsyncParticleWriter::write(const std::string &fn, ParticleFrame &&frame) {
+  std::unique_lock<std::mutex> lock(mut);
+  written.wait(lock, [&] {
+    return error || (int)queue.size() < max_pending_frames;
+  });
+  rethrow_error();
+  queue.emplace_back(fn, std::move(frame));
+  queued.notify_one();
+}
+
+void AsyncParticleWriter::wait() {
+  std::unique_lock<std::mutex> lock(mut);
+  written.wait(lock, [&] { return queue.empty() && !writing; });
+  rethrow_error();
+}
+
+void AsyncParticleWriter::rethrow_error() {
+  if (error) {
+    auto e = error;
+    error = nullptr;
+    std::rethrow_exception(e);
+  }
+}
+
+void AsyncParticleWriter::run() {
+  while (true) {
+    std::pair<std::string, ParticleFrame> task;
+    {
+      std::unique_lock<std::mutex> lock(mut);
+      queued.wait(lock, [&] { return stopped || !queue.empty(); });
+      if (queue.empty())
+        return;
+      task = std::move(queue.front());
+      queue.pop_front();
+      writing = true;
+    }
+    written.notify_all();
+    std::exception_ptr e;
+    try {
+      write_particles_ply(task.first, task.second);
+    } catch (...) {
+      e = std::current_exception();
+    }
+    {
+      std::lock_guard<std::mutex> lock(mut);
+      writing = false;
+      if (e) {
+        // the frames queued after a failure are dropped
+        queue.clear();
+        error = e;
+      }
+    }
+    written.notify_all();
+  }
+}
+
+AsyncParticleWriter::~AsyncParticleWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    stopped = true;
+  }
+  queued.notify_one();
+  thread.join();
+}
+
 TC_NAMESPACE_END
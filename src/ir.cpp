@@ -2,7 +2,9 @@
 
 #include "ir.h"
 
+#include <mutex>
 #include <numeric>
+#include <unordered_set>
 #include "tlang.h"
 #include <Eigen/Dense>
 
@@ -68,9 +70,26 @@ Expr bit_cast(const Expr &input, DataType dt) {
 
 Expr Expr::operator[](ExprGroup indices) const {
   TC_ASSERT(is<GlobalVariableExpression>() || is<ExternalTensorExpression>());
+  if (is<GlobalVariableExpression>())
+    indices = batched_indices(snode(), indices);
   return Expr::make<GlobalPtrExpression>(*this, indices.loaded());
 }
 
+Expr BatchInstance() {
+  auto loop = context->batch_loop;
+  TC_ERROR_UNLESS(
+      loop != nullptr && current_ast_builder().in_scope(loop->body.get()),
+      "Fields of batched programs can only be accessed within top-level "
+      "loops.");
+  return Expr(loop->batch_instance);
+}
+
+ExprGroup batched_indices(SNode *snode, const ExprGroup &indices) {
+  if (!snode->is_batched())
+    return indices;
+  return ExprGroup(BatchInstance(), indices);
+}
+
 ExprGroup ExprGroup::loaded() const {
   auto indices_loaded = *this;
   for (int i = 0; i < (int)this->size(); i++)
@@ -78,7 +97,7 @@ ExprGroup ExprGroup::loaded() const {
   return indices_loaded;
 }
 
-DecoratorRecorder dec;
+thread_local DecoratorRecorder dec;
 
 IRBuilder &current_ast_builder() {
   return context->builder();
@@ -189,6 +208,7 @@ FrontendForStmt::FrontendForStmt(const Expr &loop_var,
     vectorize = 1;
   loop_var_id.resize(1);
   loop_var_id[0] = loop_var.cast<IdExpression>()->id;
+  initialize_batch();
 }
 
 FrontendForStmt::FrontendForStmt(const ExprGroup &loop_var,
@@ -212,6 +232,59 @@ FrontendForStmt::FrontendForStmt(const ExprGroup &loop_var,
   for (int i = 0; i < (int)loop_var.size(); i++) {
     loop_var_id[i] = loop_var[i].cast<IdExpression>()->id;
   }
+  initialize_batch();
+}
+
+void FrontendForStmt::initialize_batch() {
+  auto &prog = get_current_program();
+  // Only top-level loops are offloaded; nested loops run within the instance
+  // of the enclosing one
+  batched = prog.batch_size > 0 && current_ast_builder().at_root();
+  if (!batched)
+    return;
+  if (is_ranged()) {
+    // for t in [0, batch_size * (end - begin)):
+    //   instance = t / (end - begin), i = begin + t % (end - begin)
+    batch_loop_var = loop_var_id[0];
+    batch_begin = begin;
+    batch_extent = end - begin;
+    loop_var_id[0] = Ident();
+    begin = Expr(0);
+    end = batch_extent * Expr(prog.batch_size);
+  } else {
+    TC_ASSERT(global_var.snode()->is_batched());
+    loop_var_id.insert(loop_var_id.begin(), batch_instance);
+  }
+}
+
+std::unique_ptr<IRBuilder::ScopeGuard> FrontendForStmt::create_body_scope() {
+  auto scope = current_ast_builder().create_scope(body);
+  if (batched) {
+    context->batch_loop = this;
+    auto instance = Expr(batch_instance);
+    if (is_ranged()) {
+      auto t = Expr(loop_var_id[0]);
+      auto i = Expr(batch_loop_var);
+      current_ast_builder().insert(
+          std::make_unique<FrontendAllocaStmt>(batch_instance, DataType::i32));
+      current_ast_builder().insert(
+          std::make_unique<FrontendAllocaStmt>(batch_loop_var, DataType::i32));
+      instance = t / batch_extent;
+      i = batch_begin + t % batch_extent;
+    } else {
+      auto &prog = get_current_program();
+      if (prog.batch_capacity() > prog.batch_size) {
+        // The instance axis is padded to a power of two; skip the padding
+        auto stmt =
+            std::make_unique<FrontendIfStmt>(instance < Expr(prog.batch_size));
+        auto if_stmt = stmt.get();
+        current_ast_builder().insert(std::move(stmt));
+        scope->inner =
+            current_ast_builder().create_scope(if_stmt->true_statements);
+      }
+    }
+  }
+  return scope;
 }
 
 IRNode *Stmt::get_ir_root() {
@@ -236,15 +309,89 @@ IRNode *FrontendContext::root() {
   return static_cast<IRNode *>(root_node.get());
 }
 
-int Identifier::id_counter = 0;
+std::atomic<int> Identifier::id_counter(0);
 std::atomic<int> Stmt::instance_id_counter(0);
 
-std::unique_ptr<FrontendContext> context;
+thread_local IRArena *current_ir_arena = nullptr;
+
+void *IRArena::allocate(std::size_t size) {
+  size = (size + granularity - 1) / granularity * granularity;
+  auto bucket = size / granularity;
+  if (bucket < free_lists.size() && free_lists[bucket]) {
+    auto ptr = free_lists[bucket];
+    free_lists[bucket] = *(void **)ptr;
+    return ptr;
+  }
+  if (head + size > tail) {
+    auto new_chunk_size = std::max(size, chunk_size);
+    chunks.push_back(std::make_unique<uint8[]>(new_chunk_size));
+    head = chunks.back().get();
+    tail = head + new_chunk_size;
+  }
+  auto ptr = head;
+  head += size;
+  return ptr;
+}
+
+void IRArena::deallocate(void *ptr, std::size_t size) {
+  size = (size + granularity - 1) / granularity * granularity;
+  auto bucket = size / granularity;
+  if (bucket >= free_lists.size())
+    free_lists.resize(bucket + 1, nullptr);
+  *(void **)ptr = free_lists[bucket];
+  free_lists[bucket] = ptr;
+}
+
+namespace {
+// Every statement is preceded by the arena it was allocated from (or nullptr)
+constexpr std::size_t stmt_header_size = 16;
+}  // namespace
+
+void *Stmt::operator new(std::size_t size) {
+  auto arena = current_ir_arena;
+  size += stmt_header_size;
+  auto ptr = arena ? arena->allocate(size) : ::operator new(size);
+  *(IRArena **)ptr = arena;
+  return (uint8 *)ptr + stmt_header_size;
+}
+
+void Stmt::operator delete(void *ptr, std::size_t size) {
+  auto base = (uint8 *)ptr - stmt_header_size;
+  auto arena = *(IRArena **)base;
+  if (arena) {
+    arena->deallocate(base, size + stmt_header_size);
+  } else {
+    ::operator delete(base);
+  }
+}
+
+namespace {
+std::mutex interned_strings_mutex;
+// node-based, so that the pointers to the strings stay valid
+std::unordered_set<std::string> interned_strings;
+const std::string empty_interned_string;
+}  // namespace
+
+InternedString::InternedString() : s(&empty_interned_string) {
+}
+
+InternedString::InternedString(const std::string &str) {
+  if (str.empty()) {
+    s = &empty_interned_string;
+    return;
+  }
+  std::lock_guard<std::mutex> _(interned_strings_mutex);
+  s = &*interned_strings.insert(str).first;
+}
+
+thread_local std::unique_ptr<FrontendContext> context;
 
 void *Expr::evaluate_addr(int i, int j, int k, int l) {
   auto snode = this->cast<GlobalVariableExpression>()->snode;
-  get_current_program().synchronize();
-  return snode->evaluate(get_current_program().data_structure, i, j, k, l);
+  auto prog = snode->program;
+  TC_ASSERT_INFO(prog != nullptr, "The field is not in a layout");
+  prog->synchronize();
+  return snode->evaluate(prog->data_structure, i, j, k, l);
 }
 
 template <int i, typename... Indices>
@@ -365,7 +512,7 @@ void Stmt::replace_operand_with(Stmt *old_stmt, Stmt *new_stmt) {
   rebuild_operand_bitmap();
 }
 
-Block *current_block = nullptr;
+thread_local Block *current_block = nullptr;
 
 Expr Var(Expr x) {
   auto var = Expr(std::make_shared<IdExpression>());
@@ -430,6 +577,20 @@ void Block::erase(Stmt *stmt) {
   }
 }
 
+void Block::erase(const std::unordered_set<Stmt *> &stmts) {
+  std::vector<std::unique_ptr<Stmt>> kept;
+  kept.reserve(statements.size());
+  for (auto &stmt : statements) {
+    if (stmts.find(stmt.get()) != stmts.end()) {
+      stmt->erased = true;
+      trash_bin.push_back(std::move(stmt));
+    } else {
+      kept.push_back(std::move(stmt));
+    }
+  }
+  statements = std::move(kept);
+}
+
 void Block::insert(std::unique_ptr<Stmt> &&stmt, int location) {
   stmt->parent = this;
   if (location == -1) {
@@ -439,17 +600,25 @@ void Block::insert(std::unique_ptr<Stmt> &&stmt, int location) {
   }
 }
 
+void Block::insert(VecStatement &&stmts, int location) {
+  for (auto &stmt : stmts.stmts)
+    stmt->parent = this;
+  auto pos = location == -1 ? statements.end() : statements.begin() + location;
+  statements.insert(pos, std::make_move_iterator(stmts.stmts.begin()),
+                    std::make_move_iterator(stmts.stmts.end()));
+  stmts.stmts.clear();
+}
+
 void Block::replace_statements_in_range(int start,
                                         int end,
                                         VecStatement &&stmts) {
   TC_ASSERT(start <= end);
-  for (int i = 0; i < end - start; i++) {
-    erase(start);
-  }
-
-  for (int i = 0; i < (int)stmts.size(); i++) {
-    insert(std::move(stmts[i]), start + i);
+  for (int i = start; i < end; i++) {
+    statements[i]->erased = true;
+    trash_bin.push_back(std::move(statements[i]));
   }
+  statements.erase(statements.begin() + start, statements.begin() + end);
+  insert(std::move(stmts), start);
 }
 
 void Block::replace_with(Stmt *old_statement,
@@ -487,7 +656,7 @@ For::For(Expr s, Expr e, const std::function<void(Expr)> &func) {
   auto stmt_unique = std::make_unique<FrontendForStmt>(i, s, e);
   auto stmt = stmt_unique.get();
   current_ast_builder().insert(std::move(stmt_unique));
-  auto _ = current_ast_builder().create_scope(stmt->body);
+  auto _ = stmt->create_body_scope();
   func(i);
 }
 
@@ -3,10 +3,12 @@
 #pragma once
 
 #include <atomic>
+#include <unordered_set>
 #include <taichi/util.h>
 #include <taichi/common/bit.h>
 #include "util.h"
 #include "snode.h"
+#include "inlined_vector.h"
 
 namespace llvm {
 class Value;
@@ -91,12 +93,17 @@ void replace_all_usages_with(IRNode *root, Stmt *old_stmt, Stmt *new_stmt);
 void lower_access(IRNode *root, bool lower_atomic);
 void make_adjoint(IRNode *root);
 void constant_fold(IRNode *root);
+void global_value_numbering(IRNode *root);
+void loop_invariant_code_motion(IRNode *root);
 void offload(IRNode *root);
+void demote_atomics(IRNode *root);
 void fix_block_parents(IRNode *root);
 void replace_statements_with(IRNode *root,
                              std::function<bool(Stmt *)> filter,
                              std::function<std::unique_ptr<Stmt>()> generator);
 std::unique_ptr<ScratchPads> initialize_scratch_pad(StructForStmt *root);
+void make_block_local(IRNode *root);
+void emit_block_local_transfers(IRNode *root);
 
 }  // namespace irpass
 
@@ -173,9 +180,14 @@ class FrontendContext {
   std::unique_ptr<Block> get_root() {
     return std::move(root_node);
   }
+
+  // The top-level loop most recently opened in a batched program, which
+  // defines the instance index of field accesses in its body
+  FrontendForStmt *batch_loop = nullptr;
 };
 
-extern std::unique_ptr<FrontendContext> context;
+// Frontend state is per thread, so that programs can be defined concurrently
+extern thread_local std::unique_ptr<FrontendContext> context;
 
 class IRBuilder {
  private:
@@ -191,17 +203,30 @@ class IRBuilder {
   struct ScopeGuard {
     IRBuilder *builder;
     Block *list;
+    // A scope opened within this one, which is closed with it
+    std::unique_ptr<ScopeGuard> inner;
+
     ScopeGuard(IRBuilder *builder, Block *list) : builder(builder), list(list) {
       builder->stack.push_back(list);
     }
 
     ~ScopeGuard() {
+      inner.reset();
       builder->stack.pop_back();
     }
   };
 
   std::unique_ptr<ScopeGuard> create_scope(std::unique_ptr<Block> &list);
 
+  // Whether statements are inserted directly into the kernel body
+  bool at_root() const {
+    return stack.size() == 1;
+  }
+
+  bool in_scope(Block *block) const {
+    return std::find(stack.begin(), stack.end(), block) != stack.end();
+  }
+
   Block *current_block() {
     if (stack.empty())
       return nullptr;
@@ -219,7 +244,7 @@ inline Expr smart_load(const Expr &var);
 
 class Identifier {
  public:
-  static int id_counter;
+  static std::atomic<int> id_counter;
   std::string name_;
 
   int id;
@@ -454,10 +479,74 @@ struct LaneAttribute {
   }
 };
 
+// Memory for the statements of a kernel. Large unrolled kernels create
+// hundreds of thousands of statements, so they are carved out of big chunks
+// instead of allocated one by one; the memory of erased statements is reused
+// for statements of the same size. Statements allocated while an arena is
+// current (see IRArenaGuard) live in it, and it must outlive them.
+class IRArena {
+ public:
+  IRArena() : head(nullptr), tail(nullptr) {
+  }
+
+  IRArena(const IRArena &) = delete;
+
+  void *allocate(std::size_t size);
+
+  void deallocate(void *ptr, std::size_t size);
+
+ private:
+  static constexpr std::size_t granularity = 16;
+  static constexpr std::size_t chunk_size = 1 << 16;
+
+  std::vector<std::unique_ptr<uint8[]>> chunks;
+  uint8 *head, *tail;
+  std::vector<void *> free_lists;  // indexed by size / granularity
+};
+
+extern thread_local IRArena *current_ir_arena;
+
+class IRArenaGuard {
+ public:
+  IRArena *old_arena;
+
+  explicit IRArenaGuard(IRArena *arena) {
+    old_arena = current_ir_arena;
+    current_ir_arena = arena;
+  }
+
+  ~IRArenaGuard() {
+    current_ir_arena = old_arena;
+  }
+};
+
+// Tracebacks are long and shared by all statements flattened from the same
+// frontend expression, so only one copy of each is kept
+class InternedString {
+  const std::string *s;
+
+ public:
+  InternedString();
+
+  InternedString(const std::string &str);
+
+  const std::string &str() const {
+    return *s;
+  }
+
+  operator const std::string &() const {
+    return *s;
+  }
+
+  bool empty() const {
+    return s->empty();
+  }
+};
+
 class Stmt : public IRNode {
  protected:  // NOTE: operands should not be directly modified, for the
              // correctness of operand_bitmap
-  std::vector<Stmt **> operands;
+  InlinedVector<Stmt **, 4> operands;
 
  public:
   static std::atomic<int> instance_id_counter;
@@ -466,7 +555,7 @@ class Stmt : public IRNode {
   Block *parent;
   uint64 operand_bitmap;
   bool erased;
-  std::string tb;
+  InternedString tb;
   Stmt *adjoint;
   llvm::Value *value;
   bool is_ptr;
@@ -626,12 +715,17 @@ class Stmt : public IRNode {
     irpass::typecheck(this);
   }
 
-  void set_tb(std::string tb) {
+  void set_tb(InternedString tb) {
     this->tb = tb;
   }
 
   std::string type();
 
+  // allocated from current_ir_arena if there is one
+  static void *operator new(std::size_t size);
+
+  static void operator delete(void *ptr, std::size_t size);
+
   virtual ~Stmt() override = default;
 };
 
@@ -639,7 +733,7 @@ class Stmt : public IRNode {
 class Expression {
  public:
   Stmt *stmt;
-  std::string tb;
+  InternedString tb;
 
   Expression() {
     stmt = nullptr;
@@ -827,6 +921,12 @@ inline ExprGroup operator,(const Expr &a, const Expr &b) {
   return ExprGroup(a, b);
 }
 
+// The instance of the enclosing top-level loop in a batched program
+Expr BatchInstance();
+
+// Prepends the instance index if snode belongs to a batched program
+ExprGroup batched_indices(SNode *snode, const ExprGroup &indices);
+
 inline ExprGroup operator,(const ExprGroup &a, const Expr &b) {
   return ExprGroup(a, b);
 }
@@ -1337,8 +1437,14 @@ class Block : public IRNode {
 
   void erase(Stmt *stmt);
 
+  // Erases all of stmts with a single pass over the block
+  void erase(const std::unordered_set<Stmt *> &stmts);
+
   void insert(std::unique_ptr<Stmt> &&stmt, int location = -1);
 
+  // Inserts all of stmts at location with a single shift of the block
+  void insert(VecStatement &&stmts, int location = -1);
+
   void replace_statements_in_range(int start, int end, VecStatement &&stmts);
 
   void set_statements(VecStatement &&stmts) {
@@ -1351,33 +1457,17 @@ class Block : public IRNode {
   void replace_with(Stmt *old_statement, std::unique_ptr<Stmt> &&new_statement);
 
   void insert_before(Stmt *old_statement, VecStatement &&new_statements) {
-    int location = -1;
-    for (int i = 0; i < (int)statements.size(); i++) {
-      if (old_statement == statements[i].get()) {
-        location = i;
-        break;
-      }
-    }
+    int location = locate(old_statement);
     TC_ASSERT(location != -1);
-    for (int i = (int)new_statements.size() - 1; i >= 0; i--) {
-      insert(std::move(new_statements[i]), location);
-    }
+    insert(std::move(new_statements), location);
   }
 
   void replace_with(Stmt *old_statement, VecStatement &new_statements) {
-    int location = -1;
-    for (int i = 0; i < (int)statements.size(); i++) {
-      if (old_statement == statements[i].get()) {
-        location = i;
-        break;
-      }
-    }
+    int location = locate(old_statement);
     TC_ASSERT(location != -1);
     old_statement->replace_with(new_statements.back().get());
     statements.erase(statements.begin() + location);
-    for (int i = (int)new_statements.size() - 1; i >= 0; i--) {
-      insert(std::move(new_statements[i]), location);
-    }
+    insert(std::move(new_statements), location);
   }
 
   Stmt *lookup_var(Ident ident) const;
@@ -1412,7 +1502,10 @@ class FrontendSNodeOpStmt : public Stmt {
                       SNode *snode,
                       ExprGroup indices,
                       Expr val = Expr(nullptr))
-      : op_type(op_type), snode(snode), indices(indices.loaded()), val(val) {
+      : op_type(op_type),
+        snode(snode),
+        indices(batched_indices(snode, indices.loaded())),
+        val(val) {
     if (val.expr != nullptr) {
       TC_ASSERT(op_type == SNodeOpType::append);
       this->val.set(load_if_ptr(val));
@@ -1732,6 +1825,14 @@ class FrontendForStmt : public Stmt {
   int parallelize;
   ScratchPadOptions scratch_opt;
   int block_size;
+  // Top-level loops of batched programs also iterate over the instances. The
+  // instance index is the leading loop variable of struct-fors. Range-fors
+  // loop over a linearized (instance, element) variable, from which the
+  // instance and the user's loop variable are computed in the body.
+  bool batched;
+  Ident batch_instance;
+  Ident batch_loop_var;
+  Expr batch_begin, batch_extent;
 
   bool is_ranged() const {
     if (global_var.expr == nullptr) {
@@ -1745,10 +1846,16 @@ class FrontendForStmt : public Stmt {
 
   FrontendForStmt(const Expr &loop_var, const Expr &begin, const Expr &end);
 
+  // Opens the loop body; called after the loop is inserted
+  std::unique_ptr<IRBuilder::ScopeGuard> create_body_scope();
+
   bool is_container_statement() const override {
     return true;
   }
 
+ private:
+  void initialize_batch();
+
   DEFINE_ACCEPT
 };
 
@@ -1805,6 +1912,8 @@ class StructForStmt : public Stmt {
   int parallelize;
   int block_size;
   ScratchPadOptions scratch_opt;
+  // Block-local caches chosen by irpass::make_block_local
+  std::shared_ptr<ScratchPads> scratch_pads;
 
   StructForStmt(std::vector<Stmt *> loop_vars,
                 SNode *snode,
@@ -1870,7 +1979,7 @@ void Print_(const Expr &a, std::string str);
 
 // TODO: fix this hack...
 // for current ast
-extern Block *current_block;
+extern thread_local Block *current_block;
 
 class EvalExpression : public Expression {
  public:
@@ -1944,7 +2053,7 @@ class ProbeExpression : public Expression {
   SNode *snode;
   ExprGroup indices;
   ProbeExpression(SNode *snode, const ExprGroup &indices)
-      : snode(snode), indices(indices) {
+      : snode(snode), indices(batched_indices(snode, indices)) {
   }
 
   std::string serialize() override {
@@ -2015,8 +2124,9 @@ inline Expr load_if_ptr(const Expr &ptr) {
   if (ptr.is<GlobalPtrExpression>()) {
     return load(ptr);
   } else if (ptr.is<GlobalVariableExpression>()) {
-    TC_ASSERT(ptr.cast<GlobalVariableExpression>()->snode->num_active_indices ==
-              0);
+    TC_ASSERT(
+        ptr.cast<GlobalVariableExpression>()->snode->num_frontend_indices() ==
+        0);
     return load(ptr[ExprGroup()]);
   } else
     return ptr;
@@ -2025,7 +2135,7 @@ inline Expr load_if_ptr(const Expr &ptr) {
 inline Expr ptr_if_global(const Expr &var) {
   if (var.is<GlobalVariableExpression>()) {
     // singleton global variable
-    TC_ASSERT(var.snode()->num_active_indices == 0);
+    TC_ASSERT(var.snode()->num_frontend_indices() == 0);
     return var[ExprGroup()];
   } else {
     // may be any local or global expr
@@ -2037,7 +2147,7 @@ inline Expr smart_load(const Expr &var) {
   return load_if_ptr(ptr_if_global(var));
 }
 
-extern DecoratorRecorder dec;
+extern thread_local DecoratorRecorder dec;
 
 inline void Vectorize(int v) {
   dec.vectorize = v;
@@ -2077,7 +2187,7 @@ class For {
     auto stmt_unique = std::make_unique<FrontendForStmt>(i, s, e);
     auto stmt = stmt_unique.get();
     current_ast_builder().insert(std::move(stmt_unique));
-    auto _ = current_ast_builder().create_scope(stmt->body);
+    auto _ = stmt->create_body_scope();
     func();
   }
 
@@ -2085,7 +2195,7 @@ class For {
     auto stmt_unique = std::make_unique<FrontendForStmt>(i, global);
     auto stmt = stmt_unique.get();
     current_ast_builder().insert(std::move(stmt_unique));
-    auto _ = current_ast_builder().create_scope(stmt->body);
+    auto _ = stmt->create_body_scope();
     func();
   }
 
@@ -2094,7 +2204,7 @@ class For {
     auto stmt_unique = std::make_unique<FrontendForStmt>(i, global);
     auto stmt = stmt_unique.get();
     current_ast_builder().insert(std::move(stmt_unique));
-    auto _ = current_ast_builder().create_scope(stmt->body);
+    auto _ = stmt->create_body_scope();
     func(i);
   }
 
@@ -2104,7 +2214,7 @@ class For {
     auto stmt_unique = std::make_unique<FrontendForStmt>((i, j), global);
     auto stmt = stmt_unique.get();
     current_ast_builder().insert(std::move(stmt_unique));
-    auto _ = current_ast_builder().create_scope(stmt->body);
+    auto _ = stmt->create_body_scope();
     func(i, j);
   }
 
@@ -2115,7 +2225,7 @@ class For {
     auto stmt_unique = std::make_unique<FrontendForStmt>((i, j, k), global);
     auto stmt = stmt_unique.get();
     current_ast_builder().insert(std::move(stmt_unique));
-    auto _ = current_ast_builder().create_scope(stmt->body);
+    auto _ = stmt->create_body_scope();
     func(i, j, k);
   }
 
@@ -2127,7 +2237,7 @@ class For {
     auto stmt_unique = std::make_unique<FrontendForStmt>((i, j, k, l), global);
     auto stmt = stmt_unique.get();
     current_ast_builder().insert(std::move(stmt_unique));
-    auto _ = current_ast_builder().create_scope(stmt->body);
+    auto _ = stmt->create_body_scope();
     func(i, j, k, l);
   }
 
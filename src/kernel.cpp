@@ -12,7 +12,13 @@ Kernel::Kernel(Program &program,
                std::function<void()> func,
                std::string name,
                bool grad)
-    : program(program), name(name), grad(grad) {
+    : arena(std::make_unique<IRArena>()),
+      program(program),
+      name(name),
+      grad(grad) {
+  // the frontend constructs in func refer to the current program
+  CurrentProgramGuard _(program);
+  IRArenaGuard __(arena.get());
   program.initialize_device_llvm_context();
   is_reduction = false;
   compiled = nullptr;
@@ -32,6 +38,8 @@ Kernel::Kernel(Program &program,
 }
 
 void Kernel::compile() {
+  CurrentProgramGuard _(program);
+  IRArenaGuard __(arena.get());
   program.current_kernel = this;
   compiled = program.compile(*this);
   program.current_kernel = nullptr;
@@ -40,10 +48,18 @@ void Kernel::compile() {
 void Kernel::operator()() {
   if (!compiled)
     compile();
-  std::vector<void *> host_buffers(args.size());
-  std::vector<void *> device_buffers(args.size());
+  for (int i = 0; i < (int)args.size(); i++) {
+    if (args[i].is_batched) {
+      set_arg_nparray(i, (uint64)batched_args[i].data(),
+                      batched_args[i].size());
+    }
+  }
+  program.context.rand_seed = program.config.random_seed;
+  program.context.launch_id = program.num_launches++;
   if (program.config.arch == Arch::gpu) {
 #if defined(CUDA_FOUND)
+    std::vector<void *> host_buffers(args.size());
+    std::vector<void *> device_buffers(args.size());
     // copy data to GRAM
     bool has_buffer = false;
     for (int i = 0; i < (int)args.size(); i++) {
@@ -58,8 +74,7 @@ void Kernel::operator()() {
       } }
     if (has_buffer)
       cudaDeviceSynchronize();
-    auto c = program.get_context();
-    compiled(c);
+    compiled(program.get_context());
     if (has_buffer)
       cudaDeviceSynchronize();
     for (int i = 0; i < (int)args.size(); i++) {
@@ -73,8 +88,28 @@ void Kernel::operator()() {
     TC_ERROR("No CUDA");
 #endif
   } else {
-    auto c = program.get_context();
-    compiled(c);
+    auto &c = program.get_context();
+    // External arrays belong to the caller, who may read or free them right
+    // after the call
+    bool has_external_array = false;
+    for (auto &arg : args) {
+      has_external_array |= arg.is_nparray && !arg.is_batched;
+    }
+    if (program.config.async_mode && !has_external_array) {
+      // The launch owns copies of the batched arguments, which the host may
+      // overwrite before the launch runs
+      program.launch_queue->launch(
+          [c, func = compiled, values = batched_args]() mutable {
+            for (int i = 0; i < (int)values.size(); i++) {
+              if (!values[i].empty())
+                c.set_arg(i, (uint64)values[i].data());
+            }
+            func(c);
+          });
+    } else {
+      program.launch_queue->synchronize();
+      compiled(c);
+    }
   }
   program.sync = false;
 }
@@ -136,4 +171,53 @@ void Kernel::set_arg_nparray(int i, uint64 d, uint64 size) {
   program.context.set_arg(i, d);
 }
 
+int Kernel::insert_batched_arg(DataType dt) {
+  TC_ERROR_UNLESS(program.batch_size > 0,
+                  "Batched arguments require a batched program.");
+  int i = insert_arg(dt, true);
+  args[i].is_batched = true;
+  batched_args.resize(args.size());
+  batched_args[i].resize(program.batch_capacity() * data_type_size(dt), 0);
+  return i;
+}
+
+template <typename T>
+void store_as(void *dest, DataType dt, T val) {
+  if (dt == DataType::f32) {
+    *(float32 *)dest = (float32)val;
+  } else if (dt == DataType::f64) {
+    *(float64 *)dest = (float64)val;
+  } else if (dt == DataType::i32) {
+    *(int32 *)dest = (int32)val;
+  } else if (dt == DataType::i64) {
+    *(int64 *)dest = (int64)val;
+  } else if (dt == DataType::i16) {
+    *(int16 *)dest = (int16)val;
+  } else if (dt == DataType::u16) {
+    *(uint16 *)dest = (uint16)val;
+  } else if (dt == DataType::u32) {
+    *(uint32 *)dest = (uint32)val;
+  } else if (dt == DataType::u64) {
+    *(uint64 *)dest = (uint64)val;
+  } else {
+    TC_NOT_IMPLEMENTED
+  }
+}
+
+void Kernel::set_batched_arg_float(int i, int instance, float64 d) {
+  TC_ASSERT_INFO(args[i].is_batched,
+                 "Setting per-instance value to unbatched argument");
+  TC_ASSERT(0 <= instance && instance < program.batch_size);
+  auto dt = args[i].dt;
+  store_as(&batched_args[i][instance * data_type_size(dt)], dt, d);
+}
+
+void Kernel::set_batched_arg_int(int i, int instance, int64 d) {
+  TC_ASSERT_INFO(args[i].is_batched,
+                 "Setting per-instance value to unbatched argument");
+  TC_ASSERT(0 <= instance && instance < program.batch_size);
+  auto dt = args[i].dt;
+  store_as(&batched_args[i][instance * data_type_size(dt)], dt, d);
+}
+
 TLANG_NAMESPACE_END
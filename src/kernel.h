@@ -10,6 +10,9 @@ class Program;
 
 class Kernel {
  public:
+  // holds the statements of ir; members are destroyed in reverse order, so
+  // declaring it before ir_holder keeps it alive until the IR is gone
+  std::unique_ptr<IRArena> arena;
   std::unique_ptr<IRNode> ir_holder;
   IRNode *ir;
   Program &program;
@@ -19,8 +22,11 @@ class Kernel {
     DataType dt;
     bool is_nparray;
     std::size_t size;
+    bool is_batched;
   };
   std::vector<Arg> args;
+  // Per-instance values of batched arguments, passed to kernels as arrays
+  std::vector<std::vector<uint8>> batched_args;
   bool benchmarking;
   bool is_reduction;  // TODO: systematically treat all types of reduction
   bool grad;
@@ -43,11 +49,19 @@ class Kernel {
     return args.size() - 1;
   }
 
+  // An argument with one value per instance of a batched program, loaded in
+  // kernels with BatchedArg
+  int insert_batched_arg(DataType dt);
+
   void set_arg_float(int i, float64 d);
 
   void set_arg_int(int i, int64 d);
 
   void set_arg_nparray(int i, uint64 ptr, uint64 size);
+
+  void set_batched_arg_float(int i, int instance, float64 d);
+
+  void set_batched_arg_int(int i, int instance, int64 d);
 };
 
 TLANG_NAMESPACE_END
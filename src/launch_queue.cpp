@@ -0,0 +1,75 @@
+// In-order queue of kernel launches, executed by a worker thread
+
+#include "launch_queue.h"
+
+TLANG_NAMESPACE_BEGIN
+
+LaunchQueue::LaunchQueue() : busy(false), stopping(false) {
+}
+
+LaunchQueue::~LaunchQueue() {
+  {
+    std::lock_guard<std::mutex> _(mut);
+    stopping = true;
+  }
+  task_available.notify_one();
+  if (worker.joinable())
+    worker.join();
+}
+
+void LaunchQueue::launch(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> _(mut);
+    rethrow_error();
+    tasks.push_back(std::move(task));
+    if (!worker.joinable())
+      worker = std::thread([this] { run(); });
+  }
+  task_available.notify_one();
+}
+
+void LaunchQueue::synchronize() {
+  std::unique_lock<std::mutex> lock(mut);
+  drained.wait(lock, [this] { return tasks.empty() && !busy; });
+  rethrow_error();
+}
+
+void LaunchQueue::rethrow_error() {
+  if (error) {
+    auto e = error;
+    error = nullptr;
+    std::rethrow_exception(e);
+  }
+}
+
+void LaunchQueue::run() {
+  std::unique_lock<std::mutex> lock(mut);
+  while (true) {
+    task_available.wait(lock, [this] { return stopping || !tasks.empty(); });
+    // pending tasks are finished before stopping
+    if (tasks.empty())
+      break;
+    auto task = std::move(tasks.front());
+    tasks.pop_front();
+    busy = true;
+    lock.unlock();
+    std::exception_ptr e;
+    try {
+      task();
+    } catch (...) {
+      e = std::current_exception();
+    }
+    lock.lock();
+    busy = false;
+    if (e) {
+      // the following launches may depend on the results of the failed one
+      tasks.clear();
+      if (!error)
+        error = e;
+    }
+    if (tasks.empty())
+      drained.notify_all();
+  }
+}
+
+TLANG_NAMESPACE_END
@@ -0,0 +1,49 @@
+// In-order queue of kernel launches, executed by a worker thread
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "util.h"
+
+TLANG_NAMESPACE_BEGIN
+
+// Launches run one at a time in submission order, so every kernel observes
+// the writes of the kernels launched before it. The host must synchronize
+// before it touches the data structure (Program::synchronize does).
+//
+// If a task throws, the tasks queued after it are discarded and the exception
+// is rethrown to the host by the next launch or synchronize. (TC_ERROR does
+// not throw; it aborts the process from any thread.)
+class LaunchQueue {
+ public:
+  LaunchQueue();
+
+  // Drains the queue
+  ~LaunchQueue();
+
+  void launch(std::function<void()> task);
+
+  // Blocks until all launched tasks have finished
+  void synchronize();
+
+ private:
+  void run();
+
+  // Rethrows the exception of a failed task, with mut held
+  void rethrow_error();
+
+  std::mutex mut;
+  std::condition_variable task_available, drained;
+  std::deque<std::function<void()>> tasks;
+  bool busy;  // the worker is executing a task
+  bool stopping;
+  std::exception_ptr error;
+  std::thread worker;  // started by the first launch
+};
+
+TLANG_NAMESPACE_END
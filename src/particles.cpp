@@ -0,0 +1,75 @@
+// Exporting particle fields
+
+#include <taichi/system/threading.h>
+#include "program.h"
+#include "particles.h"
+
+TLANG_NAMESPACE_BEGIN
+
+namespace {
+
+// The accessors activate the elements they visit, which is only safe to do
+// from several threads when there is nothing to activate
+bool is_dense_path(SNode *snode) {
+  for (auto s = snode->parent; s != nullptr; s = s->parent) {
+    if (s->need_activation() || s->type == SNodeType::dynamic)
+      return false;
+  }
+  return true;
+}
+
+template <typename T>
+void gather(Program &prog, SNode *snode, int n, float32 *out) {
+  auto p = snode->physical_index_position[0];
+  auto read = [&](int i) {
+    int ind[max_num_indices] = {0};
+    ind[p] = i;
+    auto ptr = snode->evaluate(prog.data_structure, ind[0], ind[1], ind[2],
+                               ind[3]);
+    out[i] = (float32)(*(T *)ptr);
+  };
+  if (is_dense_path(snode)) {
+    ThreadedTaskManager::run(n, -1, read);
+  } else {
+    for (int i = 0; i < n; i++) {
+      read(i);
+    }
+  }
+}
+
+}  // namespace
+
+ParticleFrame gather_particles(Program &prog,
+                               const std::vector<SNode *> &fields,
+                               int n,
+                               const std::vector<std::string> &names) {
+  TC_ASSERT(names.empty() || names.size() == fields.size());
+  ParticleFrame frame(n);
+  prog.synchronize();
+  for (int k = 0; k < (int)fields.size(); k++) {
+    auto snode = fields[k];
+    TC_ERROR_UNLESS(snode->type == SNodeType::place,
+                    "Particle field {} is not a place SNode", snode->name);
+    TC_ERROR_UNLESS(snode->num_active_indices == 1,
+                    "Particle field {} must have exactly one index",
+                    snode->name);
+    std::vector<float32> data(n);
+    if (snode->dt == DataType::f32) {
+      gather<float32>(prog, snode, n, data.data());
+    } else if (snode->dt == DataType::f64) {
+      gather<float64>(prog, snode, n, data.data());
+    } else if (snode->dt == DataType::i32) {
+      gather<int32>(prog, snode, n, data.data());
+    } else if (snode->dt == DataType::i64) {
+      gather<int64>(prog, snode, n, data.data());
+    } else {
+      TC_ERROR("Particle field {} has unsupported type {}", snode->name,
+               data_type_name(snode->dt));
+    }
+    frame.add_property(names.empty() ? snode->name : names[k],
+                       std::move(data));
+  }
+  return frame;
+}
+
+TLANG_NAMESPACE_END
@@ -0,0 +1,21 @@
+// Exporting particle fields
+
+#pragma once
+
+#include <taichi/io/ply_writer.h>
+#include "snode.h"
+
+TLANG_NAMESPACE_BEGIN
+
+class Program;
+
+// Gathers the first n elements of 1D place SNodes into a frame, converted to
+// float32. Properties are named after the SNodes unless names are given.
+// Fields under dense SNodes are read in parallel; others are read serially,
+// and the elements read are activated.
+ParticleFrame gather_particles(Program &prog,
+                               const std::vector<SNode *> &fields,
+                               int n,
+                               const std::vector<std::string> &names = {});
+
+TLANG_NAMESPACE_END
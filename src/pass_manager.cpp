@@ -0,0 +1,128 @@
+#include "pass_manager.h"
+
+TLANG_NAMESPACE_BEGIN
+
+class StatementGatherer : public IRVisitor {
+ public:
+  std::vector<Stmt *> stmts;
+
+  StatementGatherer() {
+    allow_undefined_visitor = true;
+    invoke_default_visitor = true;
+  }
+
+  void visit(Stmt *stmt) override {
+    stmts.push_back(stmt);
+  }
+
+  void visit(Block *stmt_list) override {
+    for (auto &stmt : stmt_list->statements) {
+      stmt->accept(this);
+    }
+  }
+
+  void visit(IfStmt *if_stmt) override {
+    stmts.push_back(if_stmt);
+    if (if_stmt->true_statements)
+      if_stmt->true_statements->accept(this);
+    if (if_stmt->false_statements)
+      if_stmt->false_statements->accept(this);
+  }
+
+  void visit(WhileStmt *stmt) override {
+    stmts.push_back(stmt);
+    stmt->body->accept(this);
+  }
+
+  void visit(RangeForStmt *for_stmt) override {
+    stmts.push_back(for_stmt);
+    for_stmt->body->accept(this);
+  }
+
+  void visit(StructForStmt *for_stmt) override {
+    stmts.push_back(for_stmt);
+    if (for_stmt->block_initialization)
+      for_stmt->block_initialization->accept(this);
+    for_stmt->body->accept(this);
+    if (for_stmt->block_finalization)
+      for_stmt->block_finalization->accept(this);
+  }
+
+  void visit(OffloadedStmt *stmt) override {
+    stmts.push_back(stmt);
+    if (stmt->prologue)
+      stmt->prologue->accept(this);
+    if (stmt->body)
+      stmt->body->accept(this);
+    if (stmt->epilogue)
+      stmt->epilogue->accept(this);
+  }
+};
+
+std::vector<Stmt *> gather_statements(IRNode *root) {
+  StatementGatherer gatherer;
+  root->accept(&gatherer);
+  return std::move(gatherer.stmts);
+}
+
+void UseDefChains::build(IRNode *root) {
+  user_map.clear();
+  for (auto stmt : gather_statements(root)) {
+    add_user(stmt);
+  }
+}
+
+void UseDefChains::add_user(Stmt *user) {
+  for (int i = 0; i < user->num_operands(); i++) {
+    auto op = user->operand(i);
+    if (op)  // might be nullptr
+      user_map[op].insert(user);
+  }
+}
+
+void UseDefChains::remove_user(Stmt *user) {
+  for (int i = 0; i < user->num_operands(); i++) {
+    auto op = user->operand(i);
+    if (!op)
+      continue;
+    auto it = user_map.find(op);
+    if (it != user_map.end())
+      it->second.erase(user);
+  }
+}
+
+std::vector<Stmt *> UseDefChains::users(Stmt *stmt) const {
+  auto it = user_map.find(stmt);
+  if (it == user_map.end())
+    return {};
+  return std::vector<Stmt *>(it->second.begin(), it->second.end());
+}
+
+std::vector<Stmt *> UseDefChains::replace_all_usages_with(Stmt *old_stmt,
+                                                          Stmt *new_stmt) {
+  auto affected = users(old_stmt);
+  user_map.erase(old_stmt);
+  for (auto user : affected) {
+    user->replace_operand_with(old_stmt, new_stmt);
+    add_user(user);
+  }
+  return affected;
+}
+
+void PassManager::run(const std::string &title,
+                      const std::function<void()> &pass) {
+  {
+    TC_PROFILER(title);
+    pass();
+  }
+  if (config.print_ir)
+    print(title);
+}
+
+void PassManager::print(const std::string &title) {
+  TC_TRACE("{}:", title);
+  irpass::re_id(ir);
+  irpass::print(ir);
+}
+
+TLANG_NAMESPACE_END
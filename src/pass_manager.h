@@ -0,0 +1,156 @@
+// Worklist-driven IR rewriting: use-def chains, value keys, statement
+// worklists and a pass runner with per-pass timing
+
+#pragma once
+
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include "ir.h"
+
+TLANG_NAMESPACE_BEGIN
+
+// All statements under root (including container statements), in program
+// order
+std::vector<Stmt *> gather_statements(IRNode *root);
+
+// Maps each statement to the statements that take it as an operand, so that a
+// rewrite of a statement only needs to touch its users instead of traversing
+// the whole IR (see Stmt::replace_with).
+//
+// The user sets are allowed to over-approximate (replace_operand_with only
+// touches matching operands), but must never miss a user: passes that create
+// statements or directly assign operand fields (e.g. IntegerOffsetStmt::input)
+// must call remove_user before and add_user after the modification.
+class UseDefChains {
+ public:
+  UseDefChains() = default;
+
+  explicit UseDefChains(IRNode *root) {
+    build(root);
+  }
+
+  void build(IRNode *root);
+
+  // Register user on all its current operands
+  void add_user(Stmt *user);
+
+  // Unregister user from all its current operands
+  void remove_user(Stmt *user);
+
+  bool has_users(Stmt *stmt) const {
+    auto it = user_map.find(stmt);
+    return it != user_map.end() && !it->second.empty();
+  }
+
+  std::vector<Stmt *> users(Stmt *stmt) const;
+
+  // Redirect all usages of old_stmt to new_stmt. Returns the affected users.
+  // Note that old_stmt itself is NOT erased.
+  std::vector<Stmt *> replace_all_usages_with(Stmt *old_stmt, Stmt *new_stmt);
+
+ private:
+  std::unordered_map<Stmt *, std::unordered_set<Stmt *>> user_map;
+};
+
+using ValueKey = std::vector<uint64>;
+
+struct ValueKeyHash {
+  std::size_t operator()(const ValueKey &key) const {
+    uint64 h = key.size();
+    for (auto v : key)
+      h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    return (std::size_t)h;
+  }
+};
+
+// Builds a key that is identical for two statements iff they compute the same
+// value. Only statements that are pure functions of their operands (including
+// the access lowering statements) get a key.
+class ValueKeyBuilder : public IRVisitor {
+ public:
+  ValueKey key;
+  bool valid;
+
+  ValueKeyBuilder() {
+    allow_undefined_visitor = true;
+    invoke_default_visitor = false;
+  }
+
+  bool build(Stmt *stmt);
+
+  void push(uint64 v) {
+    key.push_back(v);
+  }
+
+  void push(Stmt *stmt) {
+    key.push_back((uint64)stmt);
+  }
+
+  void push(SNode *snode) {
+    key.push_back((uint64)snode);
+  }
+
+  void visit(ConstStmt *stmt) override;
+  void visit(UnaryOpStmt *stmt) override;
+  void visit(BinaryOpStmt *stmt) override;
+  void visit(TernaryOpStmt *stmt) override;
+  void visit(ElementShuffleStmt *stmt) override;
+  void visit(ArgLoadStmt *stmt) override;
+  void visit(LoopIndexStmt *stmt) override;
+  void visit(GlobalPtrStmt *stmt) override;
+  void visit(IntegerOffsetStmt *stmt) override;
+  void visit(LinearizeStmt *stmt) override;
+  void visit(OffsetAndExtractBitsStmt *stmt) override;
+  void visit(SNodeLookupStmt *stmt) override;
+  void visit(GetChStmt *stmt) override;
+};
+
+// FIFO of statements where each statement is queued at most once at a time
+class StmtWorklist {
+ public:
+  void push(Stmt *stmt) {
+    if (queued.insert(stmt).second)
+      queue.push_back(stmt);
+  }
+
+  void push(const std::vector<Stmt *> &stmts) {
+    for (auto s : stmts)
+      push(s);
+  }
+
+  Stmt *pop() {
+    auto stmt = queue.front();
+    queue.pop_front();
+    queued.erase(stmt);
+    return stmt;
+  }
+
+  bool empty() const {
+    return queue.empty();
+  }
+
+ private:
+  std::deque<Stmt *> queue;
+  std::unordered_set<Stmt *> queued;
+};
+
+// Runs a sequence of passes over one kernel. Each pass is timed into the
+// global profiler (see print_profile_info) under its title, and the IR is
+// printed after the pass when config.print_ir is on.
+class PassManager {
+ public:
+  PassManager(IRNode *ir, const CompileConfig &config)
+      : ir(ir), config(config) {
+  }
+
+  void run(const std::string &title, const std::function<void()> &pass);
+
+  void print(const std::string &title);
+
+ private:
+  IRNode *ir;
+  const CompileConfig &config;
+};
+
+TLANG_NAMESPACE_END
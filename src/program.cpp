@@ -16,9 +16,8 @@
 
 TLANG_NAMESPACE_BEGIN
 
-Program *current_program = nullptr;
-std::atomic<int> Program::num_instances;
-SNode root;
+thread_local Program *current_program = nullptr;
+thread_local SNode root;
 
 FunctionType Program::compile(Kernel &kernel) {
   FunctionType ret = nullptr;
@@ -38,8 +37,8 @@ FunctionType Program::compile(Kernel &kernel) {
 void Program::materialize_layout() {
   // always use arch=x86_64 since this is for host accessors
   std::unique_ptr<StructCompiler> scomp =
-      StructCompiler::make(config.use_llvm, Arch::x86_64);
-  scomp->run(root, true);
+      StructCompiler::make(this, config.use_llvm, Arch::x86_64);
+  scomp->run(*snode_root, true);
   layout_fn = scomp->get_source_path();
   data_structure = scomp->creator();
   profiler_print_gpu = scomp->profiler_print;
@@ -50,16 +49,47 @@ void Program::materialize_layout() {
     initialize_device_llvm_context();
     // llvm_context_device->get_init_module();
     std::unique_ptr<StructCompiler> scomp_gpu =
-        StructCompiler::make(config.use_llvm, Arch::gpu);
-    scomp_gpu->run(root, false);
+        StructCompiler::make(this, config.use_llvm, Arch::gpu);
+    scomp_gpu->run(*snode_root, false);
 #else
     TC_NOT_IMPLEMENTED
 #endif
   }
 }
 
+void Program::set_owner(SNode &snode) {
+  snode.program = this;
+  for (auto &c : snode.ch) {
+    set_owner(*c);
+  }
+}
+
+void Program::insert_batch_axis() {
+  std::function<void(SNode &)> check = [&](SNode &snode) {
+    TC_ERROR_IF(snode.type == SNodeType::hash,
+                "Hashed nodes are not supported in batched programs.");
+    TC_ERROR_IF(snode.extractors[batch_index].active,
+                "Index {} is reserved for the instances of batched programs.",
+                batch_index);
+    snode.depth += 1;
+    for (auto &c : snode.ch)
+      check(*c);
+  };
+  auto batch = SNode::create(1, SNodeType::dense);
+  batch->_batch_axis = true;
+  batch->n = batch_capacity();
+  batch->extractors[batch_index].activate(bit::log2int(batch->n));
+  for (auto &c : root.ch) {
+    check(*c);
+    batch->ch.push_back(c);
+  }
+  root.ch.clear();
+  root.ch.push_back(batch);
+}
+
 void Program::synchronize() {
   if (!sync) {
+    launch_queue->synchronize();
     if (config.arch == Arch::gpu) {
 #if defined(CUDA_FOUND)
       cudaDeviceSynchronize();
@@ -161,12 +191,9 @@ Program::Program(Arch arch) {
     arch = Arch::x86_64;
   }
 #endif
-  TC_ASSERT_INFO(num_instances == 0, "Only one instance at a time");
-  num_instances += 1;
-  SNode::counter = 0;
   // llvm_context_device is initialized before kernel compilation
-  UnifiedAllocator::create();
-  TC_ASSERT(current_program == nullptr);
+  unified_allocator = UnifiedAllocator::create();
+  // the latest program created on a thread becomes its current program
   current_program = this;
   config = default_compile_config;
   config.arch = arch;
@@ -177,9 +204,12 @@ Program::Program(Arch arch) {
   snode_root = nullptr;
   index_counter = 0;
   sync = true;
+  num_launches = 0;
+  launch_queue = std::make_unique<LaunchQueue>();
   llvm_runtime = nullptr;
   clear_all_gradients_initialized = false;
   finalized = false;
+  batch_size = 0;
 }
 
 void Program::initialize_device_llvm_context() {
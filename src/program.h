@@ -11,17 +11,37 @@
 #include "ir.h"
 #include "taichi_llvm_context.h"
 #include "kernel.h"
+#include "launch_queue.h"
 #include <dlfcn.h>
 
 TLANG_NAMESPACE_BEGIN
 
-extern Program *current_program;
-extern SNode root;
+// Programs are independent of each other and may live concurrently. Each
+// thread has its own current program, which is the one the frontend
+// constructs (layout, kernel definitions, ...) refer to, and its own root
+// SNode under construction by Program::layout.
+extern thread_local Program *current_program;
+extern thread_local SNode root;
 
 TC_FORCE_INLINE Program &get_current_program() {
   return *current_program;
 }
 
+// Makes prog the current program of this thread for the lifetime of the guard
+class CurrentProgramGuard {
+ public:
+  Program *old_program;
+
+  explicit CurrentProgramGuard(Program &prog) {
+    old_program = current_program;
+    current_program = &prog;
+  }
+
+  ~CurrentProgramGuard() {
+    current_program = old_program;
+  }
+};
+
 class Program {
  public:
   using Kernel = taichi::Tlang::Kernel;
@@ -30,18 +50,28 @@ class Program {
   Kernel *current_kernel;
   SNode *current_snode;
   SNode *snode_root;
+  std::unique_ptr<SNode> snode_root_holder;
   // pointer to the data structure. assigned to context.buffers[0] during kernel
   // launches
   void *llvm_runtime;
   void *data_structure;
+  // owns the data structure; released with the program
+  UnifiedAllocator *unified_allocator;
   CompileConfig config;
   CPUProfiler cpu_profiler;
   Context context;
   std::unique_ptr<TaichiLLVMContext> llvm_context_host, llvm_context_device;
   bool sync;  // device/host synchronized?
+  uint32 num_launches;  // of kernels, keys the random number streams
+  // Pending CPU launches (see CompileConfig::async_mode)
+  std::unique_ptr<LaunchQueue> launch_queue;
   bool clear_all_gradients_initialized;
   bool finalized;
-  static std::atomic<int> num_instances;
+  // Number of independent instances of a batched program, 0 if not batched.
+  // Must be set before layout, which then prepends an instance axis to the
+  // SNode tree. Top-level loops iterate over (instance, element) and field
+  // accesses in kernels implicitly refer to the instance of the iteration.
+  int batch_size;
 
   std::vector<std::unique_ptr<Kernel>> functions;
   int index_counter;
@@ -52,6 +82,7 @@ class Program {
   std::string layout_fn;
 
   void profiler_print() {
+    synchronize();
     if (config.arch == Arch::gpu) {
       profiler_print_gpu();
     } else {
@@ -60,6 +91,7 @@ class Program {
   }
 
   void profiler_clear() {
+    synchronize();
     if (config.arch == Arch::gpu) {
       profiler_clear_gpu();
     } else {
@@ -67,10 +99,11 @@ class Program {
     }
   }
 
-  Context get_context() {
+  Context &get_context() {
     context.buffers[0] = data_structure;
     context.cpu_profiler = &cpu_profiler;
     context.runtime = llvm_runtime;
+    context.allocator = unified_allocator;
     return context;
   }
 
@@ -87,30 +120,79 @@ class Program {
 
   void synchronize();
 
+  // Rethrows the exception of a failed launch after releasing the resources
   void finalize() {
-    current_program = nullptr;
+    // the pending launches still use the memory and the kernel libraries
+    std::exception_ptr error;
+    try {
+      synchronize();
+    } catch (...) {
+      error = std::current_exception();
+    }
+    if (current_program == this)
+      current_program = nullptr;
     for (auto &dll : loaded_dlls) {
       dlclose(dll);
     }
-    UnifiedAllocator::free();
+    UnifiedAllocator::free(unified_allocator);
+    unified_allocator = nullptr;
     finalized = true;
-    num_instances -= 1;
+    if (error)
+      std::rethrow_exception(error);
   }
 
   ~Program() {
-    if (!finalized)
-      finalize();
+    if (!finalized) {
+      try {
+        finalize();
+      } catch (...) {
+        // call finalize() to handle the errors of the last launches
+      }
+    }
   }
 
   void layout(std::function<void()> func) {
+    CurrentProgramGuard _(*this);
+    SNode::counter = 0;
     root = SNode(0, SNodeType::root);
-    snode_root = &root;
     func();
+    if (batch_size > 0)
+      insert_batch_axis();
+    // the tree is owned by this program, so that the thread can go on to lay
+    // out another one
+    snode_root_holder = std::make_unique<SNode>(std::move(root));
+    snode_root = snode_root_holder.get();
+    set_owner(*snode_root);
     materialize_layout();
   }
 
+  // Moves the children of root under a dense node over the instances
+  void insert_batch_axis();
+
+  // Marks snode and its descendants as part of this program
+  void set_owner(SNode &snode);
+
+  // Physical index of the instance axis of batched programs
+  static constexpr int batch_index = max_num_indices - 1;
+
+  // Number of instances allocated, batch_size promoted to a power of two.
+  // Kernels skip the padding instances.
+  int batch_capacity() const {
+    return batch_size > 0 ? (int)bit::least_pot_bound(batch_size) : 1;
+  }
+
   void visualize_layout(const std::string &fn);
 
+  // Binary snapshots of the data structure (see snapshot.h)
+  void save_snapshot(const std::string &fn);
+
+  void load_snapshot(const std::string &fn);
+
+  // Compiles the kernels and the layout into <prefix>.so, with a C interface
+  // in <prefix>.h that needs neither LLVM nor taichi (see aot_llvm.cpp)
+  void export_library(const std::string &prefix,
+                      const std::vector<Kernel *> &kernels);
+
   struct KernelProxy {
     std::string name;
     Program *prog;
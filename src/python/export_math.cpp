@@ -347,6 +347,21 @@ void export_math(py::module &m) {
       .def("rasterize_scale", &Array2D<Vector4>::rasterize_scale)
       .def("to_ndarray", &array2d_to_ndarray<Array2D<Vector4>, 4>);
 
+  py::class_<AsyncFrameWriter>(m, "AsyncFrameWriter")
+      .def(py::init<int, int, bool>())
+      .def(py::init<const std::string &, int, bool>())
+      // Takes the pixels of frame, which is left empty
+      .def("write",
+           [](AsyncFrameWriter *writer, const std::string &fn,
+              Array2D<Vector3> &frame) {
+             bool ret = writer->write(fn, std::move(frame));
+             frame = Array2D<Vector3>();
+             return ret;
+           })
+      .def("wait", &AsyncFrameWriter::wait)
+      .def("close", &AsyncFrameWriter::close)
+      .def("get_num_dropped", &AsyncFrameWriter::get_num_dropped);
+
   py::class_<LevelSet2D, std::shared_ptr<LevelSet2D>>(m, "LevelSet2D",
                                                       PyArray2Dreal)
       .def(py::init<Vector2i, Vector2>())
@@ -356,6 +371,7 @@ void export_math(py::module &m) {
       .def("set", static_cast<void (LevelSet2D::*)(int, int, const real &)>(
                       &LevelSet2D::set))
       .def("add_sphere", &LevelSet2D::add_sphere)
+      .def("redistance", &LevelSet2D::redistance)
       .def("add_polygon", &LevelSet2D::add_polygon)
       .def("add_plane", &LevelSet2D::add_plane)
       .def("add_slope", &LevelSet2D::add_slope)
@@ -387,6 +403,7 @@ void export_math(py::module &m) {
       .def("add_slope", &LevelSet3D::add_slope)
       .def("add_cylinder", &LevelSet3D::add_cylinder)
       .def("global_increase", &LevelSet3D::global_increase)
+      .def("redistance", &LevelSet3D::redistance)
       .def("get_gradient", &LevelSet3D::get_gradient)
       .def("rasterize", &LevelSet3D::rasterize)
       .def("sample", static_cast<real (LevelSet3D::*)(real, real, real) const>(
@@ -10,6 +10,7 @@
 #include <taichi/geometry/factory.h>
 #include <taichi/math/levelset.h>
 #include <taichi/visual/gui.h>
+#include <taichi/visual/voxelizer.h>
 
 TC_NAMESPACE_BEGIN
 
@@ -28,6 +29,21 @@ void export_visual(py::module &m) {
       .def("get_canvas", &GUI::get_canvas,
            py::return_value_policy::reference)
       .def("screenshot", &GUI::screenshot)
+      // address, size and strides (in float32 elements) of an image in
+      // memory
+      .def("set_image",
+           [](GUI *gui, uint64 address, int width, int height, int64 stride_i,
+              int64 stride_j, int num_channels, int64 stride_c) {
+             ImageView view;
+             view.data = reinterpret_cast<const float32 *>(address);
+             view.width = width;
+             view.height = height;
+             view.stride_i = stride_i;
+             view.stride_j = stride_j;
+             view.num_channels = num_channels;
+             view.stride_c = stride_c;
+             gui->set_image(view);
+           })
       .def("update", &GUI::update);
   py::class_<Canvas>(m, "Canvas")
       .def("clear", static_cast<void (Canvas::*)(int)>(&Canvas::clear))
@@ -48,6 +64,13 @@ void export_visual(py::module &m) {
       .def("radius", &Circle::radius, py::return_value_policy::reference)
       .def("color", static_cast<Circle &(Circle::*)(int)>(&Circle::color),
            py::return_value_policy::reference);
+
+  py::class_<Voxelizer>(m, "Voxelizer")
+      .def(py::init<std::vector<Vector3>, std::vector<Vector3i>, Matrix4>())
+      .def("inside", &Voxelizer::inside)
+      .def("distance", &Voxelizer::distance)
+      .def("fill", &Voxelizer::fill<real>)
+      .def("add_to_levelset", &Voxelizer::add_to_levelset);
 }
 
 TC_NAMESPACE_END
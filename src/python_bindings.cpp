@@ -78,6 +78,7 @@ void export_lang(py::module &m) {
       .def_readwrite("arch", &CompileConfig::arch)
       .def_readwrite("print_ir", &CompileConfig::print_ir)
       .def_readwrite("use_llvm", &CompileConfig::use_llvm)
+      .def_readwrite("async_mode", &CompileConfig::async_mode)
       .def_readwrite("print_struct_llvm_ir",
                      &CompileConfig::print_struct_llvm_ir)
       .def_readwrite("print_kernel_llvm_ir",
@@ -87,6 +88,13 @@ void export_lang(py::module &m) {
       .def_readwrite("simplify_after_lower_access",
                      &CompileConfig::simplify_after_lower_access)
       .def_readwrite("lower_access", &CompileConfig::lower_access)
+      .def_readwrite("hoist_loop_invariants",
+                     &CompileConfig::hoist_loop_invariants)
+      .def_readwrite("value_numbering", &CompileConfig::value_numbering)
+      .def_readwrite("demote_atomics", &CompileConfig::demote_atomics)
+      .def_readwrite("random_seed", &CompileConfig::random_seed)
+      .def_readwrite("fast_math", &CompileConfig::fast_math)
+      .def_readwrite("export_target_cpu", &CompileConfig::export_target_cpu)
 
       .def_readwrite("enable_profiler", &CompileConfig::enable_profiler)
       .def_readwrite("gradient_dt", &CompileConfig::gradient_dt);
@@ -101,11 +109,40 @@ void export_lang(py::module &m) {
   py::class_<Program>(m, "Program")
       .def(py::init<>())
       .def_readonly("config", &Program::config)
+      .def_readwrite("batch_size", &Program::batch_size)
       .def("clear_all_gradients", &Program::clear_all_gradients)
       .def("profiler_print", &Program::profiler_print)
       .def("profiler_print", &Program::profiler_clear)
       .def("finalize", &Program::finalize)
-      .def("synchronize", &Program::synchronize);
+      .def("save_snapshot", &Program::save_snapshot)
+      .def("load_snapshot", &Program::load_snapshot)
+      .def("export_library", &Program::export_library)
+      .def("synchronize", &Program::synchronize,
+           py::call_guard<py::gil_scoped_release>());
+
+  py::class_<CheckpointWriter>(m, "CheckpointWriter")
+      .def(py::init<>())
+      .def("write", &CheckpointWriter::write)
+      .def("reset", &CheckpointWriter::reset);
+
+  m.def("reconstruct_checkpoint", reconstruct_checkpoint);
+
+  py::class_<AsyncParticleWriter>(m, "AsyncParticleWriter")
+      .def(py::init<int>())
+      .def("write",
+           [](AsyncParticleWriter *writer, const std::string &fn,
+              const std::vector<SNode *> &fields, int n,
+              const std::vector<std::string> &names) {
+             writer->write(fn, gather_particles(get_current_program(), fields,
+                                                n, names));
+           })
+      .def("wait", &AsyncParticleWriter::wait);
+
+  m.def("voxelize", [](SNode *snode, const Voxelizer &voxelizer, Vector3i res,
+                       float64 value, Vector3 storage_offset) {
+    return voxelize(get_current_program(), snode, voxelizer, res, value,
+                    storage_offset);
+  });
 
   m.def("get_current_program", get_current_program,
         py::return_value_policy::reference);
@@ -139,6 +176,10 @@ void export_lang(py::module &m) {
       .def("set_arg_int", &Kernel::set_arg_int)
       .def("set_arg_float", &Kernel::set_arg_float)
       .def("set_arg_nparray", &Kernel::set_arg_nparray)
+      .def("set_batched_arg_int", &Kernel::set_batched_arg_int)
+      .def("set_batched_arg_float", &Kernel::set_batched_arg_float)
+      // Keeps the GIL: the launch setup writes the shared program context.
+      // CPU launches are queued, so Python-side work still overlaps them.
       .def("__call__", &Kernel::operator());
 
   py::class_<Expr> expr(m, "Expr");
@@ -152,7 +193,11 @@ void export_lang(py::module &m) {
              expr->cast<GlobalVariableExpression>()->is_primal = v;
            })
       .def("set_grad", &Expr::set_grad)
-      .def("get_raw_address", [](Expr *expr) { return (uint64)expr; });
+      .def("get_raw_address", [](Expr *expr) { return (uint64)expr; })
+      // Address of element (i, j) of a 2D field, e.g. for GUI.set_image
+      .def("get_element_address", [](Expr *expr, int i, int j) {
+        return (uint64)expr->val_tmp(expr->snode()->dt, i, j);
+      });
 
   export_accessors<int32>(expr);
   export_accessors<int64>(expr);
@@ -193,7 +238,7 @@ void export_lang(py::module &m) {
           auto stmt_unique = std::make_unique<FrontendForStmt>(i, s, e);
           auto stmt = stmt_unique.get();
           current_ast_builder().insert(std::move(stmt_unique));
-          scope_stack.push_back(current_ast_builder().create_scope(stmt->body));
+          scope_stack.push_back(stmt->create_body_scope());
         });
 
   m.def("begin_frontend_struct_for",
@@ -201,7 +246,7 @@ void export_lang(py::module &m) {
           auto stmt_unique = std::make_unique<FrontendForStmt>(indices, global);
           auto stmt = stmt_unique.get();
           current_ast_builder().insert(std::move(stmt_unique));
-          scope_stack.push_back(current_ast_builder().create_scope(stmt->body));
+          scope_stack.push_back(stmt->create_body_scope());
         });
 
   m.def("end_frontend_range_for", [&]() { scope_stack.pop_back(); });
@@ -235,6 +280,14 @@ void export_lang(py::module &m) {
     current_ast_builder().insert(Stmt::make<FrontendAtomicStmt>(
         AtomicOpType::add, ptr_if_global(a), load_if_ptr(b)));
   });
+  m.def("expr_atomic_max", [&](const Expr &a, const Expr &b) {
+    current_ast_builder().insert(Stmt::make<FrontendAtomicStmt>(
+        AtomicOpType::max, ptr_if_global(a), load_if_ptr(b)));
+  });
+  m.def("expr_atomic_min", [&](const Expr &a, const Expr &b) {
+    current_ast_builder().insert(Stmt::make<FrontendAtomicStmt>(
+        AtomicOpType::min, ptr_if_global(a), load_if_ptr(b)));
+  });
   m.def("expr_add", expr_add);
   m.def("expr_sub", expr_sub);
   m.def("expr_mul", expr_mul);
@@ -242,6 +295,8 @@ void export_lang(py::module &m) {
   m.def("expr_mod", expr_mod);
   m.def("expr_max", expr_max);
   m.def("expr_min", expr_min);
+  m.def("expr_atan2", expr_atan2);
+  m.def("expr_pow", expr_pow);
 
   m.def("expr_bit_and", expr_bit_and);
   m.def("expr_bit_or", expr_bit_or);
@@ -294,6 +349,8 @@ void export_lang(py::module &m) {
 
   m.def("make_arg_load_expr", Expr::make<ArgLoadExpression, int>);
 
+  m.def("make_batched_arg_load_expr", BatchedArg);
+
   m.def("make_external_tensor_expr",
         Expr::make<ExternalTensorExpression, const DataType &, int, int>);
 
@@ -353,6 +410,10 @@ void export_lang(py::module &m) {
                                                                  is_nparray);
   });
 
+  m.def("decl_batched_arg", [&](DataType dt) {
+    return get_current_program().get_current_kernel().insert_batched_arg(dt);
+  });
+
   m.def("test_throw", [] {
     try {
       throw IRModified();
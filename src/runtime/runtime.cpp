@@ -4,6 +4,7 @@
 #include <type_traits>
 #include <atomic>
 #include <cmath>
+#include "../../include/taichi/philox.h"
 
 #define FORCEINLINE __attribute__((always_inline))
 
@@ -36,6 +37,7 @@ using float64 = double;
 
 using i8 = int8;
 using i32 = int32;
+using i64 = int64;
 using f32 = float32;
 using f64 = float64;
 
@@ -43,8 +45,13 @@ constexpr int taichi_max_num_indices = 4;
 constexpr int taichi_max_num_args = 8;
 
 using uint8 = uint8_t;
+using uint32 = uint32_t;
+using uint64 = uint64_t;
 using Ptr = uint8 *;
 
+using u32 = uint32;
+using u64 = uint64;
+
 using ContextArgType = long long;
 
 extern "C" {
@@ -67,6 +74,463 @@ DEFINE_UNARY_REAL_FUNC(tan)
 DEFINE_UNARY_REAL_FUNC(tanh)
 DEFINE_UNARY_REAL_FUNC(abs)
 
+#define DEFINE_BINARY_REAL_FUNC(F)          \
+  float F##_f32(float x, float y) {       \
+    return std::F(x, y);                  \
+  }                                       \
+  double F##_f64(double x, double y) {    \
+    return std::F(x, y);                  \
+  }
+
+DEFINE_BINARY_REAL_FUNC(pow)
+DEFINE_BINARY_REAL_FUNC(atan2)
+
+// Vectorizable math functions, used with CompileConfig::fast_math
+//
+// The std:: functions above compile to calls into libm, which the loop
+// vectorizer cannot widen. The fast_* versions below are branch-free
+// polynomial approximations (mostly after Cephes) without any calls, so that
+// they are inlined into kernels and vectorized together with the loop body.
+// The runtime is compiled without optimization, so the shared kernels are
+// FORCEINLINE: otherwise they would be left behind as noinline calls.
+//
+// Maximum errors, measured against long double references on dense samples
+// and rounded up:
+//
+//                  f32       f64
+//   exp, log       1 ULP     2 ULP
+//   sin, cos       2 ULP     3 ULP    |x| < 2^20 (range reduction limit)
+//   tan            4 ULP     4 ULP    |x| < 2^20
+//   tanh           2 ULP     2 ULP
+//   atan2          3 ULP     2 ULP
+//   pow            1 ULP     2 + 2 |y ln x| ULP
+//   sqrt           0.5 ULP (the llvm.sqrt intrinsic, a single instruction)
+//
+// Denormal results are flushed to zero, and denormal inputs of log are treated
+// as zero. pow of a negative base is NaN unless the exponent is an integer.
+// sin, cos and tan of larger arguments lose accuracy, up to being meaningless,
+// which is one reason fast_math is off by default.
+//
+// The *_x4 (f32) and *_x2 (f64) variants operate on 128-bit vectors. They are
+// registered as the vector versions of the scalar functions with the loop
+// vectorizer (see vectorizable_math_functions in llvm_jit.cpp).
+
+using f32x4 = f32 __attribute__((vector_size(16)));
+using f64x2 = f64 __attribute__((vector_size(16)));
+
+FORCEINLINE f32 i32_as_f32(i32 i) {
+  union {
+    i32 i;
+    f32 f;
+  } u;
+  u.i = i;
+  return u.f;
+}
+
+FORCEINLINE i32 f32_as_i32(f32 f) {
+  union {
+    i32 i;
+    f32 f;
+  } u;
+  u.f = f;
+  return u.i;
+}
+
+FORCEINLINE f64 i64_as_f64(i64 i) {
+  union {
+    i64 i;
+    f64 f;
+  } u;
+  u.i = i;
+  return u.f;
+}
+
+FORCEINLINE i64 f64_as_i64(f64 f) {
+  union {
+    i64 i;
+    f64 f;
+  } u;
+  u.f = f;
+  return u.i;
+}
+
+FORCEINLINE f32 copysign_f32(f32 x, f32 sign) {
+  return i32_as_f32((f32_as_i32(x) & 0x7fffffff) |
+                    (f32_as_i32(sign) & (i32)0x80000000));
+}
+
+FORCEINLINE f64 copysign_f64(f64 x, f64 sign) {
+  return i64_as_f64((f64_as_i64(x) & 0x7fffffffffffffffLL) |
+                    (f64_as_i64(sign) & (i64)0x8000000000000000ULL));
+}
+
+// 2^n for integral n in [-252, 254], as two factors to stay within the
+// normal exponent range
+FORCEINLINE f32 ldexp_f32(f32 x, i32 n) {
+  i32 n1 = n >> 1;
+  i32 n2 = n - n1;
+  return x * i32_as_f32((n1 + 127) << 23) * i32_as_f32((n2 + 127) << 23);
+}
+
+FORCEINLINE f64 ldexp_f64(f64 x, i64 n) {
+  i64 n1 = n >> 1;
+  i64 n2 = n - n1;
+  return x * i64_as_f64((n1 + 1023) << 52) * i64_as_f64((n2 + 1023) << 52);
+}
+
+// e^x = 2^n e^r, where n = rint(x / ln 2) and |r| <= ln 2 / 2
+FORCEINLINE f32 exp_kernel_f32(f32 x) {
+  const f32 lo = -87.33654f, hi = 88.72283f;
+  f32 c = x < lo ? lo : (x > hi ? hi : x);
+  f32 n = __builtin_rintf(c * 1.44269504088896341f);
+  f32 r = c - n * 0.693359375f;
+  r = r - n * -2.12194440e-4f;
+  f32 p = 1.9875691500e-4f;
+  p = p * r + 1.3981999507e-3f;
+  p = p * r + 8.3334519073e-3f;
+  p = p * r + 4.1665795894e-2f;
+  p = p * r + 1.6666665459e-1f;
+  p = p * r + 5.0000001201e-1f;
+  p = p * r * r + r + 1.0f;
+  f32 ret = ldexp_f32(p, (i32)n);
+  ret = x < lo ? 0.0f : ret;
+  return x > hi ? __builtin_inff() : ret;
+}
+
+FORCEINLINE f64 exp_kernel_f64(f64 x) {
+  const f64 lo = -708.3964185322641, hi = 709.782712893384;
+  f64 c = x < lo ? lo : (x > hi ? hi : x);
+  f64 n = __builtin_rint(c * 1.4426950408889634073599);
+  f64 r = c - n * 6.93145751953125e-1;
+  r = r - n * 1.42860682030941723212e-6;
+  f64 rr = r * r;
+  f64 p = 1.26177193074810590878e-4;
+  p = p * rr + 3.02994407707441961300e-2;
+  p = p * rr + 9.99999999999999999910e-1;
+  p = p * r;
+  f64 q = 3.00198505138664455042e-6;
+  q = q * rr + 2.52448340349684104192e-3;
+  q = q * rr + 2.27265548208155028766e-1;
+  q = q * rr + 2.00000000000000000009e0;
+  f64 e = 1.0 + 2.0 * (p / (q - p));
+  f64 ret = ldexp_f64(e, (i64)n);
+  ret = x < lo ? 0.0 : ret;
+  return x > hi ? __builtin_inf() : ret;
+}
+
+// log x = k ln 2 + log m, where x = m 2^k and m is in [sqrt(1/2), sqrt(2))
+FORCEINLINE f32 log_kernel_f32(f32 x) {
+  i32 ix = f32_as_i32(x);
+  i32 k = ((ix >> 23) & 0xff) - 126;
+  f32 m = i32_as_f32((ix & 0x007fffff) | 0x3f000000);
+  bool below = m < 0.707106781186547524f;
+  k = below ? k - 1 : k;
+  f32 r = below ? m + m - 1.0f : m - 1.0f;
+  f32 z = r * r;
+  f32 p = 7.0376836292e-2f;
+  p = p * r - 1.1514610310e-1f;
+  p = p * r + 1.1676998740e-1f;
+  p = p * r - 1.2420140846e-1f;
+  p = p * r + 1.4249322787e-1f;
+  p = p * r - 1.6668057665e-1f;
+  p = p * r + 2.0000714765e-1f;
+  p = p * r - 2.4999993993e-1f;
+  p = p * r + 3.3333331174e-1f;
+  f32 fk = (f32)k;
+  f32 y = p * r * z;
+  y = y + fk * -2.12194440e-4f;
+  y = y - 0.5f * z;
+  f32 ret = r + y + fk * 0.693359375f;
+  ret = ix < 0x00800000 ? -__builtin_inff() : ret;  // zero and denormals
+  ret = ix >= 0x7f800000 ? x : ret;                 // inf and NaN
+  return x < 0.0f ? __builtin_nanf("") : ret;
+}
+
+FORCEINLINE f64 log_kernel_f64(f64 x) {
+  i64 ix = f64_as_i64(x);
+  i64 k = ((ix >> 52) & 0x7ff) - 1022;
+  f64 m = i64_as_f64((ix & 0x000fffffffffffffLL) | 0x3fe0000000000000LL);
+  bool below = m < 0.70710678118654752440;
+  k = below ? k - 1 : k;
+  // s = 2 (m - 1) / (m + 1), with m doubled if below
+  f64 num = below ? m - 0.5 : (m - 0.5) - 0.5;
+  f64 den = below ? 0.5 * num + 0.5 : 0.5 * m + 0.5;
+  f64 s = num / den;
+  f64 z = s * s;
+  f64 p = -7.89580278884799154124e-1;
+  p = p * z + 1.63866645699558079767e1;
+  p = p * z - 6.41409952958715622951e1;
+  f64 q = z - 3.56722798256324312549e1;
+  q = q * z + 3.12093766372244180303e2;
+  q = q * z - 7.69691943550460008604e2;
+  f64 fk = (f64)k;
+  f64 y = s * (z * p / q);
+  y = y - fk * 2.121944400546905827679e-4;
+  f64 ret = y + s + fk * 0.693359375;
+  ret = ix < 0x0010000000000000LL ? -__builtin_inf() : ret;
+  ret = ix >= 0x7ff0000000000000LL ? x : ret;
+  return x < 0.0 ? __builtin_nan("") : ret;
+}
+
+// sin and cos of r in [-pi/4, pi/4]. The argument is reduced by multiples of
+// pi/2 in double precision: n pi/2 is subtracted exactly for |n| < 2^20.
+FORCEINLINE f32 sin_poly_f32(f32 r) {
+  f32 z = r * r;
+  f32 p = -1.9515295891e-4f;
+  p = p * z + 8.3321608736e-3f;
+  p = p * z - 1.6666654611e-1f;
+  return r + r * z * p;
+}
+
+FORCEINLINE f32 cos_poly_f32(f32 r) {
+  f32 z = r * r;
+  f32 p = 2.443315711809948e-5f;
+  p = p * z - 1.388731625493765e-3f;
+  p = p * z + 4.166664568298827e-2f;
+  return 1.0f - 0.5f * z + z * z * p;
+}
+
+// n mod 4 for an integral n. Converting n itself is undefined once it is out
+// of the range of the integer type, or not finite.
+FORCEINLINE i32 quadrant_of(f64 n) {
+  f64 q = n - 4.0 * __builtin_floor(n * 0.25);
+  return (q >= 0.0 && q < 4.0) ? (i32)q : 0;
+}
+
+FORCEINLINE f32 reduce_pio2_f32(f32 x, i32 &quadrant) {
+  f64 d = x;
+  f64 n = __builtin_rint(d * 0.63661977236758134308);
+  quadrant = quadrant_of(n);
+  d = d - n * 1.57079632673412561417e+00;
+  d = d - n * 6.07710050650619224932e-11;
+  return (f32)d;
+}
+
+FORCEINLINE f64 sin_poly_f64(f64 r) {
+  f64 z = r * r;
+  f64 p = 1.58962301576546568060e-10;
+  p = p * z - 2.50507477628578072866e-8;
+  p = p * z + 2.75573136213857245213e-6;
+  p = p * z - 1.98412698295895385996e-4;
+  p = p * z + 8.33333333332211858878e-3;
+  p = p * z - 1.66666666666666307295e-1;
+  return r + r * z * p;
+}
+
+FORCEINLINE f64 cos_poly_f64(f64 r) {
+  f64 z = r * r;
+  f64 p = -1.13585365213876817300e-11;
+  p = p * z + 2.08757008419747316778e-9;
+  p = p * z - 2.75573141792967388112e-7;
+  p = p * z + 2.48015872888517045348e-5;
+  p = p * z - 1.38888888888730564116e-3;
+  p = p * z + 4.16666666666665929218e-2;
+  return 1.0 - 0.5 * z + z * z * p;
+}
+
+FORCEINLINE f64 reduce_pio2_f64(f64 x, i64 &quadrant) {
+  f64 n = __builtin_rint(x * 0.63661977236758134308);
+  quadrant = quadrant_of(n);
+  f64 r = x - n * 1.57079632673412561417e+00;
+  r = r - n * 6.07710050630396597660e-11;
+  r = r - n * 2.02226624871116645580e-21;
+  return r;
+}
+
+// sin(x + q pi/2)
+FORCEINLINE f32 sin_quadrant_f32(f32 r, i32 q) {
+  f32 ret = (q & 1) ? cos_poly_f32(r) : sin_poly_f32(r);
+  return (q & 2) ? -ret : ret;
+}
+
+FORCEINLINE f64 sin_quadrant_f64(f64 r, i64 q) {
+  f64 ret = (q & 1) ? cos_poly_f64(r) : sin_poly_f64(r);
+  return (q & 2) ? -ret : ret;
+}
+
+FORCEINLINE f32 sin_kernel_f32(f32 x) {
+  i32 q;
+  f32 r = reduce_pio2_f32(x, q);
+  return sin_quadrant_f32(r, q);
+}
+
+FORCEINLINE f32 cos_kernel_f32(f32 x) {
+  i32 q;
+  f32 r = reduce_pio2_f32(x, q);
+  return sin_quadrant_f32(r, q + 1);
+}
+
+FORCEINLINE f32 tan_kernel_f32(f32 x) {
+  i32 q;
+  f32 r = reduce_pio2_f32(x, q);
+  f32 s = sin_poly_f32(r), c = cos_poly_f32(r);
+  return (q & 1) ? -c / s : s / c;
+}
+
+FORCEINLINE f64 sin_kernel_f64(f64 x) {
+  i64 q;
+  f64 r = reduce_pio2_f64(x, q);
+  return sin_quadrant_f64(r, q);
+}
+
+FORCEINLINE f64 cos_kernel_f64(f64 x) {
+  i64 q;
+  f64 r = reduce_pio2_f64(x, q);
+  return sin_quadrant_f64(r, q + 1);
+}
+
+FORCEINLINE f64 tan_kernel_f64(f64 x) {
+  i64 q;
+  f64 r = reduce_pio2_f64(x, q);
+  f64 s = sin_poly_f64(r), c = cos_poly_f64(r);
+  return (q & 1) ? -c / s : s / c;
+}
+
+// tanh x = 1 - 2 / (e^2x + 1), or a polynomial near zero where that cancels
+FORCEINLINE f32 tanh_kernel_f32(f32 x) {
+  f32 ax = __builtin_fabsf(x);
+  f32 z = x * x;
+  f32 p = -5.70498872745e-3f;
+  p = p * z + 2.06390887954e-2f;
+  p = p * z - 5.37397155531e-2f;
+  p = p * z + 1.33314422036e-1f;
+  p = p * z - 3.33332819422e-1f;
+  f32 near_zero = x + x * z * p;
+  f32 far = 1.0f - 2.0f / (exp_kernel_f32(ax + ax) + 1.0f);
+  return ax < 0.625f ? near_zero : copysign_f32(far, x);
+}
+
+FORCEINLINE f64 tanh_kernel_f64(f64 x) {
+  f64 ax = __builtin_fabs(x);
+  f64 z = x * x;
+  f64 p = -9.64399179425052238628e-1;
+  p = p * z - 9.92877231001918586564e1;
+  p = p * z - 1.61468768441708447952e3;
+  f64 q = z + 1.12811678491632931402e2;
+  q = q * z + 2.23548839060100448583e3;
+  q = q * z + 4.84406305325125486048e3;
+  f64 near_zero = x + x * (z * p / q);
+  f64 far = 1.0 - 2.0 / (exp_kernel_f64(ax + ax) + 1.0);
+  return ax < 0.625 ? near_zero : copysign_f64(far, x);
+}
+
+// atan2(y, x): the ratio a of the smaller to the larger of |x| and |y| is in
+// [0, 1]. Large a is reduced with atan a = pi/4 + atan((a - 1) / (a + 1)).
+FORCEINLINE f32 atan2_kernel_f32(f32 y, f32 x) {
+  f32 ax = __builtin_fabsf(x), ay = __builtin_fabsf(y);
+  bool swap = ay > ax;
+  f32 num = swap ? ax : ay, den = swap ? ay : ax;
+  f32 a = den == 0.0f ? 0.0f : num / den;
+  bool reduce = a > 0.41421356237309504880f;
+  f32 t = reduce ? (a - 1.0f) / (a + 1.0f) : a;
+  f32 z = t * t;
+  f32 p = 8.05374449538e-2f;
+  p = p * z - 1.38776856032e-1f;
+  p = p * z + 1.99777106478e-1f;
+  p = p * z - 3.33329491539e-1f;
+  f32 ret = t + t * z * p;
+  const f32 pio4_lo = -2.18556950e-8f;
+  ret = reduce ? (ret + pio4_lo) + 0.78539816339744830962f : ret;
+  ret = swap ? (2 * pio4_lo - ret) + 1.57079632679489661923f : ret;
+  ret = f32_as_i32(x) < 0 ? (4 * pio4_lo - ret) + 3.14159265358979323846f
+                          : ret;
+  return copysign_f32(ret, y);
+}
+
+FORCEINLINE f64 atan2_kernel_f64(f64 y, f64 x) {
+  f64 ax = __builtin_fabs(x), ay = __builtin_fabs(y);
+  bool swap = ay > ax;
+  f64 num = swap ? ax : ay, den = swap ? ay : ax;
+  f64 a = den == 0.0 ? 0.0 : num / den;
+  bool reduce = a > 0.66;
+  f64 t = reduce ? (a - 1.0) / (a + 1.0) : a;
+  f64 z = t * t;
+  f64 p = -8.750608600031904122785e-1;
+  p = p * z - 1.615753718733365076637e1;
+  p = p * z - 7.500855792314704667340e1;
+  p = p * z - 1.228866684490136173410e2;
+  p = p * z - 6.485021904942025371773e1;
+  f64 q = z + 2.485846490142306297962e1;
+  q = q * z + 1.650270098316988542046e2;
+  q = q * z + 4.328810604912902668951e2;
+  q = q * z + 4.853903996359136964868e2;
+  q = q * z + 1.945506571482613964425e2;
+  f64 ret = t + t * (z * p / q);
+  // pi/4, pi/2 and pi are added in two parts to keep the low bits
+  const f64 pio4_lo = 3.061616997868383e-17;
+  ret = reduce ? (ret + pio4_lo) + 0.78539816339744830962 : ret;
+  ret = swap ? (2 * pio4_lo - ret) + 1.57079632679489661923 : ret;
+  ret = f64_as_i64(x) < 0 ? (4 * pio4_lo - ret) + 3.14159265358979323846
+                          : ret;
+  return copysign_f64(ret, y);
+}
+
+// x^y = e^(y log |x|), with the sign of x^y for negative x and integral y
+FORCEINLINE f64 pow_kernel_f64(f64 x, f64 y) {
+  f64 ax = __builtin_fabs(x);
+  f64 ret = exp_kernel_f64(y * log_kernel_f64(ax));
+  bool integral = __builtin_rint(y) == y;
+  bool odd = integral && __builtin_rint(y * 0.5) != y * 0.5;
+  ret = (x < 0.0 && odd) ? -ret : ret;
+  ret = (x < 0.0 && !integral) ? __builtin_nan("") : ret;
+  return (y == 0.0 || x == 1.0) ? 1.0 : ret;
+}
+
+// Computed in double precision, so that the error of log |x| is not
+// amplified by y
+FORCEINLINE f32 pow_kernel_f32(f32 x, f32 y) {
+  return (f32)pow_kernel_f64(x, y);
+}
+
+#define DEFINE_FAST_UNARY_FUNC(F)                     \
+  f32 fast_##F##_f32(f32 x) {                         \
+    return F##_kernel_f32(x);                         \
+  }                                                   \
+  f64 fast_##F##_f64(f64 x) {                         \
+    return F##_kernel_f64(x);                         \
+  }                                                   \
+  f32x4 fast_##F##_f32_x4(f32x4 x) {                  \
+    f32x4 ret;                                        \
+    for (int i = 0; i < 4; i++)                       \
+      ret[i] = F##_kernel_f32(x[i]);                  \
+    return ret;                                       \
+  }                                                   \
+  f64x2 fast_##F##_f64_x2(f64x2 x) {                  \
+    f64x2 ret;                                        \
+    for (int i = 0; i < 2; i++)                       \
+      ret[i] = F##_kernel_f64(x[i]);                  \
+    return ret;                                       \
+  }
+
+#define DEFINE_FAST_BINARY_FUNC(F)                    \
+  f32 fast_##F##_f32(f32 x, f32 y) {                  \
+    return F##_kernel_f32(x, y);                      \
+  }                                                   \
+  f64 fast_##F##_f64(f64 x, f64 y) {                  \
+    return F##_kernel_f64(x, y);                      \
+  }                                                   \
+  f32x4 fast_##F##_f32_x4(f32x4 x, f32x4 y) {         \
+    f32x4 ret;                                        \
+    for (int i = 0; i < 4; i++)                       \
+      ret[i] = F##_kernel_f32(x[i], y[i]);            \
+    return ret;                                       \
+  }                                                   \
+  f64x2 fast_##F##_f64_x2(f64x2 x, f64x2 y) {         \
+    f64x2 ret;                                        \
+    for (int i = 0; i < 2; i++)                       \
+      ret[i] = F##_kernel_f64(x[i], y[i]);            \
+    return ret;                                       \
+  }
+
+DEFINE_FAST_UNARY_FUNC(exp)
+DEFINE_FAST_UNARY_FUNC(log)
+DEFINE_FAST_UNARY_FUNC(sin)
+DEFINE_FAST_UNARY_FUNC(cos)
+DEFINE_FAST_UNARY_FUNC(tan)
+DEFINE_FAST_UNARY_FUNC(tanh)
+DEFINE_FAST_BINARY_FUNC(pow)
+DEFINE_FAST_BINARY_FUNC(atan2)
+
 int abs_i32(int a) {
   if (a > 0) {
     return a;
@@ -130,6 +594,9 @@ struct Context {
   int num_leaves;
   void *cpu_profiler;
   Ptr runtime;
+  u32 rand_seed;
+  u32 launch_id;
+  Ptr allocator;
 };
 
 STRUCT_FIELD_ARRAY(Context, args);
@@ -159,6 +626,55 @@ float64 atomic_add_cpu_f64(volatile float64 *dest, float64 inc) {
                                       std::memory_order::memory_order_seq_cst));
   return old_val;
 }
+
+#define DEFINE_ATOMIC_CAS_OP(T, suffix, name, op)                             \
+  T atomic_##name##_##suffix(volatile T *dest, T val) {                      \
+    T old_val;                                                               \
+    T new_val;                                                               \
+    do {                                                                     \
+      old_val = *dest;                                                       \
+      new_val = val op old_val ? val : old_val;                              \
+    } while (!__atomic_compare_exchange(                                     \
+        dest, &old_val, &new_val, true,                                      \
+        std::memory_order::memory_order_seq_cst,                             \
+        std::memory_order::memory_order_seq_cst));                           \
+    return old_val;                                                          \
+  }
+
+DEFINE_ATOMIC_CAS_OP(float32, f32, min, <)
+DEFINE_ATOMIC_CAS_OP(float32, f32, max, >)
+DEFINE_ATOMIC_CAS_OP(float64, f64, min, <)
+DEFINE_ATOMIC_CAS_OP(float64, f64, max, >)
+
+// Random numbers of RandStmt (see taichi/philox.h)
+struct RandState {
+  taichi::Tlang::philox::State state;
+};
+
+void RandState_initialize(RandState *state,
+                          Context *context,
+                          i32 task_id,
+                          i32 i0,
+                          i32 i1,
+                          i32 i2,
+                          i32 i3) {
+  taichi::Tlang::philox::initialize(&state->state, context->rand_seed,
+                                    context->launch_id, task_id, i0, i1, i2,
+                                    i3);
+}
+
+i32 rand_i32(RandState *state) {
+  return taichi::Tlang::philox::rand_i32(&state->state);
+}
+
+f32 rand_f32(RandState *state) {
+  return taichi::Tlang::philox::rand_f32(&state->state);
+}
+
+f64 rand_f64(RandState *state) {
+  return taichi::Tlang::philox::rand_f64(&state->state);
+}
+
 // These structures are accessible by both the LLVM backend and this C++ runtime
 // file here (for building complex runtime functions in C++)
 
@@ -233,17 +749,20 @@ int Root_get_num_elements(Ptr meta, Ptr node) {
   return 1;
 }
 
-void *taichi_allocate_aligned(std::size_t size, int alignment);
+// allocates from the UnifiedAllocator of the program
+void *taichi_allocate_aligned(Ptr allocator,
+                              std::size_t size,
+                              int alignment);
 
-void *taichi_allocate(std::size_t size) {
-  return taichi_allocate_aligned(size, 1);
+void *taichi_allocate(Ptr allocator, std::size_t size) {
+  return taichi_allocate_aligned(allocator, size, 1);
 }
 
 void ___stubs___() {
   printf("");
   vprintf(nullptr, nullptr);
-  taichi_allocate(1);
-  taichi_allocate_aligned(1, 1);
+  taichi_allocate(nullptr, 1);
+  taichi_allocate_aligned(nullptr, 1, 1);
 }
 
 struct Element {
@@ -262,8 +781,9 @@ struct ElementList {
   int tail;
 };
 
-void ElementList_initialize(ElementList *element_list) {
-  element_list->elements = (Element *)taichi_allocate(1024 * 1024 * 1024);
+void ElementList_initialize(ElementList *element_list, Ptr allocator) {
+  element_list->elements =
+      (Element *)taichi_allocate(allocator, 1024 * 1024 * 1024);
   element_list->tail = 0;
 }
 
@@ -285,19 +805,20 @@ struct Runtime {
 STRUCT_FIELD_ARRAY(Runtime, element_lists);
 
 Ptr Runtime_initialize(Runtime **runtime_ptr,
+                       Ptr allocator,
                        int num_snodes,
                        uint64_t root_size,
                        int root_id) {
-  *runtime_ptr = (Runtime *)taichi_allocate(sizeof(Runtime));
+  *runtime_ptr = (Runtime *)taichi_allocate(allocator, sizeof(Runtime));
   Runtime *runtime = *runtime_ptr;
   printf("Initializing runtime with %d elements\n", num_snodes);
   for (int i = 0; i < num_snodes; i++) {
     runtime->element_lists[i] =
-        (ElementList *)taichi_allocate(sizeof(ElementList));
-    ElementList_initialize(runtime->element_lists[i]);
+        (ElementList *)taichi_allocate(allocator, sizeof(ElementList));
+    ElementList_initialize(runtime->element_lists[i], allocator);
   }
   // Assuming num_snodes - 1 is the root
-  auto root_ptr = taichi_allocate_aligned(root_size, 4096);
+  auto root_ptr = taichi_allocate_aligned(allocator, root_size, 4096);
   Element elem;
   elem.loop_bounds[0] = 0;
   elem.loop_bounds[1] = 1;
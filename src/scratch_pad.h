@@ -1,3 +1,5 @@
+#pragma once
+
 #include <taichi/common/testing.h>
 #include "tlang.h"
 
@@ -95,9 +97,6 @@ class ScratchPad {
     }
   }
 
-  void codegen_cpu() {
-  }
-
   std::string name() {
     return snode->node_type_name + "_scratch_pad";
   }
@@ -115,6 +114,10 @@ class ScratchPad {
     return s;
   }
 
+  int num_bytes() {
+    return linear_size() * data_type_size(snode->dt);
+  }
+
   int linearized_index(const std::vector<int> &indices) {
     int ret = 0;
     TC_ASSERT(finalized);
@@ -206,9 +209,6 @@ class ScratchPads {
   void CSE() {
   }
 
-  void emit_gather_code_cpu() {
-  }
-
   void emit_gather_code_gpu() {
   }
 
@@ -0,0 +1,685 @@
+// Binary snapshots of the data structure of a Program
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <cstring>
+#include <unordered_set>
+#include <xxhash.h>
+#include <taichi/io/binary_stream.h>
+#include <taichi/system/threading.h>
+#include "program.h"
+#include "snapshot.h"
+
+TLANG_NAMESPACE_BEGIN
+
+namespace {
+
+constexpr char snapshot_magic[8] = {'T', 'I', 'S', 'N', 'A', 'P', 'S', 'H'};
+constexpr char delta_magic[8] = {'T', 'I', 'D', 'E', 'L', 'T', 'A', 0};
+
+void collect_snodes(SNode *snode, std::vector<SNode *> &snodes) {
+  snodes.push_back(snode);
+  for (auto &ch : snode->ch)
+    collect_snodes(ch.get(), snodes);
+}
+
+// The blocks of pointer nodes are enumerated through the statistics of their
+// allocators, which only the struct compiler of the source backend exposes
+void check_allocator_stat(SNode *snode) {
+  TC_ERROR_IF(snode->type == SNodeType::pointer && !snode->stat_func,
+              "Snapshots of {} nodes ({}) are not supported by the LLVM "
+              "backend (use_llvm)",
+              snode->type_name(), snode->get_name());
+}
+
+SnapshotSNode make_record(SNode *snode, int parent) {
+  SnapshotSNode rec;
+  std::memset(&rec, 0, sizeof(rec));
+  rec.id = snode->id;
+  rec.parent = parent;
+  rec.type = (int32)snode->type;
+  rec.dt = (int32)snode->dt;
+  rec.n = snode->n;
+  rec.morton = snode->_morton;
+  rec.bitmasked = snode->_bitmasked;
+  for (int i = 0; i < max_num_indices; i++) {
+    rec.extractor_start[i] = snode->extractors[i].start;
+    rec.extractor_num_bits[i] = snode->extractors[i].num_bits;
+    rec.extractor_acc_offset[i] = snode->extractors[i].acc_offset;
+  }
+  rec.offset_in_parent = snode->offset_in_parent;
+  rec.node_size = snode->node_size;
+  rec.element_size = snode->element_size;
+  std::strncpy(rec.name, snode->name.c_str(), sizeof(rec.name) - 1);
+  return rec;
+}
+
+// Copies elements (children structs) of SNodes, keeping the pointers held by
+// sparse descendants in the destination intact
+class ElementCopier {
+ public:
+  std::unordered_set<SNode *> has_sparse_descendants;
+
+  ElementCopier(SNode *root) {
+    mark(root);
+  }
+
+  bool mark(SNode *snode) {
+    bool sparse = false;
+    for (auto &ch : snode->ch) {
+      // evaluate mark for every child
+      sparse = mark(ch.get()) || ch->has_null() || sparse;
+    }
+    if (sparse)
+      has_sparse_descendants.insert(snode);
+    return sparse;
+  }
+
+  bool contains_sparse(SNode *snode) const {
+    return has_sparse_descendants.find(snode) != has_sparse_descendants.end();
+  }
+
+  void copy(SNode *snode, uint8 *dst, const uint8 *src) const {
+    if (!contains_sparse(snode)) {
+      std::memcpy(dst, src, snode->element_size);
+      return;
+    }
+    for (auto &c : snode->ch) {
+      auto ch = c.get();
+      auto offset = ch->offset_in_parent;
+      if (ch->has_null()) {
+        continue;
+      } else if (!contains_sparse(ch)) {
+        std::memcpy(dst + offset, src + offset, ch->node_size);
+      } else {
+        // dense or dynamic: the elements, followed by the bitmask or length
+        for (int64 k = 0; k < ch->n; k++) {
+          copy(ch, dst + offset + k * ch->element_size,
+               src + offset + k * ch->element_size);
+        }
+        auto elements_size = ch->n * ch->element_size;
+        std::memcpy(dst + offset + elements_size, src + offset + elements_size,
+                    ch->node_size - elements_size);
+      }
+    }
+  }
+};
+
+}  // namespace
+
+bool SnapshotSNode::same_layout(const SnapshotSNode &o) const {
+  return parent == o.parent && type == o.type && dt == o.dt && n == o.n &&
+         morton == o.morton && bitmasked == o.bitmasked &&
+         std::memcmp(extractor_start, o.extractor_start,
+                     sizeof(extractor_start)) == 0 &&
+         std::memcmp(extractor_num_bits, o.extractor_num_bits,
+                     sizeof(extractor_num_bits)) == 0 &&
+         offset_in_parent == o.offset_in_parent && node_size == o.node_size &&
+         element_size == o.element_size;
+}
+
+Snapshot::Snapshot(const std::string &fn) {
+#if !defined(_WIN32)
+  int fd = open(fn.c_str(), O_RDONLY);
+  TC_ERROR_IF(fd == -1, "Cannot open snapshot [{}]", fn);
+  struct stat st;
+  fstat(fd, &st);
+  size = (std::size_t)st.st_size;
+  if (size >= sizeof(SnapshotHeader))
+    data = (uint8 *)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  TC_ERROR_IF(size < sizeof(SnapshotHeader), "[{}] is not a snapshot", fn);
+  TC_ERROR_IF(data == (uint8 *)MAP_FAILED, "Cannot map snapshot [{}]", fn);
+#else
+  // no mmap: read the whole file
+  BinaryFileStreamInput in(fn);
+  size = in.size();
+  TC_ERROR_IF(size < sizeof(SnapshotHeader), "[{}] is not a snapshot", fn);
+  buffer.resize(size);
+  in.read(buffer.data(), size);
+  data = buffer.data();
+#endif
+
+  TC_ERROR_IF(std::memcmp(header().magic, snapshot_magic,
+                          sizeof(snapshot_magic)) != 0,
+              "[{}] is not a snapshot", fn);
+  TC_ERROR_IF(header().version != version,
+              "Snapshot version {} is not supported (expected {})",
+              header().version, version);
+  TC_ERROR_IF(header().file_size != size, "Snapshot [{}] is truncated", fn);
+
+  snode_region.resize(header().num_snodes, -1);
+  region_blocks.resize(header().num_regions);
+  for (int i = 0; i < header().num_regions; i++) {
+    auto &r = region(i);
+    snode_region[r.snode] = i;
+    if (snode(r.snode).type != (int)SNodeType::pointer)
+      continue;
+    for (uint64 b = 0; b < r.num_blocks; b++) {
+      auto &block = blocks(r)[b];
+      if (!block.active)
+        continue;
+      std::array<int32, max_num_indices> corner;
+      std::copy(block.coordinates, block.coordinates + max_num_indices,
+                corner.begin());
+      region_blocks[i][corner] = b;
+    }
+  }
+}
+
+Snapshot::~Snapshot() {
+#if !defined(_WIN32)
+  munmap(data, size);
+#endif
+}
+
+int Snapshot::find(const std::string &name) const {
+  for (int i = 0; i < header().num_snodes; i++) {
+    if (snode(i).type == (int)SNodeType::place && name == snode(i).name)
+      return i;
+  }
+  return -1;
+}
+
+const void *Snapshot::address(int snode_index, int i, int j, int k, int l)
+    const {
+  int indices[max_num_indices] = {i, j, k, l};
+  std::vector<int> path;
+  for (int s = snode_index; s != -1; s = snode(s).parent) {
+    path.push_back(s);
+  }
+  std::reverse(path.begin(), path.end());
+
+  auto node = block_data(region(snode_region[path[0]]), 0);
+  for (int d = 0; d + 1 < (int)path.size(); d++) {
+    auto &s = snode(path[d]);
+    // flattened index, as in the accessors
+    int tmp = 0;
+    for (int m = 0; m < max_num_indices; m++) {
+      int b = s.extractor_num_bits[m];
+      if (b) {
+        tmp = (tmp << b) +
+              ((indices[m] >> s.extractor_start[m]) & ((1 << b) - 1));
+      }
+    }
+    const uint8 *element;
+    if (s.type == (int)SNodeType::root) {
+      element = node;
+    } else if (s.type == (int)SNodeType::dense ||
+               s.type == (int)SNodeType::dynamic) {
+      TC_ERROR_IF(s.morton, "In-place access of morton nodes not supported");
+      element = node + tmp * s.element_size;
+    } else if (s.type == (int)SNodeType::pointer) {
+      std::array<int32, max_num_indices> corner;
+      for (int m = 0; m < max_num_indices; m++) {
+        auto bits = s.extractor_start[m] + s.extractor_num_bits[m];
+        corner[m] = indices[m] & ~((1 << bits) - 1);
+      }
+      auto r = snode_region[path[d]];
+      auto it = region_blocks[r].find(corner);
+      if (it == region_blocks[r].end())
+        return nullptr;
+      element = block_data(region(r), it->second);
+    } else {
+      TC_NOT_IMPLEMENTED
+    }
+    node = element + snode(path[d + 1]).offset_in_parent;
+  }
+  return node;
+}
+
+namespace {
+
+// Regions and SNode table of a snapshot, with the data of each region
+struct SnapshotContents {
+  std::vector<SnapshotSNode> records;
+  std::vector<SnapshotRegion> regions;
+  std::vector<const uint8 *> region_data;
+  std::vector<std::vector<SnapshotBlock>> block_tables;
+
+  std::size_t region_size(int i) const {
+    return regions[i].num_blocks * regions[i].element_size;
+  }
+};
+
+SnapshotContents collect_contents(Program &prog) {
+  TC_ERROR_IF(prog.data_structure == nullptr,
+              "The layout has not been materialized");
+  prog.synchronize();
+
+  std::vector<SNode *> snodes;
+  collect_snodes(prog.snode_root, snodes);
+  std::unordered_map<SNode *, int> index;
+  for (int i = 0; i < (int)snodes.size(); i++)
+    index[snodes[i]] = i;
+
+  SnapshotContents contents;
+  for (auto snode : snodes) {
+    TC_ERROR_IF(snode->type == SNodeType::hash ||
+                    snode->type == SNodeType::indirect,
+                "Snapshots of {} nodes are not supported",
+                snode->type_name());
+    TC_ERROR_IF(snode->node_size == 0, "Memory layout of {} is unknown",
+                snode->get_name());
+    check_allocator_stat(snode);
+    contents.records.push_back(make_record(
+        snode, snode->parent ? index[snode->parent] : -1));
+
+    if (snode->type != SNodeType::root && snode->type != SNodeType::pointer)
+      continue;
+    SnapshotRegion r;
+    std::memset(&r, 0, sizeof(r));
+    r.snode = index[snode];
+    r.element_size = snode->element_size;
+    std::vector<SnapshotBlock> blocks;
+    const uint8 *data = nullptr;
+    if (snode->type == SNodeType::root) {
+      SnapshotBlock block;
+      std::memset(&block, 0, sizeof(block));
+      block.active = 1;
+      blocks.push_back(block);
+      data = (const uint8 *)prog.data_structure;
+    } else {
+      auto stat = snode->stat();
+      auto metas = stat.resident_metas;
+      if (stat.num_resident_blocks)
+        data = (const uint8 *)metas[0].ptr;
+      for (std::size_t b = 0; b < stat.num_resident_blocks; b++) {
+        // blocks are allocated consecutively from the pool of the node
+        TC_ASSERT(metas[b].ptr == data + b * snode->element_size);
+        SnapshotBlock block;
+        std::copy(metas[b].indices, metas[b].indices + max_num_indices,
+                  block.coordinates);
+        block.active = metas[b].active;
+        blocks.push_back(block);
+      }
+    }
+    r.num_blocks = blocks.size();
+    contents.regions.push_back(r);
+    contents.region_data.push_back(data);
+    contents.block_tables.push_back(std::move(blocks));
+  }
+  return contents;
+}
+
+uint64 align_to_page(uint64 offset) {
+  return (offset + Snapshot::page_size - 1) / Snapshot::page_size *
+         Snapshot::page_size;
+}
+
+void write_snapshot(const std::string &fn, SnapshotContents contents) {
+  uint64 offset = sizeof(SnapshotHeader) +
+                  sizeof(SnapshotSNode) * contents.records.size() +
+                  sizeof(SnapshotRegion) * contents.regions.size();
+  for (auto &r : contents.regions) {
+    r.block_table_offset = offset;
+    offset += sizeof(SnapshotBlock) * r.num_blocks;
+  }
+  for (auto &r : contents.regions) {
+    offset = align_to_page(offset);
+    r.data_offset = offset;
+    offset += r.num_blocks * r.element_size;
+  }
+
+  SnapshotHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+  header.version = Snapshot::version;
+  header.num_snodes = (int32)contents.records.size();
+  header.num_regions = (int32)contents.regions.size();
+  header.page_size = Snapshot::page_size;
+  header.file_size = offset;
+
+  BinaryFileStreamOutput out(fn);
+  out << header;
+  for (auto &rec : contents.records)
+    out << rec;
+  for (auto &r : contents.regions)
+    out << r;
+  for (auto &blocks : contents.block_tables)
+    out.write(blocks.data(), sizeof(SnapshotBlock) * blocks.size());
+  for (int i = 0; i < (int)contents.regions.size(); i++) {
+    out.align(Snapshot::page_size);
+    TC_ASSERT(out.tell() == contents.regions[i].data_offset);
+    out.write(contents.region_data[i], contents.region_size(i));
+  }
+  TC_ASSERT(out.tell() == header.file_size);
+}
+
+}  // namespace
+
+void Snapshot::save(Program &prog, const std::string &fn) {
+  write_snapshot(fn, collect_contents(prog));
+}
+
+void Snapshot::load(Program &prog) const {
+  TC_ERROR_IF(prog.data_structure == nullptr,
+              "The layout has not been materialized");
+  prog.synchronize();
+
+  std::vector<SNode *> snodes;
+  collect_snodes(prog.snode_root, snodes);
+  TC_ERROR_IF((int)snodes.size() != header().num_snodes,
+              "Snapshot has {} SNodes instead of {}", header().num_snodes,
+              snodes.size());
+  std::unordered_map<SNode *, int> index;
+  for (int i = 0; i < (int)snodes.size(); i++)
+    index[snodes[i]] = i;
+  for (int i = 0; i < (int)snodes.size(); i++) {
+    auto s = snodes[i];
+    auto rec = make_record(s, s->parent ? index[s->parent] : -1);
+    TC_ERROR_UNLESS(rec.same_layout(snode(i)),
+                    "Snapshot layout does not match at {} ({})",
+                    s->get_name(), s->type_name());
+    check_allocator_stat(s);
+  }
+
+#if !defined(_WIN32)
+  madvise(data, size, MADV_WILLNEED);
+#endif
+
+  // Deactivate the blocks of pointer nodes that are not in the snapshot, so
+  // that the data structure ends up in the saved state. The memory of the
+  // blocks stays in the pools of the allocators.
+  for (int i = 0; i < header().num_regions; i++) {
+    auto s = snodes[region(i).snode];
+    if (s->type != SNodeType::pointer)
+      continue;
+    auto stat = s->stat();
+    for (std::size_t b = 0; b < stat.num_resident_blocks; b++) {
+      auto &meta = stat.resident_metas[b];
+      if (!meta.active)
+        continue;
+      std::array<int32, max_num_indices> corner;
+      std::copy(meta.indices, meta.indices + max_num_indices, corner.begin());
+      if (region_blocks[i].find(corner) != region_blocks[i].end())
+        continue;
+      if (meta.snode_ptr && *meta.snode_ptr == meta.ptr)
+        *meta.snode_ptr = nullptr;
+      meta.active = 0;
+    }
+  }
+
+  // Allocate the blocks of pointer nodes (serially, through the accessor of
+  // their first child, which also allocates their ancestors)
+  struct Copy {
+    SNode *snode;  // nullptr: raw copy of size bytes
+    uint8 *dst;
+    const uint8 *src;
+    std::size_t size;
+  };
+  std::vector<Copy> copies;
+  for (int i = 0; i < header().num_regions; i++) {
+    auto &r = region(i);
+    auto s = snodes[r.snode];
+    if (s->type == SNodeType::root) {
+      copies.push_back({s, (uint8 *)prog.data_structure, block_data(r, 0), 0});
+      continue;
+    }
+    auto first = s->ch[0].get();
+    for (uint64 b = 0; b < r.num_blocks; b++) {
+      auto &block = blocks(r)[b];
+      if (!block.active)
+        continue;
+      auto c = block.coordinates;
+      auto ptr = (uint8 *)first->evaluate(prog.data_structure, c[0], c[1],
+                                          c[2], c[3]) -
+                 first->offset_in_parent;
+      copies.push_back({s, ptr, block_data(r, b), 0});
+    }
+  }
+
+  // Copy in parallel. Elements without sparse descendants are raw memory and
+  // are split into chunks.
+  ElementCopier copier(prog.snode_root);
+  constexpr std::size_t chunk_size = 16 << 20;
+  std::vector<Copy> tasks;
+  for (auto &c : copies) {
+    if (copier.contains_sparse(c.snode)) {
+      tasks.push_back(c);
+      continue;
+    }
+    for (std::size_t offset = 0; offset < c.snode->element_size;
+         offset += chunk_size) {
+      tasks.push_back(
+          {nullptr, c.dst + offset, c.src + offset,
+           std::min(chunk_size, c.snode->element_size - offset)});
+    }
+  }
+  ThreadedTaskManager::run((int)tasks.size(), -1, [&](int i) {
+    auto &t = tasks[i];
+    if (t.snode)
+      copier.copy(t.snode, t.dst, t.src);
+    else
+      std::memcpy(t.dst, t.src, t.size);
+  });
+}
+
+namespace {
+
+std::size_t num_pages(std::size_t size) {
+  return (size + Snapshot::page_size - 1) / Snapshot::page_size;
+}
+
+std::vector<uint64> hash_pages(const uint8 *data, std::size_t size) {
+  std::vector<uint64> hashes(num_pages(size));
+  ThreadedTaskManager::run((int)hashes.size(), -1, [&](int p) {
+    auto begin = (std::size_t)p * Snapshot::page_size;
+    hashes[p] = XXH64(data + begin,
+                      std::min<std::size_t>(Snapshot::page_size, size - begin),
+                      0);
+  });
+  return hashes;
+}
+
+uint64 checkpoint_id(const std::vector<std::vector<SnapshotBlock>> &blocks,
+                     const std::vector<std::vector<uint64>> &page_hashes) {
+  auto state = XXH64_createState();
+  XXH64_reset(state, 0);
+  for (int i = 0; i < (int)blocks.size(); i++) {
+    uint64 num_blocks = blocks[i].size();
+    XXH64_update(state, &num_blocks, sizeof(num_blocks));
+    XXH64_update(state, blocks[i].data(),
+                 sizeof(SnapshotBlock) * blocks[i].size());
+    XXH64_update(state, page_hashes[i].data(),
+                 sizeof(uint64) * page_hashes[i].size());
+  }
+  auto id = XXH64_digest(state);
+  XXH64_freeState(state);
+  return id;
+}
+
+}  // namespace
+
+std::size_t CheckpointWriter::write(Program &prog, const std::string &fn) {
+  auto contents = collect_contents(prog);
+  int num_regions = (int)contents.regions.size();
+  std::vector<std::vector<uint64>> hashes;
+  for (int i = 0; i < num_regions; i++) {
+    hashes.push_back(
+        hash_pages(contents.region_data[i], contents.region_size(i)));
+  }
+  auto new_id = checkpoint_id(contents.block_tables, hashes);
+
+  std::size_t written = 0;
+  if (!has_base) {
+    write_snapshot(fn, contents);
+    for (int i = 0; i < num_regions; i++)
+      written += contents.region_size(i);
+  } else {
+    TC_ERROR_IF(records.size() != contents.records.size(),
+                "Layout changed since the last checkpoint");
+    for (int i = 0; i < (int)records.size(); i++) {
+      TC_ERROR_UNLESS(records[i].same_layout(contents.records[i]),
+                      "Layout changed since the last checkpoint");
+    }
+
+    // pages that are new, or whose hash changed
+    std::vector<std::vector<uint64>> changed(num_regions);
+    for (int i = 0; i < num_regions; i++) {
+      for (uint64 p = 0; p < hashes[i].size(); p++) {
+        if (p >= page_hashes[i].size() || page_hashes[i][p] != hashes[i][p])
+          changed[i].push_back(p);
+      }
+    }
+
+    std::vector<SnapshotDeltaRegion> regions(num_regions);
+    uint64 offset = sizeof(SnapshotDeltaHeader) +
+                    sizeof(SnapshotSNode) * contents.records.size() +
+                    sizeof(SnapshotDeltaRegion) * num_regions;
+    for (int i = 0; i < num_regions; i++) {
+      regions[i].region = contents.regions[i];
+      regions[i].region.block_table_offset = offset;
+      offset += sizeof(SnapshotBlock) * contents.regions[i].num_blocks;
+    }
+    for (int i = 0; i < num_regions; i++) {
+      regions[i].num_pages = changed[i].size();
+      regions[i].page_table_offset = offset;
+      offset += sizeof(uint64) * changed[i].size();
+    }
+    for (int i = 0; i < num_regions; i++) {
+      offset = align_to_page(offset);
+      regions[i].page_data_offset = offset;
+      offset += (uint64)Snapshot::page_size * changed[i].size();
+    }
+
+    SnapshotDeltaHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, delta_magic, sizeof(delta_magic));
+    header.version = Snapshot::version;
+    header.num_snodes = (int32)contents.records.size();
+    header.num_regions = num_regions;
+    header.page_size = Snapshot::page_size;
+    header.parent_id = id;
+    header.id = new_id;
+    header.file_size = offset;
+
+    BinaryFileStreamOutput out(fn);
+    out << header;
+    for (auto &rec : contents.records)
+      out << rec;
+    for (auto &r : regions)
+      out << r;
+    for (auto &blocks : contents.block_tables)
+      out.write(blocks.data(), sizeof(SnapshotBlock) * blocks.size());
+    for (auto &pages : changed)
+      out.write(pages.data(), sizeof(uint64) * pages.size());
+    for (int i = 0; i < num_regions; i++) {
+      out.align(Snapshot::page_size);
+      TC_ASSERT(out.tell() == regions[i].page_data_offset);
+      for (auto p : changed[i]) {
+        auto begin = p * Snapshot::page_size;
+        auto size = std::min<std::size_t>(Snapshot::page_size,
+                                          contents.region_size(i) - begin);
+        out.write(contents.region_data[i] + begin, size);
+        out.align(Snapshot::page_size);
+        written += size;
+      }
+    }
+    TC_ASSERT(out.tell() == header.file_size);
+  }
+
+  has_base = true;
+  id = new_id;
+  records = std::move(contents.records);
+  page_hashes = std::move(hashes);
+  return written;
+}
+
+void reconstruct_checkpoint(const std::vector<std::string> &chain,
+                            const std::string &fn) {
+  TC_ERROR_IF(chain.empty(), "Empty checkpoint chain");
+
+  SnapshotContents contents;
+  std::vector<std::vector<uint8>> data;
+  std::vector<std::vector<uint64>> hashes;
+  {
+    Snapshot base(chain[0]);
+    for (int i = 0; i < base.header().num_snodes; i++)
+      contents.records.push_back(base.snode(i));
+    for (int i = 0; i < base.header().num_regions; i++) {
+      auto &r = base.region(i);
+      contents.regions.push_back(r);
+      contents.block_tables.emplace_back(base.blocks(r),
+                                         base.blocks(r) + r.num_blocks);
+      data.emplace_back(base.block_data(r, 0),
+                        base.block_data(r, 0) + r.num_blocks * r.element_size);
+      hashes.push_back(hash_pages(data.back().data(), data.back().size()));
+    }
+  }
+  auto id = checkpoint_id(contents.block_tables, hashes);
+
+  std::vector<uint8> page(Snapshot::page_size);
+  for (int k = 1; k < (int)chain.size(); k++) {
+    BinaryFileStreamInput in(chain[k]);
+    SnapshotDeltaHeader header;
+    in >> header;
+    TC_ERROR_IF(
+        std::memcmp(header.magic, delta_magic, sizeof(delta_magic)) != 0,
+        "[{}] is not a snapshot delta", chain[k]);
+    TC_ERROR_IF(header.version != Snapshot::version ||
+                    header.page_size != Snapshot::page_size,
+                "Snapshot delta version {} is not supported", header.version);
+    TC_ERROR_IF(header.parent_id != id,
+                "[{}] does not apply to the previous checkpoint of the chain",
+                chain[k]);
+    TC_ERROR_IF(header.num_snodes != (int)contents.records.size() ||
+                    header.num_regions != (int)contents.regions.size(),
+                "Layout of [{}] does not match", chain[k]);
+    for (auto &rec : contents.records) {
+      SnapshotSNode delta_rec;
+      in >> delta_rec;
+      TC_ERROR_UNLESS(rec.same_layout(delta_rec),
+                      "Layout of [{}] does not match", chain[k]);
+    }
+    std::vector<SnapshotDeltaRegion> regions(header.num_regions);
+    for (auto &r : regions)
+      in >> r;
+
+    for (int i = 0; i < header.num_regions; i++) {
+      auto &r = regions[i];
+      auto num_blocks = r.region.num_blocks;
+      contents.regions[i].num_blocks = num_blocks;
+      contents.block_tables[i].resize(num_blocks);
+      in.seek(r.region.block_table_offset);
+      in.read(contents.block_tables[i].data(),
+              sizeof(SnapshotBlock) * num_blocks);
+
+      auto size = contents.region_size(i);
+      data[i].resize(size);
+      hashes[i].resize(num_pages(size));
+      std::vector<uint64> pages(r.num_pages);
+      in.seek(r.page_table_offset);
+      in.read(pages.data(), sizeof(uint64) * pages.size());
+      in.seek(r.page_data_offset);
+      for (auto p : pages) {
+        TC_ERROR_IF(p >= hashes[i].size(), "[{}] is corrupted", chain[k]);
+        in.read(page.data(), Snapshot::page_size);
+        auto begin = p * Snapshot::page_size;
+        auto valid = std::min<std::size_t>(Snapshot::page_size, size - begin);
+        std::memcpy(data[i].data() + begin, page.data(), valid);
+        hashes[i][p] = XXH64(page.data(), valid, 0);
+      }
+    }
+    id = checkpoint_id(contents.block_tables, hashes);
+    TC_ERROR_IF(id != header.id, "[{}] is corrupted", chain[k]);
+  }
+
+  for (auto &d : data)
+    contents.region_data.push_back(d.data());
+  write_snapshot(fn, contents);
+}
+
+void Program::save_snapshot(const std::string &fn) {
+  Snapshot::save(*this, fn);
+}
+
+void Program::load_snapshot(const std::string &fn) {
+  Snapshot(fn).load(*this);
+}
+
+TLANG_NAMESPACE_END
@@ -0,0 +1,192 @@
+// Binary snapshots of the data structure of a Program
+
+#pragma once
+
+#include <map>
+#include <array>
+#include "snode.h"
+
+TLANG_NAMESPACE_BEGIN
+
+class Program;
+
+// File layout (native endianness):
+//
+//   SnapshotHeader
+//   SnapshotSNode  x num_snodes    the SNode tree, depth-first
+//   SnapshotRegion x num_regions
+//   block tables                   one SnapshotBlock per block
+//   block data                     each region starts at a page boundary
+//
+// A region holds the raw elements (blocks) of one SNode: the single root
+// element, or every block allocated by a pointer node together with its
+// corner coordinates. Dense and dynamic nodes are stored inline in the blocks
+// of their closest root or pointer ancestor. Pointers held by sparse nodes are
+// written as-is, and skipped when the snapshot is loaded.
+struct SnapshotHeader {
+  char magic[8];
+  int32 version;
+  int32 num_snodes;
+  int32 num_regions;
+  int32 page_size;
+  uint64 file_size;
+};
+
+struct SnapshotSNode {
+  int32 id;
+  int32 parent;  // index in the SNode table, -1 for the root
+  int32 type;
+  int32 dt;
+  int64 n;
+  int32 morton;
+  int32 bitmasked;
+  int32 extractor_start[max_num_indices];
+  int32 extractor_num_bits[max_num_indices];
+  int32 extractor_acc_offset[max_num_indices];
+  uint64 offset_in_parent;
+  uint64 node_size;
+  uint64 element_size;
+  char name[64];
+
+  // Whether the snapshot can be loaded into a data structure with snode
+  bool same_layout(const SnapshotSNode &o) const;
+};
+
+struct SnapshotRegion {
+  int32 snode;  // index into the SNode table
+  int32 _;
+  uint64 num_blocks;
+  uint64 element_size;
+  uint64 block_table_offset;
+  uint64 data_offset;
+};
+
+struct SnapshotBlock {
+  int32 coordinates[max_num_indices];
+  int32 active;
+};
+
+class Snapshot {
+ public:
+  static constexpr int page_size = 4096;
+  static constexpr int version = 1;
+
+  explicit Snapshot(const std::string &fn);
+
+  ~Snapshot();
+
+  const SnapshotHeader &header() const {
+    return *(const SnapshotHeader *)data;
+  }
+
+  const SnapshotSNode &snode(int i) const {
+    return ((const SnapshotSNode *)(data + sizeof(SnapshotHeader)))[i];
+  }
+
+  const SnapshotRegion &region(int i) const {
+    return ((const SnapshotRegion *)(data + sizeof(SnapshotHeader) +
+                                     sizeof(SnapshotSNode) *
+                                         header().num_snodes))[i];
+  }
+
+  const SnapshotBlock *blocks(const SnapshotRegion &r) const {
+    return (const SnapshotBlock *)(data + r.block_table_offset);
+  }
+
+  const uint8 *block_data(const SnapshotRegion &r, uint64 b) const {
+    return data + r.data_offset + b * r.element_size;
+  }
+
+  // Index of the place SNode with the given name, or -1
+  int find(const std::string &name) const;
+
+  // Read-only access to the snapshot in place, without a Program. Returns
+  // nullptr for elements in blocks that were not allocated.
+  const void *address(int snode, int i = 0, int j = 0, int k = 0, int l = 0)
+      const;
+
+  template <typename T>
+  T val(int snode, int i = 0, int j = 0, int k = 0, int l = 0) const {
+    auto ptr = address(snode, i, j, k, l);
+    return ptr ? *(const T *)ptr : T(0);
+  }
+
+  // Copies the snapshot into the data structure of prog, which must have been
+  // created with the same layout. Blocks of pointer nodes are allocated as
+  // needed, and active blocks that are not in the snapshot are deactivated.
+  void load(Program &prog) const;
+
+  static void save(Program &prog, const std::string &fn);
+
+ private:
+  // the mapped file, or buffer where mmap is not available
+  uint8 *data;
+  std::size_t size;
+  std::vector<uint8> buffer;
+  // region of each snode (-1 if none), and its blocks indexed by corner
+  std::vector<int> snode_region;
+  std::vector<std::map<std::array<int32, max_num_indices>, uint64>>
+      region_blocks;
+};
+
+// Incremental checkpoints. The first checkpoint is a full snapshot; each of
+// the following ones is a delta holding the block tables and only the pages
+// of region data that changed since the previous checkpoint, detected by
+// comparing XXH64 hashes of the pages.
+//
+// Delta file layout:
+//
+//   SnapshotDeltaHeader
+//   SnapshotSNode       x num_snodes
+//   SnapshotDeltaRegion x num_regions
+//   block tables
+//   changed page indices (uint64) of each region
+//   changed pages, each starting at a page boundary
+struct SnapshotDeltaHeader {
+  char magic[8];
+  int32 version;
+  int32 num_snodes;
+  int32 num_regions;
+  int32 page_size;
+  // hashes identifying the checkpoint the delta applies to, and the result
+  uint64 parent_id;
+  uint64 id;
+  uint64 file_size;
+};
+
+struct SnapshotDeltaRegion {
+  SnapshotRegion region;  // data_offset is unused
+  uint64 num_pages;
+  uint64 page_table_offset;
+  uint64 page_data_offset;
+};
+
+class CheckpointWriter {
+ public:
+  CheckpointWriter() {
+    reset();
+  }
+
+  // Writes a full snapshot for the first checkpoint, and a delta to the
+  // previous checkpoint afterwards. Returns the number of bytes of region data
+  // written.
+  std::size_t write(Program &prog, const std::string &fn);
+
+  // The next checkpoint will be a full snapshot
+  void reset() {
+    has_base = false;
+  }
+
+ private:
+  bool has_base;
+  uint64 id;
+  std::vector<SnapshotSNode> records;
+  std::vector<std::vector<uint64>> page_hashes;
+};
+
+// Writes the full snapshot of the last checkpoint of chain, which is a full
+// snapshot followed by its deltas in order
+void reconstruct_checkpoint(const std::vector<std::string> &chain,
+                            const std::string &fn);
+
+TLANG_NAMESPACE_END
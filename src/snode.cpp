@@ -5,7 +5,7 @@
 
 TLANG_NAMESPACE_BEGIN
 
-int SNode::counter = 0;
+thread_local int SNode::counter = 0;
 
 SNode &SNode::place(Expr &expr_) {
   TC_ASSERT(expr_.is<GlobalVariableExpression>());
@@ -71,7 +71,7 @@ SNode &SNode::create_node(std::vector<Index> indices,
 void SNode::clear_data() {
   if (clear_func == nullptr) {
     if (clear_kernel == nullptr) {
-      clear_kernel = &kernel([&]() {
+      clear_kernel = &program->kernel([&]() {
         current_ast_builder().insert(Stmt::make<ClearAllStmt>(this, false));
       });
     }
@@ -84,7 +84,7 @@ void SNode::clear_data() {
 void SNode::clear_data_and_deactivate() {
   if (clear_func == nullptr) {
     if (clear_and_deactivate_kernel == nullptr) {
-      clear_and_deactivate_kernel = &kernel([&]() {
+      clear_and_deactivate_kernel = &program->kernel([&]() {
         current_ast_builder().insert(Stmt::make<ClearAllStmt>(this, true));
       });
     }
@@ -6,6 +6,7 @@
 TLANG_NAMESPACE_BEGIN
 
 class Expr;
+class Program;
 
 TC_FORCE_INLINE int32 constexpr operator"" _bits(unsigned long long a) {
   return 1 << a;
@@ -65,7 +66,8 @@ class SNode {
   // physical_index_position[i] =
   // the virtual index position of the i^th physical index
 
-  static int counter;
+  // SNode IDs are assigned per layout; see Program::layout
+  static thread_local int counter;
   int id;
   int depth;
   bool _verbose;
@@ -79,6 +81,8 @@ class SNode {
   TypedConstant ambient_val;
   // Note: parent will not be set until structural nodes are compiled!
   SNode *parent;
+  // The program whose layout contains this node, set by Program::layout
+  Program *program;
   std::unique_ptr<Expr> expr;
 
   std::string data_type_name() {
@@ -98,8 +102,13 @@ class SNode {
   int index_id;
   bool _morton;
   bool _bitmasked;
+  // The leading instance axis of a batched program (see Program::batch_size)
+  bool _batch_axis;
   llvm::Type *llvm_type;
   llvm::Type *llvm_element_type;
+  // Memory layout, set by the struct compiler: byte offset in the element
+  // (children struct) of the parent, size of the node and of one element
+  std::size_t offset_in_parent, node_size, element_size;
 
   std::string get_node_type_name() {
     return fmt::format("S{}", id);
@@ -121,6 +130,7 @@ class SNode {
     access_func = nullptr;
     stat_func = nullptr;
     parent = nullptr;
+    program = nullptr;
     _verbose = false;
     _multi_threaded = false;
     index_id = -1;
@@ -128,6 +138,7 @@ class SNode {
     dt = DataType::unknown;
     _morton = false;
     _bitmasked = false;
+    _batch_axis = false;
 
     clear_func = nullptr;
     clear_kernel = nullptr;
@@ -137,6 +148,9 @@ class SNode {
 
     llvm_type = nullptr;
     llvm_element_type = nullptr;
+    offset_in_parent = 0;
+    node_size = 0;
+    element_size = 0;
   }
 
   SNode &insert_children(SNodeType t) {
@@ -313,6 +327,21 @@ class SNode {
     return fmt::format("{}_refine_coordinates", get_name());
   }
 
+  // Note: like parent, this is not available until structural nodes are
+  // compiled
+  bool is_batched() const {
+    for (auto p = this; p != nullptr; p = p->parent) {
+      if (p->_batch_axis)
+        return true;
+    }
+    return false;
+  }
+
+  // Indices addressed by kernels, which leave the instance index implicit
+  int num_frontend_indices() const {
+    return num_active_indices - (int)is_batched();
+  }
+
   int max_num_elements() const {
     return 1 << total_num_bits;
   }
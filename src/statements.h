@@ -167,6 +167,12 @@ class OffloadedStmt : public Stmt {
   std::vector<Stmt *> loop_vars;
   std::vector<llvm::Value *> loop_vars_llvm;
   std::unique_ptr<Block> body;
+  // Optional. Executed by each thread before and after the loop iterations
+  // it runs, e.g. to set up and flush thread-local accumulators.
+  std::unique_ptr<Block> prologue, epilogue;
+  // Optional. SNodes cached in block-local buffers (struct_for only); see
+  // irpass::make_block_local
+  std::shared_ptr<ScratchPads> scratch_pads;
 
   OffloadedStmt(TaskType task_type) : task_type(task_type) {
     begin = end = step = 0;
@@ -192,6 +198,25 @@ class LoopIndexStmt : public Stmt {
   DEFINE_ACCEPT
 };
 
+// Pointer to an element of the block-local buffer caching `snode` in the
+// current struct_for task, at a linear offset within the buffer
+class BlockLocalPtrStmt : public Stmt {
+ public:
+  SNode *snode;
+  Stmt *offset;
+
+  BlockLocalPtrStmt(SNode *snode, Stmt *offset)
+      : snode(snode), offset(offset) {
+    add_operand(this->offset);
+    ret_type = VectorType(1, snode->dt);
+  }
+
+  virtual bool has_global_side_effect() const override {
+    return false;
+  }
+  DEFINE_ACCEPT
+};
+
 // Visits all non-containing statements
 class BasicStmtVisitor : public IRVisitor {
  public:
@@ -234,8 +259,12 @@ class BasicStmtVisitor : public IRVisitor {
   }
 
   void visit(OffloadedStmt *stmt) override {
+    if (stmt->prologue)
+      stmt->prologue->accept(this);
     if (stmt->body)
       stmt->body->accept(this);
+    if (stmt->epilogue)
+      stmt->epilogue->accept(this);
   }
 };
 
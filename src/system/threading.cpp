@@ -7,4 +7,91 @@
 
 TC_NAMESPACE_BEGIN
 
+// Whether the current thread is running a ThreadPool job
+static thread_local bool in_pool_job = false;
+
+ThreadPool::ThreadPool(int num_threads)
+    : job(nullptr), pending(0), running(0), exiting(false) {
+  for (int i = 0; i < num_threads; i++) {
+    threads.emplace_back([this] { target(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> _(mut);
+    exiting = true;
+  }
+  work_available.notify_all();
+  for (auto &th : threads) {
+    th.join();
+  }
+}
+
+void ThreadPool::run(const std::function<void()> &job, int num_helpers) {
+  num_helpers = std::min(num_helpers, size());
+  if (num_helpers <= 0 || in_pool_job) {
+    // a nested job would wait for helpers that are busy with the outer one
+    job();
+    return;
+  }
+  std::lock_guard<std::mutex> _(run_mut);
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    this->job = &job;
+    pending = running = num_helpers;
+    error = nullptr;
+  }
+  work_available.notify_all();
+
+  std::exception_ptr caller_error;
+  in_pool_job = true;
+  try {
+    job();
+  } catch (...) {
+    caller_error = std::current_exception();
+  }
+  in_pool_job = false;
+
+  std::unique_lock<std::mutex> lock(mut);
+  work_done.wait(lock, [this] { return running == 0; });
+  this->job = nullptr;
+  if (!caller_error)
+    caller_error = error;
+  error = nullptr;
+  lock.unlock();
+  if (caller_error)
+    std::rethrow_exception(caller_error);
+}
+
+void ThreadPool::target() {
+  in_pool_job = true;
+  std::unique_lock<std::mutex> lock(mut);
+  while (true) {
+    work_available.wait(lock, [this] { return exiting || pending > 0; });
+    if (exiting)
+      break;
+    pending--;
+    auto current = job;
+    lock.unlock();
+    std::exception_ptr current_error;
+    try {
+      (*current)();
+    } catch (...) {
+      current_error = std::current_exception();
+    }
+    lock.lock();
+    if (current_error && !error)
+      error = current_error;
+    if (--running == 0)
+      work_done.notify_all();
+  }
+}
+
+ThreadPool &ThreadPool::get_instance() {
+  static ThreadPool pool(
+      std::max(0, (int)std::thread::hardware_concurrency() - 1));
+  return pool;
+}
+
 TC_NAMESPACE_END
@@ -26,6 +26,8 @@
 #include <llvm/Linker/Linker.h>
 #include <llvm/Demangle/Demangle.h>
 
+#include <mutex>
+
 #include "util.h"
 #include "taichi_llvm_context.h"
 #include "backends/llvm_jit.h"
@@ -35,23 +37,32 @@ TLANG_NAMESPACE_BEGIN
 static llvm::ExitOnError exit_on_err;
 
 TaichiLLVMContext::TaichiLLVMContext(Arch arch) : arch(arch) {
-  llvm::InitializeAllTargets();
-  llvm::remove_fatal_error_handler();
-  llvm::install_fatal_error_handler(
-      [](void *user_data, const std::string &reason, bool gen_crash_diag) {
-        TC_ERROR("LLVM Fatal Error: {}", reason);
-      },
-      nullptr);
+  // LLVM is initialized once per process, while each program has its own
+  // contexts
+  static std::once_flag llvm_initialized, native_initialized, nvptx_initialized;
+  std::call_once(llvm_initialized, [] {
+    llvm::InitializeAllTargets();
+    llvm::remove_fatal_error_handler();
+    llvm::install_fatal_error_handler(
+        [](void *user_data, const std::string &reason, bool gen_crash_diag) {
+          TC_ERROR("LLVM Fatal Error: {}", reason);
+        },
+        nullptr);
+  });
 
   if (arch == Arch::x86_64) {
-    llvm::InitializeNativeTarget();
-    llvm::InitializeNativeTargetAsmPrinter();
-    llvm::InitializeNativeTargetAsmParser();
+    std::call_once(native_initialized, [] {
+      llvm::InitializeNativeTarget();
+      llvm::InitializeNativeTargetAsmPrinter();
+      llvm::InitializeNativeTargetAsmParser();
+    });
   } else {
-    LLVMInitializeNVPTXTarget();
-    LLVMInitializeNVPTXTargetMC();
-    LLVMInitializeNVPTXTargetInfo();
-    LLVMInitializeNVPTXAsmPrinter();
+    std::call_once(nvptx_initialized, [] {
+      LLVMInitializeNVPTXTarget();
+      LLVMInitializeNVPTXTargetMC();
+      LLVMInitializeNVPTXTargetInfo();
+      LLVMInitializeNVPTXAsmPrinter();
+    });
   }
   ctx = std::make_unique<llvm::LLVMContext>();
   TC_INFO("Creating llvm context for arch: {}", arch_name(arch));
@@ -91,6 +102,8 @@ std::string get_runtime_fn(Arch arch) {
 
 void compile_runtime_bitcode(Arch arch) {
   static std::set<int> runtime_compiled;
+  static std::mutex mut;
+  std::lock_guard<std::mutex> _(mut);
   if (runtime_compiled.find((int)arch) == runtime_compiled.end()) {
     auto clang = find_existing_command({"clang-7", "clang"});
     TC_ASSERT(command_exist("llvm-as"));
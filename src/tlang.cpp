@@ -35,31 +35,39 @@ void Program::initialize_gradient_clearers() {
     auto kernel_name = fmt::format("clear_gradient_{}", node->id);
     if (!places.empty()) {
       auto &ker = kernel([&] {
-        if (places[0]->num_active_indices == 1) {
+        if (places[0]->num_frontend_indices() == 1) {
           For(*places[0]->expr, [&](Expr i) {
             for (auto s : places) {
               (*s->expr)[i] = 0;
             }
           });
-        } else if (places[0]->num_active_indices == 2) {
+        } else if (places[0]->num_frontend_indices() == 2) {
           For(*places[0]->expr, [&](Expr i, Expr j) {
             for (auto s : places) {
               (*s->expr)[i, j] = 0;
             }
           });
-        } else if (places[0]->num_active_indices == 3) {
+        } else if (places[0]->num_frontend_indices() == 3) {
           For(*places[0]->expr, [&](Expr i, Expr j, Expr k) {
             for (auto s : places) {
               (*s->expr)[i, j, k] = 0;
             }
           });
-        } else if (places[0]->num_active_indices == 4) {
+        } else if (places[0]->num_frontend_indices() == 4) {
           For(*places[0]->expr, [&](Expr i, Expr j, Expr k, Expr l) {
             for (auto s : places) {
               (*s->expr)[i, j, k, l] = 0;
             }
           });
-        } else if (places[0]->num_active_indices == 0){
+        } else if (places[0]->num_frontend_indices() == 0 &&
+                   places[0]->is_batched()) {
+          // one value per instance
+          For(ExprGroup(), *places[0]->expr, [&] {
+            for (auto s : places) {
+              (*s->expr)[ExprGroup()] = 0;
+            }
+          });
+        } else if (places[0]->num_frontend_indices() == 0){
           for (auto s : places) {
             (*s->expr)[Expr(0)] = 0;
           }
@@ -71,7 +79,7 @@ void Program::initialize_gradient_clearers() {
       gradient_clearers.emplace_back([&] { ker(); });
     }
   };
-  visit(&root);
+  visit(snode_root);
 }
 
 TLANG_NAMESPACE_END
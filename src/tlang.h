@@ -25,6 +25,9 @@ inline int maximum(int a) {
 #include "util.h"
 #include "math.h"
 #include "program.h"
+#include "snapshot.h"
+#include "particles.h"
+#include "voxelize.h"
 
 TLANG_NAMESPACE_BEGIN
 
@@ -104,6 +107,15 @@ inline Expr Rand() {
   return Expr::make<RandExpression>(get_data_type<T>());
 }
 
+// Value of a batched argument (see Kernel::insert_batched_arg) for the instance
+// of the enclosing top-level loop
+inline Expr BatchedArg(int arg_id) {
+  auto &arg = get_current_program().get_current_kernel().args[arg_id];
+  TC_ASSERT(arg.is_batched);
+  auto values = Expr::make<ExternalTensorExpression>(arg.dt, 1, arg_id);
+  return load(values[BatchInstance()]);
+}
+
 template <typename T>
 inline T Eval(const T &t) {
   return t.eval();
@@ -135,6 +147,16 @@ inline Expr Atomic(Expr dest) {
   return dest;
 }
 
+inline void AtomicMax(const Expr &dest, const Expr &val) {
+  current_ast_builder().insert(Stmt::make<FrontendAtomicStmt>(
+      AtomicOpType::max, ptr_if_global(dest), load_if_ptr(val)));
+}
+
+inline void AtomicMin(const Expr &dest, const Expr &val) {
+  current_ast_builder().insert(Stmt::make<FrontendAtomicStmt>(
+      AtomicOpType::min, ptr_if_global(dest), load_if_ptr(val)));
+}
+
 // expr_group are indices
 inline void Activate(SNode *snode, const ExprGroup &expr_group) {
   current_ast_builder().insert(Stmt::make<FrontendSNodeOpStmt>(
@@ -1,51 +1,330 @@
+#include <cmath>
+#include <cstring>
+#include <limits>
 #include "../ir.h"
-#include <deque>
-#include <set>
+#include "../pass_manager.h"
 
 TLANG_NAMESPACE_BEGIN
 
-class ConstantFold : public BasicStmtVisitor {
- public:
-  ConstantFold() : BasicStmtVisitor() {
-  }
-
-  void visit(UnaryOpStmt *stmt) {
-    if (stmt->width() == 1 && stmt->op_type == UnaryOpType::cast &&
-        stmt->cast_by_value && stmt->operand->is<ConstStmt>()) {
-      auto input = stmt->operand->as<ConstStmt>()->val[0];
-      auto src_type = stmt->operand->ret_type.data_type;
-      auto dst_type = stmt->ret_type.data_type;
-      TypedConstant new_constant(dst_type);
-      bool success = false;
-      if (src_type == DataType::f32) {
-        auto v = input.val_float32();
-        if (dst_type == DataType::i32) {
-          new_constant.val_i32 = int32(v);
-          success = true;
-        }
+// Host-side evaluation of statements on constant operands.
+//
+// Only operations with exactly specified results are evaluated: integer
+// arithmetic (with two's complement wrap-around), IEEE-754 basic arithmetic,
+// sqrt, rounding, comparisons and casts. These fold to the same bits the
+// backends would compute. Transcendental functions go through libm/libdevice
+// on the target and are left to the backend. Operations that are undefined at
+// runtime (e.g. integer division by zero, out-of-range float-to-int casts) are
+// not folded either.
+namespace constant_eval {
+
+template <typename T>
+T read(const TypedConstant &c) {
+  T v;
+  std::memcpy(&v, &c.value_bits, sizeof(T));
+  return v;
+}
+
+template <typename T>
+TypedConstant make(T v) {
+  TypedConstant ret(get_data_type<T>());
+  std::memcpy(&ret.value_bits, &v, sizeof(T));
+  return ret;
+}
+
+// Invokes f with a value of the C++ type corresponding to dt
+template <typename F>
+bool dispatch(DataType dt, const F &f) {
+  if (dt == DataType::i32) {
+    return f(int32());
+  } else if (dt == DataType::i64) {
+    return f(int64());
+  } else if (dt == DataType::f32) {
+    return f(float32());
+  } else if (dt == DataType::f64) {
+    return f(float64());
+  } else {
+    return false;
+  }
+}
+
+template <typename T>
+T wrapping_add(T a, T b) {
+  using U = std::make_unsigned_t<T>;
+  return T(U(a) + U(b));
+}
+
+template <typename T>
+T wrapping_sub(T a, T b) {
+  using U = std::make_unsigned_t<T>;
+  return T(U(a) - U(b));
+}
+
+template <typename T>
+T wrapping_mul(T a, T b) {
+  using U = std::make_unsigned_t<T>;
+  return T(U(a) * U(b));
+}
+
+// fptosi is undefined for values that do not fit into the destination type
+template <typename D, typename S>
+bool float_to_int_in_range(S v) {
+  return std::isfinite(v) &&
+         v > (S)std::numeric_limits<D>::min() - (S)1 &&
+         v < (S)std::numeric_limits<D>::max() + (S)1;
+}
+
+bool cast(const TypedConstant &input,
+          DataType dst,
+          bool by_value,
+          TypedConstant &ret) {
+  if (!by_value) {
+    if (data_type_size(input.dt) != data_type_size(dst))
+      return false;
+    return dispatch(dst, [&](auto d) {
+      ret = TypedConstant(dst);
+      ret.value_bits = input.value_bits;
+      if (sizeof(d) == 4)
+        ret.value_bits &= 0xFFFFFFFFULL;
+      return true;
+    });
+  }
+  return dispatch(input.dt, [&](auto s) {
+    using S = decltype(s);
+    auto v = read<S>(input);
+    return dispatch(dst, [&](auto d) {
+      using D = decltype(d);
+      if constexpr (std::is_floating_point<S>::value &&
+                    std::is_integral<D>::value) {
+        if (!float_to_int_in_range<D>(v))
+          return false;
+      }
+      ret = make<D>((D)v);
+      return true;
+    });
+  });
+}
+
+bool unary(UnaryOpType op, const TypedConstant &input, TypedConstant &ret) {
+  return dispatch(input.dt, [&](auto t) {
+    using T = decltype(t);
+    auto v = read<T>(input);
+    if constexpr (std::is_floating_point<T>::value) {
+      if (op == UnaryOpType::neg) {
+        ret = make<T>(-v);
+      } else if (op == UnaryOpType::sqrt) {
+        ret = make<T>(std::sqrt(v));
+      } else if (op == UnaryOpType::floor) {
+        ret = make<T>(std::floor(v));
+      } else if (op == UnaryOpType::ceil) {
+        ret = make<T>(std::ceil(v));
+      } else if (op == UnaryOpType::abs) {
+        ret = make<T>(std::abs(v));
+      } else if (op == UnaryOpType::sgn) {
+        ret = make<T>(v > 0 ? T(1) : (v < 0 ? T(-1) : T(0)));
+      } else {
+        return false;
+      }
+    } else {
+      if (op == UnaryOpType::neg) {
+        ret = make<T>(wrapping_sub<T>(0, v));
+      } else if (op == UnaryOpType::abs) {
+        ret = make<T>(v > 0 ? v : wrapping_sub<T>(0, v));
+      } else if (op == UnaryOpType::bit_not) {
+        ret = make<T>(~v);
+      } else if (op == UnaryOpType::logic_not) {
+        ret = make<T>(T(!v));
+      } else {
+        return false;
       }
+    }
+    return true;
+  });
+}
 
-      if (success) {
-        auto evaluated = Stmt::make<ConstStmt>(LaneAttribute<TypedConstant>(new_constant));
-        stmt->replace_with(evaluated.get());
-        stmt->parent->insert_before(stmt, VecStatement(std::move(evaluated)));
-        stmt->parent->erase(stmt);
-        throw IRModified();
+bool binary(BinaryOpType op,
+            const TypedConstant &lhs,
+            const TypedConstant &rhs,
+            DataType ret_type,
+            TypedConstant &ret) {
+  if (lhs.dt != rhs.dt)
+    return false;
+  return dispatch(lhs.dt, [&](auto t) {
+    using T = decltype(t);
+    auto a = read<T>(lhs), b = read<T>(rhs);
+    if (is_comparison(op)) {
+      bool result;
+      if (op == BinaryOpType::cmp_lt) {
+        result = a < b;
+      } else if (op == BinaryOpType::cmp_le) {
+        result = a <= b;
+      } else if (op == BinaryOpType::cmp_gt) {
+        result = a > b;
+      } else if (op == BinaryOpType::cmp_ge) {
+        result = a >= b;
+      } else if (op == BinaryOpType::cmp_eq) {
+        result = a == b;
+      } else {
+        // ordered comparison: false if either operand is NaN
+        result = a == a && b == b && a != b;
       }
+      // true is sign-extended to -1 (see codegen)
+      return dispatch(ret_type, [&](auto r) {
+        using R = decltype(r);
+        ret = make<R>(result ? R(-1) : R(0));
+        return true;
+      });
     }
+    if (ret_type != lhs.dt)
+      return false;
+    if constexpr (std::is_floating_point<T>::value) {
+      if (op == BinaryOpType::add) {
+        ret = make<T>(a + b);
+      } else if (op == BinaryOpType::sub) {
+        ret = make<T>(a - b);
+      } else if (op == BinaryOpType::mul) {
+        ret = make<T>(a * b);
+      } else if (op == BinaryOpType::div) {
+        ret = make<T>(a / b);
+      } else if (op == BinaryOpType::max || op == BinaryOpType::min) {
+        // the order of +0 and -0 is unspecified for maxnum/minnum
+        if (a == 0 && b == 0 && std::signbit(a) != std::signbit(b))
+          return false;
+        ret = make<T>(op == BinaryOpType::max ? std::fmax(a, b)
+                                              : std::fmin(a, b));
+      } else {
+        return false;
+      }
+    } else {
+      if (op == BinaryOpType::add) {
+        ret = make<T>(wrapping_add(a, b));
+      } else if (op == BinaryOpType::sub) {
+        ret = make<T>(wrapping_sub(a, b));
+      } else if (op == BinaryOpType::mul) {
+        ret = make<T>(wrapping_mul(a, b));
+      } else if (op == BinaryOpType::div || op == BinaryOpType::mod) {
+        if (b == 0 || (a == std::numeric_limits<T>::min() && b == -1))
+          return false;
+        ret = make<T>(op == BinaryOpType::div ? a / b : a % b);
+      } else if (op == BinaryOpType::max) {
+        ret = make<T>(std::max(a, b));
+      } else if (op == BinaryOpType::min) {
+        ret = make<T>(std::min(a, b));
+      } else if (op == BinaryOpType::bit_and) {
+        ret = make<T>(a & b);
+      } else if (op == BinaryOpType::bit_or) {
+        ret = make<T>(a | b);
+      } else if (op == BinaryOpType::bit_xor) {
+        ret = make<T>(a ^ b);
+      } else {
+        return false;
+      }
+    }
+    return true;
+  });
+}
+
+bool ternary(TernaryOpType op,
+             const TypedConstant &op1,
+             const TypedConstant &op2,
+             const TypedConstant &op3,
+             TypedConstant &ret) {
+  if (op != TernaryOpType::select || !is_integral(op1.dt) || op2.dt != op3.dt)
+    return false;
+  // the condition is truncated to i1 (see codegen)
+  ret = (op1.value_bits & 1) ? op2 : op3;
+  return true;
+}
+
+}  // namespace constant_eval
+
+class ConstantFold : public IRVisitor {
+ public:
+  UseDefChains chains;
+  StmtWorklist worklist;
+
+  ConstantFold(IRNode *node) : chains(node) {
+    // container statements are queued individually; do not recurse
+    allow_undefined_visitor = true;
+    invoke_default_visitor = false;
   }
 
-  static void run(IRNode *node) {
-    ConstantFold folder;
-    while (true) {
-      bool modified = false;
-      try {
-        node->accept(&folder);
-      } catch (IRModified) {
-        modified = true;
+  // Replace stmt with the evaluated constant and queue its users, which may
+  // have become foldable (including RangeForStmt bounds).
+  void replace_with_constant(Stmt *stmt,
+                             const LaneAttribute<TypedConstant> &val) {
+    auto evaluated = Stmt::make<ConstStmt>(val);
+    auto evaluated_ptr = evaluated.get();
+    stmt->parent->insert_before(stmt, VecStatement(std::move(evaluated)));
+    worklist.push(chains.replace_all_usages_with(stmt, evaluated_ptr));
+    chains.remove_user(stmt);
+    stmt->parent->erase(stmt);
+  }
+
+  // Returns the constant operand, or nullptr if op is not a constant of the
+  // same width as stmt
+  static ConstStmt *constant_operand(Stmt *stmt, Stmt *op) {
+    auto c = op->cast<ConstStmt>();
+    if (c && c->width() == stmt->width())
+      return c;
+    return nullptr;
+  }
+
+  // Evaluates stmt lane by lane; stmt is left untouched unless all lanes fold
+  template <typename F>
+  void fold(Stmt *stmt, const F &eval_lane) {
+    LaneAttribute<TypedConstant> val;
+    val.resize(stmt->width());
+    for (int i = 0; i < stmt->width(); i++) {
+      if (!eval_lane(i, val[i]) || val[i].dt != stmt->ret_type.data_type)
+        return;
+    }
+    replace_with_constant(stmt, val);
+  }
+
+  void visit(UnaryOpStmt *stmt) override {
+    auto input = constant_operand(stmt, stmt->operand);
+    if (!input)
+      return;
+    fold(stmt, [&](int i, TypedConstant &ret) {
+      if (stmt->op_type == UnaryOpType::cast) {
+        return constant_eval::cast(input->val[i], stmt->cast_type,
+                                   stmt->cast_by_value, ret);
+      } else {
+        return constant_eval::unary(stmt->op_type, input->val[i], ret);
       }
-      if (!modified)
-        break;
+    });
+  }
+
+  void visit(BinaryOpStmt *stmt) override {
+    auto lhs = constant_operand(stmt, stmt->lhs);
+    auto rhs = constant_operand(stmt, stmt->rhs);
+    if (!lhs || !rhs)
+      return;
+    fold(stmt, [&](int i, TypedConstant &ret) {
+      return constant_eval::binary(stmt->op_type, lhs->val[i], rhs->val[i],
+                                   stmt->ret_type.data_type, ret);
+    });
+  }
+
+  void visit(TernaryOpStmt *stmt) override {
+    auto op1 = constant_operand(stmt, stmt->op1);
+    auto op2 = constant_operand(stmt, stmt->op2);
+    auto op3 = constant_operand(stmt, stmt->op3);
+    if (!op1 || !op2 || !op3)
+      return;
+    fold(stmt, [&](int i, TypedConstant &ret) {
+      return constant_eval::ternary(stmt->op_type, op1->val[i], op2->val[i],
+                                    op3->val[i], ret);
+    });
+  }
+
+  static void run(IRNode *node) {
+    ConstantFold folder(node);
+    folder.worklist.push(gather_statements(node));
+    while (!folder.worklist.empty()) {
+      auto stmt = folder.worklist.pop();
+      if (!stmt->erased)
+        stmt->accept(&folder);
     }
   }
 };
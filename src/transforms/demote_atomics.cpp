@@ -0,0 +1,270 @@
+// Demote atomic reductions into thread-local accumulation
+
+#include <limits>
+#include "../ir.h"
+#include "../snode.h"
+#include "../pass_manager.h"
+
+TLANG_NAMESPACE_BEGIN
+
+// In a task like
+//
+//   For(x, [&](Expr i) { Atomic(total[Expr(0)]) += x[i]; });
+//
+// every iteration performs an atomic operation on the same address, and all
+// threads serialize on one cache line. If the destination of an atomic
+// add/min/max does not depend on the iteration, each thread can instead
+// accumulate into a local variable, and apply a single atomic operation
+// once it is done with its share of the loop:
+//
+//   prologue: acc = identity
+//   body:     acc = acc + x[i]
+//   epilogue: atomic add(total[0], acc)
+//
+// This is only valid if nothing else in the task accesses the destination
+// SNode, other than atomics of the same kind. Must run after offloading and
+// access lowering.
+class DemoteAtomics {
+ public:
+  OffloadedStmt *task;
+  std::unordered_map<Stmt *, bool> invariant_cache;
+
+  DemoteAtomics(OffloadedStmt *task) : task(task) {
+  }
+
+  // Whether the value of s is the same in all iterations of the task and
+  // computing it has no side effects
+  bool is_invariant(Stmt *s) {
+    if (s == nullptr)  // e.g. the input of the root SNodeLookupStmt
+      return true;
+    auto it = invariant_cache.find(s);
+    if (it != invariant_cache.end())
+      return it->second;
+    bool ret = false;
+    if (s->width() != 1) {
+      ret = false;
+    } else if (s->is<ConstStmt>() || s->is<ArgLoadStmt>() ||
+               s->is<GetChStmt>() || s->is<IntegerOffsetStmt>() ||
+               s->is<OffsetAndExtractBitsStmt>() || s->is<LinearizeStmt>() ||
+               s->is<UnaryOpStmt>()) {
+      ret = true;
+    } else if (auto lookup = s->cast<SNodeLookupStmt>()) {
+      // The children of SNodes that may be inactive can be (de)allocated
+      // within the task
+      ret = !lookup->snode->need_activation();
+    } else if (auto bin = s->cast<BinaryOpStmt>()) {
+      // integer division may trap, and the prologue runs even if the
+      // statement is never reached in the body
+      ret = !(is_integral(bin->ret_type.data_type) &&
+              (bin->op_type == BinaryOpType::div ||
+               bin->op_type == BinaryOpType::mod));
+    }
+    for (int i = 0; ret && i < s->num_operands(); i++) {
+      ret = is_invariant(s->operand(i));
+    }
+    invariant_cache[s] = ret;
+    return ret;
+  }
+
+  static TypedConstant identity(AtomicOpType op, DataType dt) {
+    if (op == AtomicOpType::add) {
+      if (dt == DataType::i32)
+        return TypedConstant((int32)0);
+      else if (dt == DataType::f32)
+        return TypedConstant((float32)0);
+      else
+        return TypedConstant((float64)0);
+    }
+    bool is_max = op == AtomicOpType::max;
+    if (dt == DataType::i32) {
+      return TypedConstant(is_max ? std::numeric_limits<int32>::min()
+                                  : std::numeric_limits<int32>::max());
+    } else if (dt == DataType::f32) {
+      auto inf = std::numeric_limits<float32>::infinity();
+      return TypedConstant(is_max ? -inf : inf);
+    } else {
+      auto inf = std::numeric_limits<float64>::infinity();
+      return TypedConstant(is_max ? -inf : inf);
+    }
+  }
+
+  static BinaryOpType binary_op(AtomicOpType op) {
+    if (op == AtomicOpType::add)
+      return BinaryOpType::add;
+    else if (op == AtomicOpType::max)
+      return BinaryOpType::max;
+    else
+      return BinaryOpType::min;
+  }
+
+  // Returns false if the task accesses SNodes in ways we cannot track
+  bool gather_accesses(const std::vector<Stmt *> &stmts,
+                       std::unordered_map<SNode *, std::vector<Stmt *>> &uses) {
+    for (auto s : stmts) {
+      Stmt *ptr = nullptr;
+      if (auto load = s->cast<GlobalLoadStmt>()) {
+        ptr = load->ptr;
+      } else if (auto store = s->cast<GlobalStoreStmt>()) {
+        ptr = store->ptr;
+      } else if (auto atomic = s->cast<AtomicOpStmt>()) {
+        ptr = atomic->dest;
+      } else if (s->is<SNodeOpStmt>() || s->is<ClearAllStmt>()) {
+        return false;
+      }
+      // block-local buffers are private to the thread
+      if (ptr == nullptr || ptr->is<ExternalPtrStmt>() ||
+          ptr->is<BlockLocalPtrStmt>())
+        continue;
+      if (auto get_ch = ptr->cast<GetChStmt>()) {
+        uses[get_ch->output_snode].push_back(s);
+      } else {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Returns whether the task is modified
+  bool run() {
+    if (task->task_type != OffloadedStmt::TaskType::range_for &&
+        task->task_type != OffloadedStmt::TaskType::struct_for)
+      return false;
+    auto stmts = gather_statements(task->body.get());
+
+    std::unordered_map<SNode *, std::vector<Stmt *>> uses;
+    if (!gather_accesses(stmts, uses))
+      return false;
+
+    std::unordered_set<Stmt *> used;
+    for (auto s : stmts) {
+      for (int i = 0; i < s->num_operands(); i++) {
+        used.insert(s->operand(i));
+      }
+    }
+
+    auto demotable = [&](Stmt *s) {
+      auto atomic = s->cast<AtomicOpStmt>();
+      if (!atomic || atomic->width() != 1 || atomic->parent->mask() ||
+          used.find(atomic) != used.end())
+        return false;
+      auto dt = atomic->val->ret_type.data_type;
+      if (dt != DataType::i32 && dt != DataType::f32 && dt != DataType::f64)
+        return false;
+      return is_invariant(atomic->dest);
+    };
+
+    // SNodes only accessed by demotable atomics of the same kind
+    std::unordered_set<SNode *> demoted_snodes;
+    for (auto &it : uses) {
+      auto &accesses = it.second;
+      bool ok = true;
+      for (auto s : accesses) {
+        ok = ok && demotable(s) &&
+             s->as<AtomicOpStmt>()->op_type ==
+                 accesses[0]->as<AtomicOpStmt>()->op_type;
+      }
+      if (ok)
+        demoted_snodes.insert(it.first);
+    }
+
+    // Atomics grouped by destination, in program order
+    std::vector<Stmt *> dests;
+    std::unordered_map<Stmt *, std::vector<AtomicOpStmt *>> atomics;
+    for (auto s : stmts) {
+      auto atomic = s->cast<AtomicOpStmt>();
+      if (!atomic)
+        continue;
+      auto get_ch = atomic->dest->cast<GetChStmt>();
+      if (!get_ch || demoted_snodes.find(get_ch->output_snode) ==
+                         demoted_snodes.end())
+        continue;
+      if (atomics.find(atomic->dest) == atomics.end())
+        dests.push_back(atomic->dest);
+      atomics[atomic->dest].push_back(atomic);
+    }
+    if (dests.empty())
+      return false;
+
+    // Move the address computations to the prologue. They are pure and
+    // loop-invariant, and the prologue dominates the body.
+    std::unordered_set<Stmt *> hoisted;
+    std::function<void(Stmt *)> mark = [&](Stmt *s) {
+      if (s == nullptr || hoisted.find(s) != hoisted.end())
+        return;
+      hoisted.insert(s);
+      for (int i = 0; i < s->num_operands(); i++)
+        mark(s->operand(i));
+    };
+    for (auto dest : dests)
+      mark(dest);
+
+    if (!task->prologue)
+      task->prologue = std::make_unique<Block>();
+    if (!task->epilogue)
+      task->epilogue = std::make_unique<Block>();
+    auto prologue = task->prologue.get();
+    auto epilogue = task->epilogue.get();
+    for (auto s : stmts) {
+      if (hoisted.find(s) == hoisted.end())
+        continue;
+      auto block = s->parent;
+      auto loc = block->locate(s);
+      auto owned = std::move(block->statements[loc]);
+      block->statements.erase(block->statements.begin() + loc);
+      prologue->insert(std::move(owned));
+    }
+
+    VecStatement init, flush;
+    for (auto dest : dests) {
+      auto op = atomics[dest][0]->op_type;
+      auto dt = atomics[dest][0]->val->ret_type.data_type;
+
+      auto acc = init.push_back<AllocaStmt>(dt);
+      auto identity_val = init.push_back<ConstStmt>(
+          LaneAttribute<TypedConstant>(identity(op, dt)));
+      init.push_back<LocalStoreStmt>(acc, identity_val);
+
+      for (auto atomic : atomics[dest]) {
+        VecStatement accumulate;
+        auto old_val = accumulate.push_back<LocalLoadStmt>(
+            LaneAttribute<LocalAddress>(LocalAddress(acc, 0)));
+        old_val->ret_type = acc->ret_type;
+        auto new_val = accumulate.push_back<BinaryOpStmt>(binary_op(op),
+                                                          old_val, atomic->val);
+        new_val->ret_type = acc->ret_type;
+        accumulate.push_back<LocalStoreStmt>(acc, new_val);
+        atomic->parent->replace_with(atomic, accumulate);
+      }
+
+      auto partial = flush.push_back<LocalLoadStmt>(
+          LaneAttribute<LocalAddress>(LocalAddress(acc, 0)));
+      partial->ret_type = acc->ret_type;
+      flush.push_back<AtomicOpStmt>(op, dest, partial);
+    }
+    for (int i = 0; i < (int)init.size(); i++)
+      prologue->insert(std::move(init[i]));
+    for (int i = 0; i < (int)flush.size(); i++)
+      epilogue->insert(std::move(flush[i]));
+    return true;
+  }
+};
+
+namespace irpass {
+
+void demote_atomics(IRNode *root) {
+  auto root_block = dynamic_cast<Block *>(root);
+  TC_ASSERT(root_block);
+  bool modified = false;
+  for (auto &s : root_block->statements) {
+    if (auto task = s->cast<OffloadedStmt>()) {
+      DemoteAtomics pass(task);
+      modified |= pass.run();
+    }
+  }
+  if (modified)
+    fix_block_parents(root);
+}
+
+}  // namespace irpass
+
+TLANG_NAMESPACE_END
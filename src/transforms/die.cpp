@@ -1,102 +1,47 @@
 // Dead Instruction Elimination
 
 #include "../ir.h"
-#include <unordered_set>
+#include "../pass_manager.h"
 
 TLANG_NAMESPACE_BEGIN
 
 // Dead Instruction Elimination
-class DIE : public IRVisitor {
+// Statements without users and without global side effects are erased.
+// Erasing a statement only re-examines its operands, so the pass is linear in
+// the size of the IR instead of restarting the traversal after each erasure.
+// Dead statements are only marked during the traversal, and removed from
+// their blocks in one pass per block at the end.
+class DIE {
  public:
-  std::unordered_set<int> used;
-  int phase;  // 0: mark usage 1: eliminate
-
-  DIE(IRNode *node) {
-    allow_undefined_visitor = true;
-    invoke_default_visitor = true;
-    while (1) {
-      bool modified = false;
-      phase = 0;
-      used.clear();
-      node->accept(this);
-      phase = 1;
-      while (1) {
-        try {
-          node->accept(this);
-        } catch (IRModified) {
-          modified = true;
-          continue;
-        }
-        break;
-      }
-      if (!modified)
-        break;
-    }
-  }
-
-  void register_usage(Stmt *stmt) {
-    for (auto op : stmt->get_operands()) {
-      if (op) {  // might be nullptr
-        if (used.find(op->instance_id) == used.end()) {
-          used.insert(op->instance_id);
-        }
+  static void run(IRNode *root) {
+    UseDefChains chains(root);
+    StmtWorklist worklist;
+    std::unordered_map<Block *, std::unordered_set<Stmt *>> dead;
+    worklist.push(gather_statements(root));
+    while (!worklist.empty()) {
+      auto stmt = worklist.pop();
+      if (stmt->erased || stmt->has_global_side_effect() ||
+          chains.has_users(stmt))
+        continue;
+      auto operands = stmt->get_operands();
+      chains.remove_user(stmt);
+      stmt->erased = true;
+      dead[stmt->parent].insert(stmt);
+      for (auto op : operands) {
+        if (op)  // might be nullptr
+          worklist.push(op);
       }
     }
-  }
-
-  void visit(Stmt *stmt) {
-    TC_ASSERT(!stmt->erased);
-    if (phase == 0) {
-      register_usage(stmt);
-    } else {
-      if (!stmt->has_global_side_effect() &&
-          used.find(stmt->instance_id) == used.end()) {
-        stmt->parent->erase(stmt);
-        throw IRModified();
-      }
-    }
-  }
-
-  void visit(Block *stmt_list) {
-    for (auto &stmt : stmt_list->statements) {
-      stmt->accept(this);
-    }
-  }
-
-  void visit(IfStmt *if_stmt) {
-    register_usage(if_stmt);
-    if (if_stmt->true_statements)
-      if_stmt->true_statements->accept(this);
-    if (if_stmt->false_statements) {
-      if_stmt->false_statements->accept(this);
+    for (auto &it : dead) {
+      it.first->erase(it.second);
     }
   }
-
-  void visit(WhileStmt *stmt) {
-    register_usage(stmt);
-    stmt->body->accept(this);
-  }
-
-  void visit(RangeForStmt *for_stmt) {
-    register_usage(for_stmt);
-    for_stmt->body->accept(this);
-  }
-
-  void visit(StructForStmt *for_stmt) {
-    register_usage(for_stmt);
-    for_stmt->body->accept(this);
-  }
-
-  void visit(OffloadedStmt *stmt) {
-    if (stmt->body)
-      stmt->body->accept(this);
-  }
 };
 
 namespace irpass {
 
 void die(IRNode *root) {
-  DIE instance(root);
+  DIE::run(root);
 }
 
 }  // namespace irpass
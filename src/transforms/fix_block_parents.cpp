@@ -46,8 +46,12 @@ class FixBlockParents : public IRVisitor {
   }
 
   void visit(OffloadedStmt *stmt) override {
+    if (stmt->prologue)
+      stmt->prologue->accept(this);
     if (stmt->body)
       stmt->body->accept(this);
+    if (stmt->epilogue)
+      stmt->epilogue->accept(this);
   }
 
   void run() {
@@ -1,5 +1,6 @@
 #include "../ir.h"
 #include "../scratch_pad.h"
+#include "../pass_manager.h"
 
 TLANG_NAMESPACE_BEGIN
 
@@ -11,22 +12,37 @@ class AccessAnalysis : public IRVisitor {
 
   std::vector<std::vector<int>> block_indices;
 
-  AccessAnalysis(StructForStmt *for_stmt, ScratchPads *pads)
+  // Access offsets are relative to the loop variables, over all positions
+  // within `block`
+  AccessAnalysis(StructForStmt *for_stmt, ScratchPads *pads, SNode *block)
       : for_stmt(for_stmt), pads(pads) {
     allow_undefined_visitor = true;
     invoke_default_visitor = false;
 
-    TC_WARN(
-        "Using the size of scratch_opt[0].second as the snode size to cache");
-    generate_block_indices(for_stmt->scratch_opt[0].second->parent, {}, 0);
+    generate_block_indices(block, {}, 0);
 
-    const auto &block = for_stmt->body;
+    for_stmt->body->accept(this);
+  }
 
-    for (int i = 0; i < (int)block->statements.size(); i++) {
-      block->statements[i]->accept(this);
+  void visit(Block *block) override {
+    for (auto &stmt : block->statements) {
+      stmt->accept(this);
     }
+  }
 
-    pads->print();
+  void visit(IfStmt *if_stmt) override {
+    if (if_stmt->true_statements)
+      if_stmt->true_statements->accept(this);
+    if (if_stmt->false_statements)
+      if_stmt->false_statements->accept(this);
+  }
+
+  void visit(RangeForStmt *for_stmt) override {
+    for_stmt->body->accept(this);
+  }
+
+  void visit(WhileStmt *stmt) override {
+    stmt->body->accept(this);
   }
 
   void generate_block_indices(SNode *snode, std::vector<int> index, int s) {
@@ -51,6 +67,9 @@ class AccessAnalysis : public IRVisitor {
   }
 
   void access(Stmt *stmt, AccessFlag flag) {
+    // e.g. external arrays
+    if (!stmt->is<GlobalPtrStmt>())
+      return;
     auto ptr = stmt->as<GlobalPtrStmt>();
     for (int l = 0; l < stmt->width(); l++) {
       auto snode = ptr->snodes[l];
@@ -132,9 +151,6 @@ class AccessAnalysis : public IRVisitor {
     }
   }
 
-  void visit(Stmt *stmt) override {
-    TC_ASSERT(!stmt->is_container_statement());
-  }
 };
 
 class InsertScratchPad : public IRVisitor {
@@ -176,7 +192,11 @@ class InsertScratchPad : public IRVisitor {
       for (auto &opt : for_stmt->scratch_opt) {
         pads->insert(opt.second);
       }
-      AccessAnalysis _(for_stmt, pads.get());
+      TC_WARN(
+          "Using the size of scratch_opt[0].second as the snode size to cache");
+      AccessAnalysis _(for_stmt, pads.get(),
+                       for_stmt->scratch_opt[0].second->parent);
+      pads->print();
       // WeakenAccess _(for_stmt);
     }
     for_stmt->body->accept(this);
@@ -187,6 +207,331 @@ class InsertScratchPad : public IRVisitor {
   }
 };
 
+// Block-local caches of struct-fors on CPUs
+//
+// With Cache(0, x), a struct-for accesses x through a thread-local buffer
+// holding x over the current leaf block, plus the halo the body accesses
+// around it (the bounds computed by AccessAnalysis):
+//
+//   prologue: buf[*] = x[origin + bounds[0] + *]   (read, write)
+//             buf[*] = 0                           (accumulate)
+//   body:     x[i + 1] -> buf[i + 1 - origin - bounds[0]]
+//   epilogue: x[origin + bounds[0] + *] = buf[*]   (write)
+//             x[origin + bounds[0] + *] += buf[*]  (accumulate, atomic)
+//
+// where origin is the coordinates of the first element of the block. The
+// buffer is small and contiguous, while the halo of x is scattered over the
+// neighboring blocks.
+//
+// make_block_local analyzes and rewrites the body. It needs the GlobalPtrStmts
+// and therefore runs before access lowering. emit_block_local_transfers then
+// fills the prologue and epilogue of the offloaded task, which runs once per
+// leaf block on CPUs.
+class MakeBlockLocal {
+ public:
+  // The buffers of a loop should fit in L1 along with the rest of the data
+  static constexpr int max_buffer_bytes = 32 * 1024;
+
+  StructForStmt *for_stmt;
+  // the leaf block iterated over
+  SNode *leaf;
+  std::vector<int> block_dims;
+
+  MakeBlockLocal(StructForStmt *for_stmt)
+      : for_stmt(for_stmt), leaf(for_stmt->snode->parent) {
+    for (int i = 0; i < (int)for_stmt->loop_vars.size(); i++) {
+      block_dims.push_back(
+          1 << leaf->extractors[leaf->physical_index_position[i]].num_bits);
+    }
+  }
+
+  // Blocks of dense SNodes are complete, and their lookups never fail
+  static bool dense(SNode *snode) {
+    for (; snode != nullptr; snode = snode->parent) {
+      if (snode->type != SNodeType::root && snode->type != SNodeType::dense &&
+          snode->type != SNodeType::place)
+        return false;
+    }
+    return true;
+  }
+
+  // Whether all accesses of the body to snode are loads, stores or atomic
+  // adds at offsets from the loop indices, so that AccessAnalysis sees them
+  bool regular_accesses(SNode *snode, const std::vector<Stmt *> &stmts) {
+    int num_indices = (int)for_stmt->loop_vars.size();
+    if (snode->num_active_indices != num_indices)
+      return false;
+    bool accessed = false;
+    for (auto s : stmts) {
+      if (auto op = s->cast<SNodeOpStmt>()) {
+        if (op->snodes[0] == snode)
+          return false;
+      }
+      auto ptr = s->cast<GlobalPtrStmt>();
+      if (!ptr || ptr->snodes[0] != snode)
+        continue;
+      if ((int)ptr->indices.size() != num_indices)
+        return false;
+      for (int i = 0; i < num_indices; i++) {
+        auto diff = analysis::value_diff(ptr->indices[i], 0,
+                                         for_stmt->loop_vars[i]);
+        if (!diff.linear_related())
+          return false;
+      }
+      accessed = true;
+    }
+    for (auto s : stmts) {
+      for (int i = 0; i < s->num_operands(); i++) {
+        auto op = s->operand(i);
+        if (!op || !op->is<GlobalPtrStmt>() ||
+            op->as<GlobalPtrStmt>()->snodes[0] != snode)
+          continue;
+        if (s->is<GlobalLoadStmt>())
+          continue;
+        if (auto store = s->cast<GlobalStoreStmt>()) {
+          if (store->data != op)
+            continue;
+        }
+        if (auto atomic = s->cast<AtomicOpStmt>()) {
+          if (atomic->op_type == AtomicOpType::add && atomic->val != op)
+            continue;
+        }
+        return false;
+      }
+    }
+    return accessed;
+  }
+
+  bool cacheable(ScratchPad &pad) {
+    auto flags = pad.total_flags;
+    if (flags == AccessFlag::read || flags == AccessFlag::accumulate)
+      return true;
+    if ((flags & AccessFlag::accumulate) != 0)
+      return false;
+    // Written back without atomics, so the buffer must not overlap the
+    // neighboring blocks
+    for (int i = 0; i < pad.dim; i++) {
+      if (pad.bounds[0][i] < 0 || pad.bounds[1][i] > block_dims[i])
+        return false;
+    }
+    return true;
+  }
+
+  void run() {
+    if (!dense(for_stmt->snode))
+      return;
+    // The block origin is found by clearing the lowest bits of the indices
+    for (int i = 0; i < (int)for_stmt->loop_vars.size(); i++) {
+      if (leaf->extractors[leaf->physical_index_position[i]].start != 0)
+        return;
+    }
+    auto stmts = gather_statements(for_stmt->body.get());
+    for (auto s : stmts) {
+      if (s->width() != 1)  // TODO: support vectorization
+        return;
+    }
+
+    auto pads = std::make_unique<ScratchPads>();
+    for (auto &opt : for_stmt->scratch_opt) {
+      auto snode = opt.second;
+      // Cache(1, x) is the read-only data cache of GPUs
+      if (opt.first != 0 || pads->has(snode))
+        continue;
+      if (!dense(snode) || !regular_accesses(snode, stmts)) {
+        TC_WARN("Not caching {}: irregular accesses", snode->node_type_name);
+        continue;
+      }
+      pads->insert(snode);
+    }
+    if (pads->pads.empty())
+      return;
+    AccessAnalysis _(for_stmt, pads.get(), leaf);
+    pads->finalize();
+
+    int total_bytes = 0;
+    for (auto &opt : for_stmt->scratch_opt) {
+      auto snode = opt.second;
+      if (!pads->has(snode))
+        continue;
+      auto &pad = pads->get(snode);
+      if (!cacheable(pad)) {
+        TC_WARN("Not caching {}: unsupported access pattern",
+                snode->node_type_name);
+      } else if (total_bytes + pad.num_bytes() > max_buffer_bytes) {
+        TC_WARN("Not caching {}: the buffer is too large",
+                snode->node_type_name);
+      } else {
+        total_bytes += pad.num_bytes();
+        continue;
+      }
+      pads->pads.erase(snode);
+    }
+    if (pads->pads.empty())
+      return;
+
+    std::vector<GlobalPtrStmt *> ptrs;
+    std::vector<AtomicOpStmt *> atomics;
+    for (auto s : stmts) {
+      if (auto ptr = s->cast<GlobalPtrStmt>()) {
+        if (pads->has(ptr->snodes[0]))
+          ptrs.push_back(ptr);
+      } else if (auto atomic = s->cast<AtomicOpStmt>()) {
+        auto dest = atomic->dest->cast<GlobalPtrStmt>();
+        if (dest && pads->has(dest->snodes[0]))
+          atomics.push_back(atomic);
+      }
+    }
+
+    for (auto ptr : ptrs) {
+      auto snode = ptr->snodes[0];
+      auto &pad = pads->get(snode);
+      VecStatement local_ptr;
+      std::vector<Stmt *> local_indices;
+      for (int i = 0; i < pad.dim; i++) {
+        // the origin of the block is the loop index with the bits within the
+        // block cleared
+        auto loop_index = local_ptr.push_back<LocalLoadStmt>(
+            LaneAttribute<LocalAddress>(LocalAddress(for_stmt->loop_vars[i], 0)));
+        auto mask = local_ptr.push_back<ConstStmt>(
+            LaneAttribute<TypedConstant>(TypedConstant(~(block_dims[i] - 1))));
+        auto origin = local_ptr.push_back<BinaryOpStmt>(BinaryOpType::bit_and,
+                                                        loop_index, mask);
+        auto begin = local_ptr.push_back<ConstStmt>(
+            LaneAttribute<TypedConstant>(TypedConstant(pad.bounds[0][i])));
+        auto offset = local_ptr.push_back<BinaryOpStmt>(
+            BinaryOpType::sub, ptr->indices[i], origin);
+        local_indices.push_back(local_ptr.push_back<BinaryOpStmt>(
+            BinaryOpType::sub, offset, begin));
+      }
+      auto linearized =
+          local_ptr.push_back<LinearizeStmt>(local_indices, pad.pad_size);
+      local_ptr.push_back<BlockLocalPtrStmt>(snode, linearized);
+      ptr->parent->replace_with(ptr, local_ptr);
+    }
+
+    // The buffer is private to the thread
+    for (auto atomic : atomics) {
+      VecStatement accumulate;
+      auto old_val = accumulate.push_back<GlobalLoadStmt>(atomic->dest);
+      auto new_val = accumulate.push_back<BinaryOpStmt>(BinaryOpType::add,
+                                                        old_val, atomic->val);
+      accumulate.push_back<GlobalStoreStmt>(atomic->dest, new_val);
+      atomic->parent->replace_with(atomic, accumulate);
+    }
+
+    for_stmt->scratch_pads = std::move(pads);
+  }
+};
+
+class BlockLocalTransfers {
+ public:
+  OffloadedStmt *task;
+
+  BlockLocalTransfers(OffloadedStmt *task) : task(task) {
+  }
+
+  template <typename T, typename... Args>
+  static T *insert(Block *block, Args &&... args) {
+    auto stmt = Stmt::make_typed<T>(std::forward<Args>(args)...);
+    auto ret = stmt.get();
+    block->insert(std::move(stmt));
+    return ret;
+  }
+
+  using ElementFunc = std::function<void(Block *, Stmt *, std::vector<Stmt *>)>;
+
+  // Emits a loop nest over the buffer of pad. `body` is emitted into the
+  // innermost loop, given the linear offset of the element in the buffer and
+  // its global indices.
+  void for_each_element(Block *block, ScratchPad &pad, const ElementFunc &body) {
+    std::vector<Stmt *> local_indices, global_indices;
+    std::function<void(Block *, int)> emit = [&](Block *current, int i) {
+      if (i == pad.dim) {
+        auto offset = insert<LinearizeStmt>(current, local_indices,
+                                            pad.pad_size);
+        body(current, offset, global_indices);
+        return;
+      }
+      auto loop_var = insert<AllocaStmt>(current, DataType::i32);
+      auto begin = insert<ConstStmt>(
+          current, LaneAttribute<TypedConstant>(TypedConstant(0)));
+      auto end = insert<ConstStmt>(
+          current, LaneAttribute<TypedConstant>(TypedConstant(pad.pad_size[i])));
+      auto loop = insert<RangeForStmt>(current, loop_var, begin, end,
+                                       std::make_unique<Block>(), 1, 1);
+      auto inner = loop->body.get();
+      auto local_index = insert<LocalLoadStmt>(
+          inner, LaneAttribute<LocalAddress>(LocalAddress(loop_var, 0)));
+      // the loop index of the prologue and epilogue is the block origin
+      auto origin = insert<LoopIndexStmt>(
+          inner, task->snode->physical_index_position[i], true);
+      auto offset = insert<ConstStmt>(
+          inner, LaneAttribute<TypedConstant>(TypedConstant(pad.bounds[0][i])));
+      auto relative =
+          insert<BinaryOpStmt>(inner, BinaryOpType::add, local_index, offset);
+      local_indices.push_back(local_index);
+      global_indices.push_back(
+          insert<BinaryOpStmt>(inner, BinaryOpType::add, origin, relative));
+      emit(inner, i + 1);
+      local_indices.pop_back();
+      global_indices.pop_back();
+    };
+    emit(block, 0);
+  }
+
+  void run() {
+    if (!task->prologue)
+      task->prologue = std::make_unique<Block>();
+    if (!task->epilogue)
+      task->epilogue = std::make_unique<Block>();
+    auto prologue = task->prologue.get();
+    auto epilogue = task->epilogue.get();
+    for (auto &it : task->scratch_pads->pads) {
+      auto snode = it.first;
+      auto &pad = it.second;
+      if (pad.total_flags == AccessFlag::accumulate) {
+        auto zero = insert<ConstStmt>(
+            prologue, LaneAttribute<TypedConstant>(TypedConstant(snode->dt)));
+        for_each_element(prologue, pad, [&](Block *block, Stmt *offset,
+                                            std::vector<Stmt *> indices) {
+          auto local_ptr = insert<BlockLocalPtrStmt>(block, snode, offset);
+          insert<GlobalStoreStmt>(block, local_ptr, zero);
+        });
+        for_each_element(epilogue, pad, [&](Block *block, Stmt *offset,
+                                            std::vector<Stmt *> indices) {
+          auto local_ptr = insert<BlockLocalPtrStmt>(block, snode, offset);
+          auto val = insert<GlobalLoadStmt>(block, local_ptr);
+          auto ptr = insert<GlobalPtrStmt>(block, LaneAttribute<SNode *>(snode),
+                                           indices);
+          insert<AtomicOpStmt>(block, AtomicOpType::add, ptr, val);
+        });
+        continue;
+      }
+      // Elements only written in some iterations keep their values, so
+      // written buffers are gathered as well
+      for_each_element(prologue, pad, [&](Block *block, Stmt *offset,
+                                          std::vector<Stmt *> indices) {
+        auto ptr = insert<GlobalPtrStmt>(block, LaneAttribute<SNode *>(snode),
+                                         indices);
+        ptr->activate = false;
+        auto val = insert<GlobalLoadStmt>(block, ptr);
+        auto local_ptr = insert<BlockLocalPtrStmt>(block, snode, offset);
+        insert<GlobalStoreStmt>(block, local_ptr, val);
+      });
+      if ((pad.total_flags & AccessFlag::write) != 0) {
+        for_each_element(epilogue, pad, [&](Block *block, Stmt *offset,
+                                            std::vector<Stmt *> indices) {
+          auto local_ptr = insert<BlockLocalPtrStmt>(block, snode, offset);
+          auto val = insert<GlobalLoadStmt>(block, local_ptr);
+          auto ptr = insert<GlobalPtrStmt>(block, LaneAttribute<SNode *>(snode),
+                                           indices);
+          insert<GlobalStoreStmt>(block, ptr, val);
+        });
+      }
+    }
+  }
+};
+
 namespace irpass {
 
 std::unique_ptr<ScratchPads> initialize_scratch_pad(StructForStmt *root) {
@@ -194,6 +539,42 @@ std::unique_ptr<ScratchPads> initialize_scratch_pad(StructForStmt *root) {
   return _.get();
 }
 
+void make_block_local(IRNode *root) {
+  auto root_block = dynamic_cast<Block *>(root);
+  TC_ASSERT(root_block);
+  for (auto &s : root_block->statements) {
+    if (auto for_stmt = s->cast<StructForStmt>()) {
+      if (!for_stmt->scratch_opt.empty()) {
+        MakeBlockLocal pass(for_stmt);
+        pass.run();
+      }
+    }
+  }
+}
+
+void emit_block_local_transfers(IRNode *root) {
+  auto root_block = dynamic_cast<Block *>(root);
+  TC_ASSERT(root_block);
+  std::vector<OffloadedStmt *> tasks;
+  for (auto &s : root_block->statements) {
+    auto task = s->cast<OffloadedStmt>();
+    if (task && task->scratch_pads) {
+      BlockLocalTransfers pass(task);
+      pass.run();
+      tasks.push_back(task);
+    }
+  }
+  if (tasks.empty())
+    return;
+  fix_block_parents(root);
+  typecheck(root);
+  for (auto task : tasks) {
+    lower_access(task->prologue.get(), true);
+    lower_access(task->epilogue.get(), true);
+  }
+  fix_block_parents(root);
+}
+
 }  // namespace irpass
 
 TLANG_NAMESPACE_END
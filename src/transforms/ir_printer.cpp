@@ -375,8 +375,18 @@ class IRPrinter : public IRVisitor {
             stmt->snode->get_node_type_name());
     } else {
       print("{} = offloaded {} {{", stmt->name(), details);
+      if (stmt->prologue) {
+        print("prologue {{");
+        stmt->prologue->accept(this);
+        print("}}");
+      }
       TC_ASSERT(stmt->body);
       stmt->body->accept(this);
+      if (stmt->epilogue) {
+        print("epilogue {{");
+        stmt->epilogue->accept(this);
+        print("}}");
+      }
       print("}}");
     }
   }
@@ -384,6 +394,11 @@ class IRPrinter : public IRVisitor {
   void visit(LoopIndexStmt *stmt) override {
     print("{} = loop index {}", stmt->name(), stmt->index);
   }
+
+  void visit(BlockLocalPtrStmt *stmt) override {
+    print("{}{} = block local ptr [{}] {}", stmt->type_hint(), stmt->name(),
+          stmt->snode->node_type_name, stmt->offset->name());
+  }
 };
 
 namespace irpass {
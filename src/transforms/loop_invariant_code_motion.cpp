@@ -0,0 +1,201 @@
+// Loop Invariant Code Motion
+
+#include "../ir.h"
+#include "../snode.h"
+#include "../pass_manager.h"
+
+TLANG_NAMESPACE_BEGIN
+
+// Hoists statements whose value does not change across iterations out of
+// RangeForStmt and WhileStmt bodies. Loops are processed inner-most first, so
+// that e.g. the access lowering chain of x[i] in a loop over j is moved out of
+// both the j loop and, if i is also invariant there, the loops around it.
+//
+// Only statements directly in the loop body are candidates (statements under
+// an IfStmt are conditionally executed). Loops directly under the kernel root
+// are offloaded as separate tasks and are never hoisted out of.
+class LoopInvariantCodeMotion : public IRVisitor {
+ public:
+  Block *root;
+
+  LoopInvariantCodeMotion(IRNode *node) {
+    allow_undefined_visitor = true;
+    invoke_default_visitor = false;
+    root = dynamic_cast<Block *>(node);
+  }
+
+  void visit(Block *stmt_list) override {
+    for (int i = 0; i < (int)stmt_list->statements.size(); i++) {
+      auto num_statements = stmt_list->statements.size();
+      stmt_list->statements[i]->accept(this);
+      // skip over the statements hoisted in front of the current one
+      i += (int)(stmt_list->statements.size() - num_statements);
+    }
+  }
+
+  void visit(IfStmt *if_stmt) override {
+    if (if_stmt->true_statements)
+      if_stmt->true_statements->accept(this);
+    if (if_stmt->false_statements)
+      if_stmt->false_statements->accept(this);
+  }
+
+  void visit(WhileStmt *stmt) override {
+    stmt->body->accept(this);
+    if (stmt->parent != root)
+      hoist(stmt, stmt->body.get());
+  }
+
+  void visit(RangeForStmt *for_stmt) override {
+    for_stmt->body->accept(this);
+    if (for_stmt->parent != root)
+      hoist(for_stmt, for_stmt->body.get());
+  }
+
+  void visit(StructForStmt *for_stmt) override {
+    for_stmt->body->accept(this);
+  }
+
+  void visit(OffloadedStmt *stmt) override {
+    if (stmt->body)
+      stmt->body->accept(this);
+  }
+
+  // Whether any SNode from the root to snode may be inactive, in which case
+  // looking it up depends on (and may change) the data structure state
+  static bool needs_activation(SNode *snode) {
+    for (; snode != nullptr; snode = snode->parent) {
+      if (snode->need_activation())
+        return true;
+    }
+    return false;
+  }
+
+  static bool guaranteed_to_execute(Stmt *loop) {
+    if (auto range_for = loop->cast<RangeForStmt>()) {
+      auto begin = range_for->begin->cast<ConstStmt>();
+      auto end = range_for->end->cast<ConstStmt>();
+      return begin && end && begin->width() == 1 && end->width() == 1 &&
+             begin->val[0].dt == DataType::i32 &&
+             end->val[0].dt == DataType::i32 &&
+             begin->val[0].val_i32 < end->val[0].val_i32;
+    }
+    // statements before the first WhileControlStmt run at least once
+    return loop->is<WhileStmt>();
+  }
+
+  void hoist(Stmt *loop, Block *body) {
+    auto loop_stmts = gather_statements(body);
+    std::unordered_set<Stmt *> in_loop(loop_stmts.begin(), loop_stmts.end());
+
+    // Allocas written in the loop, and whether the loop may (de)activate
+    // SNodes
+    std::unordered_set<Stmt *> written;
+    bool activates = false, deactivates = false;
+    if (auto range_for = loop->cast<RangeForStmt>())
+      written.insert(range_for->loop_var);
+    for (auto s : loop_stmts) {
+      if (auto store = s->cast<LocalStoreStmt>()) {
+        written.insert(store->ptr);
+      } else if (auto atomic = s->cast<AtomicOpStmt>()) {
+        written.insert(atomic->dest);
+      } else if (auto range_for = s->cast<RangeForStmt>()) {
+        written.insert(range_for->loop_var);
+      } else if (auto control = s->cast<WhileControlStmt>()) {
+        written.insert(control->mask);
+      } else if (auto ptr = s->cast<GlobalPtrStmt>()) {
+        for (int i = 0; i < ptr->width(); i++)
+          activates |= ptr->activate && needs_activation(ptr->snodes[i]);
+      } else if (auto lookup = s->cast<SNodeLookupStmt>()) {
+        activates |= lookup->activate;
+      } else if (auto op = s->cast<SNodeOpStmt>()) {
+        activates |= op->op_type == SNodeOpType::activate ||
+                     op->op_type == SNodeOpType::append;
+        deactivates |= op->op_type == SNodeOpType::deactivate ||
+                       op->op_type == SNodeOpType::clear;
+      } else if (s->is<ClearAllStmt>()) {
+        deactivates = true;
+      }
+    }
+
+    bool speculative = !guaranteed_to_execute(loop);
+
+    auto movable = [&](Stmt *s) -> bool {
+      if (s->is_container_statement() || s->is<AllocaStmt>() ||
+          s->is<RandStmt>() || s->is<GlobalLoadStmt>())
+        return false;
+      if (auto load = s->cast<LocalLoadStmt>()) {
+        for (int i = 0; i < load->width(); i++) {
+          if (written.find(load->ptr[i].var) != written.end())
+            return false;
+        }
+        return true;
+      }
+      if (auto bin = s->cast<BinaryOpStmt>()) {
+        // integer division may trap when executed speculatively
+        if (speculative && is_integral(bin->ret_type.data_type) &&
+            (bin->op_type == BinaryOpType::div ||
+             bin->op_type == BinaryOpType::mod))
+          return false;
+        return true;
+      }
+      bool reads_structure = false, activate = false;
+      if (auto ptr = s->cast<GlobalPtrStmt>()) {
+        for (int i = 0; i < ptr->width(); i++)
+          reads_structure |= needs_activation(ptr->snodes[i]);
+        activate = ptr->activate;
+      } else if (auto lookup = s->cast<SNodeLookupStmt>()) {
+        reads_structure = lookup->snode->need_activation();
+        activate = lookup->activate;
+      } else {
+        return !s->has_global_side_effect();
+      }
+      if (!reads_structure)
+        return true;
+      if (activate)
+        return !speculative && !deactivates;
+      else
+        return !activates && !deactivates;
+    };
+
+    auto invariant = [&](Stmt *s) -> bool {
+      for (int i = 0; i < s->num_operands(); i++) {
+        auto op = s->operand(i);
+        if (op && in_loop.find(op) != in_loop.end())
+          return false;
+      }
+      return true;
+    };
+
+    VecStatement hoisted;
+    std::vector<pStmt> kept;
+    for (auto &s : body->statements) {
+      if (s->is<WhileControlStmt>())
+        speculative = true;
+      if (movable(s.get()) && invariant(s.get())) {
+        in_loop.erase(s.get());
+        hoisted.push_back(std::move(s));
+      } else {
+        kept.push_back(std::move(s));
+      }
+    }
+    body->statements = std::move(kept);
+    if (hoisted.size())
+      loop->parent->insert_before(loop, std::move(hoisted));
+  }
+
+  static void run(IRNode *node) {
+    LoopInvariantCodeMotion pass(node);
+    node->accept(&pass);
+  }
+};
+
+namespace irpass {
+
+void loop_invariant_code_motion(IRNode *root) {
+  LoopInvariantCodeMotion::run(root);
+}
+
+}  // namespace irpass
+
+TLANG_NAMESPACE_END
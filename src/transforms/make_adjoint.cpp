@@ -321,6 +321,8 @@ class MakeAdjoint : public IRVisitor {
       // no gradient (likely integer types)
       return;
     }
+    TC_ERROR_UNLESS(stmt->op_type == AtomicOpType::add,
+                    "Only atomic add is differentiable.");
     TC_ASSERT(snodes[0]->get_grad() != nullptr);
     snodes[0] = snodes[0]->get_grad();
     auto adjoint_ptr = insert<GlobalPtrStmt>(snodes, ptr->indices);
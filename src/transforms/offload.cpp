@@ -106,6 +106,7 @@ class Offloader {
 
     offloaded_struct_for->block_size = for_stmt->block_size;
     offloaded_struct_for->snode = for_stmt->snode;
+    offloaded_struct_for->scratch_pads = for_stmt->scratch_pads;
 
     root_block->insert(std::move(offloaded_struct_for));
   }
@@ -1,44 +1,395 @@
 #include <taichi/taichi>
-#include <set>
 #include "../ir.h"
+#include "../pass_manager.h"
 
 TLANG_NAMESPACE_BEGIN
 
+// Records, for each block to simplify, the container statement owning it and
+// the enclosing struct for. Only the bodies of containers are simplified
+// (e.g. not the block initialization of struct fors).
+class SimplifyScopes : public IRVisitor {
+ public:
+  std::unordered_map<Block *, Stmt *> owner;
+  std::unordered_map<Block *, StructForStmt *> struct_for;
+  std::vector<Stmt *> stmts;  // in program order
+  Stmt *current_owner;
+  StructForStmt *current_struct_for;
+
+  SimplifyScopes(IRNode *root) {
+    allow_undefined_visitor = true;
+    invoke_default_visitor = true;
+    current_owner = nullptr;
+    current_struct_for = nullptr;
+    root->accept(this);
+  }
+
+  void enter(Stmt *container, Block *block) {
+    if (!block)
+      return;
+    auto old_owner = current_owner;
+    current_owner = container;
+    block->accept(this);
+    current_owner = old_owner;
+  }
+
+  void visit(Stmt *stmt) override {
+    stmts.push_back(stmt);
+  }
+
+  void visit(Block *block) override {
+    owner[block] = current_owner;
+    struct_for[block] = current_struct_for;
+    for (auto &stmt : block->statements) {
+      stmt->accept(this);
+    }
+  }
+
+  void visit(IfStmt *if_stmt) override {
+    stmts.push_back(if_stmt);
+    enter(if_stmt, if_stmt->true_statements.get());
+    enter(if_stmt, if_stmt->false_statements.get());
+  }
+
+  void visit(RangeForStmt *for_stmt) override {
+    stmts.push_back(for_stmt);
+    enter(for_stmt, for_stmt->body.get());
+  }
+
+  void visit(StructForStmt *for_stmt) override {
+    stmts.push_back(for_stmt);
+    TC_ASSERT(current_struct_for == nullptr);
+    current_struct_for = for_stmt;
+    enter(for_stmt, for_stmt->body.get());
+    current_struct_for = nullptr;
+  }
+
+  void visit(WhileStmt *stmt) override {
+    stmts.push_back(stmt);
+    enter(stmt, stmt->body.get());
+  }
+
+  void visit(OffloadedStmt *stmt) override {
+    stmts.push_back(stmt);
+    enter(stmt, stmt->prologue.get());
+    enter(stmt, stmt->body.get());
+    enter(stmt, stmt->epilogue.get());
+  }
+};
+
+// Also keys the loads. Two loads with the same key only read the same value
+// if no store (or container statement) lies between them.
+class LoadKeyBuilder : public ValueKeyBuilder {
+ public:
+  using ValueKeyBuilder::visit;
+
+  void visit(GlobalLoadStmt *stmt) override {
+    push(stmt->ptr);
+    valid = true;
+  }
+
+  void visit(LocalLoadStmt *stmt) override {
+    for (int l = 0; l < stmt->width(); l++) {
+      push(stmt->ptr[l].var);
+      push(stmt->ptr[l].offset);
+    }
+    valid = true;
+  }
+};
+
+// The live statements of a block, by position in the block, and the accesses
+// among them that the rewrites look for
+struct BlockIndex {
+  std::unordered_map<Stmt *, int> position;
+  // statements with the same key (see LoadKeyBuilder), and the key of each
+  std::unordered_map<ValueKey, std::map<int, Stmt *>, ValueKeyHash> by_key;
+  std::unordered_map<Stmt *, ValueKey> key;
+  std::map<int, Stmt *> containers;
+  std::map<int, Stmt *> global_stores;
+  // the local loads and stores of each alloca
+  std::unordered_map<Stmt *, std::map<int, Stmt *>> local_loads;
+  std::unordered_map<Stmt *, std::map<int, Stmt *>> local_stores;
+};
+
 // Common subexpression elimination, store forwarding, useless local store
 // elimination; Simplify if statements into conditional stores.
-class BasicBlockSimplify : public IRVisitor {
+// The pass is driven by a worklist: a rewrite only re-queues the statements it
+// may enable further rewrites of (the users of a replaced statement, the
+// neighbouring accesses of an erased local load or store), instead of
+// restarting from the IR root. Erased statements are only marked during the
+// traversal, and removed from their blocks in one pass per block at the end.
+// Duplicates and the neighbouring accesses of a statement are found through
+// the index of its block instead of scanning the block, so that the pass
+// stays fast on the long blocks of unrolled kernels. Erasing a statement
+// removes it from the index; inserting statements (which already takes time
+// linear in the block) drops the index, which is rebuilt on its next use.
+class Simplify : public IRVisitor {
  public:
-  Block *block;
-
-  int current_stmt_id;
-  std::set<int> &visited;
   StructForStmt *current_struct_for;
-
-  BasicBlockSimplify(Block *block,
-                     std::set<int> &visited,
-                     StructForStmt *current_struct_for)
-      : block(block), visited(visited), current_struct_for(current_struct_for) {
+  UseDefChains chains;
+  StmtWorklist worklist;
+  SimplifyScopes scopes;
+  std::unordered_map<Block *, std::unordered_set<Stmt *>> dead;
+  std::unordered_map<Block *, BlockIndex> indices;
+  LoadKeyBuilder key_builder;
+
+  Simplify(IRNode *root) : chains(root), scopes(root) {
     allow_undefined_visitor = true;
     invoke_default_visitor = false;
     current_struct_for = nullptr;
-    run();
   }
 
-  bool is_done(Stmt *stmt) {
-    return visited.find(stmt->instance_id) != visited.end();
+  static void run(IRNode *root) {
+    Simplify simplifier(root);
+    simplifier.worklist.push(simplifier.scopes.stmts);
+    while (!simplifier.worklist.empty()) {
+      auto stmt = simplifier.worklist.pop();
+      if (stmt->erased)
+        continue;
+      auto scope = simplifier.scopes.struct_for.find(stmt->parent);
+      if (scope == simplifier.scopes.struct_for.end())
+        continue;
+      simplifier.current_struct_for = scope->second;
+      stmt->accept(&simplifier);
+    }
+    for (auto &it : simplifier.dead) {
+      it.first->erase(it.second);
+    }
+  }
+
+  BlockIndex &index_of(Block *block) {
+    auto it = indices.find(block);
+    if (it != indices.end())
+      return it->second;
+    auto &index = indices[block];
+    for (int i = 0; i < (int)block->statements.size(); i++) {
+      auto stmt = block->statements[i].get();
+      if (stmt->erased)
+        continue;
+      index.position[stmt] = i;
+      add_to_index(index, stmt);
+    }
+    return index;
+  }
+
+  // Called when statements are inserted into or removed from block
+  void invalidate(Block *block) {
+    indices.erase(block);
   }
 
-  void set_done(Stmt *stmt) {
-    visited.insert(stmt->instance_id);
+  void add_to_index(BlockIndex &index, Stmt *stmt) {
+    int position = index.position[stmt];
+    if (stmt->is_container_statement())
+      index.containers[position] = stmt;
+    if (stmt->is<GlobalStoreStmt>())
+      index.global_stores[position] = stmt;
+    if (stmt->is<LocalStoreStmt>())
+      index.local_stores[stmt->as<LocalStoreStmt>()->ptr][position] = stmt;
+    if (stmt->is<LocalLoadStmt>()) {
+      auto load = stmt->as<LocalLoadStmt>();
+      for (int l = 0; l < load->width(); l++)
+        index.local_loads[load->ptr[l].var][position] = stmt;
+    }
+    if (key_builder.build(stmt)) {
+      index.by_key[key_builder.key][position] = stmt;
+      index.key[stmt] = key_builder.key;
+    }
+  }
+
+  void remove_from_index(BlockIndex &index, Stmt *stmt) {
+    int position = index.position.at(stmt);
+    index.containers.erase(position);
+    index.global_stores.erase(position);
+    if (stmt->is<LocalStoreStmt>())
+      index.local_stores[stmt->as<LocalStoreStmt>()->ptr].erase(position);
+    if (stmt->is<LocalLoadStmt>()) {
+      auto load = stmt->as<LocalLoadStmt>();
+      for (int l = 0; l < load->width(); l++)
+        index.local_loads[load->ptr[l].var].erase(position);
+    }
+    auto key = index.key.find(stmt);
+    if (key != index.key.end()) {
+      auto same = index.by_key.find(key->second);
+      same->second.erase(position);
+      if (same->second.empty())
+        index.by_key.erase(same);
+      index.key.erase(key);
+    }
+    index.position.erase(stmt);
+  }
+
+  // The key of stmt changes with its operands
+  void update_index(Stmt *stmt) {
+    auto it = indices.find(stmt->parent);
+    if (it == indices.end())
+      return;
+    auto &index = it->second;
+    auto position = index.position.find(stmt);
+    if (position == index.position.end())
+      return;
+    auto p = position->second;
+    remove_from_index(index, stmt);
+    index.position[stmt] = p;
+    add_to_index(index, stmt);
   }
 
-  void run() {
-    for (int i = 0; i < (int)block->statements.size(); i++) {
-      current_stmt_id = i;
-      block->statements[i]->accept(this);
+  int position_of(Stmt *stmt) {
+    return index_of(stmt->parent).position.at(stmt);
+  }
+
+  // The last statement in stmts before position
+  static Stmt *previous(const std::map<int, Stmt *> &stmts, int position) {
+    auto it = stmts.lower_bound(position);
+    if (it == stmts.begin())
+      return nullptr;
+    return std::prev(it)->second;
+  }
+
+  // The first statement in stmts after position
+  static Stmt *next(const std::map<int, Stmt *> &stmts, int position) {
+    auto it = stmts.upper_bound(position);
+    if (it == stmts.end())
+      return nullptr;
+    return it->second;
+  }
+
+  static bool any_between(const std::map<int, Stmt *> &stmts,
+                          int begin,
+                          int end) {
+    auto it = stmts.upper_bound(begin);
+    return it != stmts.end() && it->first < end;
+  }
+
+  // The closest statement before stmt in its block with the same key
+  Stmt *previous_equivalent(Stmt *stmt) {
+    auto &index = index_of(stmt->parent);
+    auto key = index.key.find(stmt);
+    if (key == index.key.end())
+      return nullptr;
+    return previous(index.by_key[key->second], index.position[stmt]);
+  }
+
+  // Common subexpression elimination of statements without side effects:
+  // replaces stmt with the first equivalent statement of its block, if that
+  // one precedes it
+  void eliminate_duplicate(Stmt *stmt) {
+    auto &index = index_of(stmt->parent);
+    auto key = index.key.find(stmt);
+    if (key == index.key.end())
+      return;
+    auto first = index.by_key[key->second].begin()->second;
+    if (first != stmt)
+      replace_and_erase(stmt, first);
+  }
+
+  // Removes the erased statements of block
+  void flush(Block *block) {
+    auto it = dead.find(block);
+    if (it != dead.end()) {
+      block->erase(it->second);
+      dead.erase(it);
+      invalidate(block);
     }
   }
 
+  bool empty(Block *block) {
+    flush(block);
+    return block->statements.empty();
+  }
+
+  // Marks stmt erased. The neighbouring accesses of the local variables it
+  // reads or writes, its container and, if it is a container itself, the
+  // statements after it may now be simplified.
+  void erase(Stmt *stmt) {
+    if (stmt->is<LocalStoreStmt>()) {
+      push_related_accesses(stmt, stmt->as<LocalStoreStmt>()->ptr);
+    } else if (stmt->is<LocalLoadStmt>()) {
+      auto load = stmt->as<LocalLoadStmt>();
+      for (int l = 0; l < load->width(); l++) {
+        if (l == 0 || load->ptr[l].var != load->ptr[l - 1].var)
+          push_related_accesses(stmt, load->ptr[l].var);
+      }
+    }
+    if (stmt->is_container_statement())
+      push_following(stmt);
+    auto owner = scopes.owner.find(stmt->parent);
+    if (owner != scopes.owner.end() && owner->second)
+      worklist.push(owner->second);
+    chains.remove_user(stmt);
+    auto index = indices.find(stmt->parent);
+    if (index != indices.end())
+      remove_from_index(index->second, stmt);
+    stmt->erased = true;
+    dead[stmt->parent].insert(stmt);
+  }
+
+  // Queues the previous store to alloca before stmt, and the loads and the
+  // next store of alloca after stmt in the same block
+  void push_related_accesses(Stmt *stmt, Stmt *alloca) {
+    auto &index = index_of(stmt->parent);
+    int position = index.position.at(stmt);
+    auto &stores = index.local_stores[alloca];
+    auto container = index.containers.upper_bound(position);
+    int end = container == index.containers.end()
+                  ? (int)stmt->parent->statements.size()
+                  : container->first;
+    auto store = previous(stores, position);
+    if (store && !any_between(index.containers, index.position[store],
+                              position)) {
+      worklist.push(store);
+    }
+    auto next_store = stores.upper_bound(position);
+    if (next_store != stores.end() && next_store->first < end) {
+      worklist.push(next_store->second);
+      end = next_store->first;
+    }
+    auto &loads = index.local_loads[alloca];
+    for (auto it = loads.upper_bound(position);
+         it != loads.end() && it->first < end; ++it) {
+      worklist.push(it->second);
+    }
+  }
+
+  // Queues the statements after stmt in its block
+  void push_following(Stmt *stmt) {
+    auto &stmts = stmt->parent->statements;
+    for (int i = position_of(stmt) + 1; i < (int)stmts.size(); i++) {
+      if (!stmts[i]->erased)
+        worklist.push(stmts[i].get());
+    }
+  }
+
+  // Redirect all users of stmt to new_stmt, then erase stmt. The users have
+  // new operands and need to be simplified again.
+  void replace_and_erase(Stmt *stmt, Stmt *new_stmt) {
+    replace_usages(stmt, new_stmt);
+    erase(stmt);
+  }
+
+  void replace_usages(Stmt *stmt, Stmt *new_stmt) {
+    auto users = chains.replace_all_usages_with(stmt, new_stmt);
+    for (auto user : users)
+      update_index(user);
+    worklist.push(users);
+  }
+
+  // Statements created by this pass must be registered in the chains
+  Stmt *insert_before(Stmt *stmt, pStmt &&new_stmt) {
+    auto ret = stmt->insert_before_me(std::move(new_stmt));
+    invalidate(stmt->parent);
+    chains.add_user(ret);
+    worklist.push(ret);
+    return ret;
+  }
+
+  // The operand of the new statement is registered by the caller, once its
+  // users have been redirected to it
+  Stmt *insert_after(Stmt *stmt, pStmt &&new_stmt) {
+    auto ret = stmt->insert_after_me(std::move(new_stmt));
+    invalidate(stmt->parent);
+    worklist.push(ret);
+    return ret;
+  }
+
   void visit(Stmt *stmt) override {
     if (stmt->is_container_statement())
       return;
@@ -48,65 +399,11 @@ class BasicBlockSimplify : public IRVisitor {
   }
 
   void visit(GlobalPtrStmt *stmt) override {
-    if (is_done(stmt))
-      return;
-    for (int i = 0; i < current_stmt_id; i++) {
-      auto &bstmt = block->statements[i];
-      if (stmt->ret_type == bstmt->ret_type) {
-        auto &bstmt_data = *bstmt;
-        if (typeid(bstmt_data) == typeid(*stmt)) {
-          auto bstmt_ = bstmt->as<GlobalPtrStmt>();
-          bool same = true;
-          for (int l = 0; l < stmt->width(); l++) {
-            if (stmt->snodes[l] != bstmt_->snodes[l]) {
-              same = false;
-              break;
-            }
-          }
-          if (stmt->indices.size() != bstmt_->indices.size()) {
-            same = false;
-          } else {
-            for (int j = 0; j < (int)stmt->indices.size(); j++) {
-              if (stmt->indices[j] != bstmt_->indices[j])
-                same = false;
-            }
-          }
-          if (same) {
-            stmt->replace_with(bstmt.get());
-            stmt->parent->erase(current_stmt_id);
-            throw IRModified();
-          }
-        }
-      }
-    }
-    set_done(stmt);
+    eliminate_duplicate(stmt);
   }
 
   void visit(ConstStmt *stmt) override {
-    if (is_done(stmt))
-      return;
-    for (int i = 0; i < current_stmt_id; i++) {
-      auto &bstmt = block->statements[i];
-      auto &bstmt_data = *bstmt;
-      if (typeid(bstmt_data) == typeid(*stmt)) {
-        if (stmt->width() == bstmt->width()) {
-          auto bstmt_ = bstmt->as<ConstStmt>();
-          bool same = true;
-          for (int l = 0; l < stmt->width(); l++) {
-            if (!stmt->val[l].equal_type_and_value(bstmt_->val[l])) {
-              same = false;
-              break;
-            }
-          }
-          if (same) {
-            stmt->replace_with(bstmt.get());
-            stmt->parent->erase(current_stmt_id);
-            throw IRModified();
-          }
-        }
-      }
-    }
-    set_done(stmt);
+    eliminate_duplicate(stmt);
   }
 
   void visit(AllocaStmt *stmt) override {
@@ -114,8 +411,6 @@ class BasicBlockSimplify : public IRVisitor {
   }
 
   void visit(ElementShuffleStmt *stmt) override {
-    if (is_done(stmt))
-      return;
     // is this stmt necessary?
     {
       bool same_source = true;
@@ -129,9 +424,8 @@ class BasicBlockSimplify : public IRVisitor {
       if (same_source && inc_index &&
           stmt->width() == stmt->elements[0].stmt->width()) {
         // useless shuffle.
-        stmt->replace_with(stmt->elements[0].stmt);
-        stmt->parent->erase(current_stmt_id);
-        throw IRModified();
+        replace_and_erase(stmt, stmt->elements[0].stmt);
+        return;
       }
     }
 
@@ -143,94 +437,43 @@ class BasicBlockSimplify : public IRVisitor {
                                          stmt->elements[0].index,
                                          current_struct_for->loop_vars[k]);
         if (diff.linear_related() && diff.certain()) {
-          auto load = stmt->insert_before_me(
-              Stmt::make<LocalLoadStmt>(LocalAddress(loop_vars[k], 0)));
+          auto load = insert_before(
+              stmt, Stmt::make<LocalLoadStmt>(LocalAddress(loop_vars[k], 0)));
           load->ret_type.data_type = DataType::i32;
-          auto constant = stmt->insert_before_me(
-              Stmt::make<ConstStmt>(TypedConstant(diff.low)));
+          auto constant = insert_before(
+              stmt, Stmt::make<ConstStmt>(TypedConstant(diff.low)));
           constant->ret_type.data_type = DataType::i32;
-          auto add = stmt->insert_before_me(
-              Stmt::make<BinaryOpStmt>(BinaryOpType::add, load, constant));
+          auto add = insert_before(
+              stmt, Stmt::make<BinaryOpStmt>(BinaryOpType::add, load, constant));
           add->ret_type.data_type = DataType::i32;
-          stmt->replace_with(add);
-          stmt->parent->erase(stmt);
-          throw IRModified();
+          replace_and_erase(stmt, add);
+          return;
         }
       }
     }
 
     // find dup
-    for (int i = 0; i < current_stmt_id; i++) {
-      auto &bstmt = block->statements[i];
-      if (stmt->ret_type == bstmt->ret_type) {
-        auto &bstmt_data = *bstmt;
-        if (typeid(bstmt_data) == typeid(*stmt)) {
-          auto bstmt_ = bstmt->as<ElementShuffleStmt>();
-          bool same = true;
-          for (int l = 0; l < stmt->width(); l++) {
-            if (stmt->elements[l].stmt != bstmt_->elements[l].stmt ||
-                stmt->elements[l].index != bstmt_->elements[l].index) {
-              same = false;
-              break;
-            }
-          }
-          if (same) {
-            stmt->replace_with(bstmt.get());
-            stmt->parent->erase(stmt);
-            throw IRModified();
-          }
-        }
-      }
-    }
-    set_done(stmt);
+    eliminate_duplicate(stmt);
   }
 
   void visit(LocalLoadStmt *stmt) override {
-    if (is_done(stmt))
-      return;
-    for (int i = 0; i < current_stmt_id; i++) {
-      auto &bstmt = block->statements[i];
-      if (stmt->ret_type == bstmt->ret_type) {
-        auto &bstmt_data = *bstmt;
-        if (typeid(bstmt_data) == typeid(*stmt)) {
-          auto bstmt_ = bstmt->as<LocalLoadStmt>();
-          bool same = true;
-          std::vector<Stmt *> vars;
-          for (int l = 0; l < stmt->width(); l++) {
-            vars.push_back(stmt->ptr[l].var);
-            if (stmt->ptr[l].var != bstmt_->ptr[l].var ||
-                stmt->ptr[l].offset != bstmt_->ptr[l].offset) {
-              same = false;
-              break;
-            }
-          }
-          if (same) {
-            // no store to the var?
-            bool has_related_store = false;
-            for (int j = i + 1; j < current_stmt_id; j++) {
-              if (block->statements[j]
-                      ->is_container_statement()) {  // no if, while, etc..
-                has_related_store = true;
-                break;
-              }
-              if (block->statements[j]->is<LocalStoreStmt>()) {
-                auto st = block->statements[j]->as<LocalStoreStmt>();
-                for (auto var : vars) {
-                  if (st->ptr == var) {
-                    has_related_store = true;
-                    break;
-                  }
-                }
-              }
-            }
-            if (!has_related_store) {
-              stmt->replace_with(bstmt.get());
-              stmt->parent->erase(current_stmt_id);
-              throw IRModified();
-            }
-          }
+    auto &index = index_of(stmt->parent);
+    int position = index.position.at(stmt);
+    // an earlier load of the same addresses, with no store to them in between
+    if (auto previous_load = previous_equivalent(stmt)) {
+      int begin = index.position[previous_load];
+      // no if, while, etc..
+      bool has_related_store = any_between(index.containers, begin, position);
+      for (int l = 0; l < stmt->width(); l++) {
+        if (any_between(index.local_stores[stmt->ptr[l].var], begin,
+                        position)) {
+          has_related_store = true;
         }
       }
+      if (!has_related_store) {
+        replace_and_erase(stmt, previous_load);
+        return;
+      }
     }
 
     // store-forwarding
@@ -242,157 +485,58 @@ class BasicBlockSimplify : public IRVisitor {
       }
     }
     if (regular) {
-      // Check all previous statements in the current block before the local
-      // load
-      auto block = stmt->parent;
-      Stmt *containing_statement = stmt;
-      bool modified = false;
-      while (true) {
-        auto stmt_id = block->locate(containing_statement);
-        TC_ASSERT(stmt_id != -1);
-        for (int i = stmt_id - 1; i >= 0; i--) {
-          auto &bstmt = block->statements[i];
-          // Find a previous store
-          if (bstmt->is<LocalStoreStmt>()) {
-            auto bstmt_ = bstmt->as<LocalStoreStmt>();
-            // Same alloca
-            if (bstmt_->ptr == alloca) {
-              // Forward to the first local store only
-              stmt->replace_with(bstmt_->data);
-              stmt->parent->erase(current_stmt_id);
-              throw IRModified();
-            }
-          } else if (bstmt->is_container_statement()) {
-            // assume this container may modify the local var
-            modified = true;
-            break;
-          }
-        }
-        break;
-        /*
-        // Note: simply checking all statements before stmt is not sufficient
-        // since statements after stmt may change the value of the alloca
-        if (modified) break;
-        // Go to parent level
-        auto parent_block = block->parent;
-        if (!parent_block)
-          break;
-        Stmt *parent_statement = nullptr;
-        for (int i = 0; i < parent_block->statements.size(); i++) {
-          auto s = parent_block->statements[i].get();
-          if (s->is<RangeForStmt>() &&
-              s->as<RangeForStmt>()->body.get() == block) {
-            parent_statement = s;
-            break;
-          }
-        }
-        if (!parent_statement)
-          break;
-        block = parent_block;
-        containing_statement = parent_statement;
-        */
+      // Forward the previous store in the current block, unless a container
+      // statement (which may modify the local var) lies in between.
+      // Note: looking for stores in the enclosing blocks is not sufficient,
+      // since statements after stmt may change the value of the alloca
+      auto store = previous(index.local_stores[alloca], position);
+      if (store &&
+          !any_between(index.containers, index.position[store], position)) {
+        replace_and_erase(stmt, store->as<LocalStoreStmt>()->data);
+        return;
       }
     }
-    set_done(stmt);
   }
 
   void visit(LocalStoreStmt *stmt) override {
-    if (is_done(stmt))
-      return;
-
-    // has previous store?
-    for (int i = 0; i < current_stmt_id; i++) {
-      auto &bstmt = block->statements[i];
-      if (stmt->ret_type == bstmt->ret_type) {
-        auto &bstmt_data = *bstmt;
-        if (typeid(bstmt_data) == typeid(*stmt)) {
-          auto bstmt_ = bstmt->as<LocalStoreStmt>();
-          bool same = stmt->ptr == bstmt_->ptr;
-          if (same) {
-            bool has_load = false;
-            for (int j = i + 1; j < current_stmt_id; j++) {
-              if (block->statements[j]
-                      ->is_container_statement()) {  // no if, while, etc..
-                has_load = true;
-                break;
-              }
-              if (block->statements[j]->is<LocalLoadStmt>() &&
-                  block->statements[j]->as<LocalLoadStmt>()->has_source(
-                      stmt->ptr)) {
-                has_load = true;
-              }
-            }
-            if (!has_load) {
-              stmt->parent->erase(bstmt_);
-              throw IRModified();
-            }
-          }
-        }
+    auto &index = index_of(stmt->parent);
+    int position = index.position.at(stmt);
+    auto &loads = index.local_loads[stmt->ptr];
+    // has previous store, with no load in between?
+    if (auto store = previous(index.local_stores[stmt->ptr], position)) {
+      int begin = index.position[store];
+      // no if, while, etc..
+      if (!any_between(index.containers, begin, position) &&
+          !any_between(loads, begin, position)) {
+        erase(store);
+        worklist.push(stmt);
+        return;
       }
     }
 
     // has following load?
-
-    if (stmt->parent->locate(stmt->ptr) != -1) {
+    if (index.position.count(stmt->ptr)) {
       // optimize local variables only
-      bool has_related = false;
-      for (int i = current_stmt_id + 1; i < (int)block->statements.size();
-           i++) {
-        auto &bstmt = block->statements[i];
-        if (bstmt->is_container_statement()) {
-          has_related = true;
-          break;
-        }
-        if (bstmt->is<LocalLoadStmt>()) {
-          auto bstmt_ = bstmt->as<LocalLoadStmt>();
-          if (bstmt_->has_source(stmt->ptr)) {
-            has_related = true;
-            break;
-          }
-        }
-      }
-      if (!has_related) {
-        stmt->parent->erase(stmt);
-        throw IRModified();
+      if (!next(index.containers, position) && !next(loads, position)) {
+        erase(stmt);
+        return;
       }
     }
-
-    set_done(stmt);
   }
 
   void visit(GlobalLoadStmt *stmt) override {
-    if (is_done(stmt))
-      return;
-    for (int i = 0; i < current_stmt_id; i++) {
-      auto &bstmt = block->statements[i];
-      if (stmt->ret_type == bstmt->ret_type) {
-        auto &bstmt_data = *bstmt;
-        if (typeid(bstmt_data) == typeid(*stmt)) {
-          auto bstmt_ = bstmt->as<GlobalLoadStmt>();
-          bool same = stmt->ptr == bstmt_->ptr;
-          if (same) {
-            // no store to the var?
-            bool has_store = false;
-            for (int j = i + 1; j < current_stmt_id; j++) {
-              if (block->statements[j]
-                      ->is_container_statement()) {  // no if, while, etc..
-                has_store = true;
-                break;
-              }
-              if (block->statements[j]->is<GlobalStoreStmt>()) {
-                has_store = true;
-              }
-            }
-            if (!has_store) {
-              stmt->replace_with(bstmt.get());
-              stmt->parent->erase(current_stmt_id);
-              throw IRModified();
-            }
-          }
-        }
+    auto &index = index_of(stmt->parent);
+    int position = index.position.at(stmt);
+    // an earlier load of the same pointer, with no store in between
+    if (auto previous_load = previous_equivalent(stmt)) {
+      int begin = index.position[previous_load];
+      // no if, while, etc..
+      if (!any_between(index.containers, begin, position) &&
+          !any_between(index.global_stores, begin, position)) {
+        replace_and_erase(stmt, previous_load);
+        return;
       }
     }
-    set_done(stmt);
   }
 
   void visit(GlobalStoreStmt *stmt) override {
@@ -404,63 +548,25 @@ class BasicBlockSimplify : public IRVisitor {
   }
 
   void visit(IntegerOffsetStmt *stmt) override {
-    if (is_done(stmt))
-      return;
     if (stmt->offset == 0) {
-      stmt->replace_with(stmt->input);
-      stmt->parent->erase(stmt);
-      throw IRModified();
-    }
-
-    for (int i = 0; i < current_stmt_id; i++) {
-      auto &bstmt = block->statements[i];
-      if (stmt->ret_type == bstmt->ret_type) {
-        auto &bstmt_data = *bstmt;
-        if (typeid(bstmt_data) == typeid(*stmt)) {
-          auto bstmt_ = bstmt->as<IntegerOffsetStmt>();
-          if (bstmt_->input == stmt->input && bstmt_->offset == stmt->offset) {
-            stmt->replace_with(bstmt.get());
-            stmt->parent->erase(current_stmt_id);
-            throw IRModified();
-          }
-        }
-      }
+      replace_and_erase(stmt, stmt->input);
+      return;
     }
-    set_done(stmt);
+
+    eliminate_duplicate(stmt);
   }
 
   void visit(UnaryOpStmt *stmt) override {
-    if (is_done(stmt))
-      return;
     if (stmt->op_type == UnaryOpType::cast) {
       if (stmt->cast_type == stmt->operand->ret_type.data_type) {
-        stmt->replace_with(stmt->operand);
-        stmt->parent->erase(current_stmt_id);
-        set_done(stmt);
+        replace_and_erase(stmt, stmt->operand);
         return;
       }
     }
-    for (int i = 0; i < current_stmt_id; i++) {
-      auto &bstmt = block->statements[i];
-      if (stmt->ret_type == bstmt->ret_type) {
-        auto &bstmt_data = *bstmt;
-        if (typeid(bstmt_data) == typeid(*stmt)) {
-          auto bstmt_ = bstmt->as<UnaryOpStmt>();
-          if (bstmt_->same_operation(stmt) &&
-              bstmt_->operand == stmt->operand) {
-            stmt->replace_with(bstmt.get());
-            stmt->parent->erase(current_stmt_id);
-            throw IRModified();
-          }
-        }
-      }
-    }
-    set_done(stmt);
+    eliminate_duplicate(stmt);
   }
 
   void visit(BinaryOpStmt *stmt) override {
-    if (is_done(stmt))
-      return;
     if ((stmt->op_type == BinaryOpType::add ||
          stmt->op_type == BinaryOpType::sub) &&
         stmt->ret_type.data_type == DataType::i32) {
@@ -473,54 +579,19 @@ class BasicBlockSimplify : public IRVisitor {
           }
         }
         if (all_zero) {
-          stmt->replace_with(stmt->lhs);
-          stmt->parent->erase(current_stmt_id);
-          throw IRModified();
-        }
-      }
-    }
-    for (int i = 0; i < current_stmt_id; i++) {
-      auto &bstmt = block->statements[i];
-      if (stmt->ret_type == bstmt->ret_type) {
-        auto &bstmt_data = *bstmt;
-        if (typeid(bstmt_data) == typeid(*stmt)) {
-          auto bstmt_ = bstmt->as<BinaryOpStmt>();
-          if (bstmt_->op_type == stmt->op_type && bstmt_->lhs == stmt->lhs &&
-              bstmt_->rhs == stmt->rhs) {
-            stmt->replace_with(bstmt.get());
-            stmt->parent->erase(current_stmt_id);
-            throw IRModified();
-          }
+          replace_and_erase(stmt, stmt->lhs);
+          return;
         }
       }
     }
-    set_done(stmt);
+    eliminate_duplicate(stmt);
   }
 
   void visit(TernaryOpStmt *stmt) override {
-    if (is_done(stmt))
-      return;
-    for (int i = 0; i < current_stmt_id; i++) {
-      auto &bstmt = block->statements[i];
-      if (stmt->ret_type == bstmt->ret_type) {
-        auto &bstmt_data = *bstmt;
-        if (typeid(bstmt_data) == typeid(*stmt)) {
-          auto bstmt_ = bstmt->as<TernaryOpStmt>();
-          if (bstmt_->op_type == stmt->op_type && bstmt_->op1 == stmt->op1 &&
-              bstmt_->op2 == stmt->op2 && bstmt_->op3 == stmt->op3) {
-            stmt->replace_with(bstmt.get());
-            stmt->parent->erase(current_stmt_id);
-            throw IRModified();
-          }
-        }
-      }
-    }
-    set_done(stmt);
+    eliminate_duplicate(stmt);
   }
 
   void visit(OffsetAndExtractBitsStmt *stmt) override {
-    if (is_done(stmt))
-      return;
     // step 1: try weakening when a struct for is used
     if (current_struct_for && !stmt->simplified) {
       auto &loop_vars = current_struct_for->loop_vars;
@@ -530,10 +601,13 @@ class BasicBlockSimplify : public IRVisitor {
         if (diff.linear_related() && diff.certain()) {
           // case 1: last loop var, vectorized, has assumption on vec size
           if (k == (int)current_struct_for->loop_vars.size() - 1) {
-            auto load = stmt->insert_before_me(
+            auto load = insert_before(
+                stmt,
                 Stmt::make<LocalLoadStmt>(LocalAddress(loop_vars[k], 0)));
             load->ret_type.data_type = DataType::i32;
+            chains.remove_user(stmt);
             stmt->input = load;
+            chains.add_user(stmt);
             int64 bound = 1LL << stmt->bit_end;
             auto offset = (((int64)diff.low % bound + bound) % bound) &
                           ~((1LL << (stmt->bit_begin)) - 1);
@@ -544,52 +618,41 @@ class BasicBlockSimplify : public IRVisitor {
                 current_struct_for->vectorize == bound) {
               // TODO: take care of cases where vectorization width != z
               // dimension of the block
-              auto offset_stmt = stmt->insert_after_me(
-                  Stmt::make<IntegerOffsetStmt>(stmt, offset));
-              stmt->replace_with(offset_stmt);
+              auto offset_stmt = insert_after(
+                  stmt, Stmt::make<IntegerOffsetStmt>(stmt, offset));
+              replace_usages(stmt, offset_stmt);
               // fix the offset stmt operand
               offset_stmt->as<IntegerOffsetStmt>()->input = stmt;
+              chains.add_user(offset_stmt);
               stmt->offset = 0;
             } else {
               stmt->offset = offset;
             }
           } else {
             // insert constant
-            auto load = stmt->insert_before_me(
+            auto load = insert_before(
+                stmt,
                 Stmt::make<LocalLoadStmt>(LocalAddress(loop_vars[k], 0)));
             load->ret_type.data_type = DataType::i32;
-            auto constant = stmt->insert_before_me(
-                Stmt::make<ConstStmt>(TypedConstant(diff.low)));
-            auto add = stmt->insert_before_me(
+            auto constant = insert_before(
+                stmt, Stmt::make<ConstStmt>(TypedConstant(diff.low)));
+            auto add = insert_before(
+                stmt,
                 Stmt::make<BinaryOpStmt>(BinaryOpType::add, load, constant));
             add->ret_type.data_type = DataType::i32;
+            chains.remove_user(stmt);
             stmt->input = add;
+            chains.add_user(stmt);
           }
           stmt->simplified = true;
-          throw IRModified();
+          worklist.push(stmt);
+          return;
         }
       }
     }
 
     // step 2: eliminate dup
-    for (int i = 0; i < current_stmt_id; i++) {
-      auto &bstmt = block->statements[i];
-      if (stmt->ret_type == bstmt->ret_type) {
-        auto &bstmt_data = *bstmt;
-        if (typeid(bstmt_data) == typeid(*stmt)) {
-          auto bstmt_ = bstmt->as<OffsetAndExtractBitsStmt>();
-          if (bstmt_->input == stmt->input &&
-              bstmt_->bit_begin == stmt->bit_begin &&
-              bstmt_->bit_end == stmt->bit_end &&
-              bstmt_->offset == stmt->offset) {
-            stmt->replace_with(bstmt.get());
-            stmt->parent->erase(current_stmt_id);
-            throw IRModified();
-          }
-        }
-      }
-    }
-    set_done(stmt);
+    eliminate_duplicate(stmt);
   }
 
   template <typename T>
@@ -607,43 +670,26 @@ class BasicBlockSimplify : public IRVisitor {
   }
 
   void visit(LinearizeStmt *stmt) override {
-    if (is_done(stmt))
-      return;
-
     if (stmt->inputs.size() && stmt->inputs.back()->is<IntegerOffsetStmt>()) {
       auto previous_offset = stmt->inputs.back()->as<IntegerOffsetStmt>();
       // push forward offset
-      auto offset_stmt = stmt->insert_after_me(
-          Stmt::make<IntegerOffsetStmt>(stmt, previous_offset->offset));
+      auto offset_stmt = insert_after(
+          stmt, Stmt::make<IntegerOffsetStmt>(stmt, previous_offset->offset));
 
+      chains.remove_user(stmt);
       stmt->inputs.back() = previous_offset->input;
-      stmt->replace_with(offset_stmt);
+      chains.add_user(stmt);
+      replace_usages(stmt, offset_stmt);
       offset_stmt->as<IntegerOffsetStmt>()->input = stmt;
-      throw IRModified();
-    }
-
-    for (int i = 0; i < current_stmt_id; i++) {
-      auto &bstmt = block->statements[i];
-      if (stmt->ret_type == bstmt->ret_type) {
-        auto &bstmt_data = *bstmt;
-        if (typeid(bstmt_data) == typeid(*stmt)) {
-          auto bstmt_ = bstmt->as<LinearizeStmt>();
-          if (identical_vectors(bstmt_->inputs, stmt->inputs) &&
-              identical_vectors(bstmt_->strides, stmt->strides)) {
-            stmt->replace_with(bstmt.get());
-            stmt->parent->erase(current_stmt_id);
-            throw IRModified();
-          }
-        }
-      }
+      chains.add_user(offset_stmt);
+      worklist.push(stmt);
+      return;
     }
-    set_done(stmt);
+
+    eliminate_duplicate(stmt);
   }
 
   void visit(SNodeLookupStmt *stmt) override {
-    if (is_done(stmt))
-      return;
-
     if (stmt->input_index->is<IntegerOffsetStmt>()) {
       auto previous_offset = stmt->input_index->as<IntegerOffsetStmt>();
       // push forward offset
@@ -656,76 +702,47 @@ class BasicBlockSimplify : public IRVisitor {
                   snode->ch[i]->dt == DataType::f32);
       }
 
-      auto offset_stmt = stmt->insert_after_me(Stmt::make<IntegerOffsetStmt>(
-          stmt, previous_offset->offset * sizeof(int32) * (snode->ch.size())));
+      auto offset_stmt = insert_after(
+          stmt, Stmt::make<IntegerOffsetStmt>(
+                    stmt, previous_offset->offset * sizeof(int32) *
+                              (snode->ch.size())));
 
+      chains.remove_user(stmt);
       stmt->input_index = previous_offset->input;
-      stmt->replace_with(offset_stmt);
+      chains.add_user(stmt);
+      replace_usages(stmt, offset_stmt);
       offset_stmt->as<IntegerOffsetStmt>()->input = stmt;
-      throw IRModified();
-    }
-
-    for (int i = 0; i < current_stmt_id; i++) {
-      auto &bstmt = block->statements[i];
-      if (stmt->ret_type == bstmt->ret_type) {
-        auto &bstmt_data = *bstmt;
-        if (typeid(bstmt_data) == typeid(*stmt)) {
-          auto bstmt_ = bstmt->as<SNodeLookupStmt>();
-          if (bstmt_->snode == stmt->snode &&
-              bstmt_->input_snode == stmt->input_snode &&
-              bstmt_->input_index == stmt->input_index &&
-              // identical_vectors(bstmt_->global_indices,
-              // stmt->global_indices)
-              // && no need for the above line. As long as input_index are the
-              // same global indices comparison can be omitted
-              bstmt_->activate == stmt->activate) {
-            stmt->replace_with(bstmt.get());
-            stmt->parent->erase(current_stmt_id);
-            throw IRModified();
-          }
-        }
-      }
+      chains.add_user(offset_stmt);
+      worklist.push(stmt);
+      return;
     }
-    set_done(stmt);
+
+    eliminate_duplicate(stmt);
   }
 
   void visit(GetChStmt *stmt) override {
-    if (is_done(stmt))
-      return;
-
     if (stmt->input_ptr->is<IntegerOffsetStmt>()) {
       auto previous_offset = stmt->input_ptr->as<IntegerOffsetStmt>();
       // push forward offset
 
       // auto snode = stmt->input_snode;
-      auto offset_stmt = stmt->insert_after_me(Stmt::make<IntegerOffsetStmt>(
-          stmt, stmt->chid * sizeof(int32) + previous_offset->offset));
+      auto offset_stmt = insert_after(
+          stmt, Stmt::make<IntegerOffsetStmt>(
+                    stmt, stmt->chid * sizeof(int32) + previous_offset->offset));
 
+      chains.remove_user(stmt);
       stmt->input_ptr = previous_offset->input;
-      stmt->replace_with(offset_stmt);
+      chains.add_user(stmt);
+      replace_usages(stmt, offset_stmt);
       stmt->chid = 0;
       stmt->output_snode = stmt->input_snode->ch[stmt->chid].get();
       offset_stmt->as<IntegerOffsetStmt>()->input = stmt;
-      throw IRModified();
-    }
-
-    for (int i = 0; i < current_stmt_id; i++) {
-      auto &bstmt = block->statements[i];
-      if (stmt->ret_type == bstmt->ret_type) {
-        auto &bstmt_data = *bstmt;
-        if (typeid(bstmt_data) == typeid(*stmt)) {
-          auto bstmt_ = bstmt->as<GetChStmt>();
-          if (bstmt_->input_ptr == stmt->input_ptr &&
-              bstmt_->input_snode == stmt->input_snode &&
-              bstmt_->chid == stmt->chid) {
-            stmt->replace_with(bstmt.get());
-            stmt->parent->erase(current_stmt_id);
-            throw IRModified();
-          }
-        }
-      }
+      chains.add_user(offset_stmt);
+      worklist.push(stmt);
+      return;
     }
-    set_done(stmt);
+
+    eliminate_duplicate(stmt);
   }
 
   void visit(AtomicOpStmt *stmt) override {
@@ -749,7 +766,12 @@ class BasicBlockSimplify : public IRVisitor {
   }
 
   void visit(IfStmt *if_stmt) override {
-    auto flatten = [&](std::vector<pStmt> &clause, bool true_branch) {
+    // Statements moved out of the clauses, inserted before if_stmt at once
+    VecStatement hoisted;
+    std::vector<Stmt *> conditional_values;
+    auto flatten = [&](Block *clause_block, bool true_branch) {
+      flush(clause_block);
+      auto &clause = clause_block->statements;
       bool plain_clause = true;  // no global store, no container
 
       // Here we try to move statements outside the clause;
@@ -787,61 +809,68 @@ class BasicBlockSimplify : public IRVisitor {
             for (int l = 0; l < store->width(); l++) {
               lanes.push_back(LocalAddress(store->ptr, l));
             }
-            auto load =
-                if_stmt->insert_before_me(Stmt::make<LocalLoadStmt>(lanes));
-            load->infer_type();
-            auto select = if_stmt->insert_before_me(
-                Stmt::make<TernaryOpStmt>(TernaryOpType::select, if_stmt->cond,
-                                          true_branch ? store->data : load,
-                                          true_branch ? load : store->data));
-            select->infer_type();
+            auto load = hoisted.push_back(Stmt::make<LocalLoadStmt>(lanes));
+            auto select = hoisted.push_back(Stmt::make<TernaryOpStmt>(
+                TernaryOpType::select, if_stmt->cond,
+                true_branch ? store->data : load,
+                true_branch ? load : store->data));
+            conditional_values.push_back(load);
+            conditional_values.push_back(select);
+            chains.remove_user(store);
             store->data = select;
-            if_stmt->insert_before_me(std::move(clause[i]));
+            chains.add_user(store);
+            hoisted.push_back(std::move(clause[i]));
           } else {
-            if_stmt->insert_before_me(std::move(clause[i]));
+            hoisted.push_back(std::move(clause[i]));
           }
         }
         auto clean_clause = std::vector<pStmt>();
-        bool reduced = false;
         for (auto &&stmt : clause) {
           if (stmt != nullptr) {
             clean_clause.push_back(std::move(stmt));
-          } else {
-            reduced = true;
           }
         }
         clause = std::move(clean_clause);
-        return reduced;
+        invalidate(clause_block);
       }
-      return false;
     };
 
-    if (if_stmt->true_statements &&
-        flatten(if_stmt->true_statements->statements, true)) {
-      throw IRModified();
-    }
-    if (if_stmt->false_statements &&
-        flatten(if_stmt->false_statements->statements, false)) {
-      throw IRModified();
-    }
-
-    if (if_stmt->true_statements) {
-      if (if_stmt->true_statements->statements.empty()) {
-        if_stmt->true_statements = nullptr;
-        throw IRModified();
+    if (if_stmt->true_statements)
+      flatten(if_stmt->true_statements.get(), true);
+    if (if_stmt->false_statements)
+      flatten(if_stmt->false_statements.get(), false);
+
+    if (hoisted.size()) {
+      std::vector<Stmt *> moved;
+      for (auto &stmt : hoisted.stmts)
+        moved.push_back(stmt.get());
+      if_stmt->parent->insert_before(if_stmt, std::move(hoisted));
+      invalidate(if_stmt->parent);
+      // the type check may insert casts before the selects, so it runs after
+      // they are in the block
+      for (auto stmt : conditional_values) {
+        stmt->infer_type();
+        chains.add_user(stmt);
       }
-    }
-
-    if (if_stmt->false_statements) {
-      if (if_stmt->false_statements->statements.empty()) {
-        if_stmt->false_statements = nullptr;
-        throw IRModified();
+      worklist.push(moved);
+      push_following(if_stmt);
+    }
+
+    // Erased statements of a dropped clause must outlive the pass
+    auto drop_if_empty = [&](std::unique_ptr<Block> &clause) {
+      if (clause && empty(clause.get())) {
+        auto &trash_bin = if_stmt->parent->trash_bin;
+        for (auto &stmt : clause->trash_bin)
+          trash_bin.push_back(std::move(stmt));
+        invalidate(clause.get());
+        clause = nullptr;
       }
-    }
+    };
+    drop_if_empty(if_stmt->true_statements);
+    drop_if_empty(if_stmt->false_statements);
 
     if (!if_stmt->true_statements && !if_stmt->false_statements) {
-      if_stmt->parent->erase(if_stmt);
-      throw IRModified();
+      erase(if_stmt);
     }
   }
 
@@ -851,78 +880,16 @@ class BasicBlockSimplify : public IRVisitor {
 
   void visit(OffloadedStmt *stmt) override {
     if (stmt->task_type != OffloadedStmt::TaskType ::listgen &&
-        stmt->body->statements.empty()) {
-      stmt->parent->erase(stmt);
-      throw IRModified();
-    }
-  }
-};
-
-class Simplify : public IRVisitor {
- public:
-  StructForStmt *current_struct_for;
-  bool modified;
-
-  Simplify(IRNode *node) {
-    modified = false;
-    allow_undefined_visitor = true;
-    invoke_default_visitor = true;
-    current_struct_for = nullptr;
-    node->accept(this);
-  }
-
-  void visit(Block *block) override {
-    std::set<int> visited;
-    while (true) {
-      try {
-        BasicBlockSimplify _(block, visited, current_struct_for);
-      } catch (IRModified) {
-        modified = true;
-        continue;
-      }
-      break;
-    }
-    for (auto &stmt : block->statements) {
-      stmt->accept(this);
+        empty(stmt->body.get())) {
+      erase(stmt);
     }
   }
-
-  void visit(IfStmt *if_stmt) override {
-    if (if_stmt->true_statements)
-      if_stmt->true_statements->accept(this);
-    if (if_stmt->false_statements)
-      if_stmt->false_statements->accept(this);
-  }
-
-  void visit(RangeForStmt *for_stmt) override {
-    for_stmt->body->accept(this);
-  }
-
-  void visit(StructForStmt *for_stmt) override {
-    TC_ASSERT(current_struct_for == nullptr);
-    current_struct_for = for_stmt;
-    for_stmt->body->accept(this);
-    current_struct_for = nullptr;
-  }
-
-  void visit(WhileStmt *stmt) override {
-    stmt->body->accept(this);
-  }
-
-  void visit(OffloadedStmt *stmt) override {
-    if (stmt->body)
-      stmt->body->accept(this);
-  }
 };
 
 namespace irpass {
 
 void simplify(IRNode *root) {
-  while (1) {
-    Simplify pass(root);
-    if (!pass.modified)
-      break;
-  }
+  Simplify::run(root);
 }
 
 void full_simplify(IRNode *root) {
@@ -70,7 +70,7 @@ class TypeCheck : public IRVisitor {
           "stmt_id = {}) at",
           stmt->ptr->ret_data_type_name(), stmt->data->ret_data_type_name(),
           stmt->id);
-      fmt::print(stmt->tb);
+      fmt::print(stmt->tb.str());
       TC_WARN("Compilation stopped due to type mismatch.");
       exit(-1);
     }
@@ -172,7 +172,7 @@ class TypeCheck : public IRVisitor {
       } else {
         TC_WARN(comment + " at");
       }
-      fmt::print(stmt->tb);
+      fmt::print(stmt->tb.str());
       TC_WARN("Compilation stopped due to type mismatch.");
       exit(-1);
     };
@@ -260,13 +260,21 @@ class TypeCheck : public IRVisitor {
     stmt->ret_type = VectorType(1, DataType::i32);
   }
 
+  void visit(BlockLocalPtrStmt *stmt) {
+    stmt->ret_type = VectorType(1, stmt->snode->dt);
+  }
+
   void visit(GetChStmt *stmt) {
     stmt->ret_type = VectorType(1, stmt->output_snode->dt);
   }
 
   void visit(OffloadedStmt *stmt) {
+    if (stmt->prologue)
+      stmt->prologue->accept(this);
     if (stmt->body)
       stmt->body->accept(this);
+    if (stmt->epilogue)
+      stmt->epilogue->accept(this);
   }
 
   static void run(IRNode *node) {
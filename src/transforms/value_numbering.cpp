@@ -0,0 +1,241 @@
+// Global Value Numbering
+
+#include "../ir.h"
+#include "../snode.h"
+#include "../pass_manager.h"
+
+TLANG_NAMESPACE_BEGIN
+
+bool ValueKeyBuilder::build(Stmt *stmt) {
+  key.clear();
+  valid = false;
+  push((uint64)typeid(*stmt).hash_code());
+  push(stmt->ret_type.width);
+  push((uint64)stmt->ret_type.data_type);
+  push(stmt->is_ptr);
+  stmt->accept(this);
+  return valid;
+}
+
+void ValueKeyBuilder::visit(ConstStmt *stmt) {
+  for (int i = 0; i < stmt->width(); i++) {
+    auto &val = stmt->val[i];
+    if (val.dt == DataType::i32 || val.dt == DataType::f32) {
+      // only the lower 32 bits are initialized
+      push((uint64)(uint32)val.val_i32);
+    } else if (val.dt == DataType::i64 || val.dt == DataType::f64) {
+      push(val.value_bits);
+    } else {
+      return;
+    }
+  }
+  valid = true;
+}
+
+void ValueKeyBuilder::visit(UnaryOpStmt *stmt) {
+  push((uint64)stmt->op_type);
+  if (stmt->op_type == UnaryOpType::cast) {
+    push((uint64)stmt->cast_type);
+    push(stmt->cast_by_value);
+  }
+  push(stmt->operand);
+  valid = true;
+}
+
+static bool is_commutative(BinaryOpType op) {
+  return op == BinaryOpType::add || op == BinaryOpType::mul ||
+         op == BinaryOpType::max || op == BinaryOpType::min ||
+         binary_is_bitwise(op) || op == BinaryOpType::cmp_eq ||
+         op == BinaryOpType::cmp_ne;
+}
+
+void ValueKeyBuilder::visit(BinaryOpStmt *stmt) {
+  push((uint64)stmt->op_type);
+  auto lhs = stmt->lhs, rhs = stmt->rhs;
+  if (is_commutative(stmt->op_type) && rhs < lhs)
+    std::swap(lhs, rhs);
+  push(lhs);
+  push(rhs);
+  valid = true;
+}
+
+void ValueKeyBuilder::visit(TernaryOpStmt *stmt) {
+  push((uint64)stmt->op_type);
+  push(stmt->op1);
+  push(stmt->op2);
+  push(stmt->op3);
+  valid = true;
+}
+
+void ValueKeyBuilder::visit(ElementShuffleStmt *stmt) {
+  push(stmt->pointer);
+  for (int i = 0; i < stmt->width(); i++) {
+    push(stmt->elements[i].stmt);
+    push(stmt->elements[i].index);
+  }
+  valid = true;
+}
+
+void ValueKeyBuilder::visit(ArgLoadStmt *stmt) {
+  push(stmt->arg_id);
+  valid = true;
+}
+
+void ValueKeyBuilder::visit(LoopIndexStmt *stmt) {
+  push(stmt->index);
+  push(stmt->is_struct_for);
+  valid = true;
+}
+
+void ValueKeyBuilder::visit(GlobalPtrStmt *stmt) {
+  push(stmt->activate);
+  for (int i = 0; i < stmt->width(); i++)
+    push(stmt->snodes[i]);
+  for (auto index : stmt->indices)
+    push(index);
+  valid = true;
+}
+
+void ValueKeyBuilder::visit(IntegerOffsetStmt *stmt) {
+  push(stmt->input);
+  push((uint64)stmt->offset);
+  valid = true;
+}
+
+void ValueKeyBuilder::visit(LinearizeStmt *stmt) {
+  for (int i = 0; i < (int)stmt->inputs.size(); i++) {
+    push(stmt->inputs[i]);
+    push(stmt->strides[i]);
+  }
+  valid = true;
+}
+
+void ValueKeyBuilder::visit(OffsetAndExtractBitsStmt *stmt) {
+  push(stmt->input);
+  push(stmt->bit_begin);
+  push(stmt->bit_end);
+  push((uint64)stmt->offset);
+  valid = true;
+}
+
+// Repeated lookups with the same activation are idempotent: the first one
+// activates, the dominated ones would find the same (already active) child.
+void ValueKeyBuilder::visit(SNodeLookupStmt *stmt) {
+  push(stmt->snode);
+  push(stmt->input_snode);
+  push(stmt->input_index);
+  push(stmt->activate);
+  valid = true;
+}
+
+void ValueKeyBuilder::visit(GetChStmt *stmt) {
+  push(stmt->input_ptr);
+  push(stmt->chid);
+  valid = true;
+}
+
+// Dominator-scoped value numbering over the structured IR. A statement
+// dominates the statements after it in its block and everything nested in
+// them, so each block opens a scope on top of the enclosing ones. Unlike the
+// per-block search in simplify, this also merges e.g. the access lowering
+// chains recomputed in the branches or inner loops of a kernel.
+class ValueNumbering : public IRVisitor {
+ public:
+  Block *root;
+  UseDefChains chains;
+  ValueKeyBuilder key_builder;
+  std::vector<std::unordered_map<ValueKey, Stmt *, ValueKeyHash>> scopes;
+  // Scopes below this one belong to a different task
+  int visible_begin;
+
+  ValueNumbering(IRNode *node) : chains(node) {
+    allow_undefined_visitor = true;
+    invoke_default_visitor = false;
+    root = dynamic_cast<Block *>(node);
+    visible_begin = 0;
+  }
+
+  Stmt *lookup(const ValueKey &key) {
+    for (int i = (int)scopes.size() - 1; i >= visible_begin; i--) {
+      auto it = scopes[i].find(key);
+      if (it != scopes[i].end())
+        return it->second;
+    }
+    return nullptr;
+  }
+
+  void visit(Block *stmt_list) override {
+    scopes.emplace_back();
+    for (int i = 0; i < (int)stmt_list->statements.size();) {
+      auto stmt = stmt_list->statements[i].get();
+      if (key_builder.build(stmt)) {
+        if (auto existing = lookup(key_builder.key)) {
+          chains.replace_all_usages_with(stmt, existing);
+          chains.remove_user(stmt);
+          stmt_list->erase(i);
+          continue;
+        }
+        scopes.back()[key_builder.key] = stmt;
+      } else {
+        stmt->accept(this);
+      }
+      i++;
+    }
+    scopes.pop_back();
+  }
+
+  // Loops directly under the kernel root become separate tasks (see offload),
+  // which cannot reference values computed outside of them.
+  void visit_task_body(Block *body) {
+    auto backup = visible_begin;
+    visible_begin = (int)scopes.size();
+    body->accept(this);
+    visible_begin = backup;
+  }
+
+  void visit_loop_body(Stmt *loop, Block *body) {
+    if (loop->parent == root)
+      visit_task_body(body);
+    else
+      body->accept(this);
+  }
+
+  void visit(IfStmt *if_stmt) override {
+    if (if_stmt->true_statements)
+      if_stmt->true_statements->accept(this);
+    if (if_stmt->false_statements)
+      if_stmt->false_statements->accept(this);
+  }
+
+  void visit(WhileStmt *stmt) override {
+    stmt->body->accept(this);
+  }
+
+  void visit(RangeForStmt *for_stmt) override {
+    visit_loop_body(for_stmt, for_stmt->body.get());
+  }
+
+  void visit(StructForStmt *for_stmt) override {
+    visit_loop_body(for_stmt, for_stmt->body.get());
+  }
+
+  void visit(OffloadedStmt *stmt) override {
+    if (stmt->body)
+      visit_task_body(stmt->body.get());
+  }
+
+  static void run(IRNode *node) {
+    ValueNumbering pass(node);
+    node->accept(&pass);
+  }
+};
+
+namespace irpass {
+
+void global_value_numbering(IRNode *root) {
+  ValueNumbering::run(root);
+}
+
+}  // namespace irpass
+
+TLANG_NAMESPACE_END
@@ -10,11 +10,6 @@
 
 TLANG_NAMESPACE_BEGIN
 
-UnifiedAllocator *allocator_instance = nullptr;
-UnifiedAllocator *&allocator() {
-  return allocator_instance;
-}
-
 taichi::Tlang::UnifiedAllocator::UnifiedAllocator(std::size_t size, bool gpu)
     : size(size), gpu(gpu) {
   size += 4096;
@@ -62,8 +57,7 @@ taichi::Tlang::UnifiedAllocator::~UnifiedAllocator() {
   }
 }
 
-void taichi::Tlang::UnifiedAllocator::create() {
-  TC_ASSERT(allocator() == nullptr);
+UnifiedAllocator *taichi::Tlang::UnifiedAllocator::create() {
   void *dst;
   bool gpu = false;
 #if defined(CUDA_FOUND)
@@ -72,17 +66,16 @@ void taichi::Tlang::UnifiedAllocator::create() {
 #else
   dst = std::malloc(sizeof(UnifiedAllocator));
 #endif
-  allocator() = new (dst) UnifiedAllocator(1LL << 40, gpu);
+  return new (dst) UnifiedAllocator(1LL << 40, gpu);
 }
 
-void taichi::Tlang::UnifiedAllocator::free() {
-  (*allocator()).~UnifiedAllocator();
+void taichi::Tlang::UnifiedAllocator::free(UnifiedAllocator *allocator) {
+  allocator->~UnifiedAllocator();
 #if defined(CUDA_FOUND)
-  cudaFree(allocator());
+  cudaFree(allocator);
 #else
-  std::free(allocator());
+  std::free(allocator);
 #endif
-  allocator() = nullptr;
 }
 
 void taichi::Tlang::UnifiedAllocator::memset(unsigned char val) {
@@ -96,6 +89,8 @@ UnifiedAllocator::UnifiedAllocator() {
 
 TLANG_NAMESPACE_END
 
-extern "C" void *taichi_allocate_aligned(std::size_t size, int alignment) {
-  return taichi::Tlang::allocate(size, alignment);
+extern "C" void *taichi_allocate_aligned(void *allocator,
+                                         std::size_t size,
+                                         int alignment) {
+  return ((taichi::Tlang::UnifiedAllocator *)allocator)->alloc(size, alignment);
 }
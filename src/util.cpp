@@ -192,6 +192,7 @@ std::string binary_op_type_name(BinaryOpType type) {
     REGISTER_TYPE(cmp_ne);
     REGISTER_TYPE(cmp_eq);
     REGISTER_TYPE(atan2);
+    REGISTER_TYPE(pow);
 #undef REGISTER_TYPE
   }
   return type_names[type];
@@ -373,10 +374,17 @@ CompileConfig::CompileConfig() {
     gcc_version = 6;
   }
   lazy_compilation = true;
+  async_mode = true;
   serial_schedule = false;
   simplify_before_lower_access = true;
   lower_access = true;
   simplify_after_lower_access = true;
+  hoist_loop_invariants = true;
+  value_numbering = true;
+  demote_atomics = true;
+  random_seed = 0;
+  fast_math = false;
+  export_target_cpu = "generic";
   attempt_vectorized_load_cpu = true;
   gradient_dt = DataType::f32;
   enable_profiler = true;
@@ -36,7 +36,8 @@ real measure_cpe(std::function<void()> target,
 
 struct Context;
 
-using FunctionType = std::function<void(Context)>;
+// Compiled kernels take the context by reference to avoid copying it per launch
+using FunctionType = std::function<void(Context &)>;
 
 enum class DataType : int {
   f16,
@@ -160,6 +161,7 @@ enum class BinaryOpType : int {
   cmp_eq,
   cmp_ne,
   atan2,
+  pow,
   undefined
 };
 
@@ -324,6 +326,8 @@ struct CompileConfig {
   int gcc_version;
   bool internal_optimization;
   bool lazy_compilation;
+  // CPU kernels are launched into a queue and run asynchronously to the host
+  bool async_mode;
   bool force_vectorized_global_load;
   bool force_vectorized_global_store;
   int external_optimization_level;
@@ -333,6 +337,20 @@ struct CompileConfig {
   bool simplify_before_lower_access;
   bool lower_access;
   bool simplify_after_lower_access;
+  bool hoist_loop_invariants;
+  bool value_numbering;
+  // Only applies to the LLVM backends. The source backend still relies on
+  // mark_reduction().
+  bool demote_atomics;
+  // kernels launched in the same order produce the same random numbers
+  uint32 random_seed;
+  // vectorizable approximations of transcendental functions, and floating
+  // point optimizations that ignore NaNs, infinities and rounding. Off by
+  // default: sin, cos and tan are only accurate for |x| < 2^20.
+  bool fast_math;
+  // CPU that libraries exported by Program::export_library run on. "generic"
+  // runs on any CPU of the architecture, "native" is the host CPU.
+  std::string export_target_cpu;
   bool attempt_vectorized_load_cpu;
   bool use_llvm;
   bool print_struct_llvm_ir;
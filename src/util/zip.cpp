@@ -109,6 +109,117 @@ std::vector<uint8> read(const std::string fn, bool verbose) {
   return ret;
 }
 
+GzipWriter::GzipWriter(const std::string &fn, int level)
+    : crc(MZ_CRC32_INIT), size(0), buffer(1 << 20) {
+  file = std::fopen(fn.c_str(), "wb");
+  TC_ERROR_IF(file == nullptr, "Cannot open file [{}] for writing", fn);
+  auto s = new mz_stream;
+  std::memset(s, 0, sizeof(mz_stream));
+  // Raw deflate stream, wrapped in the gzip header and trailer
+  auto status = mz_deflateInit2(s, level, MZ_DEFLATED, -MZ_DEFAULT_WINDOW_BITS,
+                                9, MZ_DEFAULT_STRATEGY);
+  TC_ERROR_IF(status != MZ_OK, "mz_deflateInit2() failed!");
+  stream = s;
+  const uint8 header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+  TC_ERROR_IF(std::fwrite(header, 1, sizeof(header), file) != sizeof(header),
+              "Failed to write to file [{}]", fn);
+}
+
+void GzipWriter::write(const void *data, std::size_t len) {
+  auto s = (mz_stream *)stream;
+  auto p = reinterpret_cast<const uint8 *>(data);
+  crc = (uint32)mz_crc32(crc, p, len);
+  size += len;
+  while (len > 0) {
+    auto chunk = std::min(len, std::size_t(1) << 30);
+    s->next_in = p;
+    s->avail_in = (unsigned int)chunk;
+    TC_ERROR_IF(!write_compressed(MZ_NO_FLUSH), "Failed to write gzip file");
+    p += chunk;
+    len -= chunk;
+  }
+}
+
+bool GzipWriter::write_compressed(int flush) {
+  auto s = (mz_stream *)stream;
+  while (true) {
+    s->next_out = buffer.data();
+    s->avail_out = (unsigned int)buffer.size();
+    auto status = mz_deflate(s, flush);
+    if (status != MZ_OK && status != MZ_STREAM_END && status != MZ_BUF_ERROR)
+      return false;
+    auto out = buffer.size() - s->avail_out;
+    if (std::fwrite(buffer.data(), 1, out, file) != out)
+      return false;
+    if (flush == MZ_FINISH ? status == MZ_STREAM_END
+                           : s->avail_in == 0 && s->avail_out != 0)
+      return true;
+  }
+}
+
+bool GzipWriter::finish() {
+  if (file == nullptr)
+    return true;
+  bool ok = write_compressed(MZ_FINISH);
+  if (ok) {
+    // CRC32 and size modulo 2^32, little-endian
+    uint32 trailer[2] = {crc, (uint32)size};
+    ok = std::fwrite(trailer, 1, sizeof(trailer), file) == sizeof(trailer);
+  }
+  auto s = (mz_stream *)stream;
+  mz_deflateEnd(s);
+  delete s;
+  stream = nullptr;
+  ok = std::fclose(file) == 0 && ok;
+  file = nullptr;
+  return ok;
+}
+
+void GzipWriter::close() {
+  TC_ERROR_IF(!finish(), "Failed to write gzip file");
+}
+
+GzipWriter::~GzipWriter() {
+  // TC_ERROR aborts, so failures are only reported by an explicit close()
+  finish();
+}
+
+std::vector<uint8> read_gzip(const std::string &fn) {
+  auto data = read_data_from_file(fn);
+  TC_ERROR_IF(data.size() < 18 || data[0] != 0x1f || data[1] != 0x8b ||
+                  data[2] != 8,
+              "[{}] is not a gzip file", fn);
+  // skip the optional header fields
+  auto flags = data[3];
+  std::size_t begin = 10;
+  if (flags & 4)  // FEXTRA
+    begin += 2 + (data[begin] | (data[begin + 1] << 8));
+  for (int field : {8, 16}) {  // FNAME, FCOMMENT
+    if (flags & field) {
+      while (begin < data.size() && data[begin] != 0)
+        begin++;
+      begin++;
+    }
+  }
+  if (flags & 2)  // FHCRC
+    begin += 2;
+  TC_ERROR_IF(begin + 8 > data.size(), "[{}] is truncated", fn);
+
+  std::size_t len = 0;
+  auto p = tinfl_decompress_mem_to_heap(data.data() + begin,
+                                        data.size() - begin - 8, &len, 0);
+  TC_ERROR_IF(p == nullptr, "Failed to decompress [{}]", fn);
+  std::vector<uint8> ret((uint8 *)p, (uint8 *)p + len);
+  mz_free(p);
+
+  uint32 trailer[2];
+  std::memcpy(trailer, data.data() + data.size() - 8, sizeof(trailer));
+  TC_ERROR_IF(trailer[0] != (uint32)mz_crc32(MZ_CRC32_INIT, ret.data(), len) ||
+                  trailer[1] != (uint32)len,
+              "[{}] is corrupted", fn);
+  return ret;
+}
+
 }  // namespace zip
 
 TC_NAMESPACE_END
@@ -0,0 +1,70 @@
+// Voxelizing triangle meshes into fields
+
+#include <taichi/visual/voxelizer.h>
+#include "program.h"
+#include "voxelize.h"
+
+TLANG_NAMESPACE_BEGIN
+
+namespace {
+
+template <typename T>
+void write(Program &prog,
+           SNode *snode,
+           const std::vector<std::vector<Vector3i>> &cells,
+           float64 value) {
+  for (auto &slice : cells) {
+    for (auto &cell : slice) {
+      int ind[max_num_indices] = {0};
+      for (int d = 0; d < 3; d++) {
+        ind[snode->physical_index_position[d]] = cell[d];
+      }
+      // evaluate activates the ancestors of the cell
+      auto ptr = snode->evaluate(prog.data_structure, ind[0], ind[1], ind[2],
+                                 ind[3]);
+      *(T *)ptr = (T)value;
+    }
+  }
+}
+
+}  // namespace
+
+int64 voxelize(Program &prog,
+               SNode *snode,
+               const Voxelizer &voxelizer,
+               const Vector3i &res,
+               float64 value,
+               const Vector3 &storage_offset) {
+  TC_ERROR_UNLESS(snode->type == SNodeType::place,
+                  "Voxelization target {} is not a place SNode", snode->name);
+  TC_ERROR_UNLESS(snode->num_active_indices == 3,
+                  "Voxelization target {} must have exactly three indices",
+                  snode->name);
+  // The scanlines run in parallel; activation of sparse blocks is not
+  // thread-safe, so the cells are collected per x slice (each filled by a
+  // single thread) and written serially.
+  prog.synchronize();
+  std::vector<std::vector<Vector3i>> cells(res[0]);
+  voxelizer.for_each_inside(res, storage_offset, [&](int i, int j, int k) {
+    cells[i].push_back(Vector3i(i, j, k));
+  });
+  int64 count = 0;
+  for (auto &slice : cells) {
+    count += (int64)slice.size();
+  }
+  if (snode->dt == DataType::f32) {
+    write<float32>(prog, snode, cells, value);
+  } else if (snode->dt == DataType::f64) {
+    write<float64>(prog, snode, cells, value);
+  } else if (snode->dt == DataType::i32) {
+    write<int32>(prog, snode, cells, value);
+  } else if (snode->dt == DataType::i64) {
+    write<int64>(prog, snode, cells, value);
+  } else {
+    TC_ERROR("Voxelization target {} has unsupported data type {}",
+             snode->name, data_type_name(snode->dt));
+  }
+  return count;
+}
+
+TLANG_NAMESPACE_END
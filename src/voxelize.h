@@ -0,0 +1,23 @@
+// Voxelizing triangle meshes into fields
+
+#pragma once
+
+#include <taichi/visual/voxelizer.h>
+#include "snode.h"
+
+TLANG_NAMESPACE_BEGIN
+
+class Program;
+
+// Sets the cells of a 3D place SNode inside the mesh to value, for a grid of
+// resolution res with samples at (i, j, k) + storage_offset. Only the cells
+// inside are written, so in sparse data structures only the blocks they touch
+// are activated. Returns the number of cells written.
+int64 voxelize(Program &prog,
+               SNode *snode,
+               const Voxelizer &voxelizer,
+               const Vector3i &res,
+               float64 value = 1,
+               const Vector3 &storage_offset = Vector3(0.5_f));
+
+TLANG_NAMESPACE_END
@@ -0,0 +1,51 @@
+#include <dlfcn.h>
+#include <taichi/testing.h>
+#include <taichi/lang.h>
+
+TLANG_NAMESPACE_BEGIN
+
+TC_TEST("export_library") {
+  int n = 128;
+  std::string prefix = "export_library_test";
+  {
+    Program prog(Arch::x86_64);
+    NamedScalar(x, x, i32);
+    NamedScalar(total, total, i32);
+    layout([&] {
+      root.dense(Index(0), n).place(x);
+      root.place(total);
+    });
+
+    Kernel(fill).def([&] {
+      auto s = get_current_program().get_current_kernel().insert_arg(
+          DataType::i32, false);
+      For(0, n, [&](Expr i) { x[i] = i * Expr::make<ArgLoadExpression>(s); });
+    });
+    Kernel(reduce).def(
+        [&] { For(x, [&](Expr i) { Atomic(total) += x[i]; }); });
+    prog.export_library(prefix, {&fill, &reduce});
+  }
+
+  // The library works without the program that produced it
+  auto dll = dlopen(("./" + prefix + ".so").c_str(), RTLD_NOW);
+  TC_CHECK(dll != nullptr);
+  auto create = (void *(*)())dlsym(dll, "create_data_structure");
+  auto destroy = (void (*)(void *))dlsym(dll, "destroy_data_structure");
+  auto fill = (void (*)(void *, int32))dlsym(dll, "fill");
+  auto reduce = (void (*)(void *))dlsym(dll, "reduce");
+  auto access_x = (int32 * (*)(void *, int)) dlsym(dll, "access_x");
+  auto access_total = (int32 * (*)(void *)) dlsym(dll, "access_total");
+  TC_CHECK(create && destroy && fill && reduce && access_x && access_total);
+
+  auto ds = create();
+  fill(ds, 3);
+  reduce(ds);
+  for (int i = 0; i < n; i++) {
+    TC_CHECK(*access_x(ds, i) == i * 3);
+  }
+  TC_CHECK(*access_total(ds) == n * (n - 1) / 2 * 3);
+  destroy(ds);
+  dlclose(dll);
+};
+
+TLANG_NAMESPACE_END
@@ -1,9 +1,34 @@
 #include <taichi/lang.h>
 #include <taichi/testing.h>
 #include <numeric>
+#include "../../src/pass_manager.h"
 
 TLANG_NAMESPACE_BEGIN
 
+namespace {
+
+int count_atomics(Block *block) {
+  if (block == nullptr)
+    return 0;
+  auto stmts = gather_statements(block);
+  return (int)std::count_if(stmts.begin(), stmts.end(),
+                            [](Stmt *s) { return s->is<AtomicOpStmt>(); });
+}
+
+// The offloaded task of kernel k with the given type
+OffloadedStmt *find_task(Kernel &k, OffloadedStmt::TaskType type) {
+  auto root = dynamic_cast<Block *>(k.ir);
+  TC_ASSERT(root);
+  for (auto &s : root->statements) {
+    auto task = s->cast<OffloadedStmt>();
+    if (task && task->task_type == type)
+      return task;
+  }
+  return nullptr;
+}
+
+}  // namespace
+
 TC_TEST("atomics") {
   CoreState::set_trigger_gdb_when_crash(true);
   int n = 10000000;
@@ -73,4 +98,69 @@ TC_TEST("parallel_reduce") {
   TC_CHECK(fsum.val<int32>() == (n / 2) * (n - 1) * 10);
 };
 
+TC_TEST("demote_atomics") {
+  CoreState::set_trigger_gdb_when_crash(true);
+  int n = 1024 * 64;
+  // The pass, and atomic min/max, are only supported by the LLVM backend
+  auto use_llvm = default_compile_config.use_llvm;
+  default_compile_config.use_llvm = true;
+  Program prog(Arch::x86_64);
+  default_compile_config.use_llvm = use_llvm;
+
+  Global(a, i32);
+  Global(sum, i32);
+  Global(count, i32);
+  Global(fmax, f32);
+  Global(fmin, f32);
+  layout([&]() {
+    root.dense(Index(0), n / 1024).dense(Index(0), 1024).place(a);
+    root.place(sum, count, fmax, fmin);
+  });
+
+  int64 expected_sum = 0;
+  for (int i = 0; i < n; i++) {
+    a.val<int32>(i) = i;
+    expected_sum += i % 7;
+  }
+
+  Kernel(reduce).def([&]() {
+    For(a, [&](Expr i) {
+      Atomic(sum[Expr(0)]) += a[i] % 7;
+      AtomicMax(fmax[Expr(0)], cast<float32>(a[i] - n / 2));
+      AtomicMin(fmin[Expr(0)], cast<float32>(a[i] - n / 2));
+    });
+  });
+
+  // count is also read in the loop, which rules out the demotion
+  Kernel(count_odd).def([&]() {
+    For(0, n, [&](Expr i) {
+      If(count[Expr(0)] >= 0).Then([&] { Atomic(count[Expr(0)]) += i % 2; });
+    });
+  });
+
+  reduce();
+  count_odd();
+
+  TC_CHECK(sum.val<int32>() == expected_sum);
+  TC_CHECK(fmax.val<float32>() == n / 2 - 1);
+  TC_CHECK(fmin.val<float32>() == -n / 2);
+  TC_CHECK(count.val<int32>() == n / 2);
+
+  // the three atomics of reduce are applied once per thread, in the epilogue
+  auto task = find_task(reduce, OffloadedStmt::struct_for);
+  TC_CHECK(task != nullptr);
+  if (task) {
+    TC_CHECK(task->prologue != nullptr);
+    TC_CHECK(count_atomics(task->body.get()) == 0);
+    TC_CHECK(count_atomics(task->epilogue.get()) == 3);
+  }
+  // and the one of count_odd is left in the loop body
+  task = find_task(count_odd, OffloadedStmt::range_for);
+  TC_CHECK(task != nullptr);
+  if (task) {
+    TC_CHECK(count_atomics(task->body.get()) == 1);
+    TC_CHECK(count_atomics(task->epilogue.get()) == 0);
+  }
+};
+
 TLANG_NAMESPACE_END
@@ -1,6 +1,8 @@
 #include <taichi/lang.h>
 #include <taichi/testing.h>
+#include <future>
 #include <numeric>
+#include <thread>
 #include <taichi/visual/gui.h>
 
 TLANG_NAMESPACE_BEGIN
@@ -257,6 +259,134 @@ TC_TEST("rand") {
   kernel([&]() { For(0, n, [&](Expr i) { Print(Rand<float>()); }); })();
 };
 
+TC_TEST("rand_reproducible") {
+  CoreState::set_trigger_gdb_when_crash(true);
+  int n = 1024;
+
+  auto sample = [&](uint32 seed) {
+    std::vector<float32> ret;
+    Program prog(Arch::x86_64);
+    prog.config.random_seed = seed;
+
+    Global(a, f32);
+    Global(b, f32);
+    layout([&]() { root.dense(Index(0), n).place(a, b); });
+
+    kernel([&]() {
+      For(0, n, [&](Expr i) {
+        a[i] = Rand<float32>();
+        b[i] = Rand<float32>();
+      });
+    })();
+
+    for (int i = 0; i < n; i++) {
+      ret.push_back(a.val<float32>(i));
+      ret.push_back(b.val<float32>(i));
+    }
+    return ret;
+  };
+
+  auto x = sample(1);
+  TC_CHECK(x == sample(1));
+  TC_CHECK(x != sample(2));
+
+  float64 sum = 0;
+  int num_repeated = 0;
+  for (int i = 0; i < n; i++) {
+    TC_CHECK(0 <= x[2 * i]);
+    TC_CHECK(x[2 * i] < 1);
+    sum += x[2 * i] + x[2 * i + 1];
+    num_repeated += x[2 * i] == x[2 * i + 1];
+  }
+  TC_CHECK(std::abs(sum / (2 * n) - 0.5) < 0.05);
+  TC_CHECK(num_repeated == 0);
+};
+
+TC_TEST("fast_math") {
+  CoreState::set_trigger_gdb_when_crash(true);
+  int n = 256;
+  for (auto fast_math : {false, true}) {
+    // the vector math library is only used by the LLVM backend
+    auto use_llvm = default_compile_config.use_llvm;
+    default_compile_config.use_llvm = true;
+    Program prog(Arch::x86_64);
+    default_compile_config.use_llvm = use_llvm;
+    prog.config.fast_math = fast_math;
+
+    Global(x, f32);
+    Global(x64, f64);
+    Vector r(DataType::f32, 8);
+    Vector r64(DataType::f64, 8);
+    layout([&]() {
+      auto &fork = root.dense(0, n);
+      fork.place(x, x64);
+      for (int k = 0; k < 8; k++)
+        fork.place(r(k), r64(k));
+    });
+
+    auto arg = [](int i) { return 0.05f + i * 0.037f; };
+    auto arg64 = [](int i) { return 0.05 + i * 0.037; };
+    for (int i = 0; i < n; i++) {
+      x.val<float32>(i) = arg(i);
+      x64.val<float64>(i) = arg64(i);
+    }
+
+    kernel([&]() {
+      For(0, n, [&](Expr i) {
+        auto v = Var(x[i]);
+        auto w = Var(v * 0.3f - 1.5f);
+        r(0)[i] = exp(v);
+        r(1)[i] = log(v);
+        r(2)[i] = sin(v * 37.0f);
+        r(3)[i] = cos(v * 37.0f);
+        r(4)[i] = tan(v);
+        r(5)[i] = tanh(v - 5.0f);
+        r(6)[i] = atan2(w, v - 5.0f);
+        r(7)[i] = pow(v, w);
+
+        auto v64 = Var(x64[i]);
+        auto w64 = Var(v64 * 0.3 - 1.5);
+        r64(0)[i] = exp(v64);
+        r64(1)[i] = log(v64);
+        r64(2)[i] = sin(v64 * 37.0);
+        r64(3)[i] = cos(v64 * 37.0);
+        r64(4)[i] = tan(v64);
+        r64(5)[i] = tanh(v64 - 5.0);
+        r64(6)[i] = atan2(w64, v64 - 5.0);
+        r64(7)[i] = pow(v64, w64);
+      });
+    })();
+
+    for (int i = 0; i < n; i++) {
+      float32 v = arg(i), w = v * 0.3f - 1.5f;
+      float64 expected[8] = {std::exp(v),           std::log(v),
+                             std::sin(v * 37.0f),   std::cos(v * 37.0f),
+                             std::tan(v),           std::tanh(v - 5.0f),
+                             std::atan2(w, v - 5.0f), std::pow(v, w)};
+      for (int k = 0; k < 8; k++) {
+        auto ref = (float32)expected[k];
+        auto ulp = std::nextafter(std::abs(ref), 1e30f) - std::abs(ref);
+        TC_CHECK(std::abs(r(k).val<float32>(i) - expected[k]) <= 4 * ulp);
+      }
+
+      float64 v64 = arg64(i), w64 = v64 * 0.3 - 1.5;
+      float64 expected64[8] = {std::exp(v64),
+                               std::log(v64),
+                               std::sin(v64 * 37.0),
+                               std::cos(v64 * 37.0),
+                               std::tan(v64),
+                               std::tanh(v64 - 5.0),
+                               std::atan2(w64, v64 - 5.0),
+                               std::pow(v64, w64)};
+      for (int k = 0; k < 8; k++) {
+        auto ref = expected64[k];
+        auto ulp = std::nextafter(std::abs(ref), 1e300) - std::abs(ref);
+        TC_CHECK(std::abs(r64(k).val<float64>(i) - ref) <= 16 * ulp);
+      }
+    }
+  }
+};
+
 TC_TEST("while") {
   CoreState::set_trigger_gdb_when_crash(true);
   int n = 4096;
@@ -844,4 +974,158 @@ TC_TEST("cmp") {
   }
 };
 
+TC_TEST("multiple_programs") {
+  CoreState::set_trigger_gdb_when_crash(true);
+  int n = 128;
+
+  // each thread runs its own program
+  auto simulate = [&](int seed, std::vector<int> &result) {
+    Program prog(Arch::x86_64);
+
+    Global(a, i32);
+    layout([&]() { root.dense(Index(0), n).place(a); });
+
+    kernel([&]() { For(0, n, [&](Expr i) { a[i] = i * seed; }); })();
+
+    result.resize(n);
+    for (int i = 0; i < n; i++) {
+      result[i] = a.val<int32>(i);
+    }
+  };
+
+  int num_threads = 4;
+  std::vector<std::vector<int>> results(num_threads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back(simulate, t + 1, std::ref(results[t]));
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (int t = 0; t < num_threads; t++) {
+    for (int i = 0; i < n; i++) {
+      TC_CHECK(results[t][i] == i * (t + 1));
+    }
+  }
+
+  // two programs alive on the same thread
+  Program prog1(Arch::x86_64);
+  Global(a, i32);
+  prog1.layout([&]() { root.dense(Index(0), n).place(a); });
+
+  Program prog2(Arch::x86_64);
+  Global(b, i32);
+  prog2.layout([&]() { root.dense(Index(0), n).place(b); });
+  // each program allocates its data structure from its own allocator
+  TC_CHECK(prog1.unified_allocator != prog2.unified_allocator);
+
+  prog1.kernel([&]() { For(0, n, [&](Expr i) { a[i] = i + 1; }); })();
+  prog2.kernel([&]() { For(0, n, [&](Expr i) { b[i] = i + 2; }); })();
+
+  // accessors read from the program owning the field
+  for (int i = 0; i < n; i++) {
+    TC_CHECK(a.val<int32>(i) == i + 1);
+    TC_CHECK(b.val<int32>(i) == i + 2);
+  }
+};
+
+TC_TEST("batched_program") {
+  CoreState::set_trigger_gdb_when_crash(true);
+  int n = 64;
+  int batch_size = 5;
+
+  Program prog(Arch::x86_64);
+  prog.batch_size = batch_size;
+
+  Global(a, i32);
+  Global(sum, i32);
+  layout([&]() {
+    root.dense(Index(0), n).place(a);
+    root.place(sum);
+  });
+
+  int scale;
+  auto &fill = kernel([&]() {
+    scale = get_current_program().get_current_kernel().insert_batched_arg(
+        DataType::i32);
+    For(0, n, [&](Expr i) { a[i] = i * BatchedArg(scale); });
+  });
+  for (int b = 0; b < batch_size; b++) {
+    fill.set_batched_arg_int(scale, b, b + 1);
+  }
+  fill();
+
+  kernel([&]() { For(a, [&](Expr i) { Atomic(sum) += a[i]; }); })();
+
+  for (int b = 0; b < batch_size; b++) {
+    for (int i = 0; i < n; i++) {
+      TC_CHECK(a.val<int32>(b, i) == i * (b + 1));
+    }
+    TC_CHECK(sum.val<int32>(b) == n * (n - 1) / 2 * (b + 1));
+  }
+
+  // struct-fors skip the instances padding batch_size to a power of two
+  kernel([&]() { For(a, [&](Expr i) { a[i] = a[i] + 1; }); })();
+  for (int b = 0; b < prog.batch_capacity(); b++) {
+    for (int i = 0; i < n; i++) {
+      TC_CHECK(a.val<int32>(b, i) == (b < batch_size ? i * (b + 1) + 1 : 0));
+    }
+  }
+};
+
+TC_TEST("async_launch") {
+  CoreState::set_trigger_gdb_when_crash(true);
+  int n = 1024;
+
+  Program prog(Arch::x86_64);
+  TC_CHECK(prog.config.async_mode);
+
+  Global(a, i32);
+  layout([&]() { root.dense(Index(0), n).place(a); });
+
+  int inc;
+  auto &add = kernel([&]() {
+    inc = get_current_program().get_current_kernel().insert_arg(DataType::i32,
+                                                                false);
+    For(0, n, [&](Expr i) {
+      a[i] = a[i] + Expr::make<ArgLoadExpression>(inc);
+    });
+  });
+  // arguments are captured at launch, so that the host may set the next
+  // ones while the queue is still busy
+  int expected = 0;
+  for (int k = 1; k <= 100; k++) {
+    add.set_arg_int(inc, k);
+    add();
+    expected += k;
+  }
+  // the accessor waits for the queue to drain
+  for (int i = 0; i < n; i++) {
+    TC_CHECK(a.val<int32>(i) == expected);
+  }
+};
+
+TC_TEST("launch_queue_error") {
+  LaunchQueue queue;
+  std::vector<int> done;
+  // hold the worker until all three launches are queued
+  std::promise<void> queued;
+  auto ready = queued.get_future();
+  queue.launch([&] {
+    ready.wait();
+    done.push_back(1);
+  });
+  queue.launch([&] { throw std::runtime_error("launch failed"); });
+  queue.launch([&] { done.push_back(3); });
+  queued.set_value();
+  // the launches after the failed one are discarded
+  CHECK_THROWS_AS(queue.synchronize(), std::runtime_error);
+  TC_CHECK(done == std::vector<int>{1});
+  // the error is reported once, and the queue can be used again
+  queue.synchronize();
+  queue.launch([&] { done.push_back(4); });
+  queue.synchronize();
+  TC_CHECK((done == std::vector<int>{1, 4}));
+};
+
 TLANG_NAMESPACE_END
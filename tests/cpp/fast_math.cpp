@@ -0,0 +1,117 @@
+#include <taichi/lang.h>
+#include <taichi/testing.h>
+#include <limits>
+#if defined(TLANG_WITH_LLVM)
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include "../../src/backends/llvm_jit.h"
+#endif
+
+TLANG_NAMESPACE_BEGIN
+
+#if defined(TLANG_WITH_LLVM)
+
+// for (int i = 0; i < n; i++) out[i] = fast_pow(x[i], y[i]), in a module
+// prepared like a kernel module
+template <typename T>
+std::unique_ptr<llvm::Module> pow_loop_module(TaichiLLVMContext *tlctx,
+                                              const std::string &name) {
+  auto &ctx = *tlctx->ctx;
+  auto module = tlctx->clone_runtime_module();
+  for (auto &f : *module) {
+    if (!f.isDeclaration())
+      f.setLinkage(llvm::Function::PrivateLinkage);
+  }
+  auto real = tlctx->get_data_type<T>();
+  auto ptr = llvm::PointerType::get(real, 0);
+  auto i32_ty = llvm::Type::getInt32Ty(ctx);
+  auto func_type = llvm::FunctionType::get(llvm::Type::getVoidTy(ctx),
+                                           {ptr, ptr, ptr, i32_ty}, false);
+  auto func = llvm::Function::Create(
+      func_type, llvm::Function::ExternalLinkage, name, module.get());
+  auto args = func->arg_begin();
+  llvm::Value *x = &*args++, *y = &*args++, *out = &*args++, *n = &*args;
+  auto pow = module->getFunction(
+      fmt::format("fast_pow_{}", data_type_short_name(get_data_type<T>())));
+  TC_ASSERT(pow);
+
+  auto entry = llvm::BasicBlock::Create(ctx, "entry", func);
+  auto loop = llvm::BasicBlock::Create(ctx, "loop", func);
+  auto exit = llvm::BasicBlock::Create(ctx, "exit", func);
+  llvm::IRBuilder<> builder(entry);
+  auto zero = llvm::ConstantInt::get(i32_ty, 0);
+  builder.CreateCondBr(builder.CreateICmpSGT(n, zero), loop, exit);
+
+  builder.SetInsertPoint(loop);
+  auto i = builder.CreatePHI(i32_ty, 2);
+  i->addIncoming(zero, entry);
+  llvm::Value *x_i = builder.CreateLoad(real, builder.CreateGEP(real, x, i));
+  llvm::Value *y_i = builder.CreateLoad(real, builder.CreateGEP(real, y, i));
+  auto ret = builder.CreateCall(pow, {x_i, y_i});
+  builder.CreateStore(ret, builder.CreateGEP(real, out, i));
+  auto next = builder.CreateNSWAdd(i, llvm::ConstantInt::get(i32_ty, 1));
+  i->addIncoming(next, loop);
+  builder.CreateCondBr(builder.CreateICmpSLT(next, n), loop, exit);
+
+  builder.SetInsertPoint(exit);
+  builder.CreateRetVoid();
+  TC_ASSERT(!llvm::verifyFunction(*func, &llvm::errs()));
+  return module;
+}
+
+template <typename T>
+void test_pow_loop(TaichiLLVMContext *tlctx, int width) {
+  auto type_name = data_type_short_name(get_data_type<T>());
+  auto name = fmt::format("fast_math_pow_loop_{}", type_name);
+  auto module = pow_loop_module<T>(tlctx, name);
+  global_optimize_module_x86_64(module, true);
+
+  // The vector variant is kept for the loop vectorizer
+  auto vector_fn = fmt::format("fast_pow_{}_x{}", type_name, width);
+  TC_CHECK(module->getFunction(vector_fn) != nullptr);
+  // The loop is vectorized: either the vector variant is called, or the
+  // scalar function was inlined and widened
+  bool vectorized = false;
+  for (auto &bb : *module->getFunction(name)) {
+    for (auto &inst : bb) {
+      if (auto call = llvm::dyn_cast<llvm::CallInst>(&inst)) {
+        auto callee = call->getCalledFunction();
+        vectorized |= callee && callee->getName() == vector_fn;
+      }
+      auto type = inst.getType();
+      vectorized |=
+          type->isVectorTy() && type->getScalarType()->isFloatingPointTy();
+    }
+  }
+  TC_CHECK(vectorized);
+
+  tlctx->jit->addModule(std::move(module), true);
+  auto pow_loop =
+      (void (*)(T *, T *, T *, int))jit_lookup_name(tlctx->jit.get(), name);
+  // Not a multiple of the vector width, for the scalar remainder
+  int n = 1003;
+  std::vector<T> x(n), y(n), out(n);
+  for (int i = 0; i < n; i++) {
+    x[i] = T(0.5) + T(1.5) * i / n;
+    y[i] = T(-2) + T(4) * i / n;
+  }
+  pow_loop(x.data(), y.data(), out.data(), n);
+  for (int i = 0; i < n; i++) {
+    T expected = std::pow(x[i], y[i]);
+    TC_CHECK(std::abs(out[i] - expected) <=
+             8 * std::numeric_limits<T>::epsilon() * std::abs(expected));
+  }
+}
+
+TC_TEST("fast_math_vectorize") {
+  CoreState::set_trigger_gdb_when_crash(true);
+  // needs no program, whatever its backend
+  TaichiLLVMContext tlctx(Arch::x86_64);
+  test_pow_loop<float32>(&tlctx, 4);
+  test_pow_loop<float64>(&tlctx, 2);
+};
+
+#endif
+
+TLANG_NAMESPACE_END
@@ -0,0 +1,78 @@
+#include <taichi/util.h>
+#include <taichi/testing.h>
+#include <taichi/visualization/image_buffer.h>
+#include <fstream>
+#include <thread>
+
+TC_NAMESPACE_BEGIN
+
+TC_TEST("async_frame_writer") {
+  Vector2i res(64, 32);
+  {
+    AsyncFrameWriter writer(2, 4, false);
+    for (int i = 0; i < 8; i++) {
+      TC_CHECK(writer.write(fmt::format("frame_writer_test_{}.png", i),
+                            Array2D<Vector3>(res, Vector3(i / 8.0_f))));
+    }
+    writer.wait();
+    TC_CHECK(writer.get_num_dropped() == 0);
+    for (int i = 0; i < 8; i++) {
+      auto fn = fmt::format("frame_writer_test_{}.png", i);
+      TC_CHECK(read_data_from_file(fn).size() > 0);
+      std::remove(fn.c_str());
+    }
+
+    // Failures on the writer threads are reported by the next call
+    writer.write("frame_writer_missing_dir/0.png",
+                 Array2D<Vector3>(res, Vector3(0.0_f)));
+    CHECK_THROWS_AS(writer.wait(), std::runtime_error);
+    writer.wait();
+    writer.close();
+  }
+}
+
+#if !defined(_WIN32)
+TC_TEST("async_frame_writer_drop") {
+  // The reader only starts once the file "go" exists, and a frame is larger
+  // than the pipe buffer, so the writer thread blocks on the first frame
+  std::string go = "frame_writer_test.go";
+  std::remove(go.c_str());
+  Vector2i res(512, 512);
+  std::size_t frame_size = res[0] * res[1] * 3;
+  AsyncFrameWriter writer(
+      fmt::format("while [ ! -e {} ]; do sleep 0.01; done; "
+                  "cat > frame_writer_test.raw",
+                  go),
+      1, true);
+  TC_CHECK(writer.write("", Array2D<Vector3>(res, Vector3(0.0_f))));
+  // Wait for the writer thread to take the first frame off the queue
+  while (writer.get_num_pending() != 0) {
+    std::this_thread::yield();
+  }
+  TC_CHECK(writer.write("", Array2D<Vector3>(res, Vector3(1.0_f))));
+  // The queue is full
+  TC_CHECK(!writer.write("", Array2D<Vector3>(res, Vector3(0.5_f))));
+  std::ofstream(go).close();
+  writer.close();
+  TC_CHECK(writer.get_num_dropped() == 1);
+
+  auto data = read_data_from_file("frame_writer_test.raw");
+  TC_CHECK(data.size() == frame_size * 2);
+  if (data.size() == frame_size * 2) {
+    TC_CHECK(data[0] == 0);
+    TC_CHECK(data[frame_size - 1] == 0);
+    TC_CHECK(data[frame_size] == 255);
+    TC_CHECK(data[frame_size * 2 - 1] == 255);
+  }
+  std::remove("frame_writer_test.raw");
+  std::remove(go.c_str());
+}
+
+TC_TEST("async_frame_writer_encoder_failure") {
+  AsyncFrameWriter writer("cat > /dev/null; exit 3", 1, false);
+  TC_CHECK(writer.write("", Array2D<Vector3>(Vector2i(8, 8), Vector3(0.0_f))));
+  CHECK_THROWS_AS(writer.close(), std::runtime_error);
+}
+#endif
+
+TC_NAMESPACE_END
@@ -0,0 +1,63 @@
+#include <taichi/testing.h>
+#include <taichi/visual/gui.h>
+#include <limits>
+
+TC_NAMESPACE_BEGIN
+
+TC_TEST("image_view_to_bgra8") {
+  TC_CHECK(color_to_uint8(0.5f) == 127);
+  TC_CHECK(color_to_uint8(1.0f) == 255);
+  TC_CHECK(color_to_uint8(-1.0f) == 0);
+  TC_CHECK(color_to_uint8(1e10f) == 255);
+  TC_CHECK(color_to_uint8(std::numeric_limits<float32>::quiet_NaN()) == 0);
+  TC_CHECK(color_to_uint8(std::numeric_limits<float32>::infinity()) == 255);
+
+  // Column-major RGBA with extra rows and columns, and values out of range
+  int n = 7, m = 10, width = 5, height = 9;
+  std::vector<float32> special = {std::numeric_limits<float32>::quiet_NaN(),
+                                  -std::numeric_limits<float32>::infinity(),
+                                  std::numeric_limits<float32>::infinity(),
+                                  -1e20f, 1e20f, 3e9f, -0.5f, 1.5f};
+  std::vector<float32> data(n * m * 4);
+  for (int k = 0; k < (int)data.size(); k++) {
+    data[k] = k % 3 == 0 ? special[k / 3 % special.size()]
+                         : (k * 37 % 256) / 255.0f;
+  }
+  ImageView view;
+  view.data = data.data();
+  view.width = n;
+  view.height = m;
+  view.stride_i = 4 * m;
+  view.stride_j = 4;
+  view.num_channels = 4;
+
+  auto check = [&](const ImageView &view) {
+    std::vector<uint32> out(width * height);
+    view.to_bgra8(width, height, out.data());
+    int mismatches = 0;
+    for (int j = 0; j < height; j++) {
+      for (int i = 0; i < width; i++) {
+        auto c = view.pixel(i, height - 1 - j);
+        auto p = reinterpret_cast<uint8 *>(&out[j * width + i]);
+        mismatches += p[0] != color_to_uint8(c[2]) ||
+                      p[1] != color_to_uint8(c[1]) ||
+                      p[2] != color_to_uint8(c[0]) ||
+                      p[3] != color_to_uint8(c[3]);
+      }
+    }
+    TC_CHECK(mismatches == 0);
+  };
+  check(view);
+
+  // Gray, read through the strided path
+  view.num_channels = 1;
+  check(view);
+  // RGB with planar channels
+  view.num_channels = 3;
+  view.stride_i = m;
+  view.stride_j = 1;
+  view.stride_c = n * m;
+  check(view);
+}
+
+TC_NAMESPACE_END
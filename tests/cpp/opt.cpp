@@ -1,9 +1,16 @@
 #include <taichi/lang.h>
 #include <taichi/testing.h>
 #include <numeric>
+#include "../../src/pass_manager.h"
 
 TLANG_NAMESPACE_BEGIN
 
+// Number of statements in the compiled IR of k for which pred holds
+int count_statements(Kernel &k, const std::function<bool(Stmt *)> &pred) {
+  auto stmts = gather_statements(k.ir);
+  return (int)std::count_if(stmts.begin(), stmts.end(), pred);
+}
+
 TC_TEST("access_simp") {
   CoreState::set_trigger_gdb_when_crash(true);
   int n = 16;
@@ -55,4 +62,137 @@ TC_TEST("root_leaf_path_weakening") {
   })();
 };
 
+TC_TEST("simplify_redundant_arithmetic") {
+  CoreState::set_trigger_gdb_when_crash(true);
+  int n = 16;
+  Program prog(Arch::x86_64);
+
+  Global(a, i32);
+
+  layout([&]() { root.dense(Index(0), n).place(a); });
+
+  auto &func = kernel([&]() {
+    For(0, n, [&](Expr i) {
+      auto sum = Var(0);
+      for (int k = 0; k < 64; k++) {
+        // duplicated subexpressions are merged by simplify
+        sum = sum + (i * 2 + k) - (i * 2 + k) + 1;
+      }
+      a[i] = sum;
+    });
+  });
+  func();
+
+  for (int i = 0; i < n; i++) {
+    TC_CHECK(a.val<int32>(i) == 64);
+  }
+  // the 128 copies of i * 2 are merged into one
+  TC_CHECK(count_statements(func, [](Stmt *s) {
+             auto bin = s->cast<BinaryOpStmt>();
+             return bin && bin->op_type == BinaryOpType::mul;
+           }) == 1);
+};
+
+TC_TEST("simplify_if_to_select") {
+  CoreState::set_trigger_gdb_when_crash(true);
+  int n = 16;
+  Program prog(Arch::x86_64);
+
+  Global(a, i32);
+
+  layout([&]() { root.dense(Index(0), n).place(a); });
+
+  auto &func = kernel([&]() {
+    For(0, n, [&](Expr i) {
+      auto ret = Var(0);
+      for (int k = 0; k < 16; k++) {
+        // local stores only: each if becomes a select
+        If(i % 2 == 0)
+            .Then([&] { ret = ret + k; })
+            .Else([&] { ret = ret - 1; });
+      }
+      a[i] = ret;
+    });
+  });
+  func();
+
+  for (int i = 0; i < n; i++) {
+    TC_CHECK(a.val<int32>(i) == (i % 2 == 0 ? 120 : -16));
+  }
+  TC_CHECK(count_statements(func, [](Stmt *s) {
+             return s->is<IfStmt>();
+           }) == 0);
+};
+
+TC_TEST("loop_invariant_code_motion") {
+  CoreState::set_trigger_gdb_when_crash(true);
+  int n = 16;
+  Program prog(Arch::x86_64);
+
+  Global(a, i32);
+  Global(b, i32);
+
+  layout([&]() {
+    root.dense(Index(0), n).place(a);
+    root.dense(Index(0), n / 8).pointer().dense(Index(0), 8).place(b);
+  });
+
+  for (int i = 0; i < n; i++) {
+    a.val<int32>(i) = i;
+  }
+
+  auto &func = kernel([&]() {
+    For(0, n, [&](Expr i) {
+      auto sum = Var(0);
+      For(0, n, [&](Expr j) {
+        // the address computation of a[i] is hoisted out of the j loop
+        sum = sum + a[i] * 2 + j;
+        // b[i] activates a pointer node. Its lookup is hoisted as well,
+        // since the j loop is known to run at least once.
+        b[i] = sum;
+      });
+    });
+  });
+  func();
+
+  for (int i = 0; i < n; i++) {
+    TC_CHECK(b.val<int32>(i) == n * 2 * i + n * (n - 1) / 2);
+  }
+  // the inner loop (the outer one is offloaded) only loads, adds and stores
+  auto inner = gather_statements(func.ir);
+  inner.erase(std::remove_if(inner.begin(), inner.end(),
+                             [](Stmt *s) { return !s->is<RangeForStmt>(); }),
+              inner.end());
+  TC_CHECK(inner.size() == 1);
+  for (auto s : gather_statements(inner[0]->as<RangeForStmt>()->body.get())) {
+    TC_CHECK(!(s->is<SNodeLookupStmt>() || s->is<GetChStmt>() ||
+               s->is<LinearizeStmt>()));
+  }
+};
+
+TC_TEST("constant_fold") {
+  CoreState::set_trigger_gdb_when_crash(true);
+  int n = 16;
+  Program prog(Arch::x86_64);
+
+  Global(a, i32);
+  Global(b, f32);
+
+  layout([&]() { root.dense(Index(0), n).place(a, b); });
+
+  kernel([&]() {
+    // the loop bound is folded into a constant
+    For(Expr(0), Expr(n) * 3 / 3, [&](Expr i) {
+      a[i] = i + (Expr(7) * 6 - 2) % 7 + (Expr(1) < Expr(2));
+      b[i] = sqrt(Expr(16.0f)) + cast<float32>(Expr(-3) / 2) +
+             floor(Expr(2.5f));
+    });
+  })();
+
+  for (int i = 0; i < n; i++) {
+    TC_CHECK(a.val<int32>(i) == i + 5 - 1);
+    TC_CHECK(b.val<float32>(i) == 5.0f);
+  }
+};
+
 TLANG_NAMESPACE_END
@@ -0,0 +1,46 @@
+#include <taichi/testing.h>
+#include <taichi/lang.h>
+
+TLANG_NAMESPACE_BEGIN
+
+TC_TEST("particle_ply") {
+  int n = 1000;
+  Program prog(Arch::x86_64);
+  NamedScalar(x, x, f32);
+  NamedScalar(m, m, i32);
+  prog.layout([&] { root.dense(Index(0), n).place(x, m); });
+  for (int i = 0; i < n; i++) {
+    x.val<float32>(i) = i * 0.5f;
+    m.val<int32>(i) = i % 7;
+  }
+  {
+    AsyncParticleWriter writer;
+    for (auto fn : {"particles_test.ply", "particles_test.ply.gz"}) {
+      writer.write(fn, gather_particles(prog, {x.snode(), m.snode()}, n,
+                                        {"x", "mass"}));
+    }
+    writer.wait();
+  }
+
+  auto data = read_data_from_file("particles_test.ply");
+  TC_CHECK(zip::read_gzip("particles_test.ply.gz") == data);
+  std::string header(data.begin(), data.begin() + 200);
+  header = header.substr(0, header.find("end_header\n") + 11);
+  TC_CHECK(header ==
+           "ply\n"
+           "format binary_little_endian 1.0\n"
+           "element vertex 1000\n"
+           "property float x\n"
+           "property float mass\n"
+           "end_header\n");
+  TC_CHECK(data.size() == header.size() + n * 2 * sizeof(float32));
+  auto vertices = (float32 *)(data.data() + header.size());
+  for (int i = 0; i < n; i++) {
+    TC_CHECK_EQUAL(vertices[i * 2], i * 0.5f, 0);
+    TC_CHECK_EQUAL(vertices[i * 2 + 1], float32(i % 7), 0);
+  }
+  std::remove("particles_test.ply");
+  std::remove("particles_test.ply.gz");
+}
+
+TLANG_NAMESPACE_END
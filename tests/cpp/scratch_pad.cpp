@@ -1,9 +1,24 @@
 #include <taichi/lang.h>
 #include <taichi/testing.h>
 #include <numeric>
+#include "../../src/pass_manager.h"
 
 TLANG_NAMESPACE_BEGIN
 
+namespace {
+
+// The SNodes kernel k accesses through block-local buffers
+std::set<SNode *> block_local_snodes(Kernel &k) {
+  std::set<SNode *> ret;
+  for (auto s : gather_statements(k.ir)) {
+    if (auto ptr = s->cast<BlockLocalPtrStmt>())
+      ret.insert(ptr->snode);
+  }
+  return ret;
+}
+
+}  // namespace
+
 TC_TEST("range_assumption") {
   CoreState::set_trigger_gdb_when_crash(true);
   Program prog(Arch::gpu);
@@ -135,4 +150,103 @@ TC_TEST("scratch_pad_3d") {
   }
 };
 
+TC_TEST("block_local_cpu") {
+  CoreState::set_trigger_gdb_when_crash(true);
+  // block-local caches are only supported by the LLVM backend
+  auto use_llvm = default_compile_config.use_llvm;
+  default_compile_config.use_llvm = true;
+  Program prog(Arch::x86_64);
+  default_compile_config.use_llvm = use_llvm;
+
+  int n = 128;
+  int block_size = 8;
+
+  Global(x, f32);
+  Global(y, f32);
+  Global(y_ref, f32);
+  Global(a, i32);
+  Global(p, i32);
+  Global(p_ref, i32);
+
+  auto ij = Indices(0, 1);
+  layout([&]() {
+    root.dense(ij, n / block_size)
+        .dense(ij, block_size)
+        .place(x, y, y_ref, a, p, p_ref);
+  });
+
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      x.val<float32>(i, j) = std::sin(0.1f * i) * std::cos(0.3f * j);
+      a.val<int32>(i, j) = (i * 7 + j * 13) % 17;
+    }
+  }
+
+  auto laplacian = [&](Expr out) {
+    return [&, out]() {
+      Declare(i);
+      Declare(j);
+      For((i, j), x, [&]() {
+        out[i, j] = 4.0f * x[i, j] - x[i - 1, j] - x[i + 1, j] - x[i, j - 1] -
+                    x[i, j + 1];
+      });
+    };
+  };
+
+  // x is read with a halo, y is written within the block
+  Kernel(laplacian_cached).def([&]() {
+    Cache(0, x);
+    Cache(0, y);
+    laplacian(y)();
+  });
+  Kernel(laplacian_ref).def(laplacian(y_ref));
+
+  auto scatter = [&](Expr out) {
+    return [&, out]() {
+      Declare(i);
+      Declare(j);
+      For((i, j), a, [&]() {
+        Atomic(out[i, j]) += a[i, j];
+        Atomic(out[i + 1, j]) += 2 * a[i, j];
+        Atomic(out[i, j - 1]) += 3 * a[i, j];
+      });
+    };
+  };
+
+  // p is accumulated into with a halo
+  Kernel(scatter_cached).def([&]() {
+    Cache(0, p);
+    scatter(p)();
+  });
+  Kernel(scatter_ref).def(scatter(p_ref));
+
+  laplacian_cached();
+  laplacian_ref();
+  scatter_cached();
+  scatter_ref();
+
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      TC_CHECK(y.val<float32>(i, j) == y_ref.val<float32>(i, j));
+      TC_CHECK(p.val<int32>(i, j) == p_ref.val<int32>(i, j));
+    }
+  }
+  // away from the (periodic) boundary
+  TC_CHECK_EQUAL(y.val<float32>(5, 9),
+                 4.0f * x.val<float32>(5, 9) - x.val<float32>(4, 9) -
+                     x.val<float32>(6, 9) - x.val<float32>(5, 8) -
+                     x.val<float32>(5, 10),
+                 1e-5f);
+  TC_CHECK(p.val<int32>(5, 9) == a.val<int32>(5, 9) +
+                                     2 * a.val<int32>(4, 9) +
+                                     3 * a.val<int32>(5, 10));
+
+  // the results also match if the accesses are not cached at all
+  TC_CHECK(block_local_snodes(laplacian_cached) ==
+           std::set<SNode *>({x.snode(), y.snode()}));
+  TC_CHECK(block_local_snodes(scatter_cached) ==
+           std::set<SNode *>({p.snode()}));
+  TC_CHECK(block_local_snodes(laplacian_ref).empty());
+};
+
 TLANG_NAMESPACE_END
@@ -0,0 +1,129 @@
+#include <taichi/testing.h>
+#include <taichi/lang.h>
+
+TLANG_NAMESPACE_BEGIN
+
+TC_TEST("snapshot") {
+  int n = 64;
+  std::string fn = "snapshot_test.bin";
+  auto layout = [&](Expr &x, Expr &y) {
+    auto i = Index(0), j = Index(1);
+    root.dense(i, n).place(x);
+    root.dense(i, n / 8).pointer().dense({i, j}, {8, n}).place(y);
+  };
+  {
+    Program prog(Arch::x86_64);
+    NamedScalar(x, x, f32);
+    NamedScalar(y, y, i32);
+    prog.layout([&] { layout(x, y); });
+    for (int i = 0; i < n; i++) {
+      x.val<float32>(i) = i * 0.5f;
+    }
+    // allocates half of the pointer blocks
+    for (int i = 0; i < n / 2; i++) {
+      for (int j = 0; j < n; j++) {
+        y.val<int32>(i, j) = i * n + j;
+      }
+    }
+    prog.save_snapshot(fn);
+  }
+  {
+    Snapshot snapshot(fn);
+    auto sx = snapshot.find("x"), sy = snapshot.find("y");
+    TC_CHECK(sx != -1);
+    TC_CHECK(sy != -1);
+    for (int i = 0; i < n; i++) {
+      TC_CHECK_EQUAL(snapshot.val<float32>(sx, i), i * 0.5f, 0);
+      for (int j = 0; j < n; j++) {
+        TC_CHECK(snapshot.val<int32>(sy, i, j) == (i < n / 2 ? i * n + j : 0));
+      }
+    }
+    TC_CHECK(snapshot.address(sy, n - 1, 0) == nullptr);
+  }
+  {
+    Program prog(Arch::x86_64);
+    NamedScalar(x, x, f32);
+    NamedScalar(y, y, i32);
+    prog.layout([&] { layout(x, y); });
+    // a block that is not in the snapshot
+    y.val<int32>(n - 1, 0) = 1;
+    prog.load_snapshot(fn);
+    for (int i = 0; i < n; i++) {
+      TC_CHECK_EQUAL(x.val<float32>(i), i * 0.5f, 0);
+    }
+    auto stat = y.parent().parent().snode()->stat();
+    int num_active_blocks = 0;
+    for (std::size_t b = 0; b < stat.num_resident_blocks; b++) {
+      auto &meta = stat.resident_metas[b];
+      if (meta.active) {
+        num_active_blocks++;
+        TC_CHECK(meta.indices[0] < n / 2);
+      }
+    }
+    TC_CHECK(num_active_blocks == n / 16);
+    for (int i = 0; i < n / 2; i++) {
+      for (int j = 0; j < n; j++) {
+        TC_CHECK(y.val<int32>(i, j) == i * n + j);
+      }
+    }
+  }
+  std::remove(fn.c_str());
+}
+
+TC_TEST("snapshot_delta") {
+  int n = 1024;
+  Program prog(Arch::x86_64);
+  NamedScalar(x, x, f32);
+  NamedScalar(y, y, i32);
+  prog.layout([&] {
+    auto i = Index(0);
+    root.dense(i, n).place(x);
+    root.dense(i, n / 256).pointer().dense(i, 256).place(y);
+  });
+  for (int i = 0; i < n; i++) {
+    x.val<float32>(i) = i;
+  }
+  y.val<int32>(0) = 1;
+
+  CheckpointWriter writer;
+  std::vector<std::string> chain;
+  auto checkpoint = [&] {
+    chain.push_back(fmt::format("snapshot_delta_{}.bin", chain.size()));
+    return writer.write(prog, chain.back());
+  };
+  auto full_size = checkpoint();
+  // nothing changed
+  TC_CHECK(checkpoint() == 0);
+  // one page of x changed, and a new block of y
+  x.val<float32>(n - 1) = -1;
+  y.val<int32>(n - 1) = 2;
+  auto delta_size = checkpoint();
+  TC_CHECK(delta_size > 0);
+  TC_CHECK(delta_size < full_size);
+
+  std::string fn = "snapshot_delta_reconstructed.bin";
+  reconstruct_checkpoint(chain, fn);
+  {
+    Snapshot snapshot(fn);
+    auto sx = snapshot.find("x"), sy = snapshot.find("y");
+    for (int i = 0; i < n; i++) {
+      float32 expected_x = i == n - 1 ? -1 : i;
+      int32 expected_y = i == 0 ? 1 : (i == n - 1 ? 2 : 0);
+      TC_CHECK_EQUAL(snapshot.val<float32>(sx, i), expected_x, 0);
+      TC_CHECK(snapshot.val<int32>(sy, i) == expected_y);
+    }
+  }
+  // the state before the last delta
+  reconstruct_checkpoint({chain[0], chain[1]}, fn);
+  {
+    Snapshot snapshot(fn);
+    TC_CHECK_EQUAL(snapshot.val<float32>(snapshot.find("x"), n - 1),
+                   float32(n - 1), 0);
+    TC_CHECK(snapshot.address(snapshot.find("y"), n - 1) == nullptr);
+  }
+  for (auto &f : chain)
+    std::remove(f.c_str());
+  std::remove(fn.c_str());
+}
+
+TLANG_NAMESPACE_END
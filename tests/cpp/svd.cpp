@@ -131,6 +131,72 @@ TC_TEST("svd_scalar") {
   }
 }
 
+// Decomposes n matrices stored as structure of arrays with the batched
+// (SIMD) SVD and polar decomposition
+TC_TEST("svd_batch") {
+  using Matrix = TMatrix<float32, 3>;
+  float32 tolerance = 2e-3_f32;
+  // not a multiple of the lane width, to exercise the scalar tail
+  constexpr int n = 100003;
+  std::vector<float32> a_data(9 * n), u_data(9 * n), sigma_data(3 * n),
+      v_data(9 * n), r_data(9 * n), s_data(9 * n);
+  const float32 *a[9];
+  float32 *u[9], *sigma[3], *v[9], *r[9], *s[9];
+  for (int i = 0; i < 9; i++) {
+    a[i] = &a_data[i * n];
+    u[i] = &u_data[i * n];
+    v[i] = &v_data[i * n];
+    r[i] = &r_data[i * n];
+    s[i] = &s_data[i * n];
+  }
+  for (int i = 0; i < 3; i++)
+    sigma[i] = &sigma_data[i * n];
+
+  std::vector<Matrix> ms(n);
+  for (int k = 0; k < n; k++) {
+    ms[k] = Matrix::rand();
+    for (int i = 0; i < 9; i++)
+      a_data[i * n + k] = ms[k](i / 3, i % 3);
+  }
+
+  auto t = Time::get_time();
+  svd_batch(n, a, u, sigma, v);
+  auto svd_time = Time::get_time() - t;
+  t = Time::get_time();
+  polar_decomp_batch(n, a, r, s);
+  auto polar_time = Time::get_time() - t;
+  TC_INFO("Batched SVD ({}): {:.2f} M matrices/s", svd_batch_isa(),
+          n / svd_time * 1e-6);
+  TC_INFO("Batched polar decomposition ({}): {:.2f} M matrices/s",
+          svd_batch_isa(), n / polar_time * 1e-6);
+
+  auto get = [&](float32 *const m[9], int k) {
+    Matrix ret;
+    for (int i = 0; i < 9; i++)
+      ret(i / 3, i % 3) = m[i][k];
+    return ret;
+  };
+  for (int k = 0; k < n; k++) {
+    Matrix U = get(u, k), V = get(v, k), R = get(r, k), S = get(s, k);
+    Matrix sig(0.0_f32);
+    for (int i = 0; i < 3; i++)
+      sig(i, i) = sigma[i][k];
+    TC_CHECK_EQUAL(ms[k], U * sig * transposed(V), tolerance);
+    TC_CHECK_EQUAL(Matrix(1), U * transposed(U), tolerance);
+    TC_CHECK_EQUAL(Matrix(1), V * transposed(V), tolerance);
+    TC_CHECK(std::abs(determinant(U) - 1) < tolerance);
+    TC_CHECK(std::abs(determinant(V) - 1) < tolerance);
+    TC_CHECK(sig(0, 0) >= sig(1, 1));
+    TC_CHECK(sig(1, 1) >= std::abs(sig(2, 2)));
+    if (std::abs(determinant(ms[k])) > tolerance)
+      TC_CHECK((sig(2, 2) < 0) == (determinant(ms[k]) < 0));
+    TC_CHECK_EQUAL(ms[k], R * S, tolerance);
+    TC_CHECK_EQUAL(Matrix(1), R * transposed(R), tolerance);
+    TC_CHECK(std::abs(determinant(R) - 1) < tolerance);
+    TC_CHECK_EQUAL(S, transposed(S), tolerance);
+  }
+}
+
 TC_TEST("svd_dsl") {
   for (auto vec : {1}) {
     CoreState::set_trigger_gdb_when_crash(true);
@@ -266,4 +332,126 @@ TC_TEST("svd_dsl_float64") {
   }
 }
 
+// The unrolled SVD is one block of several thousand statements. simplify
+// takes time about linear in the size of a block: four SVDs in one block take
+// about four times as long as one, not sixteen.
+TC_TEST("svd_simplify_time") {
+  CoreState::set_trigger_gdb_when_crash(true);
+  constexpr int n = 16;
+  Program prog(Arch::x86_64);
+  auto f32 = DataType::f32;
+  Matrix gA(f32, 3, 3), gU(f32, 3, 3), gSigma(f32, 3, 1), gV(f32, 3, 3);
+
+  layout([&] {
+    root.dense(Index(0), n).place(gA).place(gU).place(gSigma).place(gV);
+  });
+
+  auto simplify_time = [&](int copies) {
+    auto &k = kernel([&] {
+      For(0, n, [&](Expr i) {
+        for (int c = 0; c < copies; c++) {
+          auto svd = sifakis_svd<float32, int32>(gA[i] * float32(c + 1));
+          gU[i] = std::get<0>(svd);
+          gSigma[i] = std::get<1>(svd);
+          gV[i] = std::get<2>(svd);
+        }
+      });
+    });
+    irpass::lower(k.ir);
+    irpass::typecheck(k.ir);
+    auto t = Time::get_time();
+    irpass::simplify(k.ir);
+    return Time::get_time() - t;
+  };
+
+  auto single = simplify_time(1);
+  auto quadruple = simplify_time(4);
+  TC_INFO("simplify: one SVD {:.2f} ms, four SVDs {:.2f} ms", single * 1000,
+          quadruple * 1000);
+  TC_CHECK(quadruple < single * 8);
+}
+
+// Compilation time of large unrolled kernels: SVD and the P2G of MLS-MPM.
+// It checks nothing and compiles two very large kernels, so it is disabled;
+// remove the return to run it.
+TC_TEST("compile_time_benchmark") {
+  return;
+  auto measure = [](const std::string &name,
+                    const std::function<void()> &body) {
+    auto t = Time::get_time();
+    auto &k = kernel(body);
+    auto frontend_time = Time::get_time() - t;
+    t = Time::get_time();
+    k.compile();
+    auto compile_time = Time::get_time() - t;
+    TC_INFO("{}: frontend {:.2f} ms, compilation {:.2f} ms", name,
+            frontend_time * 1000, compile_time * 1000);
+  };
+
+  constexpr int dim = 3, n = 64, n_particles = 8192;
+  const float32 dt = 1e-4_f, dx = 1.0_f / n, inv_dx = 1.0_f / dx;
+  const float32 particle_mass = 1.0_f, vol = 1.0_f, mu = 10, lambda = 10;
+
+  Program prog(Arch::x86_64);
+  auto f32 = DataType::f32;
+  Matrix gA(f32, dim, dim), gU(f32, dim, dim), gSigma(f32, dim, 1),
+      gV(f32, dim, dim);
+  Vector particle_x(f32, dim), particle_v(f32, dim), grid_v(f32, dim);
+  Matrix particle_F(f32, dim, dim), particle_C(f32, dim, dim);
+  Global(grid_m, f32);
+
+  layout([&] {
+    auto i = Index(0), j = Index(1), k = Index(2), p = Index(3);
+    root.dense(i, n_particles).place(gA).place(gU).place(gSigma).place(gV);
+    root.dense(p, n_particles)
+        .place(particle_x)
+        .place(particle_v)
+        .place(particle_F)
+        .place(particle_C);
+    root.dense({i, j, k}, n).place(grid_v).place(grid_m);
+  });
+
+  measure("svd", [&] {
+    For(0, n_particles, [&](Expr i) {
+      auto svd = sifakis_svd<float32, int32>(gA[i]);
+      gU[i] = std::get<0>(svd);
+      gSigma[i] = std::get<1>(svd);
+      gV[i] = std::get<2>(svd);
+    });
+  });
+
+  measure("mpm_p2g", [&] {
+    For(particle_x(0), [&](Expr p) {
+      auto x = Var(particle_x[p]), v = Var(particle_v[p]),
+           C = Var(particle_C[p]);
+      auto base_coord = floor(inv_dx * x - 0.5_f), fx = x * inv_dx - base_coord;
+      Matrix F = Var(Matrix::identity(dim) + dt * C) * particle_F[p];
+      particle_F[p] = F;
+      Vector w[] = {Var(0.5_f * sqr(1.5_f - fx)), Var(0.75_f - sqr(fx - 1.0_f)),
+                    Var(0.5_f * sqr(fx - 0.5_f))};
+      auto svd = sifakis_svd<float32, int32>(F);
+      auto R = Var(std::get<0>(svd) * transposed(std::get<2>(svd)));
+      auto sig = Var(std::get<1>(svd));
+      auto J = Var(sig(0) * sig(1) * sig(2));
+      auto cauchy = Var(2.0_f * mu * (F - R) * transposed(F) +
+                        (Matrix::identity(3) * lambda) * (J - 1.0f) * J);
+      auto affine =
+          Var(particle_mass * C - (4 * inv_dx * inv_dx * dt * vol) * cauchy);
+      auto base_i = Var(cast<int32>(base_coord(0))),
+           base_j = Var(cast<int32>(base_coord(1))),
+           base_k = Var(cast<int32>(base_coord(2)));
+      for (int a = 0; a < 3; a++)
+        for (int b = 0; b < 3; b++)
+          for (int c = 0; c < 3; c++) {
+            auto dpos = dx * (Vector({a, b, c}).cast_elements<float32>() - fx);
+            auto weight = w[a](0) * w[b](1) * w[c](2);
+            auto node = (base_i + a, base_j + b, base_k + c);
+            Atomic(grid_v[node]) +=
+                weight * (particle_mass * v + affine * dpos);
+            Atomic(grid_m[node]) += weight * particle_mass;
+          }
+    });
+  });
+}
+
 TLANG_NAMESPACE_END
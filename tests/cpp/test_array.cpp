@@ -3,9 +3,11 @@
     The use of this software is governed by the LICENSE file.
 *******************************************************************************/
 
+#include <set>
 #include <taichi/common/util.h>
 #include <taichi/common/task.h>
 #include <taichi/math/array.h>
+#include <taichi/system/timer.h>
 #include <taichi/testing.h>
 
 TC_NAMESPACE_BEGIN
@@ -17,4 +19,152 @@ TC_TEST("array") {
   TC_CHECK(A.get_size() == B.get_size());
 }
 
+TC_TEST("array_brick_layout") {
+  Vector3i res(8, 16, 24);
+  Array3D<real> a(res);
+  BrickArray3D<real> b(res);
+  for (auto &ind : a.get_region()) {
+    a[ind] = ind.i * 1000 + ind.j * 10 + ind.k * 0.1_f;
+  }
+  for (auto &ind : b.get_region()) {
+    b[ind] = ind.i * 1000 + ind.j * 10 + ind.k * 0.1_f;
+  }
+  // the region of a brick array walks its storage in order
+  int count = 0;
+  for (auto &ind : b.get_region()) {
+    TC_CHECK(&b[ind] == &b.data[count]);
+    count++;
+  }
+  TC_CHECK(count == res.x * res.y * res.z);
+  for (int i = 0; i < res.x; i++) {
+    for (int j = 0; j < res.y; j++) {
+      for (int k = 0; k < res.z; k++) {
+        TC_CHECK(a[i][j][k] == b[i][j][k]);
+      }
+    }
+  }
+  for (int t = 0; t < 100; t++) {
+    Vector3 pos(rand() * res.x, rand() * res.y, rand() * res.z);
+    TC_CHECK(a.sample(pos) == b.sample(pos));
+  }
+  // ranges that do not align with bricks
+  std::set<int> visited;
+  for (auto &ind : Region3D(Vector3i(1, 3, 5), Vector3i(7, 9, 23),
+                            Vector3(0.5_f), 2)) {
+    bool inside = 1 <= ind.i && ind.i < 7 && 3 <= ind.j && ind.j < 9 &&
+                  5 <= ind.k && ind.k < 23;
+    TC_CHECK(inside);
+    visited.insert(b.offset(ind.i, ind.j, ind.k));
+  }
+  TC_CHECK(visited.size() == 6 * 6 * 18);
+
+  BrickArray2D<int> c(Vector2i(16, 8));
+  count = 0;
+  for (auto &ind : c.get_region()) {
+    c[ind] = count++;
+  }
+  for (int i = 0; i < 16; i++) {
+    for (int j = 0; j < 8; j++) {
+      TC_CHECK(c[i][j] == c.data[c.offset(i, j)]);
+    }
+  }
+  TC_CHECK(c[Vector2i(9, 3)] == 64 + 8 + 3);
+}
+
+TC_TEST("array_parallel") {
+  // more than a chunk, and not a multiple of the SIMD width
+  Vector2i res(301, 257);
+  Array2D<float32> a(res), b(res);
+  for (auto &ind : a.get_region()) {
+    a[ind] = std::sin(ind.i * 0.37f + ind.j * 1.1f);
+    b[ind] = std::cos(ind.i * 0.5f - ind.j * 0.2f) - 0.5f;
+  }
+  float64 sum = 0, dot = 0, abs_sum = 0;
+  float32 abs_max = 0, min = 1e30f, max = -1e30f;
+  for (auto &ind : a.get_region()) {
+    sum += b[ind];
+    dot += (float64)a[ind] * b[ind];
+    abs_sum += std::abs(b[ind]);
+    abs_max = std::max(abs_max, std::abs(b[ind]));
+    min = std::min(min, b[ind]);
+    max = std::max(max, b[ind]);
+  }
+  // float32 accumulation
+  real tolerance = 1e-5_f * abs_sum;
+  TC_CHECK_EQUAL(b.sum(), (float32)sum, tolerance);
+  TC_CHECK_EQUAL(a.dot(b), (float32)dot, tolerance);
+  TC_CHECK_EQUAL(b.abs_sum(), (float32)abs_sum, tolerance);
+  TC_CHECK_EQUAL(a.dot_double(b), dot, 1e-9_f);
+  TC_CHECK(b.abs_max() == abs_max);
+  TC_CHECK(b.min() == min);
+  TC_CHECK(b.max() == max);
+
+  auto c = a + b;
+  auto d = a.add(0.5f, b);
+  d -= b;
+  for (auto &ind : a.get_region()) {
+    TC_CHECK(c[ind] == a[ind] + b[ind]);
+    TC_CHECK(d[ind] == (a[ind] + 0.5f * b[ind]) - b[ind]);
+  }
+
+  Array3D<Vector3> u(Vector3i(33, 32, 35)), v(Vector3i(33, 32, 35));
+  Vector3 vector_dot(0.0_f);
+  for (auto &ind : u.get_region()) {
+    u[ind] = Vector3(ind.i, ind.j, ind.k) * 0.1_f;
+    v[ind] = Vector3(1.0_f, -1.0_f, 2.0_f);
+    vector_dot += u[ind] * v[ind];
+  }
+  auto w = u - v;
+  TC_CHECK(w[Vector3i(3, 4, 5)] == u[Vector3i(3, 4, 5)] - Vector3(1, -1, 2));
+  auto result = u.dot(v);
+  for (int i = 0; i < 3; i++) {
+    TC_CHECK_EQUAL(result[i], vector_dot[i], 1e-3_f * std::abs(vector_dot[i]));
+  }
+  TC_CHECK_EQUAL(u.abs_max(), 3.4_f, 1e-5_f);
+
+  // each cell of the region is visited once, also with bricks
+  BrickArray3D<int> count(Vector3i(16, 8, 8));
+  parallel_for(Region3D(Vector3i(3, 1, 0), Vector3i(13, 8, 7), Vector3(0.5_f),
+                        2),
+               [&](const Index3D &ind) { count[ind] += 1; });
+  int total = 0;
+  for (auto &ind : count.get_region()) {
+    bool inside = 3 <= ind.i && ind.i < 13 && 1 <= ind.j && ind.k < 7;
+    TC_CHECK(count[ind] == (int)inside);
+    total += count[ind];
+  }
+  TC_CHECK(total == 10 * 7 * 7);
+}
+
+TC_TEST("array_layout_benchmark") {
+  return;
+  Vector3i res(256, 256, 256);
+  int n = 10000000;
+  std::vector<Vector3> positions(n);
+  // random walk, as particles sampling a velocity field
+  Vector3 pos = res.template cast<real>() * 0.5_f;
+  for (int i = 0; i < n; i++) {
+    pos += Vector3(rand(), rand(), rand()) * 2.0_f - Vector3(1.0_f);
+    for (int d = 0; d < 3; d++) {
+      pos[d] = clamp(pos[d], 1.0_f, res[d] - 1.0_f);
+    }
+    positions[i] = pos;
+  }
+  auto benchmark = [&](auto &&arr, const std::string &name) {
+    for (auto &ind : arr.get_region()) {
+      arr[ind] = ind.i + ind.j + ind.k;
+    }
+    real sum = 0;
+    auto t = Time::get_time();
+    for (int i = 0; i < n; i++) {
+      sum += arr.sample(positions[i]);
+    }
+    t = Time::get_time() - t;
+    TC_INFO("{}: {:.2f} M samples/s (sum {})", name, n / t * 1e-6, sum);
+  };
+  benchmark(Array3D<real>(res), "row-major");
+  benchmark(BrickArray3D<real, 2>(res), "4^3 bricks");
+  benchmark(BrickArray3D<real, 3>(res), "8^3 bricks");
+}
+
 TC_NAMESPACE_END
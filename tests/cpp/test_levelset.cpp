@@ -0,0 +1,70 @@
+/*******************************************************************************
+    Copyright (c) The Taichi Authors (2016- ). All Rights Reserved.
+    The use of this software is governed by the LICENSE file.
+*******************************************************************************/
+
+#include <taichi/common/util.h>
+#include <taichi/math/levelset.h>
+#include <taichi/system/timer.h>
+#include <taichi/testing.h>
+
+TC_NAMESPACE_BEGIN
+
+TC_TEST("redistance") {
+  // A sphere with a distorted (but same-signed) distance field
+  int n = 64;
+  real radius = 20.3_f;
+  Vector3 center(31.7_f, 32.1_f, 30.9_f);
+  LevelSet3D levelset(Vector3i(n, n, n));
+  for (auto &ind : levelset.get_region()) {
+    real r = length(ind.get_pos() - center);
+    levelset[ind] = (r * r - radius * radius) * 0.1_f;
+  }
+  real band = 6;
+  levelset.redistance(band);
+  real max_error = 0;
+  for (auto &ind : levelset.get_region()) {
+    real exact = length(ind.get_pos() - center) - radius;
+    if (std::abs(exact) > band + 1) {
+      TC_CHECK(std::abs(levelset[ind]) == band);
+    } else if (std::abs(exact) < band - 1) {
+      max_error = std::max(max_error, std::abs(levelset[ind] - exact));
+      TC_CHECK(levelset[ind] * exact >= 0);
+    }
+  }
+  // first-order accurate
+  TC_CHECK(max_error < 0.6_f);
+
+  // 2D, without a band
+  LevelSet2D circle(Vector2i(128, 96));
+  for (auto &ind : circle.get_region()) {
+    real r = length(ind.get_pos() - Vector2(40.5_f));
+    circle[ind] = std::pow(r / 30, 3.0_f) - 1;
+  }
+  circle.redistance();
+  max_error = 0;
+  for (auto &ind : circle.get_region()) {
+    real exact = length(ind.get_pos() - Vector2(40.5_f)) - 30;
+    max_error = std::max(max_error, std::abs(circle[ind] - exact));
+  }
+  TC_CHECK(max_error < 1.0_f);
+}
+
+TC_TEST("redistance_benchmark") {
+  return;
+  int n = 512;
+  LevelSet3D levelset(Vector3i(n, n, n));
+  for (auto &ind : levelset.get_region()) {
+    auto r = length(ind.get_pos() - Vector3(n * 0.5_f));
+    levelset[ind] = r * r - sqr(n * 0.3_f);
+  }
+  for (real band : {5.0_f, LevelSet3D::INF}) {
+    auto copy = levelset;
+    auto t = Time::get_time();
+    copy.redistance(band);
+    TC_INFO("Redistancing {}^3 with band {}: {:.3f} s", n, band,
+            Time::get_time() - t);
+  }
+}
+
+TC_NAMESPACE_END
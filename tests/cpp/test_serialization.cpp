@@ -0,0 +1,76 @@
+/*******************************************************************************
+    Copyright (c) The Taichi Authors (2016- ). All Rights Reserved.
+    The use of this software is governed by the LICENSE file.
+*******************************************************************************/
+
+#include <taichi/common/util.h>
+#include <taichi/math/array.h>
+#include <taichi/testing.h>
+
+TC_NAMESPACE_BEGIN
+
+TC_TEST("binary_serializer_stream") {
+  std::string fn = "binary_serializer_stream_test.tcb";
+  Array3D<real> grid(Vector3i(64, 32, 48));
+  for (int i = 0; i < grid.get_size(); i++) {
+    grid.data[i] = i * 0.5_f;
+  }
+  std::vector<int> small{1, 2, 3};
+  std::vector<float64> large(100000);
+  for (int i = 0; i < (int)large.size(); i++) {
+    large[i] = i;
+  }
+  std::string name = "grid";
+
+  BinaryOutputSerializer writer;
+  writer.initialize(fn);
+  writer(name);
+  writer(small);
+  writer(grid);
+  writer(large);
+  writer.finalize();
+
+  {
+    BinaryInputSerializer reader;
+    reader.initialize(fn);
+    std::string name_;
+    std::vector<int> small_;
+    Array3D<real> grid_;
+    reader(name_);
+    reader(small_);
+    reader(grid_);
+    std::size_t n;
+    auto large_ = reader.view_array<float64>(n);
+    reader.finalize();
+    TC_CHECK(name_ == name);
+    TC_CHECK(small_ == small);
+    TC_CHECK(grid_.get_res() == grid.get_res());
+    TC_CHECK(grid_.get_size() == grid.get_size());
+    TC_CHECK(grid_.data == grid.data);
+    TC_CHECK(grid_[Vector3i(63, 31, 47)] == grid[Vector3i(63, 31, 47)]);
+    TC_CHECK(n == large.size());
+    // Large arrays are used in place from the page-aligned file mapping
+    TC_CHECK((std::size_t)large_ % BinaryInputSerializer::page_size == 0);
+    TC_CHECK(std::memcmp(large_, large.data(), n * sizeof(float64)) == 0);
+  }
+
+  // In-memory output is not padded, and is read like the file
+  {
+    BinaryOutputSerializer writer;
+    writer.initialize();
+    writer(grid);
+    writer.finalize();
+    TC_CHECK(*reinterpret_cast<std::size_t *>(writer.data.data()) ==
+             writer.head);
+    BinaryInputSerializer reader;
+    reader.initialize(writer.data.data());
+    Array3D<real> grid_;
+    reader(grid_);
+    reader.finalize();
+    TC_CHECK(grid_.get_res() == grid.get_res());
+    TC_CHECK(grid_.data == grid.data);
+  }
+  std::remove(fn.c_str());
+}
+
+TC_NAMESPACE_END
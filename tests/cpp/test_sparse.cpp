@@ -0,0 +1,87 @@
+/*******************************************************************************
+    Copyright (c) The Taichi Authors (2016- ). All Rights Reserved.
+    The use of this software is governed by the LICENSE file.
+*******************************************************************************/
+
+#include <taichi/common/util.h>
+#include <taichi/math/sparse.h>
+#include <taichi/testing.h>
+
+TC_NAMESPACE_BEGIN
+
+TC_TEST("sparse_matrix_assembly") {
+  int n = 1000;
+  SparseMatrix A(n);
+  std::vector<std::vector<real>> dense(n, std::vector<real>(n, 0));
+  for (int k = 0; k < 20000; k++) {
+    int i = rand_int() % n, j = rand_int() % n;
+    real val = rand();
+    A.insert(i, j, val);
+    dense[i][j] += val;
+  }
+  TC_CHECK(A.num_nonzeros() <= 20000);
+
+  Array1D<real> x(n);
+  for (int i = 0; i < n; i++) {
+    x[i] = rand();
+  }
+  auto y = A.multiply(x);
+  for (int i = 0; i < n; i++) {
+    real y_gt = 0;
+    for (int j = 0; j < n; j++) {
+      y_gt += dense[i][j] * x[j];
+    }
+    TC_CHECK(std::abs(y[i] - y_gt) < 1e-3_f * std::max(1.0_f, std::abs(y_gt)));
+  }
+  TC_CHECK(A.get(3, 5) == dense[3][5]);
+}
+
+TC_TEST("block_sparse_matrix") {
+  int n = 100;
+  using Block = BlockSparseMatrix<3>::Block;
+  BlockSparseMatrix<3> B(n);
+  SparseMatrix A(n * 3);
+  for (int k = 0; k < 1000; k++) {
+    int bi = rand_int() % n, bj = rand_int() % n;
+    Block block = Block::rand();
+    B.insert(bi, bj, block);
+    for (int r = 0; r < 3; r++) {
+      for (int c = 0; c < 3; c++) {
+        A.insert(bi * 3 + r, bj * 3 + c, block(r, c));
+      }
+    }
+  }
+  Array1D<real> x(n * 3);
+  for (int i = 0; i < n * 3; i++) {
+    x[i] = rand();
+  }
+  auto y = A.multiply(x), y_block = B.multiply(x);
+  for (int i = 0; i < n * 3; i++) {
+    TC_CHECK(std::abs(y[i] - y_block[i]) < 1e-3_f);
+  }
+}
+
+TC_TEST("conjugate_gradient") {
+  // 1D Poisson
+  int n = 100;
+  SparseMatrix A(n);
+  for (int i = 0; i < n; i++) {
+    A.insert(i, i, 2);
+    if (i > 0)
+      A.insert(i, i - 1, -1);
+    if (i + 1 < n)
+      A.insert(i, i + 1, -1);
+  }
+  Array1D<real> b(n), x(n);
+  for (int i = 0; i < n; i++) {
+    b[i] = 1;
+  }
+  int iterations = conjugate_gradient(A, b, x, 1e-5_f, 1000);
+  TC_CHECK(iterations != -1);
+  auto Ax = A.multiply(x);
+  for (int i = 0; i < n; i++) {
+    TC_CHECK(std::abs(Ax[i] - b[i]) < 1e-2_f);
+  }
+}
+
+TC_NAMESPACE_END
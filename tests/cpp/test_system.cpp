@@ -8,6 +8,7 @@
 #include <taichi/math/svd.h>
 #include <taichi/math/eigen.h>
 #include <taichi/system/virtual_memory.h>
+#include <taichi/system/threading.h>
 
 TC_NAMESPACE_BEGIN
 
@@ -25,4 +26,34 @@ TC_TEST("Virtual Memory") {
 
 }
 
+TC_TEST("threaded_task_manager") {
+  // many short loops reuse the threads of the shared pool
+  std::vector<int> hits(1000, 0);
+  for (int k = 0; k < 100; k++) {
+    ThreadedTaskManager::run(1000, -1, [&](int i) { hits[i]++; });
+  }
+  for (auto h : hits) {
+    CHECK(h == 100);
+  }
+
+  // an exception thrown on any thread reaches the caller
+  bool caught = false;
+  try {
+    ThreadedTaskManager::run(1000, -1, [&](int i) {
+      if (i == 777)
+        throw std::runtime_error("task failed");
+    });
+  } catch (const std::runtime_error &) {
+    caught = true;
+  }
+  CHECK(caught);
+
+  // nested loops run serially on the thread that reaches them
+  std::atomic<int> total(0);
+  ThreadedTaskManager::run(16, -1, [&](int i) {
+    ThreadedTaskManager::run(16, -1, [&](int j) { total++; });
+  });
+  CHECK(total == 256);
+}
+
 TC_NAMESPACE_END
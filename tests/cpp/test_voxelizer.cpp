@@ -0,0 +1,107 @@
+/*******************************************************************************
+    Copyright (c) The Taichi Authors (2016- ). All Rights Reserved.
+    The use of this software is governed by the LICENSE file.
+*******************************************************************************/
+
+#include <taichi/visual/voxelizer.h>
+#include <taichi/testing.h>
+#include <taichi/lang.h>
+#include <mutex>
+
+TC_NAMESPACE_BEGIN
+
+// The cube [lower, upper]^3, two triangles per face
+Voxelizer cube_voxelizer(real lower,
+                         real upper,
+                         const Matrix4 &transform = Matrix4(1.0_f)) {
+  std::vector<Vector3> vertices;
+  for (int c = 0; c < 8; c++) {
+    vertices.push_back(Vector3(c & 4 ? upper : lower, c & 2 ? upper : lower,
+                               c & 1 ? upper : lower));
+  }
+  // two triangles for each of the faces x = lower, x = upper, y = lower...
+  int indices[12][3] = {{0, 1, 3}, {0, 3, 2}, {4, 6, 7}, {4, 7, 5},
+                        {0, 4, 5}, {0, 5, 1}, {2, 3, 7}, {2, 7, 6},
+                        {0, 2, 6}, {0, 6, 4}, {1, 5, 7}, {1, 7, 3}};
+  std::vector<Vector3i> faces;
+  for (auto &f : indices) {
+    faces.push_back(Vector3i(f[0], f[1], f[2]));
+  }
+  return Voxelizer(vertices, faces, transform);
+}
+
+TC_TEST("voxelizer_cube") {
+  // Cube faces, edges and corners are all aligned with the sample positions
+  auto voxelizer = cube_voxelizer(1.5_f, 5.5_f);
+  int n = 8;
+  Array3D<int> grid(Vector3i(n, n, n));
+  voxelizer.fill(grid, 1);
+  std::vector<real> z;
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      voxelizer.crossings(i + 0.5_f, j + 0.5_f, z);
+      TC_CHECK(z.size() % 2 == 0);
+      for (int k = 0; k < n; k++) {
+        bool interior = 2 <= std::min({i, j, k}) && std::max({i, j, k}) <= 4;
+        bool exterior = std::min({i, j, k}) < 1 || std::max({i, j, k}) > 5;
+        if (interior) {
+          TC_CHECK(grid[i][j][k] == 1);
+          TC_CHECK(voxelizer.inside(Vector3(i, j, k) + Vector3(0.5_f)));
+        }
+        if (exterior) {
+          TC_CHECK(grid[i][j][k] == 0);
+        }
+      }
+    }
+  }
+
+  LevelSet<3> levelset(Vector3i(n, n, n));
+  voxelizer.add_to_levelset(levelset, 3);
+  TC_CHECK_EQUAL(levelset[3][3][3], -2.0_f, 1e-5_f);
+  TC_CHECK_EQUAL(levelset[7][3][3], 2.0_f, 1e-5_f);
+  TC_CHECK_EQUAL(levelset[3][0][3], 1.0_f, 1e-5_f);
+  // clamped to the band
+  TC_CHECK_EQUAL(levelset[7][7][7], 3.0_f, 1e-5_f);
+}
+
+TC_TEST("voxelizer_volume") {
+  // A rotated cube with arbitrary offset: the number of cells inside
+  // approximates its volume
+  Matrix4 transform(1.0_f);
+  transform = matrix4_scale_s(&transform, 16.0_f);
+  transform = matrix4_rotate_angle_axis(&transform, 30.0_f, Vector3(1, 2, 3));
+  transform = matrix4_translate(&transform, Vector3(20.3_f));
+  auto voxelizer = cube_voxelizer(-0.5_f, 0.5_f, transform);
+  int64 count = 0;
+  std::mutex mut;
+  voxelizer.for_each_inside(Vector3i(40), Vector3(0.5_f),
+                            [&](int i, int j, int k) {
+                              std::lock_guard<std::mutex> _(mut);
+                              count++;
+                            });
+  TC_CHECK_EQUAL(count / 4096.0_f, 1.0_f, 0.02_f);
+}
+
+TC_NAMESPACE_END
+
+TLANG_NAMESPACE_BEGIN
+
+TC_TEST("voxelize_sparse") {
+  int n = 32;
+  Program prog(Arch::x86_64);
+  NamedScalar(x, x, i32);
+  prog.layout([&] {
+    auto ijk = Indices(0, 1, 2);
+    root.dense(ijk, n / 8).pointer().dense(ijk, 8).place(x);
+  });
+  // covers the samples of the block of cells [8, 16)^3 only
+  auto voxelizer = cube_voxelizer(7.9_f, 15.9_f);
+  auto count = voxelize(prog, x.snode(), voxelizer, Vector3i(n, n, n), 3);
+  TC_CHECK(count == 512);
+  auto stat = x.parent().parent().snode()->stat();
+  TC_CHECK(stat.num_resident_blocks == 1);
+  TC_CHECK(x.val<int32>(8, 8, 8) == 3);
+  TC_CHECK(x.val<int32>(15, 12, 9) == 3);
+}
+
+TLANG_NAMESPACE_END